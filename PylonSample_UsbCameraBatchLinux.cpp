@@ -0,0 +1,115 @@
+/*
+Note: Before getting started, Basler recommends reading the Programmer's Guide topic
+in the pylon C++ API documentation that gets installed with pylon.
+If you are upgrading to a higher major version of pylon, Basler also
+strongly recommends reading the Migration topic in the pylon C++ API documentation.
+
+This custom sample is not found in the standard Pylon SDK. It is released under the included Pylon License and is without warranty.
+
+Batch front end for station scripts (Linux only). Instead of launching one wrapper per camera and operation, hand
+all of them to one process, which enumerates once, runs cameras in parallel and prints one JSON document:
+
+    sudo ./UsbCameraBatch "audit * min_speed=5000"
+    sudo ./UsbCameraBatch "reset 40012345" "wait-ready 40012345 timeout=8000 min_speed=5000" "speed 40012346 5000"
+    printf 'list\nport-cycle 40012345\nwait-ready 40012345\n' | sudo ./UsbCameraBatch -
+    sudo ./UsbCameraBatch --placement line2.map --parallel 16 "audit *"
+    sudo ./UsbCameraBatch --status-board /dev/shm/UsbCameraStatus.board "reset *"
+    sudo ./UsbCameraBatch --record /var/log/usb-incident.rec "reset 40012345" "wait-ready 40012345"
+
+With --status-board, resets and port cycles fail for cameras another process on the host is recovering.
+With --record, the devices present at the start and every operation on a camera are recorded for CUsbIncidentFile.
+
+Operations: list, audit, reset, port-cycle, wait-ready, speed. The exit code is 0 if every operation succeeded,
+1 if one failed and 2 if the batch couldn't be run. Build with eg:
+
+    g++ -std=c++11 -O2 -DLINUX_BUILD -I. PylonSample_UsbCameraBatchLinux.cpp -o UsbCameraBatch -pthread
+
+*/
+
+#ifdef LINUX_BUILD
+#include <iostream>
+#include <iterator>
+#include <chrono>
+#include <cstdlib>
+
+// for running the batch. Everything it does goes through sysfs and usbfs, so pylon is never initialized.
+#include "UsbCameraBatchRunnerLinux.h"
+#include "UsbIncidentRecorderLinux.h"
+
+// Namespace for using cout.
+using namespace std;
+
+
+int main(int argc, char* argv[])
+{
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend backend;
+	UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner runner(backend);
+	UsbCameraDeviceManager::CUsbCameraPlacementMap placementMap;
+	UsbCameraDeviceManager::CUsbCameraStatusBoard statusBoard;
+	UsbCameraDeviceManagerLinux::CUsbIncidentRecorder recorder(backend);
+
+	// the operations, from the arguments and/or stdin
+	std::vector<UsbCameraDeviceManagerLinux::SUsbBatchOperation> operations;
+	std::string errorMessage;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		bool parsed = true;
+
+		if (argument == "--placement" && i + 1 < argc)
+		{
+			parsed = placementMap.Load(argv[++i], errorMessage);
+			runner.SetPlacementMap(&placementMap);
+		}
+		else if (argument == "--status-board" && i + 1 < argc)
+		{
+			parsed = statusBoard.Open(argv[++i], errorMessage);
+			runner.SetStatusBoard(&statusBoard);
+		}
+		else if (argument == "--record" && i + 1 < argc)
+		{
+			parsed = recorder.Open(argv[++i], errorMessage);
+			runner.SetApiCallObserver(&recorder);
+		}
+		else if (argument == "--parallel" && i + 1 < argc)
+			runner.SetMaxParallel((unsigned int)strtoul(argv[++i], NULL, 10));
+		else if (argument == "-")
+		{
+			std::string text((std::istreambuf_iterator<char>(cin)), std::istreambuf_iterator<char>());
+			parsed = UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::ParseBatch(text, operations, errorMessage);
+		}
+		else
+		{
+			UsbCameraDeviceManagerLinux::SUsbBatchOperation operation;
+			parsed = UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::ParseOperation(argument, operation, errorMessage);
+			operations.push_back(operation);
+		}
+
+		if (parsed == false)
+		{
+			cerr << errorMessage << endl;
+			return 2;
+		}
+	}
+
+	if (operations.empty())
+	{
+		cerr << "Usage: " << argv[0] << " [--placement file] [--status-board file] [--record file] [--parallel n] [-] \"<list|audit|reset|port-cycle|wait-ready|speed> [serial|*] [timeout=ms] [min_speed=Mbps]\" ..." << endl;
+		return 2;
+	}
+
+	std::vector<UsbCameraDeviceManagerLinux::SUsbBatchResult> results;
+	bool succeeded = runner.Run(operations, results, errorMessage);
+	if (results.empty() && succeeded == false)
+	{
+		cerr << errorMessage << endl;
+		return 2;
+	}
+
+	double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+	cout << UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::FormatJson(results, totalMs);
+	return succeeded ? 0 : 1;
+}
+#endif
@@ -23,6 +23,17 @@ using namespace Pylon;
 // Namespace for using cout.
 using namespace std;
 
+// Where the files shared between runs and processes live: one place for everybody, whatever the working directory
+static std::string SharedFilePath(const char* fileName)
+{
+	const char* programData = getenv("PROGRAMDATA");
+	std::string path = (programData != NULL) ? programData : "C:\\ProgramData";
+	path.append("\\UsbCameraDeviceManager");
+	CreateDirectoryA(path.c_str(), NULL);  // fails harmlessly if it exists
+	path.append("\\");
+	path.append(fileName);
+	return path;
+}
 
 int main(int argc, char* argv[])
 {
@@ -42,23 +53,71 @@ int main(int argc, char* argv[])
 		// create the UsbDeviceManager object (does not require camera to be connected)
 		UsbCameraDeviceManager::CUsbCameraDeviceManager dm;
 
-		// initial the device manager (pulls device instance ID, etc)
-		dm.InitializeFromCamera(serialNumber);
+		// remember the camera's identity between runs, so the next start doesn't have to enumerate
+		UsbCameraDeviceManager::CUsbCameraIdentityDatabase identityDatabase;
+		std::string databaseError;
+		if (identityDatabase.Open(SharedFilePath("UsbCameraIdentity.db"), databaseError))
+			dm.SetIdentityDatabase(&identityDatabase);
+		else
+			cout << databaseError << endl;
+
+		// other processes managing cameras on this host check the same board, so only one of them recovers a camera at a time
+		UsbCameraDeviceManager::CUsbCameraStatusBoard statusBoard;
+		if (statusBoard.Open(SharedFilePath("UsbCameraStatus.board"), databaseError))
+			dm.SetStatusBoard(&statusBoard);
+		else
+			cout << databaseError << endl;
+
+		// check the whole rig against the plan once at startup: cameras that aren't connected at all, or are in the wrong port,
+		// show up here. After that the manager checks its own camera whenever it comes back.
+		UsbCameraDeviceManager::CUsbCameraPlacementMap placementMap;
+		std::string placementError;
+		if (placementMap.Load(SharedFilePath("UsbCameraPlacement.map"), placementError))
+		{
+			std::vector<UsbCameraDeviceManager::SUsbPlacementFinding> findings;
+			UsbCameraDeviceManager::SUsbResult placement = UsbCameraDeviceManager::CUsbCameraDeviceManager::CheckAllPlacements(placementMap, findings);
+			if (placement.code == UsbCameraDeviceManager::UsbResult_Misplaced)
+				cout << UsbCameraDeviceManager::CUsbCameraPlacementMap::FormatFindings(findings);
+			else if (placement.Succeeded() == false)
+				cout << placement.FormatErrorMessage() << endl;
+			dm.SetPlacementMap(&placementMap);
+		}
+		else
+			cout << placementError << endl;
+
+		// initial the device manager (pulls device instance ID, etc. from the database if it's there, otherwise from the camera)
+		dm.InitializeFromCache(serialNumber);
 
 		cout << "Device Instance ID           : " << dm.GetDeviceInstanceID() << endl;
 		cout << "Composite Device Instance ID : " << dm.GetCompositeDeviceInstanceID() << endl;
 
-		cout << "Powering down camera device..." << endl;
-		dm.DisableCamera();
+		// how long the waits below took
+		unsigned int elapsedMs = 0;
 
-		cout << "Waiting 10 seconds..." << endl;
-		Sleep(10000);
+		cout << "Powering down camera device..." << endl;
+		if (dm.DisableCamera() == false)
+		{
+			// the cause is typed, no need to look into the message
+			if (dm.GetLastResult(UsbCameraDeviceManager::UsbOperation_DisableCamera).code == UsbCameraDeviceManager::UsbResult_AccessDenied)
+				cout << "Run the sample as administrator to disable the camera." << endl;
+			else
+				cout << dm.GetLastErrorMessage() << endl;
+		}
+
+		cout << "Waiting for camera to go away..." << endl;
+		if (dm.WaitForCameraGone(serialNumber, 10000, elapsedMs))
+			cout << "Camera gone after " << elapsedMs << " ms" << endl;
+		else
+			cout << dm.GetLastErrorMessage() << endl;
 
 		cout << "Powering up camera device..." << endl;
 		dm.EnableCamera();
 
-		cout << "Waiting 10 seconds..." << endl;
-		Sleep(10000);
+		cout << "Waiting for camera to be ready..." << endl;
+		if (dm.WaitForCameraReady(serialNumber, 10000, elapsedMs))
+			cout << "Camera ready after " << elapsedMs << " ms" << endl;
+		else
+			cout << dm.GetLastErrorMessage() << endl;
 
 		CDeviceInfo info;
 		info.SetSerialNumber(serialNumber.c_str());
@@ -66,6 +125,28 @@ int main(int argc, char* argv[])
 		camera.Open();
 		cout << "Camera Connected :-)" << endl;
 
+		// from here on, recover the camera as soon as pylon reports it removed instead of waiting for a grab to time out
+		// and bring its features back in one pass once it's reattached (snapshotted now, before anything can go wrong)
+		UsbCameraDeviceManager::CUsbCameraStateCache stateCache;
+		UsbCameraDeviceManager::CPylonCameraConnection connection(camera);
+		connection.SetStateCache(&stateCache, 5000);
+		// dm isn't used on this thread any more, the recovery thread waits with it
+		UsbCameraDeviceManager::CUsbCameraRemovalRecovery removalRecovery(dm.GetReadyWaiter(), 15000);
+		removalRecovery.SetResultHandler([](const UsbCameraDeviceManager::SUsbRemovalRecoveryResult& result)
+		{
+			if (result.recovered)
+				cout << "Camera " << result.serialNumber << " streaming again " << result.totalMs << " ms after removal (restore "
+					<< result.restore.restoreMs << " ms, first frame " << result.restore.firstFrameMs << " ms)" << endl;
+			else
+				cout << result.errorMessage << endl;
+		});
+
+		std::string recoveryError;
+		if (removalRecovery.Register(&connection, recoveryError) == false)
+			cout << recoveryError << endl;
+
+		cout << "Unplug and replug the camera to see it recovered, press Enter to continue." << endl;
+		while (cin.get() != '\n');
 	}
 	catch (const GenericException &e)
 	{
@@ -0,0 +1,583 @@
+// UsbCameraAcceptanceTest.h
+// Streams a recovered camera briefly and checks bandwidth, frame interval jitter and failed buffers before it counts as healthy
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERAACCEPTANCETEST_H
+#define USBCAMERAACCEPTANCETEST_H
+
+#include <pylon/PylonIncludes.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <stdint.h>
+#include "UsbClock.h"
+#include "UsbStreamAdmissionController.h"
+
+namespace UsbCameraDeviceManager
+{
+	// One buffer that came back during the window
+	struct SUsbStreamFrame
+	{
+		uint64_t arrivalUs;          // on the host, from the start of streaming
+		uint64_t bytes;
+		bool succeeded;              // false for a failed (eg: incomplete) buffer
+
+		SUsbStreamFrame() : arrivalUs(0), bytes(0), succeeded(false) {}
+	};
+
+	// What a probe saw while streaming, and what the camera was configured to deliver
+	struct SUsbStreamCapture
+	{
+		uint64_t payloadBytes;       // PayloadSize
+		double expectedFrameRate;    // the resulting frame rate the camera reports, 0 if it doesn't
+		unsigned int windowMs;       // how long it streamed
+		std::vector<SUsbStreamFrame> frames;
+
+		SUsbStreamCapture() : payloadBytes(0), expectedFrameRate(0), windowMs(0) {}
+	};
+
+	// Opens a camera, streams a test pattern at its configured payload size for a window and closes it again
+	class IUsbStreamProbe
+	{
+	public:
+		virtual ~IUsbStreamProbe() {}
+
+		// The camera must not be open elsewhere (eg: run it before ReattachCamera()). Streams for windowMs, stretched by
+		// StretchWindowMs() for a camera too slow to deliver minimumFrames in it.
+		virtual bool Capture(const std::string& serialNumber, unsigned int windowMs, unsigned int minimumFrames, unsigned int maximumWindowMs,
+			SUsbStreamCapture& capture, std::string& errorMessage) = 0;
+
+		// windowMs, or long enough for minimumFrames at frameRate (and one more for the stream starting up), at most maximumWindowMs
+		static unsigned int StretchWindowMs(unsigned int windowMs, unsigned int minimumFrames, unsigned int maximumWindowMs, double frameRate);
+	};
+
+	// Streams through pylon. The test pattern keeps the data independent of the scene, and triggering is switched off for
+	// the window so the camera free-runs at its configured frame rate. Both are put back afterwards, also when streaming
+	// fails. With an admission controller the window waits for its turn like any other stream, so testing a fleet of
+	// recovered cameras doesn't oversubscribe the controllers they share.
+	class CPylonStreamProbe : public IUsbStreamProbe
+	{
+	private:
+		// undoes what Capture() changed, however it is left: stops grabbing, gives the admission back, restores the features
+		struct SCaptureGuard
+		{
+			Pylon::CInstantCamera& camera;
+			CUsbStreamAdmissionController* admission;
+			std::string serialNumber;
+			GenApi::CEnumerationPtr pattern;
+			std::string previousPattern;
+			GenApi::CEnumerationPtr triggerSelector;
+			GenApi::CEnumerationPtr triggerMode;
+			std::string previousTriggerSelector;
+			std::string previousTriggerMode;
+
+			SCaptureGuard(Pylon::CInstantCamera& camera) : camera(camera), admission(NULL) {}
+			~SCaptureGuard();
+		};
+
+		std::mutex m_lock;
+		CUsbStreamAdmissionController* m_admission;
+		unsigned int m_admissionTimeoutMs;
+		int m_priority;
+		std::map<std::string, std::string> m_controllerIds;
+
+		CPylonStreamProbe(const CPylonStreamProbe&);
+		CPylonStreamProbe& operator=(const CPylonStreamProbe&);
+
+	public:
+		// admission may be NULL (stream right away) and must outlive this object. A camera that isn't admitted within
+		// admissionTimeoutMs fails its capture.
+		CPylonStreamProbe(CUsbStreamAdmissionController* admission = NULL, unsigned int admissionTimeoutMs = 30000, int priority = 0);
+
+		// The controller a camera is on, as the admission controller knows it. Cameras without one share the id "".
+		void SetControllerId(const std::string& serialNumber, const std::string& controllerId);
+
+		bool Capture(const std::string& serialNumber, unsigned int windowMs, unsigned int minimumFrames, unsigned int maximumWindowMs,
+			SUsbStreamCapture& capture, std::string& errorMessage);
+	};
+
+	// How a simulated camera streams
+	struct SUsbSimulatedStream
+	{
+		bool openable;
+		uint64_t payloadBytes;
+		double frameRate;            // what the camera is configured for
+		double deliveredRatio;       // how much of it the link actually carries, eg: 0.5 on a degraded link
+		double jitterRatio;          // frame intervals alternate this far (of the interval) above and below the mean
+		unsigned int failedBuffers;  // spread evenly over the window
+
+		SUsbSimulatedStream() : openable(true), payloadBytes(5 * 1024 * 1024), frameRate(50), deliveredRatio(1), jitterRatio(0), failedBuffers(0) {}
+	};
+
+	// A local stand-in for CPylonStreamProbe, eg: for exercising recovery escalation without cameras. Each capture takes the next
+	// queued stream, the last one stays; a healthy default one until something is queued. Sleeps the window on its clock. Thread safe.
+	class CSimulatedUsbStreamProbe : public IUsbStreamProbe
+	{
+	private:
+		std::mutex m_lock;
+		std::deque<SUsbSimulatedStream> m_streams;
+		std::vector<std::string> m_captured;
+		IUsbClock* m_clock;
+
+		CSimulatedUsbStreamProbe(const CSimulatedUsbStreamProbe&);
+		CSimulatedUsbStreamProbe& operator=(const CSimulatedUsbStreamProbe&);
+
+	public:
+		// The clock must outlive this object. NULL for the steady clock.
+		CSimulatedUsbStreamProbe(IUsbClock* clock = NULL);
+
+		void Queue(const SUsbSimulatedStream& stream);
+
+		bool Capture(const std::string& serialNumber, unsigned int windowMs, unsigned int minimumFrames, unsigned int maximumWindowMs,
+			SUsbStreamCapture& capture, std::string& errorMessage);
+
+		// The serial numbers captured so far, in order
+		std::vector<std::string> GetCaptured();
+	};
+
+	// What a camera has to achieve to pass
+	struct SUsbAcceptancePolicy
+	{
+		unsigned int windowMs;              // how long to stream, longer for a camera too slow to deliver minimumFrames in it
+		unsigned int minimumFrames;         // good frames, fewer can't be judged. Only what fits if the window hit maximumWindowMs.
+		unsigned int maximumWindowMs;       // how far the window is stretched for a slow camera
+		double minimumBandwidthRatio;       // of payload x frame rate, skipped if the camera doesn't report a frame rate
+		uint64_t minimumBytesPerSecond;     // 0 for none
+		double maximumJitterRatio;          // standard deviation of the frame interval over its mean
+		unsigned int maximumFailedBuffers;
+
+		SUsbAcceptancePolicy() : windowMs(1000), minimumFrames(10), maximumWindowMs(10000), minimumBandwidthRatio(0.9), minimumBytesPerSecond(0),
+			maximumJitterRatio(0.25), maximumFailedBuffers(0) {}
+	};
+
+	struct SUsbAcceptanceResult
+	{
+		std::string serialNumber;
+		bool passed;
+		unsigned int frames;                // good ones
+		unsigned int failedBuffers;
+		double bytesPerSecond;
+		double expectedBytesPerSecond;      // 0 if unknown
+		double meanIntervalMs;
+		double jitterMs;                    // standard deviation of the frame interval
+		unsigned int elapsedMs;             // the whole test, opening and closing included
+		std::string reason;                 // why it failed, empty if it passed
+
+		SUsbAcceptanceResult() : passed(false), frames(0), failedBuffers(0), bytesPerSecond(0), expectedBytesPerSecond(0),
+			meanIntervalMs(0), jitterMs(0), elapsedMs(0) {}
+	};
+
+	// A camera that enumerates and opens again after a recovery can still be on a degraded link: it streams, but slower, in
+	// bursts, or dropping buffers. Run() streams it for a short window through a probe and judges what arrived. Meant for
+	// one thread at a time.
+	class CUsbCameraAcceptanceTest
+	{
+	private:
+		IUsbStreamProbe& m_probe;
+		SUsbAcceptancePolicy m_policy;
+		IUsbClock* m_clock;
+
+		CUsbCameraAcceptanceTest(const CUsbCameraAcceptanceTest&);
+		CUsbCameraAcceptanceTest& operator=(const CUsbCameraAcceptanceTest&);
+
+	public:
+		// The probe and clock must outlive this object. NULL for the steady clock.
+		CUsbCameraAcceptanceTest(IUsbStreamProbe& probe, const SUsbAcceptancePolicy& policy = SUsbAcceptancePolicy(), IUsbClock* clock = NULL);
+
+		void SetPolicy(const SUsbAcceptancePolicy& policy);
+
+		SUsbAcceptancePolicy GetPolicy();
+
+		// True if the camera passed. A camera that can't be streamed at all fails too, with the probe's error as the reason.
+		bool Run(const std::string& serialNumber, SUsbAcceptanceResult& result, std::string& errorMessage);
+
+		// Judges a capture. Doesn't set serialNumber or elapsedMs.
+		static void Evaluate(const SUsbStreamCapture& capture, const SUsbAcceptancePolicy& policy, SUsbAcceptanceResult& result);
+
+		// eg: "40012345 passed: 50 frames, 0 failed, 262.1 MB/s of 262.1 MB/s, interval 20.00 ms +- 0.12 ms"
+		static std::string FormatResult(const SUsbAcceptanceResult& result);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline unsigned int UsbCameraDeviceManager::IUsbStreamProbe::StretchWindowMs(unsigned int windowMs, unsigned int minimumFrames, unsigned int maximumWindowMs, double frameRate)
+{
+	if (frameRate <= 0)
+		return windowMs;
+
+	double neededMs = std::ceil((minimumFrames + 1) * 1000.0 / frameRate);
+	if (neededMs <= windowMs)
+		return windowMs;
+	return (neededMs < maximumWindowMs) ? (unsigned int)neededMs : std::max(windowMs, maximumWindowMs);
+}
+
+inline UsbCameraDeviceManager::CPylonStreamProbe::SCaptureGuard::~SCaptureGuard()
+{
+	// each step on its own, a failing one must not keep the others from running
+	try { camera.StopGrabbing(); }
+	catch (const GenICam::GenericException &) {}
+
+	if (admission != NULL)
+		admission->Release(serialNumber);
+
+	try
+	{
+		if (previousTriggerMode != "")
+		{
+			triggerSelector->FromString("FrameStart");
+			triggerMode->FromString(previousTriggerMode.c_str());
+		}
+	}
+	catch (const GenICam::GenericException &) {}
+
+	try
+	{
+		if (previousTriggerSelector != "")
+			triggerSelector->FromString(previousTriggerSelector.c_str());
+	}
+	catch (const GenICam::GenericException &) {}
+
+	try
+	{
+		if (previousPattern != "")
+			pattern->FromString(previousPattern.c_str());
+	}
+	catch (const GenICam::GenericException &) {}
+
+	try { camera.Close(); }
+	catch (const GenICam::GenericException &) {}
+}
+
+inline UsbCameraDeviceManager::CPylonStreamProbe::CPylonStreamProbe(CUsbStreamAdmissionController* admission, unsigned int admissionTimeoutMs, int priority)
+{
+	m_admission = admission;
+	m_admissionTimeoutMs = admissionTimeoutMs;
+	m_priority = priority;
+}
+
+inline void UsbCameraDeviceManager::CPylonStreamProbe::SetControllerId(const std::string& serialNumber, const std::string& controllerId)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_controllerIds[serialNumber] = controllerId;
+}
+
+inline bool UsbCameraDeviceManager::CPylonStreamProbe::Capture(const std::string& serialNumber, unsigned int windowMs, unsigned int minimumFrames, unsigned int maximumWindowMs,
+	SUsbStreamCapture& capture, std::string& errorMessage)
+{
+	capture = SUsbStreamCapture();
+
+	try
+	{
+		Pylon::CDeviceInfo info;
+		info.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
+		info.SetSerialNumber(serialNumber.c_str());
+		Pylon::CInstantCamera camera(Pylon::CTlFactory::GetInstance().CreateDevice(info));
+		camera.Open();
+		GenApi::INodeMap& nodeMap = camera.GetNodeMap();
+
+		// declared after the camera, so it runs first on the way out
+		SCaptureGuard guard(camera);
+		guard.serialNumber = serialNumber;
+
+		// SFNC 2 cameras call it TestPattern, older ones TestImageSelector
+		guard.pattern = nodeMap.GetNode("TestPattern");
+		const char* patternName = "GreyDiagonalSawtooth8";
+		if (GenApi::IsWritable(guard.pattern) == false)
+		{
+			guard.pattern = nodeMap.GetNode("TestImageSelector");
+			patternName = "Testimage1";
+		}
+		if (GenApi::IsWritable(guard.pattern))
+		{
+			guard.previousPattern = guard.pattern->ToString().c_str();
+			guard.pattern->FromString(patternName);
+		}
+
+		guard.triggerSelector = nodeMap.GetNode("TriggerSelector");
+		guard.triggerMode = nodeMap.GetNode("TriggerMode");
+		if (GenApi::IsWritable(guard.triggerSelector) && GenApi::IsWritable(guard.triggerMode))
+		{
+			guard.previousTriggerSelector = guard.triggerSelector->ToString().c_str();
+			guard.triggerSelector->FromString("FrameStart");
+			guard.previousTriggerMode = guard.triggerMode->ToString().c_str();
+			guard.triggerMode->FromString("Off");
+		}
+
+		GenApi::CIntegerPtr payloadSize = nodeMap.GetNode("PayloadSize");
+		if (GenApi::IsReadable(payloadSize))
+			capture.payloadBytes = (uint64_t)payloadSize->GetValue();
+
+		GenApi::CFloatPtr frameRate = nodeMap.GetNode("ResultingFrameRate");
+		if (GenApi::IsReadable(frameRate) == false)
+			frameRate = nodeMap.GetNode("ResultingFrameRateAbs");
+		if (GenApi::IsReadable(frameRate))
+			capture.expectedFrameRate = frameRate->GetValue();
+		capture.windowMs = StretchWindowMs(windowMs, minimumFrames, maximumWindowMs, capture.expectedFrameRate);
+
+		// wait for a share of the controller like the application's own streams do
+		if (m_admission != NULL)
+		{
+			std::string controllerId;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				std::map<std::string, std::string>::iterator known = m_controllerIds.find(serialNumber);
+				if (known != m_controllerIds.end())
+					controllerId = known->second;
+			}
+
+			SUsbStreamDemand demand;
+			if (CUsbStreamAdmissionController::ReadStreamDemand(camera, controllerId, m_priority, demand, errorMessage) == false
+				|| m_admission->Acquire(demand, m_admissionTimeoutMs, errorMessage) == false)
+				return false;
+			guard.admission = m_admission;
+		}
+
+		// host arrival times, that's where a degraded link shows
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point end = start + std::chrono::milliseconds(capture.windowMs);
+		camera.StartGrabbing(Pylon::GrabStrategy_OneByOne);
+		while (std::chrono::steady_clock::now() < end)
+		{
+			unsigned int remainingMs = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(end - std::chrono::steady_clock::now()).count();
+			Pylon::CGrabResultPtr result;
+			if (camera.RetrieveResult(remainingMs + 1, result, Pylon::TimeoutHandling_Return) == false || result.IsValid() == false)
+				continue;
+
+			SUsbStreamFrame frame;
+			frame.arrivalUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			frame.succeeded = result->GrabSucceeded();
+			frame.bytes = frame.succeeded ? (uint64_t)result->GetPayloadSize() : 0;
+			capture.frames.push_back(frame);
+		}
+		return true;
+	}
+	catch (const GenICam::GenericException &e)
+	{
+		errorMessage = "Error: Capture(): GenICam exception occurred. ";
+		errorMessage.append(e.GetDescription());
+		return false;
+	}
+}
+
+inline UsbCameraDeviceManager::CSimulatedUsbStreamProbe::CSimulatedUsbStreamProbe(IUsbClock* clock)
+{
+	m_clock = (clock != NULL) ? clock : &CSystemUsbClock::Instance();
+}
+
+inline void UsbCameraDeviceManager::CSimulatedUsbStreamProbe::Queue(const SUsbSimulatedStream& stream)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_streams.push_back(stream);
+}
+
+inline bool UsbCameraDeviceManager::CSimulatedUsbStreamProbe::Capture(const std::string& serialNumber, unsigned int windowMs, unsigned int minimumFrames, unsigned int maximumWindowMs,
+	SUsbStreamCapture& capture, std::string& errorMessage)
+{
+	capture = SUsbStreamCapture();
+
+	SUsbSimulatedStream stream;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_streams.empty() == false)
+			stream = m_streams.front();
+		if (m_streams.size() > 1)
+			m_streams.pop_front();
+		m_captured.push_back(serialNumber);
+	}
+
+	if (stream.openable == false)
+	{
+		errorMessage = "Error: Capture(): Camera " + serialNumber + " could not be opened.";
+		return false;
+	}
+
+	capture.payloadBytes = stream.payloadBytes;
+	capture.expectedFrameRate = stream.frameRate;
+	capture.windowMs = StretchWindowMs(windowMs, minimumFrames, maximumWindowMs, stream.frameRate);
+	windowMs = capture.windowMs;
+
+	// frames come at the rate the link carries, alternately early and late
+	double deliveredRate = stream.frameRate * stream.deliveredRatio;
+	if (deliveredRate > 0)
+	{
+		double intervalUs = 1000000.0 / deliveredRate;
+		size_t count = (size_t)(windowMs * deliveredRate / 1000.0);
+		double arrivalUs = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			SUsbStreamFrame frame;
+			if (i > 0)
+				arrivalUs += intervalUs * (1.0 + (((i % 2) == 1) ? stream.jitterRatio : -stream.jitterRatio));
+			frame.arrivalUs = (uint64_t)arrivalUs;
+			frame.succeeded = true;
+			frame.bytes = stream.payloadBytes;
+			capture.frames.push_back(frame);
+		}
+
+		for (unsigned int f = 0; f < stream.failedBuffers && f < count; f++)
+		{
+			SUsbStreamFrame& frame = capture.frames[(size_t)(((uint64_t)f * 2 + 1) * count / ((uint64_t)stream.failedBuffers * 2))];
+			frame.succeeded = false;
+			frame.bytes = 0;
+		}
+	}
+
+	m_clock->SleepMs(windowMs);
+	return true;
+}
+
+inline std::vector<std::string> UsbCameraDeviceManager::CSimulatedUsbStreamProbe::GetCaptured()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_captured;
+}
+
+inline UsbCameraDeviceManager::CUsbCameraAcceptanceTest::CUsbCameraAcceptanceTest(IUsbStreamProbe& probe, const SUsbAcceptancePolicy& policy, IUsbClock* clock)
+	: m_probe(probe), m_policy(policy)
+{
+	m_clock = (clock != NULL) ? clock : &CSystemUsbClock::Instance();
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraAcceptanceTest::SetPolicy(const SUsbAcceptancePolicy& policy)
+{
+	m_policy = policy;
+}
+
+inline UsbCameraDeviceManager::SUsbAcceptancePolicy UsbCameraDeviceManager::CUsbCameraAcceptanceTest::GetPolicy()
+{
+	return m_policy;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraAcceptanceTest::Run(const std::string& serialNumber, SUsbAcceptanceResult& result, std::string& errorMessage)
+{
+	uint64_t start = m_clock->NowMs();
+
+	SUsbStreamCapture capture;
+	std::string probeError;
+	if (m_probe.Capture(serialNumber, m_policy.windowMs, m_policy.minimumFrames, m_policy.maximumWindowMs, capture, probeError))
+		Evaluate(capture, m_policy, result);
+	else
+	{
+		result = SUsbAcceptanceResult();
+		result.reason = probeError;
+	}
+	result.serialNumber = serialNumber;
+	result.elapsedMs = (unsigned int)(m_clock->NowMs() - start);
+
+	if (result.passed == false)
+	{
+		errorMessage = "Error: Run(): Camera " + serialNumber + " failed its acceptance test. ";
+		errorMessage.append(result.reason);
+	}
+	return result.passed;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraAcceptanceTest::Evaluate(const SUsbStreamCapture& capture, const SUsbAcceptancePolicy& policy, SUsbAcceptanceResult& result)
+{
+	result = SUsbAcceptanceResult();
+	result.expectedBytesPerSecond = (double)capture.payloadBytes * capture.expectedFrameRate;
+
+	// bandwidth and intervals from the first good frame on, the time before it is the stream starting up
+	std::vector<double> intervalsMs;
+	uint64_t firstUs = 0;
+	uint64_t lastUs = 0;
+	uint64_t bytes = 0;
+	for (size_t i = 0; i < capture.frames.size(); i++)
+	{
+		const SUsbStreamFrame& frame = capture.frames[i];
+		if (frame.succeeded == false)
+		{
+			result.failedBuffers++;
+			continue;
+		}
+
+		if (result.frames == 0)
+			firstUs = frame.arrivalUs;
+		else
+		{
+			intervalsMs.push_back((frame.arrivalUs - lastUs) / 1000.0);
+			bytes += frame.bytes;
+		}
+		lastUs = frame.arrivalUs;
+		result.frames++;
+	}
+
+	if (lastUs > firstUs)
+		result.bytesPerSecond = bytes * 1000000.0 / (lastUs - firstUs);
+
+	if (intervalsMs.empty() == false)
+	{
+		double sum = 0;
+		for (size_t i = 0; i < intervalsMs.size(); i++)
+			sum += intervalsMs[i];
+		result.meanIntervalMs = sum / intervalsMs.size();
+
+		double squares = 0;
+		for (size_t i = 0; i < intervalsMs.size(); i++)
+			squares += (intervalsMs[i] - result.meanIntervalMs) * (intervalsMs[i] - result.meanIntervalMs);
+		result.jitterMs = std::sqrt(squares / intervalsMs.size());
+	}
+
+	// a camera too slow for minimumFrames even in maximumWindowMs is judged on what fits into the window (less the first
+	// interval, the stream starting up)
+	unsigned int windowMs = (capture.windowMs != 0) ? capture.windowMs : policy.windowMs;
+	unsigned int minimumFrames = policy.minimumFrames;
+	double framesInWindow = capture.expectedFrameRate * windowMs / 1000.0;
+	if (capture.expectedFrameRate > 0 && framesInWindow - 1 < minimumFrames)
+		minimumFrames = (framesInWindow > 1) ? (unsigned int)(framesInWindow - 1) : 0;
+
+	// the first check that fails is the reason
+	if (result.frames < minimumFrames || result.frames < 2)
+		result.reason = "Only " + std::to_string(result.frames) + " good frames in " + std::to_string(windowMs) + " ms.";
+	else if (result.failedBuffers > policy.maximumFailedBuffers)
+		result.reason = std::to_string(result.failedBuffers) + " failed buffers, at most " + std::to_string(policy.maximumFailedBuffers) + " allowed.";
+	else if (result.expectedBytesPerSecond > 0 && result.bytesPerSecond < result.expectedBytesPerSecond * policy.minimumBandwidthRatio)
+		result.reason = "Bandwidth " + std::to_string((uint64_t)result.bytesPerSecond) + " bytes/s, expected at least "
+			+ std::to_string((uint64_t)(result.expectedBytesPerSecond * policy.minimumBandwidthRatio)) + ".";
+	else if (result.bytesPerSecond < (double)policy.minimumBytesPerSecond)
+		result.reason = "Bandwidth " + std::to_string((uint64_t)result.bytesPerSecond) + " bytes/s, expected at least "
+			+ std::to_string(policy.minimumBytesPerSecond) + ".";
+	else if (result.jitterMs > result.meanIntervalMs * policy.maximumJitterRatio)
+		result.reason = "Frame interval jitter " + std::to_string(result.jitterMs) + " ms, at most "
+			+ std::to_string(result.meanIntervalMs * policy.maximumJitterRatio) + " ms allowed.";
+	else
+		result.passed = true;
+}
+
+inline std::string UsbCameraDeviceManager::CUsbCameraAcceptanceTest::FormatResult(const SUsbAcceptanceResult& result)
+{
+	char text[256];
+	snprintf(text, sizeof(text), "%s %s: %u frames, %u failed, %.1f MB/s of %.1f MB/s, interval %.2f ms +- %.2f ms",
+		result.serialNumber.c_str(), result.passed ? "passed" : "failed", result.frames, result.failedBuffers,
+		result.bytesPerSecond / 1000000.0, result.expectedBytesPerSecond / 1000000.0, result.meanIntervalMs, result.jitterMs);
+
+	std::string formatted = text;
+	if (result.reason != "")
+		formatted += ". " + result.reason;
+	return formatted;
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,920 @@
+// UsbCameraBatchRunnerLinux.h
+// Runs a batch of list, audit, reset, port-cycle, wait-ready and speed operations over many cameras in one process
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERABATCHRUNNERLINUX_H
+#define USBCAMERABATCHRUNNERLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbControllerRecoveryLinux.h"
+#include "UsbCameraPlacementMap.h"
+#include "UsbCameraStatusBoard.h"
+#include "UsbClock.h"
+#include "UsbCameraResult.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	enum EUsbBatchOperationType
+	{
+		UsbBatch_List = 0,     // every camera in the shared enumeration
+		UsbBatch_Audit,        // speed, power, port state, over-currents and placement of one camera
+		UsbBatch_Reset,        // USBDEVFS_RESET
+		UsbBatch_PortCycle,    // disables and re-enables the hub port (or de- and re-authorizes on older kernels)
+		UsbBatch_WaitReady,    // waits until the camera is enumerated again, optionally at a minimum speed
+		UsbBatch_Speed,        // checks the link speed against a minimum
+		UsbBatch_Count
+	};
+
+	// One operation, as parsed from "reset 40012345" or "wait-ready 40012345 timeout=5000 min_speed=5000".
+	// A serial number of "*" stands for every Basler camera found.
+	struct SUsbBatchOperation
+	{
+		EUsbBatchOperationType type;
+		std::string serialNumber;
+		unsigned int timeoutMs;          // wait-ready
+		unsigned int minimumSpeedMbps;   // audit, wait-ready and speed. 0 for audit and wait-ready to not check it.
+
+		SUsbBatchOperation() : type(UsbBatch_List), timeoutMs(10000), minimumSpeedMbps(0) {}
+	};
+
+	// One named value of a result. Numbers and booleans are written to JSON unquoted.
+	struct SUsbBatchDetail
+	{
+		std::string name;
+		std::string value;
+		bool quoted;
+
+		SUsbBatchDetail() : quoted(true) {}
+	};
+
+	struct SUsbBatchResult
+	{
+		SUsbBatchOperation operation;
+		bool succeeded;
+		std::string errorMessage;
+		double startMs;                  // since Run() was called
+		double elapsedMs;
+		std::vector<SUsbBatchDetail> details;
+		std::vector<std::map<std::string, std::string> > cameras;   // list only
+
+		SUsbBatchResult() : succeeded(false), startMs(0), elapsedMs(0) {}
+	};
+
+	// Replaces one wrapper process per operation (pylon init, full enumeration, teardown) with a single pass: the bus is
+	// enumerated once and every operation looks its camera up in that snapshot. Operations on one camera run in the
+	// order given, different cameras run in parallel. Resets and port cycles of cameras on the same host controller are
+	// serialized, so one controller never takes several of them at once. The lock is released once the port is enabled
+	// again, so their re-enumerations may still overlap. Everything goes through sysfs and
+	// usbfs, none of it needs pylon. Needs write access to usbfs and sysfs for resets and port cycles (eg: root).
+	class CUsbCameraBatchRunner
+	{
+	private:
+		// One device of the shared enumeration
+		struct SBatchDevice
+		{
+			std::string deviceName;
+			std::string controller;
+			int busnum;
+			int devnum;
+
+			SBatchDevice() : busnum(0), devnum(0) {}
+		};
+
+		CSysfsUsbDeviceBackend& m_backend;
+		UsbCameraDeviceManager::IUsbClock* m_clock;
+		UsbCameraDeviceManager::CUsbCameraPlacementMap* m_placementMap;
+		UsbCameraDeviceManager::CUsbCameraStatusBoard* m_statusBoard;
+		UsbCameraDeviceManager::IUsbApiCallObserver* m_apiCallObserver;
+		unsigned int m_maxParallel;
+		unsigned int m_pollMs;
+		unsigned int m_portOffMs;
+
+		std::mutex m_lock;
+		std::map<std::string, SBatchDevice> m_devices;                     // by serial number, cameras only
+		std::vector<std::string> m_cameraSerialNumbers;                    // sorted
+		std::map<std::string, std::shared_ptr<std::mutex> > m_controllerLocks;
+		std::map<std::string, std::vector<UsbCameraDeviceManager::SUsbPlacementFinding> > m_placementFindings;
+
+		CUsbCameraBatchRunner(const CUsbCameraBatchRunner&);
+		CUsbCameraBatchRunner& operator=(const CUsbCameraBatchRunner&);
+
+		// the shared enumeration: every Basler camera with its bus address and controller
+		bool Enumerate(std::string& errorMessage);
+
+		// a camera's device from the shared enumeration, or from a fresh lookup once it has re-enumerated
+		bool LookupDevice(const std::string& serialNumber, bool fresh, SBatchDevice& device, std::string& errorMessage);
+
+		// held while resetting or cycling a camera on a controller
+		std::shared_ptr<std::mutex> GetControllerLock(const std::string& controller);
+
+		// writes a sysfs file
+		static bool WriteFile(const std::string& path, const std::string& value);
+
+		// runs the operations of one camera in order. After a reset or port cycle (stale) the camera is looked up afresh,
+		// the shared enumeration no longer holds its bus address.
+		void RunCamera(const std::vector<SUsbBatchOperation>& operations, const std::vector<size_t>& indexes, std::vector<SUsbBatchResult>& results, std::chrono::steady_clock::time_point started);
+
+		void RunList(SUsbBatchResult& result);
+		bool RunAudit(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result);
+		bool RunReset(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result);
+		bool RunPortCycle(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result);
+		bool RunWaitReady(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result);
+		bool RunSpeed(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result);
+
+		static void AddDetail(SUsbBatchResult& result, const std::string& name, const std::string& value, bool quoted = true);
+
+	public:
+		// The backend must outlive this object. Placement is only audited when a map is set.
+		CUsbCameraBatchRunner(CSysfsUsbDeviceBackend& backend, UsbCameraDeviceManager::IUsbClock* clock = NULL);
+
+		// Cameras worked on at the same time. Default 8.
+		void SetMaxParallel(unsigned int maxParallel);
+
+		// How often wait-ready looks for the camera. Default 50 ms.
+		void SetPollMs(unsigned int pollMs);
+
+		// How long a port cycle keeps the port disabled. Default 500 ms.
+		void SetPortOffMs(unsigned int portOffMs);
+
+		// The planned placement audits compare against (may be NULL). Must outlive Run().
+		void SetPlacementMap(UsbCameraDeviceManager::CUsbCameraPlacementMap* placementMap);
+
+		// The board resets and port cycles claim their camera on (may be NULL), so they fail instead of hitting a camera
+		// another process is recovering. The cooldown then keeps others off it while it re-enumerates. Must outlive Run().
+		void SetStatusBoard(UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard);
+
+		// Told about every operation on a camera once it's done, named as in the batch (eg: "reset"). May be NULL. Called
+		// from the worker threads, so it must be thread safe (as CUsbIncidentRecorder is). Must outlive Run().
+		void SetApiCallObserver(UsbCameraDeviceManager::IUsbApiCallObserver* apiCallObserver);
+
+		// Parses one operation: "<list|audit|reset|port-cycle|wait-ready|speed> [serial|*] [timeout=ms] [min_speed=Mbps]".
+		// speed takes the minimum as a plain third word too (eg: "speed 40012345 5000"), it defaults to 5000.
+		static bool ParseOperation(const std::string& text, SUsbBatchOperation& operation, std::string& errorMessage);
+
+		// Parses one operation per line. Empty lines and lines starting with '#' are skipped.
+		static bool ParseBatch(const std::string& text, std::vector<SUsbBatchOperation>& operations, std::string& errorMessage);
+
+		// Enumerates once, expands "*", runs everything and returns one result per operation in the order of the batch.
+		// Returns true if every operation succeeded.
+		bool Run(const std::vector<SUsbBatchOperation>& operations, std::vector<SUsbBatchResult>& results, std::string& errorMessage);
+
+		// "list", "audit", "reset", "port-cycle", "wait-ready", "speed"
+		static const char* OperationToString(EUsbBatchOperationType type);
+
+		// {"succeeded":..., "elapsed_ms":..., "operations":[{"op":..., "serial":..., "ok":..., "error":..., "start_ms":..., "elapsed_ms":..., ...}]}
+		static std::string FormatJson(const std::vector<SUsbBatchResult>& results, double totalMs);
+
+		static std::string EscapeJson(const std::string& text);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::CUsbCameraBatchRunner(CSysfsUsbDeviceBackend& backend, UsbCameraDeviceManager::IUsbClock* clock)
+	: m_backend(backend)
+{
+	m_clock = (clock != NULL) ? clock : &UsbCameraDeviceManager::CSystemUsbClock::Instance();
+	m_placementMap = NULL;
+	m_statusBoard = NULL;
+	m_apiCallObserver = NULL;
+	m_maxParallel = 8;
+	m_pollMs = 50;
+	m_portOffMs = 500;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::SetMaxParallel(unsigned int maxParallel)
+{
+	m_maxParallel = (maxParallel > 0) ? maxParallel : 1;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::SetPollMs(unsigned int pollMs)
+{
+	m_pollMs = (pollMs > 0) ? pollMs : 1;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::SetPortOffMs(unsigned int portOffMs)
+{
+	m_portOffMs = portOffMs;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::SetPlacementMap(UsbCameraDeviceManager::CUsbCameraPlacementMap* placementMap)
+{
+	m_placementMap = placementMap;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::SetStatusBoard(UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard)
+{
+	m_statusBoard = statusBoard;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::SetApiCallObserver(UsbCameraDeviceManager::IUsbApiCallObserver* apiCallObserver)
+{
+	m_apiCallObserver = apiCallObserver;
+}
+
+inline const char* UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::OperationToString(EUsbBatchOperationType type)
+{
+	switch (type)
+	{
+	case UsbBatch_List: return "list";
+	case UsbBatch_Audit: return "audit";
+	case UsbBatch_Reset: return "reset";
+	case UsbBatch_PortCycle: return "port-cycle";
+	case UsbBatch_WaitReady: return "wait-ready";
+	case UsbBatch_Speed: return "speed";
+	default: return "unknown";
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::ParseOperation(const std::string& text, SUsbBatchOperation& operation, std::string& errorMessage)
+{
+	std::istringstream stream(text);
+	std::vector<std::string> words;
+	std::string word;
+	while (stream >> word)
+		words.push_back(word);
+
+	operation = SUsbBatchOperation();
+	if (words.empty())
+	{
+		errorMessage = "Error: ParseOperation(): Empty operation.";
+		return false;
+	}
+
+	int type = 0;
+	for (; type < UsbBatch_Count; type++)
+	{
+		if (words[0] == OperationToString((EUsbBatchOperationType)type))
+			break;
+	}
+	if (type == UsbBatch_Count)
+	{
+		errorMessage = "Error: ParseOperation(): Unknown operation '" + words[0] + "' in: " + text;
+		return false;
+	}
+	operation.type = (EUsbBatchOperationType)type;
+	if (operation.type == UsbBatch_Speed)
+		operation.minimumSpeedMbps = 5000;
+
+	for (size_t i = 1; i < words.size(); i++)
+	{
+		std::size_t equals = words[i].find('=');
+		std::string key = (equals != std::string::npos) ? words[i].substr(0, equals) : "";
+		std::string value = (equals != std::string::npos) ? words[i].substr(equals + 1) : words[i];
+
+		if (key == "timeout")
+			operation.timeoutMs = (unsigned int)strtoul(value.c_str(), NULL, 10);
+		else if (key == "min_speed")
+			operation.minimumSpeedMbps = (unsigned int)strtoul(value.c_str(), NULL, 10);
+		else if (key == "" && operation.serialNumber == "")
+			operation.serialNumber = value;
+		else if (key == "" && operation.type == UsbBatch_Speed)
+			operation.minimumSpeedMbps = (unsigned int)strtoul(value.c_str(), NULL, 10);
+		else
+		{
+			errorMessage = "Error: ParseOperation(): Unexpected '" + words[i] + "' in: " + text;
+			return false;
+		}
+	}
+
+	if (operation.type == UsbBatch_List && operation.serialNumber != "")
+	{
+		errorMessage = "Error: ParseOperation(): list takes no serial number: " + text;
+		return false;
+	}
+	if (operation.type != UsbBatch_List && operation.serialNumber == "")
+	{
+		errorMessage = "Error: ParseOperation(): Missing serial number: " + text;
+		return false;
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::ParseBatch(const std::string& text, std::vector<SUsbBatchOperation>& operations, std::string& errorMessage)
+{
+	std::istringstream stream(text);
+	std::string line;
+	while (std::getline(stream, line))
+	{
+		std::size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+
+		SUsbBatchOperation operation;
+		if (ParseOperation(line, operation, errorMessage) == false)
+			return false;
+		operations.push_back(operation);
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::Enumerate(std::string& errorMessage)
+{
+	std::vector<std::string> deviceNames;
+	if (m_backend.ListDevices(deviceNames) == false)
+	{
+		errorMessage = "Error: Enumerate(): Unable to list usb devices in " + m_backend.GetSysfsRoot();
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_devices.clear();
+	m_cameraSerialNumbers.clear();
+	for (size_t i = 0; i < deviceNames.size(); i++)
+	{
+		std::string vendor;
+		std::string serial;
+		if (m_backend.ReadAttribute(deviceNames[i], "idVendor", vendor) == false || vendor != "2676"
+			|| m_backend.ReadAttribute(deviceNames[i], "serial", serial) == false || serial == "")
+			continue;
+
+		SBatchDevice device;
+		device.deviceName = deviceNames[i];
+
+		std::string value;
+		if (m_backend.ReadAttribute(device.deviceName, "busnum", value))
+			device.busnum = atoi(value.c_str());
+		if (m_backend.ReadAttribute(device.deviceName, "devnum", value))
+			device.devnum = atoi(value.c_str());
+
+		std::string devicePath;
+		std::string rootHub;
+		if (m_backend.ResolveDevicePath(device.deviceName, devicePath))
+			CUsbControllerRecovery::ParseControllerAddress(devicePath, device.controller, rootHub);
+
+		if (m_devices.count(serial) == 0)
+			m_cameraSerialNumbers.push_back(serial);
+		m_devices[serial] = device;
+	}
+	std::sort(m_cameraSerialNumbers.begin(), m_cameraSerialNumbers.end());
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::LookupDevice(const std::string& serialNumber, bool fresh, SBatchDevice& device, std::string& errorMessage)
+{
+	if (fresh == false)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		std::map<std::string, SBatchDevice>::const_iterator it = m_devices.find(serialNumber);
+		if (it == m_devices.end())
+		{
+			errorMessage = "Error: LookupDevice(): No camera with serial number " + serialNumber + " found.";
+			return false;
+		}
+		device = it->second;
+		return true;
+	}
+
+	device = SBatchDevice();
+	if (FindUsbDeviceBySerial(m_backend, serialNumber, device.deviceName) == false)
+	{
+		errorMessage = "Error: LookupDevice(): No camera with serial number " + serialNumber + " found.";
+		return false;
+	}
+
+	std::string value;
+	if (m_backend.ReadAttribute(device.deviceName, "busnum", value))
+		device.busnum = atoi(value.c_str());
+	if (m_backend.ReadAttribute(device.deviceName, "devnum", value))
+		device.devnum = atoi(value.c_str());
+
+	std::string devicePath;
+	std::string rootHub;
+	if (m_backend.ResolveDevicePath(device.deviceName, devicePath))
+		CUsbControllerRecovery::ParseControllerAddress(devicePath, device.controller, rootHub);
+	return true;
+}
+
+inline std::shared_ptr<std::mutex> UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::GetControllerLock(const std::string& controller)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::shared_ptr<std::mutex>& controllerLock = m_controllerLocks[controller];
+	if (controllerLock == nullptr)
+		controllerLock = std::make_shared<std::mutex>();
+	return controllerLock;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::WriteFile(const std::string& path, const std::string& value)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	bool written = (write(fd, value.c_str(), value.size()) == (ssize_t)value.size());
+	close(fd);
+	return written;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::AddDetail(SUsbBatchResult& result, const std::string& name, const std::string& value, bool quoted)
+{
+	SUsbBatchDetail detail;
+	detail.name = name;
+	detail.value = value;
+	detail.quoted = quoted;
+	result.details.push_back(detail);
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::RunList(SUsbBatchResult& result)
+{
+	const char* attributes[] = { "speed", "version", "product", "busnum", "devnum" };
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < m_cameraSerialNumbers.size(); i++)
+	{
+		const SBatchDevice& device = m_devices[m_cameraSerialNumbers[i]];
+
+		std::map<std::string, std::string> camera;
+		camera["serial"] = m_cameraSerialNumbers[i];
+		camera["port"] = device.deviceName;
+		camera["controller"] = device.controller;
+		for (size_t a = 0; a < sizeof(attributes) / sizeof(attributes[0]); a++)
+		{
+			std::string value;
+			if (m_backend.ReadAttribute(device.deviceName, attributes[a], value))
+				camera[attributes[a]] = value;
+		}
+		result.cameras.push_back(camera);
+	}
+	AddDetail(result, "count", std::to_string(m_cameraSerialNumbers.size()), false);
+	result.succeeded = true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::RunAudit(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result)
+{
+	SBatchDevice device;
+	if (LookupDevice(operation.serialNumber, stale, device, result.errorMessage) == false)
+		return false;
+
+	AddDetail(result, "port", device.deviceName);
+	AddDetail(result, "controller", device.controller);
+
+	// the numeric ones go out as numbers, anything the kernel doesn't have is left out
+	const char* numbers[] = { "speed", "bMaxPower", "port/over_current_count" };
+	const char* texts[] = { "version", "port/state", "power/runtime_status", "authorized" };
+	unsigned int speedMbps = 0;
+	for (size_t a = 0; a < sizeof(numbers) / sizeof(numbers[0]); a++)
+	{
+		std::string value;
+		if (m_backend.ReadAttribute(device.deviceName, numbers[a], value) == false)
+			continue;
+		unsigned long number = strtoul(value.c_str(), NULL, 10);
+		if (a == 0)
+			speedMbps = (unsigned int)number;
+		AddDetail(result, numbers[a], std::to_string(number), false);
+	}
+	for (size_t a = 0; a < sizeof(texts) / sizeof(texts[0]); a++)
+	{
+		std::string value;
+		if (m_backend.ReadAttribute(device.deviceName, texts[a], value))
+			AddDetail(result, texts[a], value);
+	}
+
+	std::string problems;
+	if (operation.minimumSpeedMbps > 0 && speedMbps < operation.minimumSpeedMbps)
+		problems = "Camera " + operation.serialNumber + " links at " + std::to_string(speedMbps) + " Mbps instead of " + std::to_string(operation.minimumSpeedMbps) + ".";
+
+	if (m_placementMap != NULL)
+	{
+		std::vector<UsbCameraDeviceManager::SUsbPlacementFinding> findings;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			findings = m_placementFindings[operation.serialNumber];
+		}
+		for (size_t i = 0; i < findings.size(); i++)
+		{
+			AddDetail(result, "placement", UsbCameraDeviceManager::CUsbCameraPlacementMap::ProblemToString(findings[i].problem));
+			problems.append((problems != "") ? " " : "");
+			problems.append(findings[i].action);
+		}
+	}
+
+	if (problems != "")
+	{
+		result.errorMessage = "Error: Audit(): " + problems;
+		return false;
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::RunReset(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result)
+{
+	SBatchDevice device;
+	if (LookupDevice(operation.serialNumber, stale, device, result.errorMessage) == false)
+		return false;
+
+	UsbCameraDeviceManager::CUsbRecoveryClaim claim(m_statusBoard, operation.serialNumber);
+	if (claim.Claim(result.errorMessage) == false)
+		return false;
+
+	std::shared_ptr<std::mutex> controllerLock = GetControllerLock(device.controller);
+	std::lock_guard<std::mutex> lock(*controllerLock);
+
+	int handle = m_backend.OpenUsbfs(device.busnum, device.devnum);
+	if (handle < 0)
+	{
+		result.errorMessage = "Error: Reset(): Unable to open usbfs node " + std::to_string(device.busnum) + "/" + std::to_string(device.devnum)
+			+ " of camera " + operation.serialNumber + ": " + strerror(-handle);
+		return false;
+	}
+
+	int status = m_backend.ResetUsbfs(handle);
+	m_backend.CloseUsbfs(handle);
+
+	// the camera re-enumerates, probably with a new device number
+	stale = true;
+	AddDetail(result, "port", device.deviceName);
+	if (status < 0)
+	{
+		result.errorMessage = "Error: Reset(): USBDEVFS_RESET of camera " + operation.serialNumber + " failed: " + strerror(-status);
+		return false;
+	}
+	claim.SetRecovered(true);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::RunPortCycle(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result)
+{
+	SBatchDevice device;
+	if (LookupDevice(operation.serialNumber, stale, device, result.errorMessage) == false)
+		return false;
+
+	UsbCameraDeviceManager::CUsbRecoveryClaim claim(m_statusBoard, operation.serialNumber);
+	if (claim.Claim(result.errorMessage) == false)
+		return false;
+
+	std::shared_ptr<std::mutex> controllerLock = GetControllerLock(device.controller);
+	std::lock_guard<std::mutex> lock(*controllerLock);
+
+	AddDetail(result, "port", device.deviceName);
+	stale = true;
+
+	// port/disable (kernel 5.x) drops the link like an unplug. It is written in the hub port's own directory
+	// (eg: .../2-1:1.0/2-1-port3), the one <device>/port links to: disabling the port disconnects the device, and
+	// its sysfs directory with the link goes away. Without it, de-authorizing at least unbinds the drivers and makes
+	// the camera configure again from scratch.
+	const char* method = "port/disable";
+	std::string path;
+	std::string off = "1";
+	std::string on = "0";
+	char resolved[PATH_MAX];
+	std::string portLink = m_backend.GetSysfsRoot() + "/" + device.deviceName + "/port";
+	if (realpath(portLink.c_str(), resolved) != NULL)
+		path = std::string(resolved) + "/disable";
+	if (path == "" || WriteFile(path, off) == false)
+	{
+		method = "authorized";
+		path = m_backend.GetSysfsRoot() + "/" + device.deviceName + "/authorized";
+		off = "0";
+		on = "1";
+		if (WriteFile(path, off) == false)
+		{
+			result.errorMessage = "Error: PortCycle(): Unable to write port/disable or authorized of " + device.deviceName + ": " + strerror(errno);
+			return false;
+		}
+	}
+	AddDetail(result, "method", method);
+
+	m_clock->SleepMs(m_portOffMs);
+
+	if (WriteFile(path, on) == false)
+	{
+		result.errorMessage = "Error: PortCycle(): Unable to re-enable " + device.deviceName + " through " + path + ": " + strerror(errno);
+		return false;
+	}
+	claim.SetRecovered(true);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::RunWaitReady(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result)
+{
+	uint64_t start = m_clock->NowMs();
+	unsigned int speedMbps = 0;
+	for (;;)
+	{
+		// after a reset the device may still be listed under its old address for a moment, so always look afresh
+		SBatchDevice device;
+		std::string ignored;
+		if (LookupDevice(operation.serialNumber, true, device, ignored))
+		{
+			std::string speed;
+			std::string configuration;
+			if (m_backend.ReadAttribute(device.deviceName, "speed", speed))
+				speedMbps = (unsigned int)strtoul(speed.c_str(), NULL, 10);
+
+			// configured, and at the speed asked for
+			if (m_backend.ReadAttribute(device.deviceName, "bConfigurationValue", configuration) && configuration != ""
+				&& (operation.minimumSpeedMbps == 0 || speedMbps >= operation.minimumSpeedMbps))
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				m_devices[operation.serialNumber] = device;
+				stale = false;
+				AddDetail(result, "port", device.deviceName);
+				AddDetail(result, "speed", std::to_string(speedMbps), false);
+				AddDetail(result, "ready_ms", std::to_string(m_clock->NowMs() - start), false);
+				return true;
+			}
+		}
+
+		if (m_clock->NowMs() - start >= operation.timeoutMs)
+			break;
+		m_clock->SleepMs(m_pollMs);
+	}
+
+	result.errorMessage = "Error: WaitReady(): Camera " + operation.serialNumber + " not ready after " + std::to_string(operation.timeoutMs) + " ms";
+	if (speedMbps > 0)
+		result.errorMessage.append(" (it is there at " + std::to_string(speedMbps) + " Mbps, " + std::to_string(operation.minimumSpeedMbps) + " needed)");
+	result.errorMessage.append(".");
+	return false;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::RunSpeed(const SUsbBatchOperation& operation, bool& stale, SUsbBatchResult& result)
+{
+	SBatchDevice device;
+	if (LookupDevice(operation.serialNumber, stale, device, result.errorMessage) == false)
+		return false;
+
+	std::string speed;
+	if (m_backend.ReadAttribute(device.deviceName, "speed", speed) == false)
+	{
+		result.errorMessage = "Error: Speed(): Unable to read the speed of " + device.deviceName;
+		return false;
+	}
+
+	unsigned int speedMbps = (unsigned int)strtoul(speed.c_str(), NULL, 10);
+	AddDetail(result, "speed", std::to_string(speedMbps), false);
+	AddDetail(result, "min_speed", std::to_string(operation.minimumSpeedMbps), false);
+	if (speedMbps < operation.minimumSpeedMbps)
+	{
+		result.errorMessage = "Error: Speed(): Camera " + operation.serialNumber + " links at " + std::to_string(speedMbps) + " Mbps instead of " + std::to_string(operation.minimumSpeedMbps) + ".";
+		return false;
+	}
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::RunCamera(const std::vector<SUsbBatchOperation>& operations, const std::vector<size_t>& indexes, std::vector<SUsbBatchResult>& results, std::chrono::steady_clock::time_point started)
+{
+	bool stale = false;
+	for (size_t i = 0; i < indexes.size(); i++)
+	{
+		const SUsbBatchOperation& operation = operations[indexes[i]];
+		SUsbBatchResult& result = results[indexes[i]];
+		result.operation = operation;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		switch (operation.type)
+		{
+		case UsbBatch_Audit: result.succeeded = RunAudit(operation, stale, result); break;
+		case UsbBatch_Reset: result.succeeded = RunReset(operation, stale, result); break;
+		case UsbBatch_PortCycle: result.succeeded = RunPortCycle(operation, stale, result); break;
+		case UsbBatch_WaitReady: result.succeeded = RunWaitReady(operation, stale, result); break;
+		case UsbBatch_Speed: result.succeeded = RunSpeed(operation, stale, result); break;
+		default: RunList(result); break;
+		}
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+		result.startMs = std::chrono::duration<double, std::milli>(start - started).count();
+		result.elapsedMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+		if (m_apiCallObserver != NULL && operation.type != UsbBatch_List)
+			m_apiCallObserver->OnApiCall(OperationToString(operation.type), operation.serialNumber, result.succeeded, (unsigned int)result.elapsedMs, result.errorMessage);
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::Run(const std::vector<SUsbBatchOperation>& operations, std::vector<SUsbBatchResult>& results, std::string& errorMessage)
+{
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	results.clear();
+
+	if (Enumerate(errorMessage) == false)
+		return false;
+
+	// "*" becomes one operation per camera, in place
+	std::vector<SUsbBatchOperation> expanded;
+	for (size_t i = 0; i < operations.size(); i++)
+	{
+		if (operations[i].serialNumber != "*")
+		{
+			expanded.push_back(operations[i]);
+			continue;
+		}
+		for (size_t s = 0; s < m_cameraSerialNumbers.size(); s++)
+		{
+			expanded.push_back(operations[i]);
+			expanded.back().serialNumber = m_cameraSerialNumbers[s];
+		}
+	}
+	results.resize(expanded.size());
+
+	// swaps can only be told apart with the whole topology, so placement is checked once for everybody up front
+	m_placementFindings.clear();
+	if (m_placementMap != NULL)
+	{
+		std::vector<UsbCameraDeviceManager::SUsbObservedPlacement> observed;
+		for (size_t s = 0; s < m_cameraSerialNumbers.size(); s++)
+		{
+			const SBatchDevice& device = m_devices[m_cameraSerialNumbers[s]];
+			UsbCameraDeviceManager::SUsbObservedPlacement placement;
+			placement.serialNumber = m_cameraSerialNumbers[s];
+			placement.portPath = device.deviceName;
+			placement.controller = device.controller;
+
+			std::string speed;
+			if (m_backend.ReadAttribute(device.deviceName, "speed", speed))
+				placement.speedMbps = (unsigned int)strtoul(speed.c_str(), NULL, 10);
+			observed.push_back(placement);
+		}
+
+		std::vector<UsbCameraDeviceManager::SUsbPlacementFinding> findings;
+		m_placementMap->CheckAll(observed, findings);
+		for (size_t i = 0; i < findings.size(); i++)
+			m_placementFindings[findings[i].serialNumber].push_back(findings[i]);
+	}
+
+	// the operations of each camera, in batch order. list only reads the shared enumeration, so it runs on its own.
+	std::vector<std::string> order;
+	std::map<std::string, std::vector<size_t> > byCamera;
+	for (size_t i = 0; i < expanded.size(); i++)
+	{
+		std::string key = (expanded[i].type == UsbBatch_List) ? "" : expanded[i].serialNumber;
+		if (byCamera.count(key) == 0)
+			order.push_back(key);
+		byCamera[key].push_back(i);
+	}
+
+	// a fixed number of workers take the next camera until there are none left
+	std::mutex queueLock;
+	size_t next = 0;
+	std::vector<std::thread> workers;
+	for (unsigned int w = 0; w < m_maxParallel && w < order.size(); w++)
+	{
+		workers.push_back(std::thread([&]()
+		{
+			for (;;)
+			{
+				size_t camera;
+				{
+					std::lock_guard<std::mutex> lock(queueLock);
+					if (next >= order.size())
+						return;
+					camera = next++;
+				}
+				RunCamera(expanded, byCamera[order[camera]], results, started);
+			}
+		}));
+	}
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w].join();
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		if (results[i].succeeded == false)
+		{
+			errorMessage = "Error: Run(): " + std::to_string(i + 1) + ". operation (" + OperationToString(results[i].operation.type) + " "
+				+ results[i].operation.serialNumber + ") failed: " + results[i].errorMessage;
+			return false;
+		}
+	}
+	return true;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::EscapeJson(const std::string& text)
+{
+	std::string escaped;
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		unsigned char c = (unsigned char)text[i];
+		if (c == '"' || c == '\\')
+		{
+			escaped.push_back('\\');
+			escaped.push_back((char)c);
+		}
+		else if (c == '\n')
+			escaped.append("\\n");
+		else if (c < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped.append(code);
+		}
+		else
+			escaped.push_back((char)c);
+	}
+	return escaped;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbCameraBatchRunner::FormatJson(const std::vector<SUsbBatchResult>& results, double totalMs)
+{
+	bool succeeded = true;
+	for (size_t i = 0; i < results.size(); i++)
+		succeeded = succeeded && results[i].succeeded;
+
+	char number[32];
+	std::string json = "{\"succeeded\":";
+	json.append(succeeded ? "true" : "false");
+	snprintf(number, sizeof(number), "%.3f", totalMs);
+	json.append(",\"elapsed_ms\":");
+	json.append(number);
+	json.append(",\"operations\":[");
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const SUsbBatchResult& result = results[i];
+		json.append((i > 0) ? ",\n" : "\n");
+		json.append("{\"op\":\"");
+		json.append(OperationToString(result.operation.type));
+		json.append("\"");
+		if (result.operation.serialNumber != "")
+			json.append(",\"serial\":\"" + EscapeJson(result.operation.serialNumber) + "\"");
+		json.append(",\"ok\":");
+		json.append(result.succeeded ? "true" : "false");
+		if (result.errorMessage != "")
+			json.append(",\"error\":\"" + EscapeJson(result.errorMessage) + "\"");
+		snprintf(number, sizeof(number), "%.3f", result.startMs);
+		json.append(",\"start_ms\":");
+		json.append(number);
+		snprintf(number, sizeof(number), "%.3f", result.elapsedMs);
+		json.append(",\"elapsed_ms\":");
+		json.append(number);
+
+		// a name that comes up more than once (eg: several placement problems) becomes an array
+		std::set<std::string> written;
+		for (size_t d = 0; d < result.details.size(); d++)
+		{
+			const SUsbBatchDetail& detail = result.details[d];
+			if (written.insert(detail.name).second == false)
+				continue;
+
+			std::vector<std::string> values;
+			for (size_t o = d; o < result.details.size(); o++)
+			{
+				if (result.details[o].name == detail.name)
+					values.push_back(detail.quoted ? "\"" + EscapeJson(result.details[o].value) + "\"" : result.details[o].value);
+			}
+
+			json.append(",\"" + EscapeJson(detail.name) + "\":");
+			if (values.size() == 1)
+				json.append(values[0]);
+			else
+			{
+				json.append("[");
+				for (size_t v = 0; v < values.size(); v++)
+					json.append(((v > 0) ? "," : "") + values[v]);
+				json.append("]");
+			}
+		}
+
+		if (result.operation.type == UsbBatch_List)
+		{
+			json.append(",\"cameras\":[");
+			for (size_t c = 0; c < result.cameras.size(); c++)
+			{
+				json.append((c > 0) ? ",{" : "{");
+				std::map<std::string, std::string>::const_iterator it = result.cameras[c].begin();
+				for (bool first = true; it != result.cameras[c].end(); ++it, first = false)
+					json.append(std::string(first ? "" : ",") + "\"" + EscapeJson(it->first) + "\":\"" + EscapeJson(it->second) + "\"");
+				json.append("}");
+			}
+			json.append("]");
+		}
+		json.append("}");
+	}
+	json.append("\n]}\n");
+	return json;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
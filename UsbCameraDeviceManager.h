@@ -25,6 +25,8 @@
 #ifdef WIN_BUILD
 #include <pylon\PylonIncludes.h>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <windows.h>
 #include <powersetting.h>
 #include <powrprof.h>
@@ -33,6 +35,14 @@
 #include <initguid.h>
 #include <devguid.h>
 #include <cfgmgr32.h>
+#include "UsbCameraAcceptanceTest.h"
+#include "UsbCameraIdentityDatabase.h"
+#include "UsbCameraPlacementMap.h"
+#include "UsbCameraRemovalRecovery.h"
+#include "UsbCameraResult.h"
+#include "UsbCameraStatusBoard.h"
+#include "UsbClock.h"
+#include "UsbSnapshotPublisher.h"
 #pragma comment(lib,"ws2_32.lib")   
 #pragma comment(lib,"setupapi.lib")   
 #pragma comment(lib, "IPHLPAPI.lib")
@@ -63,14 +73,90 @@ DEFINE_DEVPROPKEY(DEVPKEY_Device_SecuritySDS, 0xa45c254e, 0xdf1c, 0x4efd, 0x80,
 
 namespace UsbCameraDeviceManager
 {
+	// The operations that keep their own last result
+	enum EUsbCameraOperation
+	{
+		UsbOperation_Initialize = 0,            // InitializeFromCamera(), InitializeFromCache()
+		UsbOperation_EnableCamera,
+		UsbOperation_DisableCamera,
+		UsbOperation_EnableCompositeDevice,
+		UsbOperation_DisableCompositeDevice,
+		UsbOperation_WaitForCameraReady,
+		UsbOperation_WaitForCameraGone,
+		UsbOperation_ReattachCamera,
+		UsbOperation_ReadPowerSchemeSettings,
+		UsbOperation_ReadDeviceTreePowerStates,
+		UsbOperation_GetUsbConnectionType,
+		UsbOperation_ValidatePlacement,
+		UsbOperation_Count
+	};
+
+	// How hard the camera was last recovered. An acceptance test that fails moves on to the next tier.
+	enum EUsbRecoveryTier
+	{
+		UsbRecoveryTier_None = 0,               // it came back by itself, eg: replugged
+		UsbRecoveryTier_CameraDevice,           // DisableCamera(), EnableCamera()
+		UsbRecoveryTier_CompositeDevice         // DisableCameraCompositeDevice(), EnableCameraCompositeDevice()
+	};
+
+	// What the manager knows, as of the end of its last operation. Readers get a consistent copy of all of it.
+	struct SUsbCameraManagerState
+	{
+		std::string serialNumber;
+		std::string productID;
+		std::string modelName;
+		std::string deviceInstance;
+		std::string compositeDeviceInstance;
+		std::string activePowerSchemeName;
+		int hiberBootEnabled;
+		int UsbSelectiveSuspendIsEnabledAC;
+		int Usb3LinkPowerManagmentIsEnabledAC;
+		int UsbSelectiveSuspendIsEnabledDC;
+		int Usb3LinkPowerManagmentIsEnabledDC;
+		std::vector<std::string> deviceNames;
+		std::vector<std::string> devicePowerStates;
+		std::vector<SUsbPlacementFinding> placementFindings;   // from the last placement check, empty if the camera is where it belongs
+		SUsbAcceptanceResult acceptance;                   // from the last acceptance test, see SetAcceptanceTest()
+		SUsbResult operationResults[UsbOperation_Count];   // how each operation's last run ended
+		SUsbResult lastFailure;                            // the most recent failure of any operation
+		unsigned int generation;                           // counts published states
+
+		SUsbCameraManagerState() : hiberBootEnabled(-1), UsbSelectiveSuspendIsEnabledAC(-1), Usb3LinkPowerManagmentIsEnabledAC(-1),
+			UsbSelectiveSuspendIsEnabledDC(-1), Usb3LinkPowerManagmentIsEnabledDC(-1), generation(0) {}
+	};
+
+	// Operations (initialize, enable, disable, wait, read settings) are meant for one thread at a time, eg: a recovery
+	// thread. The getters read a published snapshot without locking and can be called from any thread at any rate.
 	class CUsbCameraDeviceManager
 	{
 	private:
+		// Clears the result when an operation starts, and times it and publishes the manager's state when it ends. An
+		// operation that ends with a result other than UsbResult_Ok failed. Operations called by another one (eg: the
+		// disable and enable of an escalation inside WaitForCameraReady()) are published and reported with the outermost.
+		class COperationScope
+		{
+		private:
+			CUsbCameraDeviceManager& m_manager;
+			EUsbCameraOperation m_operation;
+			uint64_t m_startMs;
+
+			COperationScope(const COperationScope&);
+			COperationScope& operator=(const COperationScope&);
+
+		public:
+			COperationScope(CUsbCameraDeviceManager& manager, EUsbCameraOperation operation);
+
+			~COperationScope();
+		};
+
+		typedef CUsbSnapshotPublisher<SUsbCameraManagerState> CStatePublisher;
+
 		std::string m_serialNumber;
 		std::string m_productID;
+		std::string m_modelName;
 		std::string m_deviceInstance;
 		std::string m_compositeDeviceInstance;
-		std::string m_errorMessage;
+		SUsbResult m_result;
 		std::string m_activePowerSchemeName;
 		std::string m_unknownDeviceInstance;
 		std::string m_unknownDeviceDescription;
@@ -83,6 +169,94 @@ namespace UsbCameraDeviceManager
 		int m_Usb3LinkPowerManagmentIsEnabledDC;
 		std::vector<std::string> m_deviceNames;
 		std::vector<std::string> m_devicePowerStates;
+		std::vector<SUsbPlacementFinding> m_placementFindings;
+		std::string m_downgradedSerialNumber;   // the camera whose last placement check found it downgraded, empty if none
+		SUsbAcceptanceResult m_acceptance;
+		CUsbCameraIdentityDatabase* m_identityDatabase;
+		CUsbCameraPlacementMap* m_placementMap;
+		bool m_identityValidated;
+		CUsbCameraStatusBoard* m_statusBoard;
+		uint32_t m_recoveryOwner;               // this manager's owner token on the status board
+		IUsbApiCallObserver* m_apiCallObserver;
+		CUsbCameraStateCache* m_stateCache;
+		Pylon::CInstantCamera* m_camera;
+		CUsbCameraAcceptanceTest* m_acceptanceTest;
+		EUsbRecoveryTier m_recoveryTier;
+		uint64_t m_enabledMs;                   // when the camera (or its composite device) was last enabled, 0 once a wait has timed from it
+		IUsbClock* m_clock;
+		unsigned int m_operationDepth;          // operations under way, more than one if they are nested
+		std::vector<std::pair<EUsbCameraOperation, SUsbResult> > m_nestedResults;   // how the nested ones ended, for the outermost to publish
+		bool m_checksChanged;                   // placement findings or acceptance result not published yet
+		CStatePublisher m_state;
+
+		// Observed re-enumeration times (ms) per camera model, shared by all instances (and their threads), under ReEnumerationLock()
+		static std::map<std::string, unsigned int>& ReEnumerationTimes();
+		static std::mutex& ReEnumerationLock();
+
+		// The time a model is known to take, false if there is none yet
+		static bool GetReEnumerationTime(const std::string &modelName, unsigned int &timeMs);
+
+		// Folds an observed time into the model's moving average. seed only sets it if the model has none yet.
+		static void UpdateReEnumerationTime(const std::string &modelName, unsigned int timeMs, bool seed);
+
+		// How long to sleep before the next readiness poll, given how long this model usually takes
+		static unsigned int NextPollIntervalMs(unsigned int elapsedMs, unsigned int expectedMs, unsigned int previousIntervalMs);
+
+		// True if the camera is enumerated and can be opened (and closed again) through pylon
+		static bool IsCameraOpenable(const std::string &serialNumber, std::string &modelName);
+
+		// Checks an identity taken from the database against the system the first time it's used, and falls back to InitializeFromCamera() if it's stale
+		bool ValidateIdentity();
+
+		// Claims the camera on the status board before touching it, so another process (or manager) can't be recovering it at the same time.
+		// A disable keeps the claim, the enable that follows (or any failure on the way) hands it back.
+		bool ClaimRecovery();
+
+		// Hands the camera back on the status board if this manager was recovering it
+		void ReleaseRecovery(const std::string &serialNumber, bool recovered);
+
+		// Snapshots the registered camera's features before a planned disable
+		void SnapshotCameraState();
+
+		// Where the camera is plugged in: its composite device's location path, the controller part of it and the link speed
+		bool ReadCameraPlacement(SUsbObservedPlacement &observed);
+
+		// The location path of a composite device and the controller part of it, the speed is left as it is
+		static bool ReadDevicePlacement(const std::string &compositeDeviceInstance, SUsbObservedPlacement &observed);
+
+		// The device instance ID of a camera's usb composite device (eg: USB\VID_2676&PID_BA02\22663088), from pylon's "0x2676" style IDs
+		static std::string MakeCompositeDeviceInstanceID(const std::string &vendorID, const std::string &productID, const std::string &serialNumber);
+
+		// Checks the camera against the placement map, if there is one, into m_placementFindings. Doesn't touch m_result,
+		// a misplaced camera doesn't fail the operation that found it. With an identity database it also remembers the
+		// camera's port there and records a downgrade if it links slower than its expected speed.
+		void CheckPlacement();
+
+		// Streams the camera through the acceptance test into m_acceptance. Sets m_result if it fails.
+		bool RunAcceptanceTest();
+
+		// Recovers the camera one tier harder than last time, up to the point it is enumerated again. False if there is no
+		// tier left (m_result is left as it is then) or the tier failed.
+		bool EscalateRecovery();
+
+		// Publishes the members for readers, with the operation's outcome (m_result) and those of the operations nested in it.
+		// UsbOperation_Count publishes the members only. Nothing is published if readers already have all of it.
+		void PublishState(EUsbCameraOperation operation);
+
+		// True if the published state has the members and the operation's outcome (see PublishState())
+		bool IsStatePublished(EUsbCameraOperation operation);
+
+		// Publishes only an operation's outcome, for the ones readers may call from any thread
+		void PublishResult(EUsbCameraOperation operation, const SUsbResult &result);
+
+		// Enables or disables a device (DICS_ENABLE, DICS_DISABLE) like in Windows Device Manager. function names the operation in the result.
+		static SUsbResult ChangeDeviceState(const std::string &deviceInstanceID, DWORD stateChange, DWORD flags, const char* function);
+
+		// What a Windows error from a SetupAPI call means for the camera
+		static EUsbResultCode ClassifyWindowsError(DWORD error);
+
+		// The result for the exception being handled. Call it from a catch block only.
+		static SUsbResult CurrentExceptionResult(const char* function);
 
 	public:
 		CUsbCameraDeviceManager();
@@ -101,13 +275,30 @@ namespace UsbCameraDeviceManager
 		// Enables the camera device like in Windows Device Manager
 		static bool EnableDevice(std::string deviceInstanceID, std::string &errorMessage);
 
+		static SUsbResult EnableDevice(const std::string &deviceInstanceID);
+
 		// Disables the camera device like in Windows Device Manager
 		static bool DisableDevice(std::string deviceInstanceID, std::string &errorMessage);
 
+		static SUsbResult DisableDevice(const std::string &deviceInstanceID);
+
+		// Enables the camera and returns, it doesn't wait for it to come back. The recovery claim is held until
+		// WaitForCameraReady() sees it, which times the re-enumeration from the enable.
 		bool EnableCamera();
 
 		bool DisableCamera();
 
+		// Waits until the camera is enumerated and can be opened through pylon, polling faster around the
+		// time this camera model usually needs to come back. elapsedMs reports how long the wait took.
+		bool WaitForCameraReady(std::string serialNumber, unsigned int timeoutMs, unsigned int &elapsedMs);
+
+		// Waits until the camera has dropped out of the enumeration. elapsedMs reports how long the wait took.
+		bool WaitForCameraGone(std::string serialNumber, unsigned int timeoutMs, unsigned int &elapsedMs);
+
+		// WaitForCameraReady() for a CUsbCameraRemovalRecovery. It runs on a recovery thread, so leave the manager to it once
+		// registered (or give it a manager of its own), one manager per camera to recover cameras in parallel.
+		CUsbCameraRemovalRecovery::ReadyWaiter GetReadyWaiter();
+
 		// Collect the power settings of the host controller
 		bool ReadPowerSchemeSettings();
 
@@ -127,6 +318,58 @@ namespace UsbCameraDeviceManager
 
 		// Reads the camera's Full Name and constructs the needed ID tags for finding it in the system.
 		bool InitializeFromCamera(std::string serialNumber);
+
+		// Remembers camera identities and recovery times across runs. The database must outlive this object. NULL to stop using it.
+		void SetIdentityDatabase(CUsbCameraIdentityDatabase* identityDatabase);
+
+		// Takes the camera's ID tags from the identity database without touching pylon, and only checks them the first time they are used.
+		// Falls back to InitializeFromCamera() if the camera isn't in the database.
+		bool InitializeFromCache(std::string serialNumber);
+
+		// Coordinates recoveries with other processes, and other managers of this one, through a shared status board. The board must outlive
+		// this object. NULL to stop using it. Disabling or enabling a camera another one is recovering then fails, and WaitForCameraReady()
+		// ends this manager's recovery.
+		void SetStatusBoard(CUsbCameraStatusBoard* statusBoard);
+
+		// Told about every operation once it's done, named by OperationToString(), eg: to record incidents. The observer must
+		// outlive this object. NULL to stop.
+		void SetApiCallObserver(IUsbApiCallObserver* apiCallObserver);
+
+		// Registers the application's camera for state restore: its features are snapshotted into the cache before a planned
+		// disable, and ReattachCamera() brings it back with them. Both must outlive this object. NULLs to stop.
+		void SetStateCache(CUsbCameraStateCache* stateCache, Pylon::CInstantCamera* camera);
+
+		// Checks the camera's port, controller and link speed against a placement map at the end of InitializeFromCamera() and
+		// after every successful WaitForCameraReady(), see GetPlacementFindings(). Downgrades are also recorded as health events
+		// in the identity database. The map must outlive this object. NULL to stop.
+		void SetPlacementMap(CUsbCameraPlacementMap* placementMap);
+
+		// Checks the placement now (eg: at startup after InitializeFromCache(), which doesn't). Fails if anything is wrong.
+		bool ValidatePlacement();
+
+		// Checks every connected usb camera against the map at once (eg: at startup, before the managers are set up), so cameras
+		// in the map that aren't connected are found as missing and connected ones that aren't in the map as unmapped.
+		// UsbResult_Misplaced if anything is wrong, findings has all of it.
+		static SUsbResult CheckAllPlacements(CUsbCameraPlacementMap &placementMap, std::vector<SUsbPlacementFinding> &findings);
+
+		// Streams the camera through an acceptance test before every successful WaitForCameraReady(). If it fails, the next
+		// recovery tier runs (a replugged camera gets disabled and enabled, a camera that was, its composite device) and the
+		// wait starts over, until it passes or there is no tier left. The test must outlive this object. NULL to stop.
+		void SetAcceptanceTest(CUsbCameraAcceptanceTest* acceptanceTest);
+
+		// How the last acceptance test went
+		SUsbAcceptanceResult GetLastAcceptanceResult();
+
+		// What the last placement check found, with the corrective action for each
+		std::vector<SUsbPlacementFinding> GetPlacementFindings();
+
+		// The time base of every wait and timeout, eg: a CVirtualUsbClock to run recovery timing in virtual time.
+		// The clock must outlive this object. NULL for the steady clock (default).
+		void SetClock(IUsbClock* clock);
+
+		// After WaitForCameraReady(): attaches the registered camera to the device that came back, restores its last snapshot
+		// in one pass, and if firstFrameTimeoutMs isn't 0 times the first frame. timing reports each step.
+		bool ReattachCamera(unsigned int firstFrameTimeoutMs, SUsbCameraRestoreTiming &timing);
 		
 		// Enables the camera device's parent USB Composite Device like in Windows Device Manager
 		bool EnableCameraCompositeDevice();
@@ -146,6 +389,9 @@ namespace UsbCameraDeviceManager
 		// For reference, the user can see if the camera is currently connected as USB2 or USB3.
 		std::string GetUsbConnectionType();
 
+		// The same without sentinel strings: portVersionBcd is eg: "0x0300", and only set on success
+		SUsbResult GetUsbConnectionType(std::string &portVersionBcd);
+
 		// For reference, the user can see the camera device instance string
 		std::string GetDeviceInstanceID();
 
@@ -157,6 +403,22 @@ namespace UsbCameraDeviceManager
 
 		// For reference, the user can see the last error message.
 		std::string GetLastErrorMessage();
+
+		// The last error of one operation, empty if its last run succeeded
+		std::string GetLastErrorMessage(EUsbCameraOperation operation);
+
+		// How one operation's last run ended, to branch on the cause (eg: UsbResult_AccessDenied) without matching messages.
+		// Reading a success doesn't allocate, so watchdogs can poll this at any rate.
+		SUsbResult GetLastResult(EUsbCameraOperation operation);
+
+		// The most recent failure of any operation, UsbResult_Ok if there was none yet
+		SUsbResult GetLastFailure();
+
+		// Everything above at once, consistent with each other
+		SUsbCameraManagerState GetState();
+
+		// The public function behind an operation, eg: "DisableCamera". "Initialize" for both initializations.
+		static const char* OperationToString(EUsbCameraOperation operation);
 	};
 }
 
@@ -168,9 +430,9 @@ inline UsbCameraDeviceManager::CUsbCameraDeviceManager::CUsbCameraDeviceManager(
 {
 	m_serialNumber = "";
 	m_productID = "";
+	m_modelName = "";
 	m_deviceInstance = "";
 	m_compositeDeviceInstance = "";
-	m_errorMessage = "";
 	m_activePowerSchemeName = "UNKNOWN";
 	m_hiberBootEnabled = -1;
 	m_UsbSelectiveSuspendIsEnabledAC = -1;
@@ -181,6 +443,21 @@ inline UsbCameraDeviceManager::CUsbCameraDeviceManager::CUsbCameraDeviceManager(
 	m_unknownDeviceInstance = "";
 	m_unknownDeviceParentDescription = "";
 	m_unknownDeviceParentInstance = "";
+	m_identityDatabase = NULL;
+	m_placementMap = NULL;
+	m_identityValidated = true;
+	m_statusBoard = NULL;
+	m_recoveryOwner = CUsbCameraStatusBoard::NewOwnerToken();
+	m_apiCallObserver = NULL;
+	m_stateCache = NULL;
+	m_camera = NULL;
+	m_acceptanceTest = NULL;
+	m_recoveryTier = UsbRecoveryTier_None;
+	m_enabledMs = 0;
+	m_clock = &CSystemUsbClock::Instance();
+	m_operationDepth = 0;
+	m_checksChanged = true;
+	PublishState(UsbOperation_Count);
 }
 
 inline UsbCameraDeviceManager::CUsbCameraDeviceManager::~CUsbCameraDeviceManager()
@@ -188,6 +465,168 @@ inline UsbCameraDeviceManager::CUsbCameraDeviceManager::~CUsbCameraDeviceManager
 	// nothing
 }
 
+inline UsbCameraDeviceManager::CUsbCameraDeviceManager::COperationScope::COperationScope(CUsbCameraDeviceManager& manager, EUsbCameraOperation operation)
+	: m_manager(manager), m_operation(operation)
+{
+	m_startMs = m_manager.m_clock->NowMs();
+	m_manager.m_result = SUsbResult();
+	m_manager.m_operationDepth++;
+}
+
+inline UsbCameraDeviceManager::CUsbCameraDeviceManager::COperationScope::~COperationScope()
+{
+	m_manager.m_result.elapsedMs = (unsigned int)(m_manager.m_clock->NowMs() - m_startMs);
+	m_manager.m_operationDepth--;
+	if (m_manager.m_operationDepth > 0)
+	{
+		m_manager.m_nestedResults.push_back(std::make_pair(m_operation, m_manager.m_result));
+		return;
+	}
+
+	m_manager.PublishState(m_operation);
+
+	if (m_manager.m_apiCallObserver != NULL)
+	{
+		bool succeeded = m_manager.m_result.Succeeded();
+		m_manager.m_apiCallObserver->OnApiCall(OperationToString(m_operation), m_manager.m_serialNumber, succeeded,
+			m_manager.m_result.elapsedMs, succeeded ? std::string() : m_manager.m_result.FormatErrorMessage());
+	}
+}
+
+// Publishes the members for readers
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::PublishState(EUsbCameraOperation operation)
+{
+	// most operations (a wait that finds the camera ready, reading settings that haven't changed) change nothing
+	if (IsStatePublished(operation))
+	{
+		m_nestedResults.clear();
+		return;
+	}
+
+	m_state.Update([&](SUsbCameraManagerState& state)
+	{
+		state.serialNumber = m_serialNumber;
+		state.productID = m_productID;
+		state.modelName = m_modelName;
+		state.deviceInstance = m_deviceInstance;
+		state.compositeDeviceInstance = m_compositeDeviceInstance;
+		state.activePowerSchemeName = m_activePowerSchemeName;
+		state.hiberBootEnabled = m_hiberBootEnabled;
+		state.UsbSelectiveSuspendIsEnabledAC = m_UsbSelectiveSuspendIsEnabledAC;
+		state.Usb3LinkPowerManagmentIsEnabledAC = m_Usb3LinkPowerManagmentIsEnabledAC;
+		state.UsbSelectiveSuspendIsEnabledDC = m_UsbSelectiveSuspendIsEnabledDC;
+		state.Usb3LinkPowerManagmentIsEnabledDC = m_Usb3LinkPowerManagmentIsEnabledDC;
+		state.deviceNames = m_deviceNames;
+		state.devicePowerStates = m_devicePowerStates;
+		state.placementFindings = m_placementFindings;
+		state.acceptance = m_acceptance;
+		for (size_t i = 0; i < m_nestedResults.size(); i++)
+		{
+			state.operationResults[m_nestedResults[i].first] = m_nestedResults[i].second;
+			if (m_nestedResults[i].second.Succeeded() == false)
+				state.lastFailure = m_nestedResults[i].second;
+		}
+		if (operation != UsbOperation_Count)
+		{
+			state.operationResults[operation] = m_result;
+			if (m_result.Succeeded() == false)
+				state.lastFailure = m_result;
+		}
+		state.generation++;
+	});
+	m_nestedResults.clear();
+	m_checksChanged = false;
+}
+
+// Whether readers already have everything PublishState() would publish
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::IsStatePublished(EUsbCameraOperation operation)
+{
+	if (m_checksChanged)
+		return false;
+
+	CStatePublisher::CReader state(m_state);
+	if (state->serialNumber != m_serialNumber || state->productID != m_productID || state->modelName != m_modelName
+		|| state->deviceInstance != m_deviceInstance || state->compositeDeviceInstance != m_compositeDeviceInstance
+		|| state->activePowerSchemeName != m_activePowerSchemeName || state->hiberBootEnabled != m_hiberBootEnabled
+		|| state->UsbSelectiveSuspendIsEnabledAC != m_UsbSelectiveSuspendIsEnabledAC
+		|| state->Usb3LinkPowerManagmentIsEnabledAC != m_Usb3LinkPowerManagmentIsEnabledAC
+		|| state->UsbSelectiveSuspendIsEnabledDC != m_UsbSelectiveSuspendIsEnabledDC
+		|| state->Usb3LinkPowerManagmentIsEnabledDC != m_Usb3LinkPowerManagmentIsEnabledDC
+		|| state->deviceNames != m_deviceNames || state->devicePowerStates != m_devicePowerStates)
+		return false;
+
+	// a failure also has to be the last one
+	for (size_t i = 0; i < m_nestedResults.size(); i++)
+	{
+		const SUsbResult& result = m_nestedResults[i].second;
+		if (state->operationResults[m_nestedResults[i].first] != result || (result.Succeeded() == false && state->lastFailure != result))
+			return false;
+	}
+	if (operation != UsbOperation_Count
+		&& (state->operationResults[operation] != m_result || (m_result.Succeeded() == false && state->lastFailure != m_result)))
+		return false;
+	return true;
+}
+
+// Publishes only an operation's outcome
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::PublishResult(EUsbCameraOperation operation, const SUsbResult &result)
+{
+	{
+		// succeeding again is the common case, and changes nothing (the time it took isn't worth a new snapshot)
+		CStatePublisher::CReader state(m_state);
+		if (state->operationResults[operation] == result)
+			return;
+	}
+
+	m_state.Update([&](SUsbCameraManagerState& state)
+	{
+		state.operationResults[operation] = result;
+		if (result.Succeeded() == false)
+			state.lastFailure = result;
+		state.generation++;
+	});
+}
+
+// What a Windows error from a SetupAPI call means for the camera
+inline UsbCameraDeviceManager::EUsbResultCode UsbCameraDeviceManager::CUsbCameraDeviceManager::ClassifyWindowsError(DWORD error)
+{
+	switch (error)
+	{
+	case ERROR_ACCESS_DENIED:
+		return UsbResult_AccessDenied;
+	case ERROR_NO_MORE_ITEMS:         // SetupDiEnumDeviceInfo() on an empty set: the device isn't there (any more)
+	case ERROR_NO_SUCH_DEVINST:
+		return UsbResult_DeviceRemoved;
+	default:
+		return UsbResult_OsError;
+	}
+}
+
+// The result for the exception being handled
+inline UsbCameraDeviceManager::SUsbResult UsbCameraDeviceManager::CUsbCameraDeviceManager::CurrentExceptionResult(const char* function)
+{
+	try
+	{
+		throw;
+	}
+	catch (const GenICam::GenericException &e)
+	{
+		SUsbResult result(UsbResult_PylonException, function);
+		result.detail = e.GetDescription();
+		return result;
+	}
+	catch (std::exception &e)
+	{
+		SUsbResult result(UsbResult_StdException, function);
+		result.detail = e.what();
+		return result;
+	}
+	catch (...)
+	{
+		return SUsbResult(UsbResult_UnknownException, function);
+	}
+}
+
 // List all USB devices on system
 inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ListAllUsbDevices(std::vector<std::string> &deviceInstanceIDs, std::vector<std::string> &deviceDescriptions)
 {
@@ -324,11 +763,13 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::GetParentDeviceInst
 // Reads the camera's Full Name and constructs the needed ID tags for finding it in the system.
 inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::InitializeFromCamera(std::string serialNumber)
 {
+	COperationScope operation(*this, UsbOperation_Initialize);
 	try
 	{
 		if (serialNumber == "")
 		{
-			m_errorMessage = "Serial Number Required for Initialization";
+			m_result = SUsbResult(UsbResult_InvalidArgument, "Initialize");
+			m_result.detail = "Serial Number Required for Initialization.";
 			return false;
 		}
 
@@ -353,7 +794,7 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::InitializeFromCamer
 		if (devices.size() == 0)
 		{
 			//std::cerr << "No matching camera devices found." << std::endl;
-			m_errorMessage = "Error: Initialize(): No matching camera devices found.";
+			m_result = SUsbResult(UsbResult_DeviceNotFound, "Initialize", "EnumerateDevices");
 			return false;
 		}
 
@@ -374,6 +815,7 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::InitializeFromCamer
 		}
 
 		m_productID = productID;
+		m_modelName = devices[0].GetModelName();
 
 		// create the device instance Id from the camera full name
 		std::size_t loc1 = fullName.find("usb");
@@ -389,437 +831,882 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::InitializeFromCamer
 		m_deviceInstance = deviceID;
 
 		// create the device instance Id for the parent usb composite device.
-		std::string compositeDeviceID = "USB\\VID_";
-		std::string vendorIDsub = vendorID.substr(2, 4);
-		std::string productIDsub = productID.substr(2, 4);
-		compositeDeviceID.append(vendorIDsub);
-		compositeDeviceID.append("&");
-		compositeDeviceID.append("PID_");
-		compositeDeviceID.append(productIDsub);
-		compositeDeviceID.append("\\");
-		compositeDeviceID.append(m_serialNumber);
-
-		m_compositeDeviceInstance = compositeDeviceID;
+		m_compositeDeviceInstance = MakeCompositeDeviceInstanceID(vendorID, productID, m_serialNumber);
+		m_identityValidated = true;
+
+		if (m_identityDatabase != NULL)
+		{
+			SUsbCameraIdentity identity;
+			m_identityDatabase->Lookup(m_serialNumber, identity);
+			identity.serialNumber = m_serialNumber;
+			identity.modelName = m_modelName;
+			identity.productID = m_productID;
+			identity.deviceInstance = m_deviceInstance;
+			identity.compositeDeviceInstance = m_compositeDeviceInstance;
+			identity.lastSeenTime = 0;
+			// the fastest port it has been on is what it should get, CheckPlacement() compares against it
+			Pylon::String_t portVersion;
+			if (devices[0].GetPropertyValue("UsbPortVersionBcd", portVersion)
+				&& CUsbCameraPlacementMap::SpeedFromPortVersion(portVersion.c_str()) >= CUsbCameraPlacementMap::SpeedFromPortVersion(identity.expectedSpeed))
+				identity.expectedSpeed = portVersion.c_str();
+			m_identityDatabase->Store(identity);
+		}
 
+		CheckPlacement();
 		return true;
 	}
-	catch (const GenICam::GenericException &e)
+	catch (...)
 	{
 		// Error handling.
-		m_errorMessage = "Error: Initialize(): GenICam exception occurred. ";
-		m_errorMessage.append(e.GetDescription());
+		m_result = CurrentExceptionResult("Initialize");
 		return false;
 	}
-	catch (std::exception &e)
+}
+
+// Remembers camera identities and recovery times across runs
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::SetIdentityDatabase(CUsbCameraIdentityDatabase* identityDatabase)
+{
+	m_identityDatabase = identityDatabase;
+}
+
+// Takes the camera's ID tags from the identity database, validation is deferred to first use
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::InitializeFromCache(std::string serialNumber)
+{
+	COperationScope operation(*this, UsbOperation_Initialize);
+	if (serialNumber == "")
 	{
-		// Error handling.
-		m_errorMessage = "Error: Initialize(): std exception occurred. ";
-		m_errorMessage.append(e.what());
+		m_result = SUsbResult(UsbResult_InvalidArgument, "Initialize");
+		m_result.detail = "Serial Number Required for Initialization.";
 		return false;
 	}
-	catch (...)
+
+	SUsbCameraIdentity identity;
+	if (m_identityDatabase == NULL || m_identityDatabase->Lookup(serialNumber, identity) == false || identity.deviceInstance == "")
+		return InitializeFromCamera(serialNumber);
+
+	m_serialNumber = identity.serialNumber;
+	m_productID = identity.productID;
+	m_modelName = identity.modelName;
+	m_deviceInstance = identity.deviceInstance;
+	m_compositeDeviceInstance = identity.compositeDeviceInstance;
+	m_identityValidated = false;
+
+	return true;
+}
+
+// Coordinates recoveries with other processes
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::SetStatusBoard(CUsbCameraStatusBoard* statusBoard)
+{
+	m_statusBoard = statusBoard;
+}
+
+// Reports every operation to an observer
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::SetApiCallObserver(IUsbApiCallObserver* apiCallObserver)
+{
+	m_apiCallObserver = apiCallObserver;
+}
+
+// Registers the application's camera for state restore
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::SetStateCache(CUsbCameraStateCache* stateCache, Pylon::CInstantCamera* camera)
+{
+	m_stateCache = stateCache;
+	m_camera = camera;
+}
+
+// Checks the camera against a placement map after initializing and after every recovery
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::SetPlacementMap(CUsbCameraPlacementMap* placementMap)
+{
+	m_placementMap = placementMap;
+}
+
+// Streams the camera through an acceptance test after every recovery
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::SetAcceptanceTest(CUsbCameraAcceptanceTest* acceptanceTest)
+{
+	m_acceptanceTest = acceptanceTest;
+}
+
+// Streams the camera through the acceptance test
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::RunAcceptanceTest()
+{
+	std::string errorMessage;
+	m_checksChanged = true;
+	if (m_acceptanceTest->Run(m_serialNumber, m_acceptance, errorMessage))
+		return true;
+
+	m_result = SUsbResult(UsbResult_AcceptanceFailed, "WaitForCameraReady", "AcceptanceTest");
+	m_result.detail = m_acceptance.reason;
+	return false;
+}
+
+// Recovers the camera one tier harder than last time
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::EscalateRecovery()
+{
+	// each step is an operation of its own, with its own result
+	unsigned int goneMs = 0;
+	switch (m_recoveryTier)
 	{
-		// Error handling.
-		m_errorMessage = "Error: Initialize(): unknown exception occured.";
+	case UsbRecoveryTier_None:
+		return DisableCamera() && WaitForCameraGone(m_serialNumber, 10000, goneMs) && EnableCamera();
+	case UsbRecoveryTier_CameraDevice:
+		return DisableCameraCompositeDevice() && WaitForCameraGone(m_serialNumber, 10000, goneMs) && EnableCameraCompositeDevice();
+	default:
 		return false;
 	}
 }
 
-// Enables the device like in Windows Device Manager
-inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::EnableDevice(std::string deviceInstanceID, std::string &errorMessage)
+// Reads where the camera is plugged in
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadCameraPlacement(SUsbObservedPlacement &observed)
+{
+	observed = SUsbObservedPlacement();
+	observed.serialNumber = m_serialNumber;
+	if (ReadDevicePlacement(m_compositeDeviceInstance, observed) == false)
+		return false;
+
+	Pylon::CDeviceInfo filter;
+	filter.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
+	filter.SetSerialNumber(m_serialNumber.c_str());
+	Pylon::DeviceInfoList_t devices;
+	Pylon::DeviceInfoList_t filters;
+	filters.push_back(filter);
+	Pylon::CTlFactory::GetInstance().EnumerateDevices(devices, filters);
+
+	Pylon::String_t portVersion;
+	if (devices.size() > 0 && devices[0].GetPropertyValue("UsbPortVersionBcd", portVersion))
+		observed.speedMbps = CUsbCameraPlacementMap::SpeedFromPortVersion(portVersion.c_str());
+	return true;
+}
+
+// Reads where a composite device is plugged in
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadDevicePlacement(const std::string &compositeDeviceInstance, SUsbObservedPlacement &observed)
+{
+	// the composite device is the usb device itself, its location path names the controller and every port down to it
+	HDEVINFO hDevInfo = SetupDiGetClassDevsA(NULL, compositeDeviceInstance.c_str(), NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT | DIGCF_ALLCLASSES);
+	if (hDevInfo == INVALID_HANDLE_VALUE)
+		return false;
+
+	SP_DEVINFO_DATA spDevInfoData;
+	spDevInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
+	char locationPaths[1024] = { 0 };
+	bool found = SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData) != FALSE &&
+		SetupDiGetDeviceRegistryPropertyA(hDevInfo, &spDevInfoData, SPDRP_LOCATION_PATHS, NULL, (PBYTE)locationPaths, sizeof(locationPaths) - 2, NULL) != FALSE;
+	SetupDiDestroyDeviceInfoList(hDevInfo);
+	if (found == false)
+		return false;
+
+	// a multi-string, the first entry is the PCIROOT one (eg: PCIROOT(0)#PCI(1400)#USBROOT(0)#USB(3)#USB(2))
+	observed.portPath = locationPaths;
+	std::size_t root = observed.portPath.find("#USBROOT(");
+	observed.controller = observed.portPath.substr(0, root);
+	return true;
+}
+
+// Makes the device instance ID of a camera's composite device
+inline std::string UsbCameraDeviceManager::CUsbCameraDeviceManager::MakeCompositeDeviceInstanceID(const std::string &vendorID, const std::string &productID, const std::string &serialNumber)
 {
+	std::string compositeDeviceID = "USB\\VID_";
+	std::string vendorIDsub = vendorID.substr(2, 4);
+	std::string productIDsub = productID.substr(2, 4);
+	compositeDeviceID.append(vendorIDsub);
+	compositeDeviceID.append("&");
+	compositeDeviceID.append("PID_");
+	compositeDeviceID.append(productIDsub);
+	compositeDeviceID.append("\\");
+	compositeDeviceID.append(serialNumber);
+	return compositeDeviceID;
+}
 
+// Checks the camera against the placement map
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::CheckPlacement()
+{
+	m_placementFindings.clear();
+	m_checksChanged = true;
+	if ((m_placementMap == NULL && m_identityDatabase == NULL) || m_serialNumber == "")
+		return;
+
+	SUsbObservedPlacement observed;
 	try
 	{
-		//std::cout << "Enabling USB Camera Device..." << std::endl;
+		if (ReadCameraPlacement(observed) == false)
+			observed.portPath = "";
+	}
+	catch (const GenICam::GenericException &)
+	{
+		// the location path is what matters, the speed stays unknown
+	}
 
-		if (deviceInstanceID == "")
-			return false;
+	if (m_placementMap != NULL)
+		m_placementMap->Check(observed, m_placementFindings);
 
-		HDEVINFO hDevInfo;
-		SP_DEVINFO_DATA spDevInfoData;
-		spDevInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
-		SP_PROPCHANGE_PARAMS spPropChangeParams;
+	bool downgraded = false;
+	for (size_t i = 0; i < m_placementFindings.size() && downgraded == false; i++)
+		downgraded = (m_placementFindings[i].problem == UsbPlacement_Downgraded);
 
-		// create an HDEVINFO for the specific device
-		hDevInfo = SetupDiGetClassDevsA(NULL, deviceInstanceID.c_str(), NULL, DIGCF_DEVICEINTERFACE | DIGCF_ALLCLASSES);
+	SUsbCameraIdentity identity;
+	if (m_identityDatabase != NULL && m_identityDatabase->Lookup(m_serialNumber, identity))
+	{
+		// without a map entry for the port, the speed it has had before is the expectation
+		if (observed.speedMbps > 0 && observed.speedMbps < CUsbCameraPlacementMap::SpeedFromPortVersion(identity.expectedSpeed))
+			downgraded = true;
 
-		if (!SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData))
+		if (observed.portPath != "" && observed.portPath != identity.portPath)
 		{
-			//std::cerr << "Error in SetupDiEnumDeviceInfo: " << GetLastError() << std::endl;
-			errorMessage = "Error: EnableDevice(): SetupDiEnumDeviceInfo(): ";
-			errorMessage.append(std::to_string(GetLastError()));
-			return false;
+			identity.portPath = observed.portPath;
+			m_identityDatabase->Store(identity);
 		}
+	}
 
-		// set the disable flag and disable the device
-		spPropChangeParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
-		spPropChangeParams.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
-		spPropChangeParams.Scope = DICS_FLAG_GLOBAL;
+	// a downgrade is an early sign of a failing cable or port, see CUsbCameraHealthModel. It's recorded once when the
+	// camera drops to the lower speed, not on every check it stays there.
+	if (downgraded && m_identityDatabase != NULL && m_downgradedSerialNumber != m_serialNumber)
+		m_identityDatabase->RecordHealthEvent(m_serialNumber, UsbHealthEvent_SpeedDowngrade, observed.speedMbps);
+	m_downgradedSerialNumber = downgraded ? m_serialNumber : "";
+}
 
-		// reset the flag to enable and repeat.
-		spPropChangeParams.StateChange = DICS_ENABLE;
+// Checks the placement now
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ValidatePlacement()
+{
+	COperationScope operation(*this, UsbOperation_ValidatePlacement);
+	if (m_placementMap == NULL)
+	{
+		m_result = SUsbResult(UsbResult_NotConfigured, "ValidatePlacement");
+		m_result.detail = "No placement map, see SetPlacementMap().";
+		return false;
+	}
+	if (m_serialNumber == "")
+	{
+		m_result = SUsbResult(UsbResult_InvalidArgument, "ValidatePlacement");
+		m_result.detail = "Serial Number Invalid.";
+		return false;
+	}
 
-		if (!SetupDiSetClassInstallParams(hDevInfo, &spDevInfoData, (SP_CLASSINSTALL_HEADER*)&spPropChangeParams, sizeof(spPropChangeParams)))
-		{
-			errorMessage = "Error: EnableDevice(): SetupDiSetClassInstallParams(): ";
-			errorMessage.append(std::to_string(GetLastError()));
-			return false;
-		}
+	CheckPlacement();
+	if (m_placementFindings.empty() == false)
+	{
+		m_result = SUsbResult(UsbResult_Misplaced, "ValidatePlacement");
+		m_result.detail = m_placementFindings[0].action;
+		if (m_placementFindings.size() > 1)
+			m_result.detail.append(" (" + std::to_string(m_placementFindings.size()) + " problems, see GetPlacementFindings())");
+		return false;
+	}
+	return true;
+}
 
-		if (!SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, hDevInfo, &spDevInfoData))
+// Checks every connected usb camera against the map
+inline UsbCameraDeviceManager::SUsbResult UsbCameraDeviceManager::CUsbCameraDeviceManager::CheckAllPlacements(CUsbCameraPlacementMap &placementMap, std::vector<SUsbPlacementFinding> &findings)
+{
+	try
+	{
+		Pylon::CDeviceInfo filter;
+		filter.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
+		Pylon::DeviceInfoList_t devices;
+		Pylon::DeviceInfoList_t filters;
+		filters.push_back(filter);
+		Pylon::CTlFactory::GetInstance().EnumerateDevices(devices, filters);
+
+		std::vector<SUsbObservedPlacement> observed;
+		for (size_t i = 0; i < devices.size(); i++)
 		{
-			errorMessage = "Error: EnableDevice(): SetupDiCallClassInstaller(): ";
-			errorMessage.append(std::to_string(GetLastError()));
-			return false;
+			SUsbObservedPlacement placement;
+			placement.serialNumber = devices[i].GetSerialNumber().c_str();
+
+			Pylon::String_t vendorID;
+			Pylon::String_t productID;
+			Pylon::String_t portVersion;
+			if (devices[i].GetPropertyValue("VendorId", vendorID) == false || devices[i].GetPropertyValue("ProductId", productID) == false
+				|| ReadDevicePlacement(MakeCompositeDeviceInstanceID(vendorID.c_str(), productID.c_str(), placement.serialNumber), placement) == false)
+				continue;
+			if (devices[i].GetPropertyValue("UsbPortVersionBcd", portVersion))
+				placement.speedMbps = CUsbCameraPlacementMap::SpeedFromPortVersion(portVersion.c_str());
+			observed.push_back(placement);
 		}
 
-		return true;
+		size_t before = findings.size();
+		if (placementMap.CheckAll(observed, findings))
+			return SUsbResult();
 
+		SUsbResult result(UsbResult_Misplaced, "CheckAllPlacements");
+		result.detail = findings[before].action;
+		if (findings.size() - before > 1)
+			result.detail.append(" (" + std::to_string(findings.size() - before) + " problems)");
+		return result;
 	}
-	catch (const GenICam::GenericException &e)
+	catch (...)
 	{
-		// Error handling.
-		errorMessage = "Error: EnableDevice(): GenICam exception occurred: ";
-		errorMessage.append(e.GetDescription());
-		return false;
+		return CurrentExceptionResult("CheckAllPlacements");
 	}
-	catch (std::exception &e)
+}
+
+// What the last placement check found
+inline std::vector<UsbCameraDeviceManager::SUsbPlacementFinding> UsbCameraDeviceManager::CUsbCameraDeviceManager::GetPlacementFindings()
+{
+	CStatePublisher::CReader state(m_state);
+	return state->placementFindings;
+}
+
+// The time base of every wait and timeout
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::SetClock(IUsbClock* clock)
+{
+	m_clock = (clock != NULL) ? clock : &CSystemUsbClock::Instance();
+}
+
+// Snapshots the registered camera's features before a planned disable
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::SnapshotCameraState()
+{
+	if (m_stateCache == NULL || m_camera == NULL || m_camera->IsOpen() == false)
+		return;
+
+	// if it fails the last snapshot is still there
+	std::string errorMessage;
+	m_stateCache->TakeSnapshot(*m_camera, true, errorMessage);
+}
+
+// Reattaches the registered camera and restores its state
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReattachCamera(unsigned int firstFrameTimeoutMs, SUsbCameraRestoreTiming &timing)
+{
+	COperationScope operation(*this, UsbOperation_ReattachCamera);
+	timing = SUsbCameraRestoreTiming();
+	if (m_stateCache == NULL || m_camera == NULL)
 	{
-		// Error handling.
-		errorMessage = "Error: EnableDevice(): std exception occurred:";
-		errorMessage.append(e.what());
+		m_result = SUsbResult(UsbResult_NotConfigured, "ReattachCamera");
+		m_result.detail = "No camera registered with SetStateCache().";
 		return false;
 	}
-	catch (...)
+
+	CPylonCameraConnection connection(*m_camera);
+	connection.SetStateCache(m_stateCache, firstFrameTimeoutMs);
+	std::string errorMessage;
+	bool reattached = connection.Reattach(errorMessage);
+	connection.GetRestoreTiming(timing);
+	if (reattached == false)
 	{
-		// Error handling.
-		errorMessage = "Error: EnableDevice(): unknown exception occured.";
-		return false;
+		m_result = SUsbResult(UsbResult_Failed, "");
+		m_result.detail = errorMessage;
 	}
+	return reattached;
 }
 
-// Enables the camera like in Windows Device Manager
-inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::EnableCamera()
+// Checks a cached identity against the system on first use
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ValidateIdentity()
+{
+	if (m_identityValidated)
+		return true;
+
+	// the instance IDs are built from vendor, product and serial, so if both devices are attached they are the right ones.
+	// Windows remembers devices that were unplugged long ago, only present ones count. A disabled device is still present,
+	// but has no enabled interface, so this asks for the device itself rather than its interfaces.
+	// This is one SetupAPI lookup each, no pylon enumeration.
+	bool known = true;
+	std::string instances[2] = { m_deviceInstance, m_compositeDeviceInstance };
+	for (int i = 0; i < 2 && known; i++)
+	{
+		HDEVINFO hDevInfo = SetupDiGetClassDevsA(NULL, instances[i].c_str(), NULL, DIGCF_PRESENT | DIGCF_ALLCLASSES);
+		if (hDevInfo == INVALID_HANDLE_VALUE)
+		{
+			known = false;
+			break;
+		}
+
+		SP_DEVINFO_DATA spDevInfoData;
+		spDevInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
+		known = (SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData) != FALSE);
+		SetupDiDestroyDeviceInfoList(hDevInfo);
+	}
+
+	if (known)
+	{
+		m_identityValidated = true;
+		return true;
+	}
+
+	// stale (eg: new firmware changed the product ID). Do it the slow way, which also refreshes the database.
+	return InitializeFromCamera(m_serialNumber);
+}
+
+// Claims the camera on the status board before touching it
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ClaimRecovery()
+{
+	if (m_statusBoard == NULL)
+		return true;
+
+	// succeeds again for the enable after our own disable
+	SUsbCameraStatus current;
+	std::string errorMessage;
+	if (m_statusBoard->TryBeginRecovery(m_serialNumber, current, errorMessage, m_recoveryOwner))
+		return true;
+
+	// another process (or manager) is recovering it or just did, unless the board had no slot for it (current is left empty then)
+	m_result = SUsbResult((current.serialNumber != "") ? UsbResult_Busy : UsbResult_NotAvailable, "");
+	m_result.detail = errorMessage;
+	return false;
+}
+
+// Hands the camera back on the status board
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::ReleaseRecovery(const std::string &serialNumber, bool recovered)
+{
+	if (m_statusBoard == NULL || m_statusBoard->IsRecoveryOwner(serialNumber, m_recoveryOwner) == false)
+		return;
+
+	std::string errorMessage;
+	m_statusBoard->EndRecovery(serialNumber, recovered, errorMessage, m_recoveryOwner);
+}
+
+// Enables or disables a device like in Windows Device Manager
+inline UsbCameraDeviceManager::SUsbResult UsbCameraDeviceManager::CUsbCameraDeviceManager::ChangeDeviceState(const std::string &deviceInstanceID, DWORD stateChange, DWORD flags, const char* function)
 {
 	try
 	{
-		std::string deviceInstanceID = m_deviceInstance;
-	
-		HDEVINFO hDevInfo;
+		if (deviceInstanceID == "")
+		{
+			SUsbResult result(UsbResult_InvalidArgument, function);
+			result.detail = "Device Instance Invalid.";
+			return result;
+		}
+
 		SP_DEVINFO_DATA spDevInfoData;
 		spDevInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
 		SP_PROPCHANGE_PARAMS spPropChangeParams;
 
 		// create an HDEVINFO for the specific device
-		hDevInfo = SetupDiGetClassDevsA(NULL, deviceInstanceID.c_str(), NULL, DIGCF_DEVICEINTERFACE | DIGCF_ALLCLASSES);
+		HDEVINFO hDevInfo = SetupDiGetClassDevsA(NULL, deviceInstanceID.c_str(), NULL, flags);
+		if (hDevInfo == INVALID_HANDLE_VALUE)
+		{
+			DWORD lastError = GetLastError();
+			return SUsbResult(ClassifyWindowsError(lastError), function, "SetupDiGetClassDevs", lastError);
+		}
 
 		if (!SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData))
 		{
-			//std::cerr << "Error in SetupDiEnumDeviceInfo: " << GetLastError() << std::endl;
-			m_errorMessage = "Error: EnableDevice(): SetupDiEnumDeviceInfo(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
-			return false;
+			DWORD lastError = GetLastError();
+			SetupDiDestroyDeviceInfoList(hDevInfo);
+			return SUsbResult(ClassifyWindowsError(lastError), function, "SetupDiEnumDeviceInfo", lastError);
 		}
 
-		// set the disable flag and disable the device
+		// set the enable or disable flag and change the device's state
 		spPropChangeParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
 		spPropChangeParams.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
 		spPropChangeParams.Scope = DICS_FLAG_GLOBAL;
-
-		// reset the flag to enable and repeat.
-		spPropChangeParams.StateChange = DICS_ENABLE;
+		spPropChangeParams.StateChange = stateChange;
 
 		if (!SetupDiSetClassInstallParams(hDevInfo, &spDevInfoData, (SP_CLASSINSTALL_HEADER*)&spPropChangeParams, sizeof(spPropChangeParams)))
 		{
-			m_errorMessage = "Error: EnableDevice(): SetupDiSetClassInstallParams(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
-			return false;
+			DWORD lastError = GetLastError();
+			SetupDiDestroyDeviceInfoList(hDevInfo);
+			return SUsbResult(ClassifyWindowsError(lastError), function, "SetupDiSetClassInstallParams", lastError);
 		}
 
 		if (!SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, hDevInfo, &spDevInfoData))
 		{
-			m_errorMessage = "Error: EnableDevice(): SetupDiCallClassInstaller(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
-			return false;
+			DWORD lastError = GetLastError();
+			SetupDiDestroyDeviceInfoList(hDevInfo);
+			return SUsbResult(ClassifyWindowsError(lastError), function, "SetupDiCallClassInstaller", lastError);
 		}
 
-		if (deviceInstanceID == m_deviceInstance)
+		SetupDiDestroyDeviceInfoList(hDevInfo);
+		return SUsbResult();
+	}
+	catch (...)
+	{
+		// Error handling.
+		return CurrentExceptionResult(function);
+	}
+}
+
+// Enables the device like in Windows Device Manager
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::EnableDevice(std::string deviceInstanceID, std::string &errorMessage)
+{
+	SUsbResult result = EnableDevice(deviceInstanceID);
+	if (result.Succeeded() == false)
+		errorMessage = result.FormatErrorMessage();
+	return result.Succeeded();
+}
+
+inline UsbCameraDeviceManager::SUsbResult UsbCameraDeviceManager::CUsbCameraDeviceManager::EnableDevice(const std::string &deviceInstanceID)
+{
+	return ChangeDeviceState(deviceInstanceID, DICS_ENABLE, DIGCF_DEVICEINTERFACE | DIGCF_ALLCLASSES, "EnableDevice");
+}
+
+// Enables the camera like in Windows Device Manager
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::EnableCamera()
+{
+	COperationScope operation(*this, UsbOperation_EnableCamera);
+	try
+	{
+		if (ValidateIdentity() == false)
+			return false;
+
+		if (ClaimRecovery() == false)
+			return false;
+
+		m_result = EnableDevice(m_deviceInstance);
+		if (m_result.Succeeded() == false)
 		{
-			// check that the camera is really enabled
-			Pylon::CDeviceInfo filter;
-			filter.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
-			filter.SetSerialNumber(m_serialNumber.c_str());
+			ReleaseRecovery(m_serialNumber, false);
+			return false;
+		}
 
-			// create a pylon device from the given serial number.
-			Pylon::DeviceInfoList_t devices;
-			Pylon::DeviceInfoList_t filters;
-			filters.push_back(filter);
+		// the camera takes a while to come back. WaitForCameraReady() waits for it (and learns how long it took),
+		// the claim is held until then.
+		//std::cout << "USB Camera Device Enabled." << std::endl;
+		m_enabledMs = m_clock->NowMs();
+		return true;
+	}
+	catch (...)
+	{
+		// Error handling.
+		m_result = CurrentExceptionResult("EnableDevice");
+		ReleaseRecovery(m_serialNumber, false);
+		return false;
+	}
+}
 
-			Pylon::CTlFactory::GetInstance().EnumerateDevices(devices, filters);
-			if (devices.size() > 0)
-			{
-				//std::cout << "USB Camera Device Enabled." << std::endl;
-				return true;
-			}
-			else
-			{
-				int attempts = 0;
-				while (attempts < 10)
-				{
-					Pylon::CTlFactory::GetInstance().EnumerateDevices(devices, filters);
-					if (devices.size() > 0)
-					{
-						//std::cout << "USB Camera Device Enabled." << std::endl;
-						return true;
-					}
+// Disables the device like in Windows Device Manager
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::DisableDevice(std::string deviceInstanceID, std::string &errorMessage)
+{
+	SUsbResult result = DisableDevice(deviceInstanceID);
+	if (result.Succeeded() == false)
+		errorMessage = result.FormatErrorMessage();
+	return result.Succeeded();
+}
 
-					attempts++;
-					Sleep(1000);
-				}
+inline UsbCameraDeviceManager::SUsbResult UsbCameraDeviceManager::CUsbCameraDeviceManager::DisableDevice(const std::string &deviceInstanceID)
+{
+	return ChangeDeviceState(deviceInstanceID, DICS_DISABLE, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT | DIGCF_ALLCLASSES, "DisableDevice");
+}
 
-				m_errorMessage = "Error: EnableDevice(): No matching camera devices found.";
-				return false;
-			}
+// Disables the camera like in Windows Device Manager
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::DisableCamera()
+{
+	COperationScope operation(*this, UsbOperation_DisableCamera);
+	try
+	{
+		if (ValidateIdentity() == false)
+			return false;
+
+		if (ClaimRecovery() == false)
+			return false;
+
+		SnapshotCameraState();
+
+		//std::cout << "USB Camera Device Disabled." << std::endl;
+		m_result = DisableDevice(m_deviceInstance);
+		if (m_result.Succeeded() == false)
+		{
+			ReleaseRecovery(m_serialNumber, false);
+			return false;
 		}
-		else
-			return true;
+
+		// the claim is held until the camera is enabled again
+		m_recoveryTier = UsbRecoveryTier_CameraDevice;
+		return true;
 	}
-	catch (const GenICam::GenericException &e)
+	catch (...)
 	{
 		// Error handling.
-		m_errorMessage = "Error: EnableDevice(): GenICam exception occurred: ";
-		m_errorMessage.append(e.GetDescription());
+		m_result = CurrentExceptionResult("DisableDevice");
+		ReleaseRecovery(m_serialNumber, false);
+		return false;
+	}
+}
+
+// Observed re-enumeration times (ms) per camera model. Seeded with a conservative guess for unknown models.
+inline std::map<std::string, unsigned int>& UsbCameraDeviceManager::CUsbCameraDeviceManager::ReEnumerationTimes()
+{
+	static std::map<std::string, unsigned int> times;
+	return times;
+}
+
+inline std::mutex& UsbCameraDeviceManager::CUsbCameraDeviceManager::ReEnumerationLock()
+{
+	static std::mutex lock;
+	return lock;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::GetReEnumerationTime(const std::string &modelName, unsigned int &timeMs)
+{
+	std::lock_guard<std::mutex> lock(ReEnumerationLock());
+	std::map<std::string, unsigned int>::iterator known = ReEnumerationTimes().find(modelName);
+	if (known == ReEnumerationTimes().end())
+		return false;
+	timeMs = known->second;
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraDeviceManager::UpdateReEnumerationTime(const std::string &modelName, unsigned int timeMs, bool seed)
+{
+	std::lock_guard<std::mutex> lock(ReEnumerationLock());
+	std::map<std::string, unsigned int>& times = ReEnumerationTimes();
+	std::map<std::string, unsigned int>::iterator known = times.find(modelName);
+	if (known == times.end())
+		times[modelName] = timeMs;
+	else if (seed == false)
+		known->second = (known->second * 3 + timeMs) / 4;
+}
+
+// Poll sparsely while the camera can't be back yet, densely around the expected time, and back off once it is overdue.
+inline unsigned int UsbCameraDeviceManager::CUsbCameraDeviceManager::NextPollIntervalMs(unsigned int elapsedMs, unsigned int expectedMs, unsigned int previousIntervalMs)
+{
+	const unsigned int minimumMs = 25;
+	const unsigned int maximumMs = 1000;
+
+	unsigned int interval;
+	if (elapsedMs < (expectedMs * 3) / 4)
+		interval = ((expectedMs * 3) / 4 - elapsedMs) / 2;
+	else if (elapsedMs < (expectedMs * 5) / 4)
+		interval = minimumMs;
+	else
+		interval = (previousIntervalMs * 3) / 2;
+
+	if (interval < minimumMs)
+		interval = minimumMs;
+	if (interval > maximumMs)
+		interval = maximumMs;
+	return interval;
+}
+
+// True if the camera is enumerated and can be opened through pylon
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::IsCameraOpenable(const std::string &serialNumber, std::string &modelName)
+{
+	Pylon::CDeviceInfo filter;
+	filter.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
+	filter.SetSerialNumber(serialNumber.c_str());
+
+	Pylon::DeviceInfoList_t devices;
+	Pylon::DeviceInfoList_t filters;
+	filters.push_back(filter);
+	Pylon::CTlFactory::GetInstance().EnumerateDevices(devices, filters);
+
+	if (devices.size() == 0)
 		return false;
-	}
-	catch (std::exception &e)
+
+	modelName = devices[0].GetModelName();
+
+	// enumerated isn't enough, the driver may still be binding. Only an open proves it's usable.
+	Pylon::IPylonDevice* device = NULL;
+	try
 	{
-		// Error handling.
-		m_errorMessage = "Error: EnableDevice(): std exception occurred:";
-		m_errorMessage.append(e.what());
-		return false;
+		device = Pylon::CTlFactory::GetInstance().CreateDevice(devices[0]);
+		device->Open();
+		device->Close();
+		Pylon::CTlFactory::GetInstance().DestroyDevice(device);
+		return true;
 	}
-	catch (...)
+	catch (const GenICam::GenericException &)
 	{
-		// Error handling.
-		m_errorMessage = "Error: EnableDevice(): unknown exception occured.";
+		if (device != NULL)
+			Pylon::CTlFactory::GetInstance().DestroyDevice(device);
 		return false;
 	}
 }
 
-// Disables the device like in Windows Device Manager
-inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::DisableDevice(std::string deviceInstanceID, std::string &errorMessage)
+// Waits until the camera is enumerated and can be opened through pylon
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::WaitForCameraReady(std::string serialNumber, unsigned int timeoutMs, unsigned int &elapsedMs)
 {
+	COperationScope operation(*this, UsbOperation_WaitForCameraReady);
+	uint64_t start = m_clock->NowMs();
+	elapsedMs = 0;
+
 	try
 	{
-		//std::cout << "Disabling USB Camera Device..." << std::endl;
-		if (deviceInstanceID == "")
+		if (serialNumber == "")
+		{
+			m_result = SUsbResult(UsbResult_InvalidArgument, "WaitForCameraReady");
+			m_result.detail = "Serial Number Invalid.";
 			return false;
+		}
 
-		HDEVINFO hDevInfo;
-		SP_DEVINFO_DATA spDevInfoData;
-		spDevInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
-		SP_PROPCHANGE_PARAMS spPropChangeParams;
-
-		// create an HDEVINFO for the specific device
-		hDevInfo = SetupDiGetClassDevsA(NULL, deviceInstanceID.c_str(), NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT | DIGCF_ALLCLASSES);
-
-		if (!SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData))
+		// the model is only known if this is the camera we were initialized from
+		std::string modelName = (serialNumber == m_serialNumber) ? m_modelName : "";
+		unsigned int expectedMs = 3000;
+		bool known = modelName != "" && GetReEnumerationTime(modelName, expectedMs);
+		if (known == false && modelName != "" && m_identityDatabase != NULL && m_identityDatabase->GetModelRecoveryEstimateMs(modelName, expectedMs))
+			UpdateReEnumerationTime(modelName, expectedMs, true); // history from earlier runs
+
+		// the camera has been on its way back since it was enabled, not just since the wait started. Each recovery tier
+		// the acceptance test escalates to gets the whole timeout again.
+		uint64_t tierStart = start;
+		bool planned = false;
+		if (serialNumber == m_serialNumber && m_enabledMs != 0 && m_enabledMs <= start)
 		{
-			errorMessage = "Error: DisableDevice(): SetupDiEnumDeviceInfo(): ";
-			errorMessage.append(std::to_string(GetLastError()));
-			return false;
+			tierStart = m_enabledMs;
+			planned = true;
 		}
+		m_enabledMs = 0;
+
+		// only a camera that was lost, or that had to be escalated, counts against its health. The application's own
+		// disable/enable is still timed, and a camera that was there all along isn't a recovery at all.
+		bool lost = false;
+		unsigned int waitedMs = 0;
+		unsigned int intervalMs = 0;
+		while (true)
+		{
+			if (IsCameraOpenable(serialNumber, modelName))
+			{
+				elapsedMs = (unsigned int)(m_clock->NowMs() - start);
+				waitedMs = (unsigned int)(m_clock->NowMs() - tierStart);
 
-		// set the disable flag and disable the device
-		spPropChangeParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
-		spPropChangeParams.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
-		spPropChangeParams.Scope = DICS_FLAG_GLOBAL;
+				if (planned || lost)
+				{
+					// remember how long this model took (moving average) to seed the next wait
+					UpdateReEnumerationTime(modelName, waitedMs, false);
+
+					if (m_identityDatabase != NULL)
+						m_identityDatabase->RecordRecovery(serialNumber, waitedMs, lost == false);
+				}
 
-		// reset the flag to enable and repeat.
-		spPropChangeParams.StateChange = DICS_DISABLE;
+				// it may have come back on another port, or slower
+				if (serialNumber == m_serialNumber)
+					CheckPlacement();
 
-		if (!SetupDiSetClassInstallParams(hDevInfo, &spDevInfoData, (SP_CLASSINSTALL_HEADER*)&spPropChangeParams, sizeof(spPropChangeParams)))
-		{
-			errorMessage = "Error: DisableDevice(): SetupDiSetClassInstallParams(): ";
-			errorMessage.append(std::to_string(GetLastError()));
-			return false;
-		}
+				// opening isn't streaming: a camera on a degraded link gets the next tier
+				if (m_acceptanceTest != NULL && serialNumber == m_serialNumber && RunAcceptanceTest() == false)
+				{
+					if (EscalateRecovery() == false)
+					{
+						elapsedMs = (unsigned int)(m_clock->NowMs() - start);
+						m_recoveryTier = UsbRecoveryTier_None;
+						ReleaseRecovery(serialNumber, false);
+						return false;
+					}
+					tierStart = (m_enabledMs != 0) ? m_enabledMs : m_clock->NowMs();
+					m_enabledMs = 0;
+					planned = false;
+					lost = true;
+					intervalMs = 0;
+					continue;
+				}
 
-		if (!SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, hDevInfo, &spDevInfoData))
-		{
-			errorMessage = "Error: DisableDevice(): SetupDiCallClassInstaller(): ";
-			errorMessage.append(std::to_string(GetLastError()));
-			return false;
-		}
+				m_recoveryTier = UsbRecoveryTier_None;
+				ReleaseRecovery(serialNumber, true);
+				return true;
+			}
 
-		//std::cout << "USB Camera Device Disabled." << std::endl;
+			if (planned == false)
+				lost = true;
 
-		return true;
-	}
-	catch (const GenICam::GenericException &e)
-	{
-		// Error handling.
-		errorMessage = "Error: DisableDevice(): GenICam exception occurred. ";
-		errorMessage.append(e.GetDescription());
-		return false;
-	}
-	catch (std::exception &e)
-	{
-		// Error handling.
-		errorMessage = "Error: DisableDevice(): std exception occurred. ";
-		errorMessage.append(e.what());
-		return false;
+			elapsedMs = (unsigned int)(m_clock->NowMs() - start);
+			waitedMs = (unsigned int)(m_clock->NowMs() - tierStart);
+			if (waitedMs >= timeoutMs)
+			{
+				m_result = SUsbResult(UsbResult_Timeout, "WaitForCameraReady");
+				m_result.detail = "Camera not ready after " + std::to_string(waitedMs) + " ms.";
+				m_recoveryTier = UsbRecoveryTier_None;
+				ReleaseRecovery(serialNumber, false);
+				return false;
+			}
+
+			intervalMs = NextPollIntervalMs(waitedMs, expectedMs, intervalMs);
+			if (intervalMs > timeoutMs - waitedMs)
+				intervalMs = timeoutMs - waitedMs;
+			m_clock->SleepMs(intervalMs);
+		}
 	}
 	catch (...)
 	{
 		// Error handling.
-		errorMessage = "Error: DisableDevice(): unknown exception occured.";
+		m_result = CurrentExceptionResult("WaitForCameraReady");
+		m_recoveryTier = UsbRecoveryTier_None;
+		ReleaseRecovery(serialNumber, false);
 		return false;
 	}
 }
 
-// Disables the camera like in Windows Device Manager
-inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::DisableCamera()
+// Waits until the camera has dropped out of the enumeration
+inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::WaitForCameraGone(std::string serialNumber, unsigned int timeoutMs, unsigned int &elapsedMs)
 {
+	COperationScope operation(*this, UsbOperation_WaitForCameraGone);
+	uint64_t start = m_clock->NowMs();
+	elapsedMs = 0;
+
 	try
 	{
-		std::string deviceInstanceID = m_deviceInstance;
-
-		HDEVINFO hDevInfo;
-		SP_DEVINFO_DATA spDevInfoData;
-		spDevInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
-		SP_PROPCHANGE_PARAMS spPropChangeParams;
-
-		// create an HDEVINFO for the specific device
-		hDevInfo = SetupDiGetClassDevsA(NULL, deviceInstanceID.c_str(), NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT | DIGCF_ALLCLASSES);
-
-		if (!SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData))
+		if (serialNumber == "")
 		{
-			m_errorMessage = "Error: DisableDevice(): SetupDiEnumDeviceInfo(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
+			m_result = SUsbResult(UsbResult_InvalidArgument, "WaitForCameraGone");
+			m_result.detail = "Serial Number Invalid.";
 			return false;
 		}
 
-		// set the disable flag and disable the device
-		spPropChangeParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
-		spPropChangeParams.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
-		spPropChangeParams.Scope = DICS_FLAG_GLOBAL;
-
-		// reset the flag to enable and repeat.
-		spPropChangeParams.StateChange = DICS_DISABLE;
+		Pylon::CDeviceInfo filter;
+		filter.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
+		filter.SetSerialNumber(serialNumber.c_str());
+		Pylon::DeviceInfoList_t filters;
+		filters.push_back(filter);
 
-		if (!SetupDiSetClassInstallParams(hDevInfo, &spDevInfoData, (SP_CLASSINSTALL_HEADER*)&spPropChangeParams, sizeof(spPropChangeParams)))
+		// removal is usually quick, so start tight and back off
+		unsigned int intervalMs = 25;
+		while (true)
 		{
-			m_errorMessage = "Error: DisableDevice(): SetupDiSetClassInstallParams(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
-			return false;
-		}
+			Pylon::DeviceInfoList_t devices;
+			Pylon::CTlFactory::GetInstance().EnumerateDevices(devices, filters);
 
-		if (!SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, hDevInfo, &spDevInfoData))
-		{
-			m_errorMessage = "Error: DisableDevice(): SetupDiCallClassInstaller(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
-			return false;
-		}
+			elapsedMs = (unsigned int)(m_clock->NowMs() - start);
+			if (devices.size() == 0)
+				return true;
 
-		//std::cout << "USB Camera Device Disabled." << std::endl;
+			if (elapsedMs >= timeoutMs)
+			{
+				m_result = SUsbResult(UsbResult_Timeout, "WaitForCameraGone");
+				m_result.detail = "Camera still present after " + std::to_string(elapsedMs) + " ms.";
+				return false;
+			}
 
-		return true;
-	}
-	catch (const GenICam::GenericException &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: DisableDevice(): GenICam exception occurred. ";
-		m_errorMessage.append(e.GetDescription());
-		return false;
+			m_clock->SleepMs((intervalMs < timeoutMs - elapsedMs) ? intervalMs : timeoutMs - elapsedMs);
+			intervalMs = (intervalMs * 3) / 2;
+			if (intervalMs > 500)
+				intervalMs = 500;
+		}
 	}
-	catch (std::exception &e)
+	catch (...)
 	{
 		// Error handling.
-		m_errorMessage = "Error: DisableDevice(): std exception occurred. ";
-		m_errorMessage.append(e.what());
+		m_result = CurrentExceptionResult("WaitForCameraGone");
 		return false;
 	}
-	catch (...)
+}
+
+// WaitForCameraReady() for a CUsbCameraRemovalRecovery
+inline UsbCameraDeviceManager::CUsbCameraRemovalRecovery::ReadyWaiter UsbCameraDeviceManager::CUsbCameraDeviceManager::GetReadyWaiter()
+{
+	return [this](const std::string& serialNumber, unsigned int timeoutMs, unsigned int& elapsedMs, std::string& errorMessage)
 	{
-		// Error handling.
-		m_errorMessage = "Error: DisableDevice(): unknown exception occured.";
+		if (WaitForCameraReady(serialNumber, timeoutMs, elapsedMs))
+			return true;
+		errorMessage = m_result.FormatErrorMessage();
 		return false;
-	}
+	};
 }
 
 // Enables the camera device's parent USB Composite Device like in Windows Device Manager
 inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::EnableCameraCompositeDevice()
 {
+	COperationScope operation(*this, UsbOperation_EnableCompositeDevice);
 	try
 	{
 		if (m_compositeDeviceInstance == "")
 		{
-			m_errorMessage = "Error: EnableCompositeDevice(): Composite Device Instance Invalid.";
-			return false;
-		}
-
-		HDEVINFO hDevInfo;
-		SP_DEVINFO_DATA spDevInfoData;
-		spDevInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
-		SP_PROPCHANGE_PARAMS spPropChangeParams;
-
-		// create an HDEVINFO for the specific composite device
-		hDevInfo = SetupDiGetClassDevsA(NULL, m_compositeDeviceInstance.c_str(), NULL, DIGCF_DEVICEINTERFACE | DIGCF_ALLCLASSES);
-
-		if (!SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData))
-		{
-			m_errorMessage = "Error: EnableCompositeDevice(): SetupDiEnumDeviceInfo(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
+			m_result = SUsbResult(UsbResult_InvalidArgument, "EnableCompositeDevice");
+			m_result.detail = "Composite Device Instance Invalid.";
 			return false;
 		}
 
-		// set the disable flag and disable the device
-		spPropChangeParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
-		spPropChangeParams.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
-		spPropChangeParams.Scope = DICS_FLAG_GLOBAL;
-		spPropChangeParams.StateChange = DICS_ENABLE;
-
-		if (!SetupDiSetClassInstallParams(hDevInfo, &spDevInfoData, (SP_CLASSINSTALL_HEADER*)&spPropChangeParams, sizeof(spPropChangeParams)))
-		{
-			m_errorMessage = "Error: EnableCompositeDevice(): SetupDiSetClassInstallParams(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
+		if (ValidateIdentity() == false)
 			return false;
-		}
 
-		if (!SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, hDevInfo, &spDevInfoData))
-		{
-			m_errorMessage = "Error: EnableCompositeDevice(): SetupDiCallClassInstaller(): ";
-			DWORD lastError = GetLastError();
-			if (lastError == 3758096907)
-				m_errorMessage.append("Windows Error code 3758096907. Device may have been removed.");
-			else
-				m_errorMessage.append(std::to_string(lastError));
+		if (ClaimRecovery() == false)
 			return false;
-		}
 
 		//std::cout << "USB Composite Device Enabled." << std::endl;
-		return true;
-	}
-	catch (const GenICam::GenericException &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: EnableCompositeDevice(): GenICam exception occurred. ";
-		m_errorMessage.append(e.GetDescription());
-		return false;
-	}
-	catch (std::exception &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: EnableCompositeDevice(): std exception occurred. ";
-		m_errorMessage.append(e.what());
-		return false;
+		m_result = ChangeDeviceState(m_compositeDeviceInstance, DICS_ENABLE, DIGCF_DEVICEINTERFACE | DIGCF_ALLCLASSES, "EnableCompositeDevice");
+		ReleaseRecovery(m_serialNumber, m_result.Succeeded());
+		if (m_result.Succeeded())
+			m_enabledMs = m_clock->NowMs();
+		return m_result.Succeeded();
 	}
 	catch (...)
 	{
 		// Error handling.
-		m_errorMessage = "Error: EnableCompositeDevice(): unknown exception occured.";
+		m_result = CurrentExceptionResult("EnableCompositeDevice");
+		ReleaseRecovery(m_serialNumber, false);
 		return false;
 	}
 }
@@ -827,80 +1714,43 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::EnableCameraComposi
 // Disables the camera device's parent USB Composite Device like in Windows Device Manager
 inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::DisableCameraCompositeDevice()
 {
+	COperationScope operation(*this, UsbOperation_DisableCompositeDevice);
 	try
 	{
 		//std::cout << "Disabling USB Composite Device..." << std::endl;
 
 		if (m_compositeDeviceInstance == "")
 		{
-			m_errorMessage = "Error: DisableCompositeDevice(): Composite Device Instance Invalid.";
+			m_result = SUsbResult(UsbResult_InvalidArgument, "DisableCompositeDevice");
+			m_result.detail = "Composite Device Instance Invalid.";
 			return false;
 		}
 
-		HDEVINFO hDevInfo;
-		SP_DEVINFO_DATA spDevInfoData;
-		spDevInfoData.cbSize = sizeof(SP_DEVINFO_DATA);
-		SP_PROPCHANGE_PARAMS spPropChangeParams;
-
-		// create an HDEVINFO for the specific composite device
-		hDevInfo = SetupDiGetClassDevsA(NULL, m_compositeDeviceInstance.c_str(), NULL, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT | DIGCF_ALLCLASSES);
-
-		if (!SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData))
-		{
-			m_errorMessage = "Error: DisableCompositeDevice(): SetupDiEnumDeviceInfo(): ";
-			DWORD lastError = GetLastError();
-			if (lastError == 259)
-				m_errorMessage.append("Windows Error code 259. Device may have been removed.");
-			else
-				m_errorMessage.append(std::to_string(lastError));
+		if (ValidateIdentity() == false)
 			return false;
-		}
-
-		// set the disable flag and disable the device
-		spPropChangeParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
-		spPropChangeParams.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
-		spPropChangeParams.Scope = DICS_FLAG_GLOBAL;
-		spPropChangeParams.StateChange = DICS_DISABLE;
 
-		if (!SetupDiSetClassInstallParams(hDevInfo, &spDevInfoData, (SP_CLASSINSTALL_HEADER*)&spPropChangeParams, sizeof(spPropChangeParams)))
-		{
-			m_errorMessage = "Error: DisableCompositeDevice(): SetupDiSetClassInstallParams(): ";
-			m_errorMessage.append(std::to_string(GetLastError()));
+		if (ClaimRecovery() == false)
 			return false;
-		}
 
-		if (!SetupDiCallClassInstaller(DIF_PROPERTYCHANGE, hDevInfo, &spDevInfoData))
+		SnapshotCameraState();
+
+		//std::cout << "USB Composite Device Disabled." << std::endl;
+		m_result = ChangeDeviceState(m_compositeDeviceInstance, DICS_DISABLE, DIGCF_DEVICEINTERFACE | DIGCF_PRESENT | DIGCF_ALLCLASSES, "DisableCompositeDevice");
+		if (m_result.Succeeded() == false)
 		{
-			m_errorMessage = "Error: DisableCompositeDevice(): SetupDiCallClassInstaller(): ";
-			DWORD lastError = GetLastError();
-			if (lastError == 5)
-				m_errorMessage.append("Windows Error code 5. Administrator rights required.");
-			else
-				m_errorMessage.append(std::to_string(lastError));
+			ReleaseRecovery(m_serialNumber, false);
 			return false;
 		}
 
-		//std::cout << "USB Composite Device Disabled." << std::endl;
+		// the claim is held until the composite device is enabled again
+		m_recoveryTier = UsbRecoveryTier_CompositeDevice;
 		return true;
 	}
-	catch (const GenICam::GenericException &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: DisableCompositeDevice(): GenICam exception occurred. ";
-		m_errorMessage.append(e.GetDescription());
-		return false;
-	}
-	catch (std::exception &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: DisableCompositeDevice(): std exception occurred. ";
-		m_errorMessage.append(e.what());
-		return false;
-	}
 	catch (...)
 	{
 		// Error handling.
-		m_errorMessage = "Error: DisableCompositeDevice(): unknown exception occured.";
+		m_result = CurrentExceptionResult("DisableCompositeDevice");
+		ReleaseRecovery(m_serialNumber, false);
 		return false;
 	}
 }
@@ -910,6 +1760,8 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadDeviceTreePower
 {
 #define ARRAY_SIZE(arr)     (sizeof(arr)/sizeof(arr[0]))
 
+	COperationScope operation(*this, UsbOperation_ReadDeviceTreePowerStates);
+
 	DEVINST devInstParent;
 	CONFIGRET status;
 	CHAR szDeviceInstanceID[255];
@@ -923,8 +1775,8 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadDeviceTreePower
 
 	if (!SetupDiEnumDeviceInfo(hDevInfo, 0, &spDevInfoData))
 	{
-		m_errorMessage = "Error: EnableCompositeDevice(): SetupDiEnumDeviceInfo(): ";
-		m_errorMessage.append(std::to_string(GetLastError()));
+		DWORD lastError = GetLastError();
+		m_result = SUsbResult(ClassifyWindowsError(lastError), "ReadDeviceTreePowerStates", "SetupDiEnumDeviceInfo", lastError);
 		return false;
 	}
 	
@@ -1004,6 +1856,7 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadDeviceTreePower
 // split and make static.
 inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadPowerSchemeSettings()
 {
+	COperationScope operation(*this, UsbOperation_ReadPowerSchemeSettings);
 	/*
 	output of c:\powercfg /q
 
@@ -1086,8 +1939,7 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadPowerSchemeSett
 			}
 			else
 			{
-				m_errorMessage.append("PowerReadACValueIndex() error: ");
-				m_errorMessage.append(std::to_string(result));
+				m_result = SUsbResult(UsbResult_OsError, "ReadPowerSchemeSettings", "PowerReadACValueIndex", result);
 				return false;
 			}
 
@@ -1106,8 +1958,7 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadPowerSchemeSett
 			}
 			else
 			{
-				m_errorMessage.append("PowerReadDCValueIndex() error: ");
-				m_errorMessage.append(std::to_string(result));
+				m_result = SUsbResult(UsbResult_OsError, "ReadPowerSchemeSettings", "PowerReadDCValueIndex", result);
 				return false;
 			}
 
@@ -1132,8 +1983,8 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadPowerSchemeSett
 			}
 			else
 			{
-				m_errorMessage.append("Unable to read LPM setting. Probably just not available on this PC. Code: ");
-				m_errorMessage.append(std::to_string(result));
+				m_result = SUsbResult(UsbResult_NotAvailable, "ReadPowerSchemeSettings", "PowerReadACValueIndex", result);
+				m_result.detail = "Unable to read LPM setting. Probably just not available on this PC.";
 				return false;
 			}
 
@@ -1160,8 +2011,8 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadPowerSchemeSett
 			}
 			else
 			{
-				m_errorMessage.append("Unable to read LPM setting. Probably just not available on this PC. Code: ");
-				m_errorMessage.append(std::to_string(result));
+				m_result = SUsbResult(UsbResult_NotAvailable, "ReadPowerSchemeSettings", "PowerReadDCValueIndex", result);
+				m_result.detail = "Unable to read LPM setting. Probably just not available on this PC.";
 				return false;
 			}
 
@@ -1175,29 +2026,14 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadPowerSchemeSett
 		}
 		else
 		{
-			m_errorMessage.append("PowerReadDCValueIndex() error: ");
-			m_errorMessage.append(std::to_string(result));
+			m_result = SUsbResult(UsbResult_OsError, "ReadPowerSchemeSettings", "PowerGetActiveScheme", result);
 			return false;
 		}
 	}
-	catch (const GenICam::GenericException &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: GetUsbPowerSettings(): GenICam exception occurred. ";
-		m_errorMessage.append(e.GetDescription());
-		return false;
-	}
-	catch (std::exception &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: GetUsbPowerSettings(): std exception occurred. ";
-		m_errorMessage.append(e.what());
-		return false;
-	}
 	catch (...)
 	{
 		// Error handling.
-		m_errorMessage = "Error: GetUsbPowerSettings(): unknown exception occured.";
+		m_result = CurrentExceptionResult("ReadPowerSchemeSettings");
 		return false;
 	}
 }
@@ -1206,123 +2042,205 @@ inline bool UsbCameraDeviceManager::CUsbCameraDeviceManager::ReadPowerSchemeSett
 // split and make static
 inline int UsbCameraDeviceManager::CUsbCameraDeviceManager::IsEnabledFastBoot()
 {
-	return m_hiberBootEnabled;
+	CStatePublisher::CReader state(m_state);
+	return state->hiberBootEnabled;
 }
 
 inline int UsbCameraDeviceManager::CUsbCameraDeviceManager::IsSelectiveSuspendEnabledOnBattery()
 {
-	return m_UsbSelectiveSuspendIsEnabledDC;
+	CStatePublisher::CReader state(m_state);
+	return state->UsbSelectiveSuspendIsEnabledDC;
 }
 
 inline int UsbCameraDeviceManager::CUsbCameraDeviceManager::IsSelectiveSuspendEnabledWhenPluggedIn()
 {
-	return m_UsbSelectiveSuspendIsEnabledAC;
+	CStatePublisher::CReader state(m_state);
+	return state->UsbSelectiveSuspendIsEnabledAC;
 }
 
 inline int UsbCameraDeviceManager::CUsbCameraDeviceManager::IsUsb3LinkPowerManagementEnabledOnBattery()
 {
-	return m_Usb3LinkPowerManagmentIsEnabledDC;
+	CStatePublisher::CReader state(m_state);
+	return state->Usb3LinkPowerManagmentIsEnabledDC;
 }
 
 inline int UsbCameraDeviceManager::CUsbCameraDeviceManager::IsUsb3LinkPowerManagementEnabledWhenPluggedIn()
 {
-	return m_Usb3LinkPowerManagmentIsEnabledAC;
+	CStatePublisher::CReader state(m_state);
+	return state->Usb3LinkPowerManagmentIsEnabledAC;
 }
 
 // get the device names in the camera's tree
 inline std::vector<std::string> UsbCameraDeviceManager::CUsbCameraDeviceManager::GetCameraTreeDeviceNames()
 {
-	return m_deviceNames;
+	CStatePublisher::CReader state(m_state);
+	return state->deviceNames;
 }
 
 // get the power states of the device names in the tree
 inline std::vector<std::string> UsbCameraDeviceManager::CUsbCameraDeviceManager::GetCameraTreeDevicePowerStates()
 {
-	return m_devicePowerStates;
+	CStatePublisher::CReader state(m_state);
+	return state->devicePowerStates;
 }
 
 // get the name of the active power scheme
 inline std::string UsbCameraDeviceManager::CUsbCameraDeviceManager::GetActivePowerSchemeName()
 {
-	return m_activePowerSchemeName;
+	CStatePublisher::CReader state(m_state);
+	return state->activePowerSchemeName;
 }
 
 // For reference, the user can see if the camera is currently connected as USB2 or USB3.
 inline std::string UsbCameraDeviceManager::CUsbCameraDeviceManager::GetUsbConnectionType()
 {
-	try
+	std::string portVersionBcd;
+	SUsbResult result = GetUsbConnectionType(portVersionBcd);
+	switch (result.code)
 	{
-		if (m_serialNumber == "")
-		{
-			m_errorMessage = "Error: GetUsbConnectionType(): Serial Number Invalid.";
-			return "InvalidSn";
-		}
-
-		Pylon::CDeviceInfo filter;
-		filter.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
-		filter.SetSerialNumber(m_serialNumber.c_str());
+	case UsbResult_Ok: return portVersionBcd;
+	case UsbResult_InvalidArgument: return "InvalidSn";
+	case UsbResult_DeviceNotFound: return "NoDeviceFound";
+	default: return "error";
+	}
+}
 
-		// create a pylon device from the given serial number.
-		Pylon::DeviceInfoList_t devices;
-		Pylon::DeviceInfoList_t filters;
-		filters.push_back(filter);
-		Pylon::CTlFactory::GetInstance().EnumerateDevices(devices, filters);
+// The link speed without sentinel strings.
+// Readers call this from any thread, so it reports its result into its own slot of the published state, not m_result.
+inline UsbCameraDeviceManager::SUsbResult UsbCameraDeviceManager::CUsbCameraDeviceManager::GetUsbConnectionType(std::string &portVersionBcd)
+{
+	std::string serialNumber;
+	{
+		CStatePublisher::CReader state(m_state);
+		serialNumber = state->serialNumber;
+	}
 
-		if (devices.size() == 0)
+	SUsbResult result;
+	try
+	{
+		if (serialNumber == "")
 		{
-			m_errorMessage = "Error: GetUsbConnectionType(): No matching camera devices found.";
-			return "NoDeviceFound";
+			result = SUsbResult(UsbResult_InvalidArgument, "GetUsbConnectionType");
+			result.detail = "Serial Number Invalid.";
 		}
+		else
+		{
+			Pylon::CDeviceInfo filter;
+			filter.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
+			filter.SetSerialNumber(serialNumber.c_str());
 
-		Pylon::String_t propertyValue;
-		devices[0].GetPropertyValue("UsbPortVersionBcd", propertyValue);
+			// create a pylon device from the given serial number.
+			Pylon::DeviceInfoList_t devices;
+			Pylon::DeviceInfoList_t filters;
+			filters.push_back(filter);
+			Pylon::CTlFactory::GetInstance().EnumerateDevices(devices, filters);
 
-		return propertyValue.c_str();
-	}
-	catch (const GenICam::GenericException &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: GetUsbConnectionType(): GenICam exception occurred. ";
-		m_errorMessage.append(e.GetDescription());
-		return "error";
-	}
-	catch (std::exception &e)
-	{
-		// Error handling.
-		m_errorMessage = "Error: GetUsbConnectionType(): std exception occurred. ";
-		m_errorMessage.append(e.what());
-		return "error";
+			Pylon::String_t propertyValue;
+			if (devices.size() == 0)
+				result = SUsbResult(UsbResult_DeviceNotFound, "GetUsbConnectionType", "EnumerateDevices");
+			else if (devices[0].GetPropertyValue("UsbPortVersionBcd", propertyValue))
+				portVersionBcd = propertyValue.c_str();
+			else
+				result = SUsbResult(UsbResult_NotAvailable, "GetUsbConnectionType", "GetPropertyValue");
+		}
 	}
 	catch (...)
 	{
 		// Error handling.
-		m_errorMessage = "Error: GetUsbConnectionType(): unknown exception occured.";
-		return "error";
+		result = CurrentExceptionResult("GetUsbConnectionType");
 	}
+
+	PublishResult(UsbOperation_GetUsbConnectionType, result);
+	return result;
 }
 
 // For reference, the user can see the camera device instance string
 inline std::string UsbCameraDeviceManager::CUsbCameraDeviceManager::GetDeviceInstanceID()
 {
-	return m_deviceInstance;
+	CStatePublisher::CReader state(m_state);
+	return state->deviceInstance;
 }
 
 // For reference, the user can see the camera device's parent USB Composite Device instance string
 inline std::string UsbCameraDeviceManager::CUsbCameraDeviceManager::GetCompositeDeviceInstanceID()
 {
-	return m_compositeDeviceInstance;
+	CStatePublisher::CReader state(m_state);
+	return state->compositeDeviceInstance;
 }
 
 // For reference, the user can see the camera device's product ID tag.
 inline std::string UsbCameraDeviceManager::CUsbCameraDeviceManager::GetProductID()
 {
-	return m_productID;
+	CStatePublisher::CReader state(m_state);
+	return state->productID;
 }
 
 // For reference, the user can see the last error message.
 inline std::string UsbCameraDeviceManager::CUsbCameraDeviceManager::GetLastErrorMessage()
 {
-	return m_errorMessage;
+	CStatePublisher::CReader state(m_state);
+	return state->lastFailure.FormatErrorMessage();
+}
+
+// The last error of one operation
+inline std::string UsbCameraDeviceManager::CUsbCameraDeviceManager::GetLastErrorMessage(EUsbCameraOperation operation)
+{
+	if (operation < 0 || operation >= UsbOperation_Count)
+		return "";
+
+	CStatePublisher::CReader state(m_state);
+	return state->operationResults[operation].FormatErrorMessage();
+}
+
+// How one operation's last run ended
+inline UsbCameraDeviceManager::SUsbResult UsbCameraDeviceManager::CUsbCameraDeviceManager::GetLastResult(EUsbCameraOperation operation)
+{
+	if (operation < 0 || operation >= UsbOperation_Count)
+		return SUsbResult(UsbResult_InvalidArgument, "GetLastResult");
+
+	CStatePublisher::CReader state(m_state);
+	return state->operationResults[operation];
+}
+
+// The most recent failure of any operation
+inline UsbCameraDeviceManager::SUsbResult UsbCameraDeviceManager::CUsbCameraDeviceManager::GetLastFailure()
+{
+	CStatePublisher::CReader state(m_state);
+	return state->lastFailure;
+}
+
+// How the last acceptance test went
+inline UsbCameraDeviceManager::SUsbAcceptanceResult UsbCameraDeviceManager::CUsbCameraDeviceManager::GetLastAcceptanceResult()
+{
+	CStatePublisher::CReader state(m_state);
+	return state->acceptance;
+}
+
+// Everything the getters report, from one snapshot
+inline UsbCameraDeviceManager::SUsbCameraManagerState UsbCameraDeviceManager::CUsbCameraDeviceManager::GetState()
+{
+	return m_state.Read();
+}
+
+// The public function behind an operation
+inline const char* UsbCameraDeviceManager::CUsbCameraDeviceManager::OperationToString(EUsbCameraOperation operation)
+{
+	switch (operation)
+	{
+	case UsbOperation_Initialize: return "Initialize";
+	case UsbOperation_EnableCamera: return "EnableCamera";
+	case UsbOperation_DisableCamera: return "DisableCamera";
+	case UsbOperation_EnableCompositeDevice: return "EnableCompositeDevice";
+	case UsbOperation_DisableCompositeDevice: return "DisableCompositeDevice";
+	case UsbOperation_WaitForCameraReady: return "WaitForCameraReady";
+	case UsbOperation_WaitForCameraGone: return "WaitForCameraGone";
+	case UsbOperation_ReattachCamera: return "ReattachCamera";
+	case UsbOperation_ReadPowerSchemeSettings: return "ReadPowerSchemeSettings";
+	case UsbOperation_ReadDeviceTreePowerStates: return "ReadDeviceTreePowerStates";
+	case UsbOperation_GetUsbConnectionType: return "GetUsbConnectionType";
+	case UsbOperation_ValidatePlacement: return "ValidatePlacement";
+	default: return "Unknown";
+	}
 }
 
 // *********************************************************************************************************
@@ -21,17 +21,73 @@
 #ifdef LINUX_BUILD
 #include <pylon/PylonIncludes.h>
 #include <iostream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include "UsbDescriptorParserLinux.h"
+#include "UsbControllerRecoveryLinux.h"
+#include "UsbModeSwitchResetLinux.h"
+#include "UsbCameraPlacementMap.h"
+#include "UsbCameraStatusBoard.h"
+#include "UsbCameraIdentityDatabase.h"
 
 
 namespace UsbCameraDeviceManagerLinux
 {
+	// One endpoint of a camera, flattened from the descriptor blob for capacity planning
+	struct SUsbEndpointInfo
+	{
+		uint8_t interfaceNumber;
+		uint8_t alternateSetting;
+		uint8_t address;
+		EUsbTransferType transferType;
+		uint16_t maxPacketSize;
+		uint8_t maxBurst;            // 0 if there is no SuperSpeed companion descriptor
+		uint16_t bytesPerInterval;   // 0 if there is no SuperSpeed companion descriptor
+	};
+
 	class CUsbCameraDeviceManagerLinux
 	{
 	private:
 		static int systemOutput(std::string& cmd, std::string& output);
 
 	public:
-		static bool UsbModeSwitchReset(Pylon::CDeviceInfo& cameraInfo, std::string& errorMessage);
+		// Resets the camera with usb_modeswitch (see CUsbModeSwitchReset). With a status board the camera is claimed for the reset,
+		// and it fails if another process is recovering the camera.
+		static bool UsbModeSwitchReset(Pylon::CDeviceInfo& cameraInfo, std::string& errorMessage, UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard = NULL);
+
+		// Last resort when the camera has wedged its host controller: unbinds and rebinds the xHCI controller, if the policy
+		// allows taking down everything else on it, then waits for all its cameras to come back. impact lists what was affected.
+		// With a status board every camera on the controller is claimed first, and nothing is touched if one of them is busy.
+		// A controller an earlier call left unbound (its bind kept failing) is bound first. With an identity database (see
+		// RecordCameraIdentity()) a camera that has dropped off the bus is found by the controller it was last on, and cameras
+		// have to come back at their expected speed.
+		static bool XhciControllerRebind(Pylon::CDeviceInfo& cameraInfo, const SUsbControllerRecoveryPolicy& policy, SUsbControllerImpact& impact, std::string& errorMessage, UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard = NULL,
+			UsbCameraDeviceManager::CUsbCameraIdentityDatabase* identityDatabase = NULL);
+
+		// Reads the raw descriptor blob of a device (its sysfs directory, see IUsbDeviceBackend::ResolveDevicePath()) into the
+		// caller's buffer. Fails rather than hand back part of a blob that doesn't fit.
+		static bool ReadDescriptors(const std::string& devicePath, uint8_t* buffer, size_t bufferSize, size_t& length, std::string& errorMessage);
+
+		// Lists the endpoints of the camera's active configuration and its power budget in mA
+		static bool GetCameraEndpointLayout(IUsbDeviceBackend& backend, const std::string& serialNumber, std::vector<SUsbEndpointInfo>& endpoints, unsigned int& maxPowerMilliAmps, std::string& errorMessage);
+
+		// Where the camera is plugged in, for a CUsbCameraPlacementMap: its device name as the port, the pci address of its
+		// controller and its link speed. A camera that isn't connected gets an empty port path, that isn't an error.
+		static bool ReadCameraPlacement(IUsbDeviceBackend& backend, const std::string& serialNumber, UsbCameraDeviceManager::SUsbObservedPlacement& observed, std::string& errorMessage);
+
+		// Files the connected camera in the identity database (CUsbHealthSignalCollector only records cameras that are in it):
+		// its sysfs path, its port and the fastest link speed it has had. If it links slower than that now, a speed downgrade
+		// is recorded and downgraded is set. Meant for startup, the collector records downgrades that happen while running.
+		static bool RecordCameraIdentity(IUsbDeviceBackend& backend, const std::string& serialNumber, UsbCameraDeviceManager::CUsbCameraIdentityDatabase& database, bool& downgraded, std::string& errorMessage);
 	};
 }
 
@@ -90,7 +146,7 @@ inline int UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::systemOutp
 	return status;
 }
 
-inline bool UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::UsbModeSwitchReset(Pylon::CDeviceInfo &cameraInfo, std::string &errorMessage)
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::UsbModeSwitchReset(Pylon::CDeviceInfo &cameraInfo, std::string &errorMessage, UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard)
 {
 	// this fix requires sudo/root priveledges
 	if (CheckForAdmin::CheckForAdmin(errorMessage) == false)
@@ -105,55 +161,265 @@ inline bool UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::UsbModeSw
 		return false;
 	}
 
-	std::string vendor = "2676";
-	std::string product = "";
-
-	// AceClassic/AceU/AceL have a different productID than Ace2
-	if (cameraInfo.GetModelName().find("acA") != std::string::npos)
-		product = "ba02";
-	if (cameraInfo.GetModelName().find("a2A") != std::string::npos)
-		product = "ba05";
-
-	// First, find the bus and device id of the camera from the serial number.
-	// eg: shell command to find the id line from lsusb output is:
-	//     lsusb -v | grep -B 20 '24281256' | grep '2676:ba02'
-	std::string strCommand = "";
-	std::string strOutput = "";
-	strCommand.append("lsusb -v | grep -B 20 '");
-	strCommand.append(cameraInfo.GetSerialNumber());
-	strCommand.append("' | grep ");
-	strCommand.append("'");
-	strCommand.append(vendor);
-	strCommand.append(":");
-	strCommand.append(product);
-	strCommand.append("'");
-
-	// run the command and capture the output
-	systemOutput(strCommand, strOutput);
-
-	// next, parse the output to find bus and device numbers
-	std::size_t pos = strOutput.find("Bus ");
-	std::string bus = strOutput.substr(pos + 4, 3);
-	pos = strOutput.find("Device ");
-	std::string device = strOutput.substr(pos + 7, 3);
-
-	// Now we can reset the individual camera using usb_modeswitch
-	// eg: sudo usb_modeswitch -v 0x2676 -p 0xba02 -b 003 -g 039 --reset-usb
-	strCommand = "";
-	strCommand.append("sudo usb_modeswitch");
-	strCommand.append(" -v 0x");
-	strCommand.append(vendor);
-	strCommand.append(" -p 0x");
-	strCommand.append(product);
-	strCommand.append(" -b ");
-	strCommand.append(bus);
-	strCommand.append(" -g ");
-	strCommand.append(device);
-	strCommand.append(" -R");
-
-	// issue the command to reset the usb port
-	system(strCommand.c_str());
+	CSysfsUsbDeviceBackend backend;
+	CUsbModeSwitchTool tool;
+	CUsbModeSwitchReset modeSwitch(backend, tool);
+	return modeSwitch.ResetCamera(std::string(cameraInfo.GetSerialNumber().c_str()), errorMessage, statusBoard);
+}
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::XhciControllerRebind(Pylon::CDeviceInfo& cameraInfo, const SUsbControllerRecoveryPolicy& policy, SUsbControllerImpact& impact, std::string& errorMessage, UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard,
+	UsbCameraDeviceManager::CUsbCameraIdentityDatabase* identityDatabase)
+{
+	// binding drivers requires sudo/root priveledges
+	if (CheckForAdmin::CheckForAdmin(errorMessage) == false)
+	{
+		errorMessage.append("must be run as sudo / root.");
+		return false;
+	}
+
+	if (cameraInfo.GetDeviceClass() != BaslerUsbDeviceClass)
+	{
+		errorMessage.append("Only usb cameras support this.");
+		return false;
+	}
+
+	// the driver remembers controllers a failed bind left unbound, so it lives as long as the process. Those are bound
+	// first, their cameras can't come back otherwise.
+	static std::mutex driverLock;
+	static CSysfsUsbControllerDriver driver;
+	std::lock_guard<std::mutex> lock(driverLock);
+
+	CSysfsUsbDeviceBackend backend;
+	CUsbControllerRecovery recovery(backend, driver);
+	recovery.SetIdentityDatabase(identityDatabase);
+	std::string serialNumber = cameraInfo.GetSerialNumber().c_str();
 
+	std::vector<std::string> unbound;
+	driver.GetUnboundControllers(unbound);
+	for (size_t i = 0; i < unbound.size(); i++)
+	{
+		if (recovery.BindController(unbound[i], policy, errorMessage) == false)
+			return false;
+	}
+
+	// the rebind takes down every camera on the controller, so all of them are claimed before anything is touched
+	std::vector<std::unique_ptr<UsbCameraDeviceManager::CUsbRecoveryClaim> > claims;
+	std::vector<std::string> claimed;
+	if (statusBoard != NULL)
+	{
+		std::string pciAddress;
+		if (recovery.FindCameraController(serialNumber, pciAddress, errorMessage) == false)
+			return false;
+
+		// the camera itself may be gone from the controller, and everything else with it
+		std::string impactError;
+		std::vector<std::string> serialNumbers(1, serialNumber);
+		if (recovery.GetControllerImpact(pciAddress, impact, impactError))
+		{
+			for (size_t i = 0; i < impact.devices.size(); i++)
+			{
+				if (impact.devices[i].isCamera && impact.devices[i].serialNumber != "" && impact.devices[i].serialNumber != serialNumber)
+					serialNumbers.push_back(impact.devices[i].serialNumber);
+			}
+		}
+
+		for (size_t i = 0; i < serialNumbers.size(); i++)
+		{
+			claims.push_back(std::unique_ptr<UsbCameraDeviceManager::CUsbRecoveryClaim>(new UsbCameraDeviceManager::CUsbRecoveryClaim(statusBoard, serialNumbers[i])));
+			claimed.push_back(serialNumbers[i]);
+			if (claims.back()->Claim(errorMessage) == false)
+				return false;
+		}
+	}
+
+	// after a rebind that only some cameras came back from, the others still count as recovered
+	bool recovered = recovery.RecoverCamera(serialNumber, policy, impact, errorMessage);
+	for (size_t i = 0; i < claims.size(); i++)
+	{
+		bool back = impact.notRecovered.empty() == false && std::find(impact.notRecovered.begin(), impact.notRecovered.end(), claimed[i]) == impact.notRecovered.end();
+		claims[i]->SetRecovered(recovered || back);
+	}
+	return recovered;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::ReadDescriptors(const std::string& devicePath, uint8_t* buffer, size_t bufferSize, size_t& length, std::string& errorMessage)
+{
+	std::string path = devicePath;
+	path.append("/descriptors");
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		errorMessage = "Error: ReadDescriptors(): Unable to open ";
+		errorMessage.append(path);
+		return false;
+	}
+
+	// sysfs hands out the whole blob in one read, but loop in case it doesn't
+	length = 0;
+	while (length < bufferSize)
+	{
+		ssize_t num_bytes = read(fd, buffer + length, bufferSize - length);
+		if (num_bytes < 0)
+		{
+			close(fd);
+			errorMessage = "Error: ReadDescriptors(): read() failed: ";
+			errorMessage.append(strerror(errno));
+			return false;
+		}
+		if (num_bytes == 0)
+			break;
+		length += num_bytes;
+	}
+
+	// a full buffer may be all of it, or the start of something longer
+	uint8_t more;
+	bool truncated = (length == bufferSize && read(fd, &more, 1) > 0);
+	close(fd);
+	if (truncated)
+	{
+		errorMessage = "Error: ReadDescriptors(): The descriptors of ";
+		errorMessage.append(devicePath);
+		errorMessage.append(" are larger than the " + std::to_string(bufferSize) + " byte buffer.");
+		return false;
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::GetCameraEndpointLayout(IUsbDeviceBackend& backend, const std::string& serialNumber, std::vector<SUsbEndpointInfo>& endpoints, unsigned int& maxPowerMilliAmps, std::string& errorMessage)
+{
+	std::string deviceName;
+	std::string devicePath;
+	if (FindUsbDeviceBySerial(backend, serialNumber, deviceName) == false || backend.ResolveDevicePath(deviceName, devicePath) == false)
+	{
+		errorMessage = "Error: GetCameraEndpointLayout(): No usb device with serial number ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(" found.");
+		return false;
+	}
+
+	// only the active configuration matters for planning
+	std::string activeConfiguration;
+	backend.ReadAttribute(deviceName, "bConfigurationValue", activeConfiguration);
+	int configurationValue = atoi(activeConfiguration.c_str());
+
+	uint8_t blob[4096];
+	size_t length = 0;
+	if (ReadDescriptors(devicePath, blob, sizeof(blob), length, errorMessage) == false)
+		return false;
+
+	CUsbDescriptorParser parser(blob, length);
+	bool superSpeed = parser.GetDeviceDescriptor().IsValid() && parser.GetDeviceDescriptor().BcdUsb() >= 0x0300;
+	maxPowerMilliAmps = 0;
+
+	SUsbDescriptorRecord record;
+	while (parser.Next(record) == UsbParseStatus_Ok)
+	{
+		if (configurationValue != 0 && record.configuration.ConfigurationValue() != configurationValue)
+			continue;
+
+		if (record.type == UsbDescriptorType_Configuration)
+			maxPowerMilliAmps = record.configuration.MaxPowerMilliAmps(superSpeed);
+
+		if (record.type == UsbDescriptorType_Endpoint)
+		{
+			SUsbEndpointInfo info;
+			info.interfaceNumber = record.usbInterface.IsValid() ? record.usbInterface.InterfaceNumber() : 0;
+			info.alternateSetting = record.usbInterface.IsValid() ? record.usbInterface.AlternateSetting() : 0;
+			info.address = record.endpoint.Address();
+			info.transferType = record.endpoint.TransferType();
+			info.maxPacketSize = record.endpoint.MaxPacketSize();
+			info.maxBurst = 0;
+			info.bytesPerInterval = 0;
+			endpoints.push_back(info);
+		}
+
+		// the companion descriptor always directly follows its endpoint
+		if (record.type == UsbDescriptorType_SuperSpeedEndpointCompanion && endpoints.empty() == false)
+		{
+			endpoints.back().maxBurst = record.companion.MaxBurst();
+			endpoints.back().bytesPerInterval = record.companion.BytesPerInterval();
+		}
+	}
+
+	if (parser.GetStatus() != UsbParseStatus_End)
+	{
+		errorMessage = "Error: GetCameraEndpointLayout(): Malformed descriptors: ";
+		errorMessage.append(CUsbDescriptorParser::StatusToString(parser.GetStatus()));
+		return false;
+	}
+
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::ReadCameraPlacement(IUsbDeviceBackend& backend, const std::string& serialNumber, UsbCameraDeviceManager::SUsbObservedPlacement& observed, std::string& errorMessage)
+{
+	observed = UsbCameraDeviceManager::SUsbObservedPlacement();
+	observed.serialNumber = serialNumber;
+
+	std::string deviceName;
+	if (FindUsbDeviceBySerial(backend, serialNumber, deviceName) == false)
+		return true;
+
+	std::string devicePath;
+	std::string rootHub;
+	if (backend.ResolveDevicePath(deviceName, devicePath) == false || CUsbControllerRecovery::ParseControllerAddress(devicePath, observed.controller, rootHub) == false)
+	{
+		errorMessage = "Error: ReadCameraPlacement(): Unable to find the host controller of ";
+		errorMessage.append(deviceName);
+		return false;
+	}
+
+	std::string speed;
+	observed.portPath = deviceName;
+	if (backend.ReadAttribute(deviceName, "speed", speed))
+		observed.speedMbps = (unsigned int)strtoul(speed.c_str(), NULL, 10);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbCameraDeviceManagerLinux::RecordCameraIdentity(IUsbDeviceBackend& backend, const std::string& serialNumber, UsbCameraDeviceManager::CUsbCameraIdentityDatabase& database, bool& downgraded, std::string& errorMessage)
+{
+	downgraded = false;
+	std::string deviceName;
+	if (FindUsbDeviceBySerial(backend, serialNumber, deviceName) == false)
+	{
+		errorMessage = "Error: RecordCameraIdentity(): No usb device with serial number ";
+		errorMessage.append(serialNumber);
+		return false;
+	}
+
+	UsbCameraDeviceManager::SUsbCameraIdentity identity;
+	database.Lookup(serialNumber, identity);
+	identity.serialNumber = serialNumber;
+	// the resolved path names the controller, which is how CUsbControllerRecovery finds it once the camera is gone
+	if (backend.ResolveDevicePath(deviceName, identity.sysfsPath) == false)
+		identity.sysfsPath = "/sys/bus/usb/devices/" + deviceName;
+	identity.portPath = deviceName;
+	identity.lastSeenTime = 0;  // now
+
+	std::string value;
+	if (backend.ReadAttribute(deviceName, "idProduct", value))
+		identity.productID = "0x" + value;
+	if (backend.ReadAttribute(deviceName, "product", value))
+		identity.modelName = value;
+
+	// sysfs speed is in Mbps (1.5, 12, 480, 5000...), the fastest seen so far is what it should get
+	unsigned long expected = strtoul(identity.expectedSpeed.c_str(), NULL, 10);
+	std::string speedText;
+	unsigned long speed = 0;
+	if (backend.ReadAttribute(deviceName, "speed", speedText))
+		speed = strtoul(speedText.c_str(), NULL, 10);
+	if (speed > 0 && speed >= expected)
+		identity.expectedSpeed = speedText;
+	else if (speed > 0)
+		downgraded = true;
+
+	if (database.Store(identity) == false)
+	{
+		errorMessage = "Error: RecordCameraIdentity(): The identity database is full or not open.";
+		return false;
+	}
+	if (downgraded)
+		database.RecordHealthEvent(serialNumber, UsbCameraDeviceManager::UsbHealthEvent_SpeedDowngrade, (unsigned int)speed);
 	return true;
 }
 // *********************************************************************************************************
@@ -0,0 +1,295 @@
+// UsbCameraHealthModel.h
+// Scores each camera's health from its persisted link and recovery history, and flags the ones likely to fail soon
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERAHEALTHMODEL_H
+#define USBCAMERAHEALTHMODEL_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <stdint.h>
+#include "UsbCameraIdentityDatabase.h"
+
+namespace UsbCameraDeviceManager
+{
+	struct SUsbCameraHealthPolicy
+	{
+		unsigned int horizonHours;          // "likely to fail" means within this long (default 24)
+		unsigned int windowHours;           // how far back events count (default 168, a week)
+		double failProbability;             // flag a camera whose estimated chance of failing within the horizon reaches this (default 0.5)
+		unsigned int failScore;             // or whose score is this or lower (default 40)
+
+		// points off the score of 100, per event in the window, and the most each kind of event can take off
+		unsigned int recoveryPenalty;       // default 10, at most 40
+		unsigned int downgradePenalty;      // default 15, at most 30
+		unsigned int overCurrentPenalty;    // default 20, at most 40
+		unsigned int kernelErrorPenalty;    // default 3, at most 30
+		unsigned int trendPenalty;          // at most this for recoveries getting slower (default 20)
+		unsigned int driftPenalty;          // at most this for recovering slower than its model does (default 15)
+
+		SUsbCameraHealthPolicy() : horizonHours(24), windowHours(168), failProbability(0.5), failScore(40), recoveryPenalty(10),
+			downgradePenalty(15), overCurrentPenalty(20), kernelErrorPenalty(3), trendPenalty(20), driftPenalty(15) {}
+	};
+
+	struct SUsbCameraHealth
+	{
+		std::string serialNumber;
+		unsigned int score;                 // 100 is healthy, 0 is as bad as it gets
+		bool likelyToFail;
+		double failureProbability;          // estimated chance of at least one recovery within the horizon
+		unsigned int recoveries;            // events in the window
+		unsigned int downgrades;
+		unsigned int overCurrents;
+		unsigned int kernelErrors;
+		double recoveryTrend;               // mean time of the newer half of its recoveries over the older half, 0 if too few
+		double recoveryDrift;               // its mean recovery time over its model's, 0 if unknown
+		std::vector<std::string> reasons;   // what took points off, eg: "3 recoveries in the last 168 h"
+
+		SUsbCameraHealth() : score(100), likelyToFail(false), failureProbability(0.0), recoveries(0), downgrades(0), overCurrents(0),
+			kernelErrors(0), recoveryTrend(0.0), recoveryDrift(0.0) {}
+	};
+
+	// Reads the health events and recovery times the identity database keeps for each camera (CUsbCameraDeviceManager
+	// records recoveries and speed downgrades, CUsbHealthSignalCollector on Linux adds sysfs and kernel log signals), so
+	// the score survives restarts. The chance of failing within the horizon treats recoveries as a Poisson process at
+	// the rate seen in the window, raised by precursors (downgrades, over-currents, kernel errors) and by recoveries that
+	// are getting slower. Use it to schedule a reset in a planned idle window instead of losing the camera mid-production.
+	class CUsbCameraHealthModel
+	{
+	private:
+		CUsbCameraIdentityDatabase& m_database;
+		SUsbCameraHealthPolicy m_policy;
+
+		static unsigned int Penalty(unsigned int count, unsigned int perEvent, unsigned int cap);
+
+		CUsbCameraHealthModel(const CUsbCameraHealthModel&);
+		CUsbCameraHealthModel& operator=(const CUsbCameraHealthModel&);
+
+	public:
+		// The database must outlive this object
+		CUsbCameraHealthModel(CUsbCameraIdentityDatabase& database, const SUsbCameraHealthPolicy& policy = SUsbCameraHealthPolicy());
+
+		void SetPolicy(const SUsbCameraHealthPolicy& policy);
+
+		// Scores one camera as of now (seconds since the epoch, 0 for the current time)
+		bool Evaluate(const std::string& serialNumber, SUsbCameraHealth& health, std::string& errorMessage, uint64_t now = 0);
+
+		// Scores every camera in the database, worst first
+		void EvaluateAll(std::vector<SUsbCameraHealth>& health, uint64_t now = 0);
+
+		// For reference, one line per camera with its score and reasons
+		static std::string FormatHealth(const std::vector<SUsbCameraHealth>& health);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CUsbCameraHealthModel::CUsbCameraHealthModel(CUsbCameraIdentityDatabase& database, const SUsbCameraHealthPolicy& policy)
+	: m_database(database), m_policy(policy)
+{
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraHealthModel::SetPolicy(const SUsbCameraHealthPolicy& policy)
+{
+	m_policy = policy;
+}
+
+inline unsigned int UsbCameraDeviceManager::CUsbCameraHealthModel::Penalty(unsigned int count, unsigned int perEvent, unsigned int cap)
+{
+	uint64_t penalty = (uint64_t)count * perEvent;
+	return (penalty > cap) ? cap : (unsigned int)penalty;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraHealthModel::Evaluate(const std::string& serialNumber, SUsbCameraHealth& health, std::string& errorMessage, uint64_t now)
+{
+	health = SUsbCameraHealth();
+	health.serialNumber = serialNumber;
+
+	SUsbCameraIdentity identity;
+	std::vector<SUsbHealthEvent> events;
+	if (m_database.Lookup(serialNumber, identity) == false || m_database.GetHealthEvents(serialNumber, events) == false)
+	{
+		errorMessage = "Error: CUsbCameraHealthModel::Evaluate(): Camera ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(" is not in the identity database.");
+		return false;
+	}
+
+	if (now == 0)
+		now = (uint64_t)time(NULL);
+	uint64_t windowSeconds = (uint64_t)m_policy.windowHours * 3600;
+	uint64_t since = (now > windowSeconds) ? now - windowSeconds : 0;
+
+	std::vector<unsigned int> recoveryMs;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		if (events[i].time < since || events[i].time > now)
+			continue;
+
+		switch (events[i].type)
+		{
+		case UsbHealthEvent_Recovery:
+			health.recoveries++;
+			recoveryMs.push_back(events[i].value);
+			break;
+		case UsbHealthEvent_SpeedDowngrade:
+			health.downgrades++;
+			break;
+		case UsbHealthEvent_OverCurrent:
+			health.overCurrents += (events[i].value > 0) ? events[i].value : 1;
+			break;
+		case UsbHealthEvent_KernelError:
+			health.kernelErrors++;
+			break;
+		default:
+			break;
+		}
+	}
+
+	// slower and slower recoveries: compare the newer half with the older half
+	if (recoveryMs.size() >= 4)
+	{
+		size_t half = recoveryMs.size() / 2;
+		double older = 0.0;
+		double newer = 0.0;
+		for (size_t i = 0; i < half; i++)
+			older += recoveryMs[i];
+		for (size_t i = recoveryMs.size() - half; i < recoveryMs.size(); i++)
+			newer += recoveryMs[i];
+		if (older > 0.0)
+			health.recoveryTrend = newer / older;
+	}
+
+	// slower than the other cameras of its model
+	unsigned int modelMs = 0;
+	if (identity.recoveryCount > 0 && m_database.GetModelRecoveryEstimateMs(identity.modelName, modelMs) && modelMs > 0)
+		health.recoveryDrift = (double)identity.recoveryMeanMs / modelMs;
+
+	char reason[128];
+	unsigned int penalty = 0;
+	unsigned int part = Penalty(health.recoveries, m_policy.recoveryPenalty, 40);
+	if (part > 0)
+	{
+		snprintf(reason, sizeof(reason), "%u recoveries in the last %u h", health.recoveries, m_policy.windowHours);
+		health.reasons.push_back(reason);
+		penalty += part;
+	}
+	part = Penalty(health.downgrades, m_policy.downgradePenalty, 30);
+	if (part > 0)
+	{
+		snprintf(reason, sizeof(reason), "%u speed downgrades in the last %u h", health.downgrades, m_policy.windowHours);
+		health.reasons.push_back(reason);
+		penalty += part;
+	}
+	part = Penalty(health.overCurrents, m_policy.overCurrentPenalty, 40);
+	if (part > 0)
+	{
+		snprintf(reason, sizeof(reason), "%u over-current conditions in the last %u h", health.overCurrents, m_policy.windowHours);
+		health.reasons.push_back(reason);
+		penalty += part;
+	}
+	part = Penalty(health.kernelErrors, m_policy.kernelErrorPenalty, 30);
+	if (part > 0)
+	{
+		snprintf(reason, sizeof(reason), "%u kernel errors in the last %u h", health.kernelErrors, m_policy.windowHours);
+		health.reasons.push_back(reason);
+		penalty += part;
+	}
+	if (health.recoveryTrend > 1.0)
+	{
+		part = (unsigned int)std::min((double)m_policy.trendPenalty, (health.recoveryTrend - 1.0) * 2.0 * m_policy.trendPenalty);
+		if (part > 0)
+		{
+			snprintf(reason, sizeof(reason), "recoveries %.0f%% slower than before", (health.recoveryTrend - 1.0) * 100.0);
+			health.reasons.push_back(reason);
+			penalty += part;
+		}
+	}
+	if (health.recoveryDrift > 1.0)
+	{
+		part = (unsigned int)std::min((double)m_policy.driftPenalty, (health.recoveryDrift - 1.0) * 2.0 * m_policy.driftPenalty);
+		if (part > 0)
+		{
+			snprintf(reason, sizeof(reason), "recovers %.0f%% slower than its model", (health.recoveryDrift - 1.0) * 100.0);
+			health.reasons.push_back(reason);
+			penalty += part;
+		}
+	}
+	health.score = (penalty >= 100) ? 0 : 100 - penalty;
+
+	// expected failures within the horizon: the window's recovery rate, with precursors counting as part of a failure
+	double expected = 0.0;
+	if (m_policy.windowHours > 0)
+	{
+		double weighted = health.recoveries + 0.5 * health.downgrades + 0.5 * health.overCurrents + 0.1 * health.kernelErrors;
+		expected = weighted * m_policy.horizonHours / m_policy.windowHours;
+		if (health.recoveryTrend > 1.0)
+			expected *= health.recoveryTrend;
+	}
+	health.failureProbability = 1.0 - std::exp(-expected);
+	health.likelyToFail = health.failureProbability >= m_policy.failProbability || health.score <= m_policy.failScore;
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraHealthModel::EvaluateAll(std::vector<SUsbCameraHealth>& health, uint64_t now)
+{
+	health.clear();
+	std::vector<std::string> serialNumbers;
+	m_database.ListSerialNumbers(serialNumbers);
+
+	for (size_t i = 0; i < serialNumbers.size(); i++)
+	{
+		SUsbCameraHealth camera;
+		std::string errorMessage;
+		if (Evaluate(serialNumbers[i], camera, errorMessage, now))
+			health.push_back(camera);
+	}
+
+	std::stable_sort(health.begin(), health.end(), [](const SUsbCameraHealth& a, const SUsbCameraHealth& b)
+	{
+		if (a.likelyToFail != b.likelyToFail)
+			return a.likelyToFail;
+		return a.score < b.score;
+	});
+}
+
+inline std::string UsbCameraDeviceManager::CUsbCameraHealthModel::FormatHealth(const std::vector<SUsbCameraHealth>& health)
+{
+	std::string text;
+	char line[128];
+	for (size_t i = 0; i < health.size(); i++)
+	{
+		snprintf(line, sizeof(line), "%-16s %3u %-14s %3.0f%%", health[i].serialNumber.c_str(), health[i].score,
+			health[i].likelyToFail ? "likely to fail" : "ok", health[i].failureProbability * 100.0);
+		text.append(line);
+		for (size_t r = 0; r < health[i].reasons.size(); r++)
+		{
+			text.append((r == 0) ? "  " : ", ");
+			text.append(health[i].reasons[r]);
+		}
+		text.append("\n");
+	}
+	return text;
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,605 @@
+// UsbCameraIdentityDatabase.h
+// A small memory mapped file remembering what was learned about each camera, so startup doesn't have to enumerate
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERAIDENTITYDATABASE_H
+#define USBCAMERAIDENTITYDATABASE_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include "UsbMappedFile.h"
+
+namespace UsbCameraDeviceManager
+{
+	// Things that happen to a camera that say something about its health, see CUsbCameraHealthModel
+	enum EUsbHealthEventType
+	{
+		UsbHealthEvent_Recovery = 0,     // came back after a reset or loss, value is how long it took (ms)
+		UsbHealthEvent_SpeedDowngrade,   // linked slower than it should
+		UsbHealthEvent_OverCurrent,      // its port reported over-current conditions, value is how many
+		UsbHealthEvent_KernelError,      // a kernel error signature (cable fault, enumeration or transfer error...)
+		UsbHealthEvent_Count
+	};
+
+	struct SUsbHealthEvent
+	{
+		EUsbHealthEventType type;
+		uint64_t time;                   // seconds since the epoch
+		unsigned int value;
+	};
+
+	// What is known about one camera. Fields that don't apply to the platform are left empty.
+	struct SUsbCameraIdentity
+	{
+		std::string serialNumber;
+		std::string modelName;
+		std::string productID;
+		std::string deviceInstance;          // Windows camera device instance ID
+		std::string compositeDeviceInstance; // Windows parent composite device instance ID
+		std::string sysfsPath;               // Linux, eg: /sys/devices/pci0000:00/0000:00:14.0/usb2/2-1/2-1.3
+		std::string portPath;                // where it was plugged in, eg: 2-1.3 or a Windows location path
+		std::string expectedSpeed;           // the fastest it has linked at: UsbPortVersionBcd on Windows, sysfs speed on Linux
+		uint64_t lastSeenTime;               // seconds since the epoch
+		unsigned int recoveryCount;          // number of recoveries timed so far
+		unsigned int recoveryMeanMs;         // moving average time for the camera to come back after a reset
+		unsigned int recoveryMaxMs;
+		unsigned int healthEventCounts[UsbHealthEvent_Count];   // all the health events ever recorded, by type
+
+		SUsbCameraIdentity() : lastSeenTime(0), recoveryCount(0), recoveryMeanMs(0), recoveryMaxMs(0)
+		{
+			for (int t = 0; t < UsbHealthEvent_Count; t++)
+				healthEventCounts[t] = 0;
+		}
+	};
+
+	// A fixed size hash table of camera identities in a memory mapped file, keyed by serial number.
+	// Opening it is a file mapping, a lookup is a few string compares, and nothing is parsed.
+	// The content is only a hint: whoever uses an identity must check it against the live system before trusting it.
+	//
+	// Any number of processes may read and write. Readers never block: they retry while a writer is in the middle of a
+	// record. Writers take a lock on the file, so processes sharing it (eg: in ProgramData) don't interleave their writes.
+	class CUsbCameraIdentityDatabase
+	{
+	public:
+		static const uint32_t Capacity = 256;
+		static const uint32_t RecoveryHistoryLength = 8;
+		static const uint32_t HealthHistoryLength = 16;   // per event type, so a burst of one kind can't push out the others
+
+	private:
+		static const uint32_t FileVersion = 3;
+		static const uint32_t SlotFree = 0;
+		static const uint32_t SlotUsed = 1;
+		static const uint32_t SlotRemoved = 2;
+
+		// the on-disk layout. Plain fixed size types only, it's written straight from memory.
+		struct SFileHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t recordSize;
+			uint32_t capacity;
+			uint32_t reserved[5];
+		};
+
+		struct SFileHealthEvent
+		{
+			uint64_t time;         // 0 for an unused entry
+			uint32_t type;
+			uint32_t value;
+		};
+
+		struct SFileRecord
+		{
+			uint32_t sequence;     // odd while a write is in progress
+			uint32_t state;        // SlotFree, SlotUsed or SlotRemoved
+			char serialNumber[32];
+			char modelName[64];
+			char productID[16];
+			char deviceInstance[256];
+			char compositeDeviceInstance[128];
+			char sysfsPath[128];
+			char portPath[128];
+			char expectedSpeed[16];
+			uint64_t lastSeenTime;
+			uint32_t recoveryCount;
+			uint32_t recoveryMeanMs;
+			uint32_t recoveryMaxMs;
+			uint32_t recoveryHistoryIndex;
+			uint32_t recoveryHistoryMs[RecoveryHistoryLength];
+			uint32_t healthEventCounts[UsbHealthEvent_Count];
+			uint32_t healthHistoryIndex[UsbHealthEvent_Count];
+			SFileHealthEvent healthHistory[UsbHealthEvent_Count][HealthHistoryLength];
+		};
+
+		CUsbMappedFile m_file;
+		std::mutex m_writeMutex;
+
+		SFileHeader* Header() const { return (SFileHeader*)m_file.GetData(); }
+		SFileRecord* Records() const { return (SFileRecord*)((char*)m_file.GetData() + sizeof(SFileHeader)); }
+
+		static uint32_t HashSerial(const std::string& serialNumber);
+		static void CopyField(char* field, size_t fieldSize, const std::string& value);
+		static std::string ReadField(const char* field, size_t fieldSize);
+
+		// m_writeMutex for the threads of this process, the file lock for the other processes
+		class CWriteLock
+		{
+		private:
+			CUsbCameraIdentityDatabase& m_database;
+			std::lock_guard<std::mutex> m_lock;
+
+		public:
+			CWriteLock(CUsbCameraIdentityDatabase& database) : m_database(database), m_lock(database.m_writeMutex) { m_database.m_file.LockExclusive(); }
+			~CWriteLock() { m_database.m_file.Unlock(); }
+		};
+
+		// index of the record for serialNumber, or -1. If insertIndex isn't NULL it gets the slot to insert into (or -1 if full).
+		int FindSlot(const std::string& serialNumber, int* insertIndex) const;
+
+		// copies a record out, retrying while a writer is in the middle of it
+		bool ReadRecord(int index, SFileRecord& record) const;
+
+		// the same for just the state and serial number, which is all a probe needs
+		void ReadSlotKey(int index, uint32_t& state, char* serialNumber) const;
+
+		void BeginWrite(SFileRecord& record);
+		void EndWrite(SFileRecord& record);
+
+		// appends to the record's history of that event type (between BeginWrite() and EndWrite())
+		static void AppendHealthEvent(SFileRecord& record, EUsbHealthEventType type, unsigned int value, uint64_t time);
+
+		static bool CompareHealthEventTime(const SUsbHealthEvent& a, const SUsbHealthEvent& b) { return a.time < b.time; }
+
+		CUsbCameraIdentityDatabase(const CUsbCameraIdentityDatabase&);
+		CUsbCameraIdentityDatabase& operator=(const CUsbCameraIdentityDatabase&);
+
+	public:
+		CUsbCameraIdentityDatabase() {}
+
+		// Maps the database file, creating it if needed. A file from another version is wiped, it's only a cache.
+		bool Open(const std::string& path, std::string& errorMessage);
+
+		void Close();
+
+		bool IsOpen() const { return m_file.IsOpen(); }
+
+		// Gets the last known identity of a camera
+		bool Lookup(const std::string& serialNumber, SUsbCameraIdentity& identity) const;
+
+		// Adds or updates a camera's identity. The recovery timings already recorded are kept.
+		bool Store(const SUsbCameraIdentity& identity);
+
+		// Forgets a camera
+		bool Remove(const std::string& serialNumber);
+
+		// Records how long the camera took to come back after a reset, also as a UsbHealthEvent_Recovery unless the reset
+		// was planned (the application's own disable/enable isn't a sign of a failing camera)
+		bool RecordRecovery(const std::string& serialNumber, unsigned int recoveryMs, bool planned = false);
+
+		// Records a health event of a known camera. time is seconds since the epoch, 0 for now.
+		bool RecordHealthEvent(const std::string& serialNumber, EUsbHealthEventType type, unsigned int value = 0, uint64_t time = 0);
+
+		// The last HealthHistoryLength health events of each type of a camera, oldest first
+		bool GetHealthEvents(const std::string& serialNumber, std::vector<SUsbHealthEvent>& events) const;
+
+		// Every camera in the database
+		void ListSerialNumbers(std::vector<std::string>& serialNumbers) const;
+
+		// The recovery time to plan for with this model: the mean over all cameras of the model that have one
+		bool GetModelRecoveryEstimateMs(const std::string& modelName, unsigned int& recoveryMs) const;
+
+		// The last recovery times of a camera, oldest first
+		bool GetRecoveryHistory(const std::string& serialNumber, std::vector<unsigned int>& recoveryMs) const;
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline uint32_t UsbCameraDeviceManager::CUsbCameraIdentityDatabase::HashSerial(const std::string& serialNumber)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < serialNumber.size(); i++)
+	{
+		hash ^= (uint8_t)serialNumber[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraIdentityDatabase::CopyField(char* field, size_t fieldSize, const std::string& value)
+{
+	// always terminated, silently truncated
+	size_t length = (value.size() < fieldSize - 1) ? value.size() : fieldSize - 1;
+	memcpy(field, value.data(), length);
+	memset(field + length, 0, fieldSize - length);
+}
+
+inline std::string UsbCameraDeviceManager::CUsbCameraIdentityDatabase::ReadField(const char* field, size_t fieldSize)
+{
+	// don't trust the file to be terminated
+	size_t length = 0;
+	while (length < fieldSize && field[length] != '\0')
+		length++;
+	return std::string(field, length);
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::Open(const std::string& path, std::string& errorMessage)
+{
+	std::lock_guard<std::mutex> lock(m_writeMutex);
+
+	size_t size = sizeof(SFileHeader) + sizeof(SFileRecord) * Capacity;
+	if (m_file.Open(path, size, errorMessage) == false)
+		return false;
+
+	// another process may be creating it, or writing to it
+	m_file.LockExclusive();
+
+	SFileHeader* header = Header();
+	bool valid = memcmp(header->magic, "UCAMIDDB", 8) == 0 && header->version == FileVersion
+		&& header->recordSize == sizeof(SFileRecord) && header->capacity == Capacity;
+
+	if (valid == false)
+	{
+		memset(m_file.GetData(), 0, size);
+		memcpy(header->magic, "UCAMIDDB", 8);
+		header->version = FileVersion;
+		header->recordSize = sizeof(SFileRecord);
+		header->capacity = Capacity;
+		m_file.Flush();
+	}
+
+	m_file.Unlock();
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraIdentityDatabase::Close()
+{
+	std::lock_guard<std::mutex> lock(m_writeMutex);
+	m_file.Flush();
+	m_file.Close();
+}
+
+inline int UsbCameraDeviceManager::CUsbCameraIdentityDatabase::FindSlot(const std::string& serialNumber, int* insertIndex) const
+{
+	if (insertIndex != NULL)
+		*insertIndex = -1;
+
+	// open addressing with linear probing. Removed slots keep the probe chain going but can be reused.
+	uint32_t start = HashSerial(serialNumber) % Capacity;
+	for (uint32_t probe = 0; probe < Capacity; probe++)
+	{
+		int index = (int)((start + probe) % Capacity);
+		uint32_t state = SlotFree;
+		char slotSerialNumber[sizeof(SFileRecord::serialNumber)];
+		ReadSlotKey(index, state, slotSerialNumber);
+
+		if (state == SlotFree)
+		{
+			if (insertIndex != NULL && *insertIndex < 0)
+				*insertIndex = index;
+			return -1;
+		}
+
+		if (state == SlotRemoved)
+		{
+			if (insertIndex != NULL && *insertIndex < 0)
+				*insertIndex = index;
+			continue;
+		}
+
+		if (strncmp(slotSerialNumber, serialNumber.c_str(), sizeof(slotSerialNumber)) == 0)
+			return index;
+	}
+	return -1;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraIdentityDatabase::ReadSlotKey(int index, uint32_t& state, char* serialNumber) const
+{
+	const volatile SFileRecord& shared = Records()[index];
+	for (int attempt = 0; attempt < 100; attempt++)
+	{
+		uint32_t before = shared.sequence;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		state = shared.state;
+		memcpy(serialNumber, (const void*)shared.serialNumber, sizeof(shared.serialNumber));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if ((before & 1) == 0 && before == shared.sequence)
+			return;
+	}
+	// a writer that died halfway leaves the sequence odd forever. Take the slot as it is, the next write to it repairs it.
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::ReadRecord(int index, SFileRecord& record) const
+{
+	const volatile SFileRecord& shared = Records()[index];
+	for (int attempt = 0; attempt < 100; attempt++)
+	{
+		uint32_t before = shared.sequence;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		memcpy(&record, (const void*)&shared, sizeof(record));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if ((before & 1) == 0 && before == shared.sequence)
+			return true;
+	}
+	// a writer that died halfway leaves the sequence odd forever
+	return false;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraIdentityDatabase::BeginWrite(SFileRecord& record)
+{
+	record.sequence = (record.sequence | 1);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraIdentityDatabase::EndWrite(SFileRecord& record)
+{
+	std::atomic_thread_fence(std::memory_order_release);
+	record.sequence = record.sequence + 1;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::Lookup(const std::string& serialNumber, SUsbCameraIdentity& identity) const
+{
+	if (IsOpen() == false || serialNumber == "")
+		return false;
+
+	int index = FindSlot(serialNumber, NULL);
+	SFileRecord record;
+	if (index < 0 || ReadRecord(index, record) == false || record.state != SlotUsed)
+		return false;
+
+	identity.serialNumber = ReadField(record.serialNumber, sizeof(record.serialNumber));
+	identity.modelName = ReadField(record.modelName, sizeof(record.modelName));
+	identity.productID = ReadField(record.productID, sizeof(record.productID));
+	identity.deviceInstance = ReadField(record.deviceInstance, sizeof(record.deviceInstance));
+	identity.compositeDeviceInstance = ReadField(record.compositeDeviceInstance, sizeof(record.compositeDeviceInstance));
+	identity.sysfsPath = ReadField(record.sysfsPath, sizeof(record.sysfsPath));
+	identity.portPath = ReadField(record.portPath, sizeof(record.portPath));
+	identity.expectedSpeed = ReadField(record.expectedSpeed, sizeof(record.expectedSpeed));
+	identity.lastSeenTime = record.lastSeenTime;
+	identity.recoveryCount = record.recoveryCount;
+	identity.recoveryMeanMs = record.recoveryMeanMs;
+	identity.recoveryMaxMs = record.recoveryMaxMs;
+	for (int t = 0; t < UsbHealthEvent_Count; t++)
+		identity.healthEventCounts[t] = record.healthEventCounts[t];
+
+	// the slot may have been reused for another camera while we looked
+	return identity.serialNumber == serialNumber;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::Store(const SUsbCameraIdentity& identity)
+{
+	CWriteLock lock(*this);
+
+	if (IsOpen() == false || identity.serialNumber == "")
+		return false;
+
+	int insertIndex = -1;
+	int index = FindSlot(identity.serialNumber, &insertIndex);
+	bool isNew = (index < 0);
+	if (isNew)
+		index = insertIndex;
+	if (index < 0)
+		return false;
+
+	SFileRecord& record = Records()[index];
+	BeginWrite(record);
+	if (isNew)
+	{
+		record.recoveryCount = 0;
+		record.recoveryMeanMs = 0;
+		record.recoveryMaxMs = 0;
+		record.recoveryHistoryIndex = 0;
+		memset(record.recoveryHistoryMs, 0, sizeof(record.recoveryHistoryMs));
+		memset(record.healthEventCounts, 0, sizeof(record.healthEventCounts));
+		memset(record.healthHistoryIndex, 0, sizeof(record.healthHistoryIndex));
+		memset(record.healthHistory, 0, sizeof(record.healthHistory));
+	}
+	CopyField(record.serialNumber, sizeof(record.serialNumber), identity.serialNumber);
+	CopyField(record.modelName, sizeof(record.modelName), identity.modelName);
+	CopyField(record.productID, sizeof(record.productID), identity.productID);
+	CopyField(record.deviceInstance, sizeof(record.deviceInstance), identity.deviceInstance);
+	CopyField(record.compositeDeviceInstance, sizeof(record.compositeDeviceInstance), identity.compositeDeviceInstance);
+	CopyField(record.sysfsPath, sizeof(record.sysfsPath), identity.sysfsPath);
+	CopyField(record.portPath, sizeof(record.portPath), identity.portPath);
+	CopyField(record.expectedSpeed, sizeof(record.expectedSpeed), identity.expectedSpeed);
+	record.lastSeenTime = (identity.lastSeenTime != 0) ? identity.lastSeenTime : (uint64_t)time(NULL);
+	record.state = SlotUsed;
+	EndWrite(record);
+
+	return true;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::Remove(const std::string& serialNumber)
+{
+	CWriteLock lock(*this);
+
+	if (IsOpen() == false)
+		return false;
+
+	int index = FindSlot(serialNumber, NULL);
+	if (index < 0)
+		return false;
+
+	SFileRecord& record = Records()[index];
+	BeginWrite(record);
+	record.state = SlotRemoved;
+	EndWrite(record);
+	return true;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::RecordRecovery(const std::string& serialNumber, unsigned int recoveryMs, bool planned)
+{
+	CWriteLock lock(*this);
+
+	if (IsOpen() == false)
+		return false;
+
+	int index = FindSlot(serialNumber, NULL);
+	if (index < 0)
+		return false;
+
+	SFileRecord& record = Records()[index];
+	BeginWrite(record);
+	// same moving average as CUsbCameraDeviceManager keeps in memory
+	if (record.recoveryCount == 0)
+		record.recoveryMeanMs = recoveryMs;
+	else
+		record.recoveryMeanMs = (record.recoveryMeanMs * 3 + recoveryMs) / 4;
+	if (recoveryMs > record.recoveryMaxMs)
+		record.recoveryMaxMs = recoveryMs;
+	record.recoveryCount++;
+	record.recoveryHistoryMs[record.recoveryHistoryIndex % RecoveryHistoryLength] = recoveryMs;
+	record.recoveryHistoryIndex = (record.recoveryHistoryIndex + 1) % RecoveryHistoryLength;
+	record.lastSeenTime = (uint64_t)time(NULL);
+	if (planned == false)
+		AppendHealthEvent(record, UsbHealthEvent_Recovery, recoveryMs, record.lastSeenTime);
+	EndWrite(record);
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraIdentityDatabase::AppendHealthEvent(SFileRecord& record, EUsbHealthEventType type, unsigned int value, uint64_t time)
+{
+	uint32_t& next = record.healthHistoryIndex[type];
+	SFileHealthEvent& event = record.healthHistory[type][next % HealthHistoryLength];
+	event.time = time;
+	event.type = (uint32_t)type;
+	event.value = value;
+	next = (next + 1) % HealthHistoryLength;
+	record.healthEventCounts[type]++;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::RecordHealthEvent(const std::string& serialNumber, EUsbHealthEventType type, unsigned int value, uint64_t time)
+{
+	CWriteLock lock(*this);
+
+	if (IsOpen() == false || type < 0 || type >= UsbHealthEvent_Count)
+		return false;
+
+	int index = FindSlot(serialNumber, NULL);
+	if (index < 0)
+		return false;
+
+	SFileRecord& record = Records()[index];
+	BeginWrite(record);
+	AppendHealthEvent(record, type, value, (time != 0) ? time : (uint64_t)::time(NULL));
+	EndWrite(record);
+	return true;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::GetHealthEvents(const std::string& serialNumber, std::vector<SUsbHealthEvent>& events) const
+{
+	events.clear();
+	if (IsOpen() == false)
+		return false;
+
+	int index = FindSlot(serialNumber, NULL);
+	SFileRecord record;
+	if (index < 0 || ReadRecord(index, record) == false || record.state != SlotUsed)
+		return false;
+
+	// in each type's ring the oldest is the one about to be overwritten, unused entries are skipped
+	for (int t = 0; t < UsbHealthEvent_Count; t++)
+	{
+		for (uint32_t i = 0; i < HealthHistoryLength; i++)
+		{
+			const SFileHealthEvent& stored = record.healthHistory[t][(record.healthHistoryIndex[t] + i) % HealthHistoryLength];
+			if (stored.time == 0 || stored.type != (uint32_t)t)
+				continue;
+
+			SUsbHealthEvent event;
+			event.type = (EUsbHealthEventType)stored.type;
+			event.time = stored.time;
+			event.value = stored.value;
+			events.push_back(event);
+		}
+	}
+
+	// merged by time, each type keeps its own order within a second
+	std::stable_sort(events.begin(), events.end(), CompareHealthEventTime);
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraIdentityDatabase::ListSerialNumbers(std::vector<std::string>& serialNumbers) const
+{
+	serialNumbers.clear();
+	if (IsOpen() == false)
+		return;
+
+	for (uint32_t i = 0; i < Capacity; i++)
+	{
+		SFileRecord record;
+		if (Records()[i].state != SlotUsed || ReadRecord((int)i, record) == false || record.state != SlotUsed)
+			continue;
+		serialNumbers.push_back(ReadField(record.serialNumber, sizeof(record.serialNumber)));
+	}
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::GetModelRecoveryEstimateMs(const std::string& modelName, unsigned int& recoveryMs) const
+{
+	if (IsOpen() == false || modelName == "")
+		return false;
+
+	uint64_t total = 0;
+	unsigned int cameras = 0;
+	for (uint32_t i = 0; i < Capacity; i++)
+	{
+		SFileRecord record;
+		if (Records()[i].state != SlotUsed || ReadRecord((int)i, record) == false || record.state != SlotUsed || record.recoveryCount == 0)
+			continue;
+		if (strncmp(record.modelName, modelName.c_str(), sizeof(record.modelName)) != 0)
+			continue;
+		total += record.recoveryMeanMs;
+		cameras++;
+	}
+
+	if (cameras == 0)
+		return false;
+
+	recoveryMs = (unsigned int)(total / cameras);
+	return true;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraIdentityDatabase::GetRecoveryHistory(const std::string& serialNumber, std::vector<unsigned int>& recoveryMs) const
+{
+	recoveryMs.clear();
+	if (IsOpen() == false)
+		return false;
+
+	int index = FindSlot(serialNumber, NULL);
+	SFileRecord record;
+	if (index < 0 || ReadRecord(index, record) == false || record.state != SlotUsed)
+		return false;
+
+	uint32_t kept = (record.recoveryCount < RecoveryHistoryLength) ? record.recoveryCount : RecoveryHistoryLength;
+	for (uint32_t i = 0; i < kept; i++)
+	{
+		uint32_t slot = (record.recoveryHistoryIndex + RecoveryHistoryLength - kept + i) % RecoveryHistoryLength;
+		recoveryMs.push_back(record.recoveryHistoryMs[slot]);
+	}
+	return true;
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,404 @@
+// UsbCameraPlacementMap.h
+// Declares which port, controller and speed each camera is planned for, and checks the live topology against it
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERAPLACEMENTMAP_H
+#define USBCAMERAPLACEMENTMAP_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+namespace UsbCameraDeviceManager
+{
+	// Where a camera is planned to be. Port paths and controllers are compared as text, so use what the platform
+	// reports: on Windows the device's first LocationPaths entry (eg: PCIROOT(0)#PCI(1400)#USBROOT(0)#USB(3)) and the
+	// part of it before #USBROOT, on Linux the sysfs device name (eg: 2-1.3) and the controller's pci address.
+	struct SUsbExpectedPlacement
+	{
+		std::string serialNumber;
+		std::string portPath;
+		std::string controller;          // empty to not check it
+		unsigned int minimumSpeedMbps;   // 5000 for USB 3.0, 480 for USB 2.0, 0 to not check it
+
+		SUsbExpectedPlacement() : minimumSpeedMbps(0) {}
+	};
+
+	// Where a camera is now
+	struct SUsbObservedPlacement
+	{
+		std::string serialNumber;
+		std::string portPath;            // empty if the camera isn't connected
+		std::string controller;
+		unsigned int speedMbps;          // 0 if unknown
+
+		SUsbObservedPlacement() : speedMbps(0) {}
+	};
+
+	enum EUsbPlacementProblem
+	{
+		UsbPlacement_Missing = 0,        // not connected at all
+		UsbPlacement_Swapped,            // it and another camera are in each other's ports
+		UsbPlacement_Misplaced,          // in another port of the right controller
+		UsbPlacement_WrongController,    // on another controller, sharing bandwidth planned for other cameras
+		UsbPlacement_Downgraded,         // linked slower than planned
+		UsbPlacement_Unmapped            // connected, but not in the map
+	};
+
+	// One thing wrong with a camera's placement, and what to do about it
+	struct SUsbPlacementFinding
+	{
+		std::string serialNumber;
+		EUsbPlacementProblem problem;
+		SUsbExpectedPlacement expected;
+		SUsbObservedPlacement observed;
+		std::string otherSerialNumber;   // the camera it's swapped with, or the one in its planned port
+		std::string action;              // eg: "Move camera 40012345 from port 2-1.4 to port 2-1.3."
+
+		SUsbPlacementFinding() : problem(UsbPlacement_Missing) {}
+	};
+
+	// The planned placement of every camera, usually loaded from a file kept with the bandwidth plan:
+	//
+	//   # line 2, top camera
+	//   [camera 40012345]
+	//   port = PCIROOT(0)#PCI(1400)#USBROOT(0)#USB(3)
+	//   controller = PCIROOT(0)#PCI(1400)
+	//   min_speed = 5000
+	//
+	// Cameras are checked one at a time as they are found (eg: by each camera's manager after it initializes and after
+	// every recovery) or all at once. The map remembers where each camera was last seen, so two cameras plugged into
+	// each other's ports are reported as a swap once both have been checked. Thread safe, one map can serve all managers.
+	class CUsbCameraPlacementMap
+	{
+	private:
+		mutable std::mutex m_lock;
+		std::map<std::string, SUsbExpectedPlacement> m_expected;
+		std::map<std::string, SUsbObservedPlacement> m_observed;   // where each camera was last seen
+
+		// the camera last seen in a port, other than serialNumber (m_lock held)
+		std::string FindOccupant(const std::string& portPath, const std::string& serialNumber) const;
+
+		// the findings of one mapped camera against what is known of the others (m_lock held)
+		void Compare(const SUsbExpectedPlacement& expected, const SUsbObservedPlacement& observed, std::vector<SUsbPlacementFinding>& findings) const;
+
+	public:
+		CUsbCameraPlacementMap();
+
+		bool Parse(const std::string& text, std::string& errorMessage);
+
+		bool Load(const std::string& path, std::string& errorMessage);
+
+		void SetExpected(const SUsbExpectedPlacement& expected);
+
+		void RemoveExpected(const std::string& serialNumber);
+
+		bool GetExpected(const std::string& serialNumber, SUsbExpectedPlacement& expected) const;
+
+		size_t GetCount() const;
+
+		// Checks one camera and remembers where it is. Appends its findings, none if it's where it belongs or unmapped.
+		void Check(const SUsbObservedPlacement& observed, std::vector<SUsbPlacementFinding>& findings);
+
+		// Checks the whole live topology: every mapped camera, including the ones that aren't there, and the connected ones
+		// that aren't mapped. Returns true if nothing is wrong.
+		bool CheckAll(const std::vector<SUsbObservedPlacement>& observed, std::vector<SUsbPlacementFinding>& findings);
+
+		// "missing", "swapped", "misplaced", "wrong_controller", "downgraded", "unmapped"
+		static const char* ProblemToString(EUsbPlacementProblem problem);
+
+		// The link speed of a UsbPortVersionBcd (eg: "0x0300" is 5000 Mbps)
+		static unsigned int SpeedFromPortVersion(const std::string& portVersionBcd);
+
+		// For reference, one line per finding with its corrective action
+		static std::string FormatFindings(const std::vector<SUsbPlacementFinding>& findings);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CUsbCameraPlacementMap::CUsbCameraPlacementMap()
+{
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraPlacementMap::Parse(const std::string& text, std::string& errorMessage)
+{
+	std::istringstream input(text);
+	std::string line;
+	int lineNumber = 0;
+	std::vector<SUsbExpectedPlacement> placements;
+
+	while (std::getline(input, line))
+	{
+		lineNumber++;
+
+		// strip comments and whitespace (port paths contain '#', so comments must start the line)
+		std::size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+		line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+
+		std::string where = "Error: CUsbCameraPlacementMap::Parse(): line " + std::to_string(lineNumber) + ": ";
+
+		if (line[0] == '[')
+		{
+			if (line.compare(0, 8, "[camera ") != 0 || line[line.size() - 1] != ']')
+			{
+				errorMessage = where + "expected [camera <serial number>]";
+				return false;
+			}
+			placements.push_back(SUsbExpectedPlacement());
+			placements.back().serialNumber = line.substr(8, line.size() - 9);
+			continue;
+		}
+
+		std::size_t equals = line.find('=');
+		if (placements.empty() || equals == std::string::npos)
+		{
+			errorMessage = where + "expected key = value inside a [camera]";
+			return false;
+		}
+
+		std::string key = line.substr(0, line.find_last_not_of(" \t", equals - 1) + 1);
+		std::string value = line.substr(line.find_first_not_of(" \t", equals + 1) == std::string::npos ? line.size() : line.find_first_not_of(" \t", equals + 1));
+
+		SUsbExpectedPlacement& current = placements.back();
+		if (key == "port")
+			current.portPath = value;
+		else if (key == "controller")
+			current.controller = value;
+		else if (key == "min_speed")
+			current.minimumSpeedMbps = (unsigned int)strtoul(value.c_str(), NULL, 10);
+		else
+		{
+			errorMessage = where + "unknown key '" + key + "'";
+			return false;
+		}
+	}
+
+	for (size_t i = 0; i < placements.size(); i++)
+		SetExpected(placements[i]);
+	return true;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraPlacementMap::Load(const std::string& path, std::string& errorMessage)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+		errorMessage = "Error: CUsbCameraPlacementMap::Load(): Unable to open ";
+		errorMessage.append(path);
+		return false;
+	}
+
+	std::stringstream text;
+	text << file.rdbuf();
+	return Parse(text.str(), errorMessage);
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraPlacementMap::SetExpected(const SUsbExpectedPlacement& expected)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_expected[expected.serialNumber] = expected;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraPlacementMap::RemoveExpected(const std::string& serialNumber)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_expected.erase(serialNumber);
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraPlacementMap::GetExpected(const std::string& serialNumber, SUsbExpectedPlacement& expected) const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SUsbExpectedPlacement>::const_iterator found = m_expected.find(serialNumber);
+	if (found == m_expected.end())
+		return false;
+	expected = found->second;
+	return true;
+}
+
+inline size_t UsbCameraDeviceManager::CUsbCameraPlacementMap::GetCount() const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_expected.size();
+}
+
+inline std::string UsbCameraDeviceManager::CUsbCameraPlacementMap::FindOccupant(const std::string& portPath, const std::string& serialNumber) const
+{
+	for (std::map<std::string, SUsbObservedPlacement>::const_iterator it = m_observed.begin(); it != m_observed.end(); ++it)
+	{
+		if (it->first != serialNumber && it->second.portPath == portPath)
+			return it->first;
+	}
+	return "";
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraPlacementMap::Compare(const SUsbExpectedPlacement& expected, const SUsbObservedPlacement& observed, std::vector<SUsbPlacementFinding>& findings) const
+{
+	SUsbPlacementFinding finding;
+	finding.serialNumber = expected.serialNumber;
+	finding.expected = expected;
+	finding.observed = observed;
+
+	if (observed.portPath == "")
+	{
+		finding.problem = UsbPlacement_Missing;
+		finding.action = "Connect camera " + expected.serialNumber + " to port " + expected.portPath;
+		if (expected.controller != "")
+			finding.action.append(" (controller " + expected.controller + ")");
+		finding.action.append(" and check its cable.");
+		findings.push_back(finding);
+		return;
+	}
+
+	bool portMatches = expected.portPath == "" || observed.portPath == expected.portPath;
+	bool controllerMatches = expected.controller == "" || observed.controller == expected.controller;
+	if (portMatches == false || controllerMatches == false)
+	{
+		std::string occupant = (expected.portPath != "") ? FindOccupant(expected.portPath, expected.serialNumber) : "";
+		std::map<std::string, SUsbExpectedPlacement>::const_iterator other = m_expected.find(occupant);
+		finding.otherSerialNumber = occupant;
+
+		if (occupant != "" && other != m_expected.end() && other->second.portPath == observed.portPath)
+		{
+			finding.problem = UsbPlacement_Swapped;
+			finding.action = "Cameras " + expected.serialNumber + " and " + occupant + " are in each other's ports: move " + expected.serialNumber +
+				" to port " + expected.portPath + " and " + occupant + " to port " + observed.portPath + ".";
+		}
+		else
+		{
+			finding.problem = controllerMatches ? UsbPlacement_Misplaced : UsbPlacement_WrongController;
+			finding.action = "Move camera " + expected.serialNumber + " from port " + observed.portPath + " to port " + expected.portPath;
+			if (controllerMatches == false)
+				finding.action.append(", it is on controller " + observed.controller + " instead of " + expected.controller + " and shares bandwidth planned for other cameras");
+			if (occupant != "")
+				finding.action.append(" (camera " + occupant + " is there now)");
+			finding.action.append(".");
+		}
+		findings.push_back(finding);
+	}
+
+	if (expected.minimumSpeedMbps > 0 && observed.speedMbps > 0 && observed.speedMbps < expected.minimumSpeedMbps)
+	{
+		finding.problem = UsbPlacement_Downgraded;
+		finding.otherSerialNumber = "";
+		finding.action = "Camera " + expected.serialNumber + " links at " + std::to_string(observed.speedMbps) + " Mbps instead of " +
+			std::to_string(expected.minimumSpeedMbps) + ": reseat it, use a USB 3 cable and make sure no USB 2 hub or extension is in the path.";
+		findings.push_back(finding);
+	}
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraPlacementMap::Check(const SUsbObservedPlacement& observed, std::vector<SUsbPlacementFinding>& findings)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (observed.portPath != "")
+		m_observed[observed.serialNumber] = observed;
+	else
+		m_observed.erase(observed.serialNumber);
+
+	std::map<std::string, SUsbExpectedPlacement>::const_iterator expected = m_expected.find(observed.serialNumber);
+	if (expected != m_expected.end())
+		Compare(expected->second, observed, findings);
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraPlacementMap::CheckAll(const std::vector<SUsbObservedPlacement>& observed, std::vector<SUsbPlacementFinding>& findings)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	size_t before = findings.size();
+
+	// the whole topology replaces what was seen before
+	m_observed.clear();
+	for (size_t i = 0; i < observed.size(); i++)
+	{
+		if (observed[i].portPath != "")
+			m_observed[observed[i].serialNumber] = observed[i];
+	}
+
+	for (std::map<std::string, SUsbExpectedPlacement>::const_iterator it = m_expected.begin(); it != m_expected.end(); ++it)
+	{
+		std::map<std::string, SUsbObservedPlacement>::const_iterator seen = m_observed.find(it->first);
+		SUsbObservedPlacement missing;
+		missing.serialNumber = it->first;
+		Compare(it->second, (seen != m_observed.end()) ? seen->second : missing, findings);
+	}
+
+	for (std::map<std::string, SUsbObservedPlacement>::const_iterator it = m_observed.begin(); it != m_observed.end(); ++it)
+	{
+		if (m_expected.find(it->first) != m_expected.end())
+			continue;
+
+		SUsbPlacementFinding finding;
+		finding.serialNumber = it->first;
+		finding.problem = UsbPlacement_Unmapped;
+		finding.observed = it->second;
+		finding.action = "Camera " + it->first + " on port " + it->second.portPath + " is not in the placement map: add it to the plan or remove it.";
+		findings.push_back(finding);
+	}
+
+	return findings.size() == before;
+}
+
+inline const char* UsbCameraDeviceManager::CUsbCameraPlacementMap::ProblemToString(EUsbPlacementProblem problem)
+{
+	switch (problem)
+	{
+	case UsbPlacement_Missing: return "missing";
+	case UsbPlacement_Swapped: return "swapped";
+	case UsbPlacement_Misplaced: return "misplaced";
+	case UsbPlacement_WrongController: return "wrong_controller";
+	case UsbPlacement_Downgraded: return "downgraded";
+	case UsbPlacement_Unmapped: return "unmapped";
+	default: return "unknown";
+	}
+}
+
+inline unsigned int UsbCameraDeviceManager::CUsbCameraPlacementMap::SpeedFromPortVersion(const std::string& portVersionBcd)
+{
+	unsigned long bcd = strtoul(portVersionBcd.c_str(), NULL, 16);
+	// the version says what the port supports, not the SuperSpeed generation, so any 3.x counts as 5000
+	if (bcd >= 0x0300)
+		return 5000;
+	if (bcd >= 0x0200)
+		return 480;
+	if (bcd >= 0x0100)
+		return 12;
+	return 0;
+}
+
+inline std::string UsbCameraDeviceManager::CUsbCameraPlacementMap::FormatFindings(const std::vector<SUsbPlacementFinding>& findings)
+{
+	std::string text;
+	for (size_t i = 0; i < findings.size(); i++)
+	{
+		text.append(findings[i].serialNumber);
+		text.append(" ");
+		text.append(ProblemToString(findings[i].problem));
+		text.append(": ");
+		text.append(findings[i].action);
+		text.append("\n");
+	}
+	return text;
+}
+// *********************************************************************************************************
+
+#endif
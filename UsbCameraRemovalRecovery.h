@@ -0,0 +1,592 @@
+// UsbCameraRemovalRecovery.h
+// Starts recovering a camera the moment pylon reports it removed, instead of at the next grab timeout
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERAREMOVALRECOVERY_H
+#define USBCAMERAREMOVALRECOVERY_H
+
+#include <pylon/PylonIncludes.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "UsbCameraStateCache.h"
+#include "UsbClock.h"
+
+namespace UsbCameraDeviceManager
+{
+	struct SUsbRemovalRecoveryResult
+	{
+		std::string serialNumber;
+		bool recovered;              // back and reattached
+		unsigned int queuedMs;       // removal callback until recovery started (other cameras ahead of it)
+		unsigned int readyMs;        // removal callback until the camera could be opened again
+		unsigned int totalMs;        // removal callback until reattached and restored
+		SUsbCameraRestoreTiming restore;   // reattach, feature restore and first frame, if the connection reports them
+		std::string errorMessage;
+	};
+
+	// The pylon side of one camera, so tests can drive removals without hardware
+	class IUsbCameraConnection
+	{
+	public:
+		virtual ~IUsbCameraConnection() {}
+
+		virtual std::string GetSerialNumber() = 0;
+
+		// onRemoved may be called on any thread and only queues work
+		virtual bool Subscribe(std::function<void()> onRemoved, std::string& errorMessage) = 0;
+
+		virtual void Unsubscribe() = 0;
+
+		// Drops the dead device and opens the one that came back
+		virtual bool Reattach(std::string& errorMessage) = 0;
+
+		// How the last Reattach() went past re-enumeration, if the connection measures it
+		virtual bool GetRestoreTiming(SUsbCameraRestoreTiming& timing) { (void)timing; return false; }
+	};
+
+	// Connects a CInstantCamera through its configuration event handler. Grabbing isn't restarted on reattach, that's up to the application.
+	class CPylonCameraConnection : public IUsbCameraConnection, public Pylon::CConfigurationEventHandler
+	{
+	private:
+		Pylon::CInstantCamera& m_camera;
+		std::string m_serialNumber;
+		std::function<void()> m_onRemoved;
+		std::mutex m_lock;
+		bool m_subscribed;
+		CUsbCameraStateCache* m_stateCache;
+		unsigned int m_firstFrameTimeoutMs;
+		SUsbCameraRestoreTiming m_timing;
+
+	public:
+		// The camera must have its device attached
+		CPylonCameraConnection(Pylon::CInstantCamera& camera);
+
+		// Restores the camera's last snapshot after reattaching, and if firstFrameTimeoutMs isn't 0 times the first frame
+		// (with the frame start trigger off, see CUsbCameraStateCache::MeasureTimeToFirstFrame()). Leave it 0 if the
+		// application can't spare a frame. If the cache has no snapshot of the camera yet, one is taken when subscribing.
+		// The cache must outlive this object.
+		void SetStateCache(CUsbCameraStateCache* stateCache, unsigned int firstFrameTimeoutMs = 0);
+
+		~CPylonCameraConnection();
+
+		virtual std::string GetSerialNumber();
+		virtual bool Subscribe(std::function<void()> onRemoved, std::string& errorMessage);
+		virtual void Unsubscribe();
+		virtual bool Reattach(std::string& errorMessage);
+		virtual bool GetRestoreTiming(SUsbCameraRestoreTiming& timing);
+
+		// pylon calls this on its own thread
+		virtual void OnCameraDeviceRemoved(Pylon::CInstantCamera& camera);
+	};
+
+	// Recovers registered cameras as soon as they are removed, each on a thread of its own, so a camera that doesn't come
+	// back doesn't hold up the others. Each gets the whole timeout from when its wait starts.
+	class CUsbCameraRemovalRecovery
+	{
+	public:
+		// Waits until the camera can be opened again, like CUsbCameraDeviceManager::WaitForCameraReady()
+		typedef std::function<bool(const std::string& serialNumber, unsigned int timeoutMs, unsigned int& elapsedMs, std::string& errorMessage)> ReadyWaiter;
+
+		typedef std::function<void(const SUsbRemovalRecoveryResult& result)> ResultHandler;
+
+	private:
+		struct SPendingRecovery
+		{
+			std::string serialNumber;
+			uint64_t removedAtMs;
+		};
+
+		// a recovery under way, until its thread has returned from the result handler
+		struct SRecovery
+		{
+			std::thread thread;
+			bool reattaching;        // a removal from now on is a new one
+			bool connectionInUse;    // Unregister() has to wait
+			bool finished;
+		};
+
+		ReadyWaiter m_waitForReady;
+		std::mutex m_waitForReadyLock;   // the shared waiter is called by one recovery at a time
+		ResultHandler m_onResult;
+		unsigned int m_timeoutMs;
+		IUsbClock& m_clock;
+		std::map<std::string, IUsbCameraConnection*> m_connections;
+		std::map<std::string, ReadyWaiter> m_waiters;
+		std::deque<SPendingRecovery> m_pending;
+		std::map<std::string, SRecovery> m_recoveries;
+		std::vector<SUsbRemovalRecoveryResult> m_results;
+		std::mutex m_lock;
+		std::condition_variable m_changed;
+		bool m_stopping;
+		std::thread m_worker;
+
+		void OnRemoved(const std::string& serialNumber);
+
+		// Starts the recoveries of removed cameras and joins the finished ones
+		void Run();
+
+		void Recover(SPendingRecovery pending, IUsbCameraConnection* connection, ReadyWaiter waitForReady);
+
+		// with m_lock held
+		bool HasFinishedRecovery();
+		bool HasStartableRecovery();
+
+	public:
+		// waitForReady is shared by the cameras registered without a waiter of their own, and called for one of them
+		// at a time. clock timestamps removals, and should be the one the waiters wait on. NULL for the steady clock.
+		CUsbCameraRemovalRecovery(ReadyWaiter waitForReady, unsigned int timeoutMs = 15000, IUsbClock* clock = NULL);
+
+		~CUsbCameraRemovalRecovery();
+
+		// Called on the camera's recovery thread after each recovery, possibly for several cameras at once. The handler
+		// may unregister cameras, including the one it is told about.
+		void SetResultHandler(ResultHandler onResult);
+
+		// The connection must outlive its registration. A camera with a waiter of its own (eg: from a manager of its own)
+		// is waited for in parallel with the others, otherwise the shared waiter is used.
+		bool Register(IUsbCameraConnection* connection, std::string& errorMessage, ReadyWaiter waitForReady = ReadyWaiter());
+
+		// Waits until a recovery of this camera already under way is done with its connection
+		void Unregister(const std::string& serialNumber);
+
+		// True once nothing is queued or running
+		bool WaitForIdle(unsigned int timeoutMs);
+
+		// Results since the last call
+		std::vector<SUsbRemovalRecoveryResult> TakeResults();
+
+		// Stops after the recoveries under way. Queued removals are dropped.
+		void Stop();
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CPylonCameraConnection::CPylonCameraConnection(Pylon::CInstantCamera& camera)
+	: m_camera(camera)
+{
+	m_serialNumber = m_camera.GetDeviceInfo().GetSerialNumber().c_str();
+	m_subscribed = false;
+	m_stateCache = NULL;
+	m_firstFrameTimeoutMs = 0;
+}
+
+inline UsbCameraDeviceManager::CPylonCameraConnection::~CPylonCameraConnection()
+{
+	Unsubscribe();
+}
+
+inline void UsbCameraDeviceManager::CPylonCameraConnection::SetStateCache(CUsbCameraStateCache* stateCache, unsigned int firstFrameTimeoutMs)
+{
+	m_stateCache = stateCache;
+	m_firstFrameTimeoutMs = firstFrameTimeoutMs;
+}
+
+inline bool UsbCameraDeviceManager::CPylonCameraConnection::GetRestoreTiming(SUsbCameraRestoreTiming& timing)
+{
+	timing = m_timing;
+	return m_stateCache != NULL;
+}
+
+inline std::string UsbCameraDeviceManager::CPylonCameraConnection::GetSerialNumber()
+{
+	return m_serialNumber;
+}
+
+inline bool UsbCameraDeviceManager::CPylonCameraConnection::Subscribe(std::function<void()> onRemoved, std::string& errorMessage)
+{
+	try
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_onRemoved = onRemoved;
+		}
+		if (m_subscribed == false)
+		{
+			// we own this handler, pylon mustn't delete it
+			m_camera.RegisterConfiguration(this, Pylon::RegistrationMode_Append, Pylon::Cleanup_None);
+			m_subscribed = true;
+		}
+
+		// a loss can't be snapshotted after the fact, so make sure there is something to restore
+		SUsbCameraStateSnapshot snapshot;
+		std::string snapshotError;
+		if (m_stateCache != NULL && m_stateCache->GetSnapshot(m_serialNumber, snapshot) == false && m_camera.IsOpen())
+			m_stateCache->TakeSnapshot(m_camera, false, snapshotError);
+		return true;
+	}
+	catch (const GenICam::GenericException &e)
+	{
+		errorMessage = "Error: CPylonCameraConnection::Subscribe(): GenICam exception occurred. ";
+		errorMessage.append(e.GetDescription());
+		return false;
+	}
+}
+
+inline void UsbCameraDeviceManager::CPylonCameraConnection::Unsubscribe()
+{
+	if (m_subscribed)
+		m_camera.DeregisterConfiguration(this);
+	m_subscribed = false;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_onRemoved = std::function<void()>();
+}
+
+inline bool UsbCameraDeviceManager::CPylonCameraConnection::Reattach(std::string& errorMessage)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	m_timing = SUsbCameraRestoreTiming();
+
+	try
+	{
+		// the handler registration belongs to the CInstantCamera, so it survives the device swap
+		m_camera.DestroyDevice();
+
+		Pylon::CDeviceInfo info;
+		info.SetDeviceClass(Pylon::BaslerUsbDeviceClass);
+		info.SetSerialNumber(m_serialNumber.c_str());
+		m_camera.Attach(Pylon::CTlFactory::GetInstance().CreateDevice(info));
+		m_camera.Open();
+		m_timing.reattachMs = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+		if (m_stateCache == NULL)
+			return true;
+
+		if (m_stateCache->Restore(m_camera, m_timing.restoreMs, errorMessage) == false)
+			return false;
+
+		if (m_firstFrameTimeoutMs != 0)
+			return CUsbCameraStateCache::MeasureTimeToFirstFrame(m_camera, m_firstFrameTimeoutMs, m_timing.firstFrameMs, errorMessage);
+		return true;
+	}
+	catch (const GenICam::GenericException &e)
+	{
+		errorMessage = "Error: CPylonCameraConnection::Reattach(): GenICam exception occurred. ";
+		errorMessage.append(e.GetDescription());
+		return false;
+	}
+}
+
+inline void UsbCameraDeviceManager::CPylonCameraConnection::OnCameraDeviceRemoved(Pylon::CInstantCamera& camera)
+{
+	(void)camera;
+	std::function<void()> onRemoved;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		onRemoved = m_onRemoved;
+	}
+	if (onRemoved)
+		onRemoved();
+}
+
+inline UsbCameraDeviceManager::CUsbCameraRemovalRecovery::CUsbCameraRemovalRecovery(ReadyWaiter waitForReady, unsigned int timeoutMs, IUsbClock* clock)
+	: m_waitForReady(waitForReady), m_clock((clock != NULL) ? *clock : CSystemUsbClock::Instance())
+{
+	m_timeoutMs = timeoutMs;
+	m_stopping = false;
+	m_worker = std::thread(&CUsbCameraRemovalRecovery::Run, this);
+}
+
+inline UsbCameraDeviceManager::CUsbCameraRemovalRecovery::~CUsbCameraRemovalRecovery()
+{
+	std::vector<std::string> serialNumbers;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (std::map<std::string, IUsbCameraConnection*>::iterator it = m_connections.begin(); it != m_connections.end(); ++it)
+			serialNumbers.push_back(it->first);
+	}
+	for (size_t i = 0; i < serialNumbers.size(); i++)
+		Unregister(serialNumbers[i]);
+
+	Stop();
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraRemovalRecovery::SetResultHandler(ResultHandler onResult)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_onResult = onResult;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraRemovalRecovery::Register(IUsbCameraConnection* connection, std::string& errorMessage, ReadyWaiter waitForReady)
+{
+	if (connection == NULL)
+	{
+		errorMessage = "Error: CUsbCameraRemovalRecovery::Register(): Connection is NULL.";
+		return false;
+	}
+
+	std::string serialNumber = connection->GetSerialNumber();
+	if (serialNumber == "")
+	{
+		errorMessage = "Error: CUsbCameraRemovalRecovery::Register(): Serial Number Invalid.";
+		return false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_connections.find(serialNumber) != m_connections.end())
+		{
+			errorMessage = "Error: CUsbCameraRemovalRecovery::Register(): Camera ";
+			errorMessage.append(serialNumber);
+			errorMessage.append(" is already registered.");
+			return false;
+		}
+		m_connections[serialNumber] = connection;
+		if (waitForReady)
+			m_waiters[serialNumber] = waitForReady;
+	}
+
+	if (connection->Subscribe([this, serialNumber]() { OnRemoved(serialNumber); }, errorMessage) == false)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_connections.erase(serialNumber);
+		m_waiters.erase(serialNumber);
+		return false;
+	}
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraRemovalRecovery::Unregister(const std::string& serialNumber)
+{
+	IUsbCameraConnection* connection = NULL;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		std::map<std::string, IUsbCameraConnection*>::iterator it = m_connections.find(serialNumber);
+		if (it == m_connections.end())
+			return;
+		connection = it->second;
+	}
+
+	// not under our lock, pylon may be inside the callback waiting for it
+	connection->Unsubscribe();
+
+	// the result handler runs after the connection is released, so it can unregister without waiting on itself
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_changed.wait(lock, [&]()
+	{
+		std::map<std::string, SRecovery>::iterator it = m_recoveries.find(serialNumber);
+		return it == m_recoveries.end() || it->second.connectionInUse == false;
+	});
+	m_connections.erase(serialNumber);
+	m_waiters.erase(serialNumber);
+	for (std::deque<SPendingRecovery>::iterator it = m_pending.begin(); it != m_pending.end();)
+	{
+		if (it->serialNumber == serialNumber)
+			it = m_pending.erase(it);
+		else
+			++it;
+	}
+	m_changed.notify_all();
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraRemovalRecovery::OnRemoved(const std::string& serialNumber)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_stopping || m_connections.find(serialNumber) == m_connections.end())
+		return;
+
+	// pylon can report a removal more than once, one recovery covers them all. Once the recovery under way reattaches,
+	// a removal is a new one and is recovered after it.
+	std::map<std::string, SRecovery>::iterator recovery = m_recoveries.find(serialNumber);
+	if (recovery != m_recoveries.end() && recovery->second.reattaching == false)
+		return;
+	for (size_t i = 0; i < m_pending.size(); i++)
+	{
+		if (m_pending[i].serialNumber == serialNumber)
+			return;
+	}
+
+	SPendingRecovery pending;
+	pending.serialNumber = serialNumber;
+	pending.removedAtMs = m_clock.NowMs();
+	m_pending.push_back(pending);
+	m_changed.notify_all();
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraRemovalRecovery::HasFinishedRecovery()
+{
+	for (std::map<std::string, SRecovery>::iterator it = m_recoveries.begin(); it != m_recoveries.end(); ++it)
+	{
+		if (it->second.finished)
+			return true;
+	}
+	return false;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraRemovalRecovery::HasStartableRecovery()
+{
+	for (size_t i = 0; i < m_pending.size(); i++)
+	{
+		if (m_recoveries.find(m_pending[i].serialNumber) == m_recoveries.end())
+			return true;
+	}
+	return false;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraRemovalRecovery::Run()
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (true)
+	{
+		m_changed.wait(lock, [&]() { return (m_stopping && m_recoveries.empty()) || HasFinishedRecovery() || HasStartableRecovery(); });
+
+		// a finished recovery has left the lock for good
+		for (std::map<std::string, SRecovery>::iterator it = m_recoveries.begin(); it != m_recoveries.end();)
+		{
+			if (it->second.finished)
+			{
+				it->second.thread.join();
+				it = m_recoveries.erase(it);
+			}
+			else
+				++it;
+		}
+
+		if (m_stopping)
+		{
+			if (m_recoveries.empty())
+				return;
+			continue;
+		}
+
+		// a camera removed again while it is being recovered waits for that recovery
+		for (std::deque<SPendingRecovery>::iterator it = m_pending.begin(); it != m_pending.end();)
+		{
+			if (m_recoveries.find(it->serialNumber) != m_recoveries.end())
+			{
+				++it;
+				continue;
+			}
+
+			SPendingRecovery pending = *it;
+			it = m_pending.erase(it);
+			std::map<std::string, IUsbCameraConnection*>::iterator connection = m_connections.find(pending.serialNumber);
+			if (connection == m_connections.end())
+				continue;
+			std::map<std::string, ReadyWaiter>::iterator waiter = m_waiters.find(pending.serialNumber);
+
+			SRecovery& recovery = m_recoveries[pending.serialNumber];
+			recovery.reattaching = false;
+			recovery.connectionInUse = true;
+			recovery.finished = false;
+			recovery.thread = std::thread(&CUsbCameraRemovalRecovery::Recover, this, pending, connection->second,
+				(waiter != m_waiters.end()) ? waiter->second : ReadyWaiter());
+		}
+	}
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraRemovalRecovery::Recover(SPendingRecovery pending, IUsbCameraConnection* connection, ReadyWaiter waitForReady)
+{
+	SUsbRemovalRecoveryResult result;
+	result.serialNumber = pending.serialNumber;
+	result.recovered = false;
+	result.readyMs = 0;
+
+	unsigned int elapsedMs = 0;
+	bool ready = false;
+	if (waitForReady)
+	{
+		result.queuedMs = (unsigned int)(m_clock.NowMs() - pending.removedAtMs);
+		ready = waitForReady(pending.serialNumber, m_timeoutMs, elapsedMs, result.errorMessage);
+	}
+	else
+	{
+		// the shared waiter (eg: one manager's WaitForCameraReady()) isn't made to be called for several cameras at once
+		std::lock_guard<std::mutex> waitLock(m_waitForReadyLock);
+		result.queuedMs = (unsigned int)(m_clock.NowMs() - pending.removedAtMs);
+		ready = m_waitForReady(pending.serialNumber, m_timeoutMs, elapsedMs, result.errorMessage);
+	}
+
+	if (ready)
+	{
+		result.readyMs = result.queuedMs + elapsedMs;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_recoveries[pending.serialNumber].reattaching = true;
+		}
+		result.recovered = connection->Reattach(result.errorMessage);
+		connection->GetRestoreTiming(result.restore);
+	}
+	result.totalMs = (unsigned int)(m_clock.NowMs() - pending.removedAtMs);
+
+	// from here on Unregister() may let the connection go
+	ResultHandler onResult;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		SRecovery& recovery = m_recoveries[pending.serialNumber];
+		recovery.reattaching = true;
+		recovery.connectionInUse = false;
+		m_results.push_back(result);
+		onResult = m_onResult;
+		m_changed.notify_all();
+	}
+
+	if (onResult)
+		onResult(result);
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_recoveries[pending.serialNumber].finished = true;
+	m_changed.notify_all();
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraRemovalRecovery::WaitForIdle(unsigned int timeoutMs)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	return m_changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]()
+	{
+		if (m_pending.empty() == false)
+			return false;
+		for (std::map<std::string, SRecovery>::iterator it = m_recoveries.begin(); it != m_recoveries.end(); ++it)
+		{
+			if (it->second.finished == false)
+				return false;
+		}
+		return true;
+	});
+}
+
+inline std::vector<UsbCameraDeviceManager::SUsbRemovalRecoveryResult> UsbCameraDeviceManager::CUsbCameraRemovalRecovery::TakeResults()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::vector<SUsbRemovalRecoveryResult> results;
+	results.swap(m_results);
+	return results;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraRemovalRecovery::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stopping = true;
+		m_pending.clear();
+		m_changed.notify_all();
+	}
+	if (m_worker.joinable())
+		m_worker.join();
+}
+// *********************************************************************************************************
+
+#endif
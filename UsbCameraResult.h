@@ -0,0 +1,201 @@
+// UsbCameraResult.h
+// The typed outcome of a camera device operation: what went wrong, where, the OS error and how long it took
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERARESULT_H
+#define USBCAMERARESULT_H
+
+#include <string>
+#include <cstring>
+
+
+namespace UsbCameraDeviceManager
+{
+	enum EUsbResultCode
+	{
+		UsbResult_Ok = 0,
+		UsbResult_InvalidArgument,       // eg: no serial number, not initialized
+		UsbResult_NotConfigured,         // something the operation needs wasn't set (eg: a placement map)
+		UsbResult_DeviceNotFound,        // not enumerated, or the OS doesn't know the device
+		UsbResult_DeviceRemoved,         // went away while it was being worked on
+		UsbResult_AccessDenied,          // administrator rights required
+		UsbResult_Busy,                  // another process is recovering the camera
+		UsbResult_Timeout,
+		UsbResult_NotAvailable,          // not supported on this host (eg: a power setting)
+		UsbResult_Misplaced,             // not where the placement map puts it
+		UsbResult_AcceptanceFailed,      // back, but didn't stream well enough, see detail
+		UsbResult_OsError,               // any other OS error, see osError
+		UsbResult_Failed,                // a collaborator failed (eg: restoring the camera's state), see detail
+		UsbResult_PylonException,
+		UsbResult_StdException,
+		UsbResult_UnknownException,
+		UsbResult_Count
+	};
+
+	// Success carries no text, so making, copying and comparing one never touches the heap. The message is only
+	// formatted when someone asks for it. function and phase point to static text.
+	struct SUsbResult
+	{
+		EUsbResultCode code;
+		const char* function;            // the operation that failed, eg: "DisableCompositeDevice". "" if detail is a complete message.
+		const char* phase;               // the call inside it that failed, eg: "SetupDiCallClassInstaller". "" if none.
+		unsigned long osError;           // GetLastError(), errno, ... 0 if none
+		unsigned int elapsedMs;          // how long the operation ran
+		std::string detail;              // eg: the exception's text, failures only
+
+		SUsbResult() : code(UsbResult_Ok), function(""), phase(""), osError(0), elapsedMs(0) {}
+
+		SUsbResult(EUsbResultCode code_, const char* function_, const char* phase_ = "", unsigned long osError_ = 0)
+			: code(code_), function(function_), phase(phase_), osError(osError_), elapsedMs(0) {}
+
+		bool Succeeded() const;
+
+		// Same outcome, regardless of how long it took
+		bool operator==(const SUsbResult& other) const;
+		bool operator!=(const SUsbResult& other) const;
+
+		// eg: "Error: DisableCompositeDevice(): SetupDiCallClassInstaller(): Error code 5. Administrator rights required."
+		// Empty for success.
+		std::string FormatErrorMessage() const;
+
+		// "ok", "invalid_argument", "not_configured", "device_not_found", "device_removed", "access_denied", "busy", "timeout",
+		// "not_available", "misplaced", "acceptance_failed", "os_error", "failed", "pylon_exception", "std_exception", "unknown_exception"
+		static const char* CodeToString(EUsbResultCode code);
+
+		// What a code means, in a sentence
+		static const char* DescribeCode(EUsbResultCode code);
+	};
+
+	// Told about every library call that acts on a camera once it is done, eg: to record it into an incident
+	// (CUsbIncidentRecorder) or to let a replayed incident respond to it (CUsbIncidentReplayer). Called on the thread
+	// that made the call, so it must be quick and must not call back into the object that reports.
+	class IUsbApiCallObserver
+	{
+	public:
+		virtual ~IUsbApiCallObserver() {}
+
+		// call is the function (eg: "DisableCamera", "ResetCamera"), errorMessage is empty on success
+		virtual void OnApiCall(const std::string& call, const std::string& serialNumber, bool succeeded, unsigned int durationMs, const std::string& errorMessage) = 0;
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline bool UsbCameraDeviceManager::SUsbResult::Succeeded() const
+{
+	return code == UsbResult_Ok;
+}
+
+inline bool UsbCameraDeviceManager::SUsbResult::operator==(const SUsbResult& other) const
+{
+	return code == other.code && osError == other.osError && strcmp(function, other.function) == 0
+		&& strcmp(phase, other.phase) == 0 && detail == other.detail;
+}
+
+inline bool UsbCameraDeviceManager::SUsbResult::operator!=(const SUsbResult& other) const
+{
+	return (*this == other) == false;
+}
+
+inline const char* UsbCameraDeviceManager::SUsbResult::CodeToString(EUsbResultCode code)
+{
+	switch (code)
+	{
+	case UsbResult_Ok: return "ok";
+	case UsbResult_InvalidArgument: return "invalid_argument";
+	case UsbResult_NotConfigured: return "not_configured";
+	case UsbResult_DeviceNotFound: return "device_not_found";
+	case UsbResult_DeviceRemoved: return "device_removed";
+	case UsbResult_AccessDenied: return "access_denied";
+	case UsbResult_Busy: return "busy";
+	case UsbResult_Timeout: return "timeout";
+	case UsbResult_NotAvailable: return "not_available";
+	case UsbResult_Misplaced: return "misplaced";
+	case UsbResult_AcceptanceFailed: return "acceptance_failed";
+	case UsbResult_OsError: return "os_error";
+	case UsbResult_Failed: return "failed";
+	case UsbResult_PylonException: return "pylon_exception";
+	case UsbResult_StdException: return "std_exception";
+	case UsbResult_UnknownException: return "unknown_exception";
+	default: return "unknown";
+	}
+}
+
+inline const char* UsbCameraDeviceManager::SUsbResult::DescribeCode(EUsbResultCode code)
+{
+	switch (code)
+	{
+	case UsbResult_Ok: return "";
+	case UsbResult_InvalidArgument: return "Invalid argument.";
+	case UsbResult_NotConfigured: return "Not configured.";
+	case UsbResult_DeviceNotFound: return "No matching camera devices found.";
+	case UsbResult_DeviceRemoved: return "Device may have been removed.";
+	case UsbResult_AccessDenied: return "Administrator rights required.";
+	case UsbResult_Busy: return "Camera is being recovered by another process.";
+	case UsbResult_Timeout: return "Timed out.";
+	case UsbResult_NotAvailable: return "Probably just not available on this PC.";
+	case UsbResult_Misplaced: return "Camera is not where the placement map puts it.";
+	case UsbResult_AcceptanceFailed: return "Camera failed its streaming acceptance test.";
+	case UsbResult_OsError: return "Operating system error.";
+	case UsbResult_Failed: return "Failed.";
+	case UsbResult_PylonException: return "GenICam exception occurred.";
+	case UsbResult_StdException: return "std exception occurred.";
+	case UsbResult_UnknownException: return "unknown exception occured.";
+	default: return "Unknown error.";
+	}
+}
+
+inline std::string UsbCameraDeviceManager::SUsbResult::FormatErrorMessage() const
+{
+	if (code == UsbResult_Ok)
+		return "";
+
+	// a collaborator's own message (eg: from the status board) is passed on as it is
+	if (function[0] == '\0' && detail != "")
+		return detail;
+
+	std::string message = "Error: ";
+	message.append(function);
+	message.append("(): ");
+	if (phase[0] != '\0')
+	{
+		message.append(phase);
+		message.append("(): ");
+	}
+	if (osError != 0)
+	{
+		message.append("Error code ");
+		message.append(std::to_string(osError));
+		message.append(". ");
+	}
+
+	// an exception's text only makes sense after saying what kind it was, anything else explains itself
+	bool exception = (code == UsbResult_PylonException || code == UsbResult_StdException || code == UsbResult_UnknownException);
+	if (detail == "" || exception)
+		message.append(DescribeCode(code));
+	if (detail != "")
+	{
+		if (exception)
+			message.append(" ");
+		message.append(detail);
+	}
+	return message;
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,362 @@
+// UsbCameraStateCache.h
+// Snapshots a camera's feature state and restores it in one pass after a recovery
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERASTATECACHE_H
+#define USBCAMERASTATECACHE_H
+
+#include <pylon/PylonIncludes.h>
+#include <string>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include "UsbClock.h"
+
+namespace UsbCameraDeviceManager
+{
+	enum EUsbCameraRestoreMethod
+	{
+		UsbRestore_FeatureStream = 0,   // CFeaturePersistence string kept in memory, loaded in one pass without validation
+		UsbRestore_UserSet              // saved into a user set on the camera, restored with a single UserSetLoad. Each snapshot writes the camera's flash.
+	};
+
+	struct SUsbCameraStateSnapshot
+	{
+		std::string serialNumber;
+		EUsbCameraRestoreMethod method;
+		std::string features;                          // the feature stream, UsbRestore_FeatureStream only
+		std::string userSet;                           // eg: UserSet1, UsbRestore_UserSet only
+		bool planned;                                  // taken right before a disable or reset, rather than ahead of an unplanned loss
+		std::chrono::steady_clock::time_point takenAt;
+
+		SUsbCameraStateSnapshot() : method(UsbRestore_FeatureStream), planned(false) {}
+	};
+
+	// How long getting a camera back to streaming took, past re-enumeration
+	struct SUsbCameraRestoreTiming
+	{
+		unsigned int reattachMs;      // new device attached and opened
+		unsigned int restoreMs;       // feature state applied
+		unsigned int firstFrameMs;    // grab started until the first frame arrived, 0 if not measured
+
+		SUsbCameraRestoreTiming() : reattachMs(0), restoreMs(0), firstFrameMs(0) {}
+	};
+
+	// Keeps the last feature snapshot of each camera. Take one after configuring a camera (and after changing it), so
+	// there is one to use after an unplanned loss; CUsbCameraDeviceManager takes one itself before a planned disable.
+	class CUsbCameraStateCache
+	{
+	private:
+		EUsbCameraRestoreMethod m_method;
+		std::string m_userSet;
+		IUsbClock* m_clock;
+		unsigned int m_commandTimeoutMs;
+		std::map<std::string, SUsbCameraStateSnapshot> m_snapshots;
+		mutable std::mutex m_lock;
+
+		// executes a command node and waits (on the clock) until the camera reports it done
+		bool ExecuteCommand(GenApi::INodeMap& nodeMap, const char* command, std::string& errorMessage);
+
+		// the user set the camera loads at power up: UserSetDefault (SFNC 2) or UserSetDefaultSelector
+		static std::string ReadStartupUserSet(GenApi::INodeMap& nodeMap);
+
+		// puts back the frame start trigger MeasureTimeToFirstFrame() switched off, if it did
+		static void RestoreTrigger(GenApi::CEnumerationPtr& triggerSelector, GenApi::CEnumerationPtr& triggerMode,
+			const std::string& previousTriggerSelector, const std::string& previousTriggerMode);
+
+	public:
+		// UsbRestore_UserSet needs the user set to overwrite (eg: "UserSet3"), one the application doesn't use otherwise.
+		// Snapshots refuse the factory "Default" set and the one the camera starts up with. clock is what waiting for a
+		// command sleeps on, NULL for the steady clock.
+		CUsbCameraStateCache(EUsbCameraRestoreMethod method = UsbRestore_FeatureStream, const std::string& userSet = "", IUsbClock* clock = NULL);
+
+		// How long UserSetSave and UserSetLoad may take (default 5000 ms)
+		void SetCommandTimeoutMs(unsigned int timeoutMs);
+
+		// Snapshots an open camera
+		bool TakeSnapshot(Pylon::CInstantCamera& camera, bool planned, std::string& errorMessage);
+
+		bool GetSnapshot(const std::string& serialNumber, SUsbCameraStateSnapshot& snapshot) const;
+
+		void RemoveSnapshot(const std::string& serialNumber);
+
+		// Applies the camera's last snapshot to the open camera
+		bool Restore(Pylon::CInstantCamera& camera, unsigned int& restoreMs, std::string& errorMessage);
+
+		// Starts grabbing, waits for the first frame and stops again, so the application's own grab starts from a known state.
+		// The frame start trigger is switched off meanwhile, a hardware triggered camera would wait for its next trigger
+		// (and the application would miss the frame it sent).
+		static bool MeasureTimeToFirstFrame(Pylon::CInstantCamera& camera, unsigned int timeoutMs, unsigned int& firstFrameMs, std::string& errorMessage);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CUsbCameraStateCache::CUsbCameraStateCache(EUsbCameraRestoreMethod method, const std::string& userSet, IUsbClock* clock)
+{
+	m_method = method;
+	m_userSet = userSet;
+	m_clock = (clock != NULL) ? clock : &CSystemUsbClock::Instance();
+	m_commandTimeoutMs = 5000;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStateCache::SetCommandTimeoutMs(unsigned int timeoutMs)
+{
+	m_commandTimeoutMs = timeoutMs;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStateCache::ExecuteCommand(GenApi::INodeMap& nodeMap, const char* command, std::string& errorMessage)
+{
+	GenApi::CCommandPtr node = nodeMap.GetNode(command);
+	if (GenApi::IsWritable(node) == false)
+	{
+		errorMessage = "Error: CUsbCameraStateCache: ";
+		errorMessage.append(command);
+		errorMessage.append(" is not available.");
+		return false;
+	}
+
+	node->Execute();
+
+	// a user set lives in flash, saving one takes a while. A camera that never reports done is not waited for forever.
+	uint64_t start = m_clock->NowMs();
+	while (node->IsDone() == false)
+	{
+		if (m_clock->NowMs() - start >= m_commandTimeoutMs)
+		{
+			errorMessage = "Error: CUsbCameraStateCache: ";
+			errorMessage.append(command);
+			errorMessage.append(" did not finish within ");
+			errorMessage.append(std::to_string(m_commandTimeoutMs));
+			errorMessage.append(" ms.");
+			return false;
+		}
+		m_clock->SleepMs(10);
+	}
+	return true;
+}
+
+inline std::string UsbCameraDeviceManager::CUsbCameraStateCache::ReadStartupUserSet(GenApi::INodeMap& nodeMap)
+{
+	GenApi::CEnumerationPtr startup = nodeMap.GetNode("UserSetDefault");
+	if (GenApi::IsReadable(startup) == false)
+		startup = nodeMap.GetNode("UserSetDefaultSelector");
+	if (GenApi::IsReadable(startup) == false)
+		return "";
+	return startup->ToString().c_str();
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStateCache::TakeSnapshot(Pylon::CInstantCamera& camera, bool planned, std::string& errorMessage)
+{
+	try
+	{
+		if (camera.IsOpen() == false)
+		{
+			errorMessage = "Error: TakeSnapshot(): Camera is not open.";
+			return false;
+		}
+
+		SUsbCameraStateSnapshot snapshot;
+		snapshot.serialNumber = camera.GetDeviceInfo().GetSerialNumber().c_str();
+		snapshot.method = m_method;
+		snapshot.planned = planned;
+
+		GenApi::INodeMap& nodeMap = camera.GetNodeMap();
+		if (m_method == UsbRestore_UserSet)
+		{
+			// the camera keeps it through a power cycle, restoring is one command instead of hundreds of writes. Never
+			// overwrite the set it starts up with, the next power cycle would come up with whatever was snapshotted.
+			if (m_userSet == "" || m_userSet == "Default")
+			{
+				errorMessage = "Error: TakeSnapshot(): No user set to save to, give one the application doesn't use otherwise (eg: UserSet3).";
+				return false;
+			}
+			std::string startupUserSet = ReadStartupUserSet(nodeMap);
+			if (startupUserSet == m_userSet)
+			{
+				errorMessage = "Error: TakeSnapshot(): ";
+				errorMessage.append(m_userSet);
+				errorMessage.append(" is the user set the camera starts up with, it is not overwritten.");
+				return false;
+			}
+
+			GenApi::CEnumerationPtr selector = nodeMap.GetNode("UserSetSelector");
+			if (GenApi::IsWritable(selector) == false)
+			{
+				errorMessage = "Error: TakeSnapshot(): UserSetSelector is not available.";
+				return false;
+			}
+			selector->FromString(m_userSet.c_str());
+			if (ExecuteCommand(nodeMap, "UserSetSave", errorMessage) == false)
+				return false;
+			snapshot.userSet = m_userSet;
+		}
+		else
+		{
+			Pylon::String_t features;
+			Pylon::CFeaturePersistence::SaveToString(features, &nodeMap);
+			snapshot.features = features.c_str();
+		}
+
+		snapshot.takenAt = std::chrono::steady_clock::now();
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_snapshots[snapshot.serialNumber] = snapshot;
+		return true;
+	}
+	catch (const GenICam::GenericException &e)
+	{
+		errorMessage = "Error: TakeSnapshot(): GenICam exception occurred. ";
+		errorMessage.append(e.GetDescription());
+		return false;
+	}
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStateCache::GetSnapshot(const std::string& serialNumber, SUsbCameraStateSnapshot& snapshot) const
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SUsbCameraStateSnapshot>::const_iterator it = m_snapshots.find(serialNumber);
+	if (it == m_snapshots.end())
+		return false;
+	snapshot = it->second;
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStateCache::RemoveSnapshot(const std::string& serialNumber)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_snapshots.erase(serialNumber);
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStateCache::Restore(Pylon::CInstantCamera& camera, unsigned int& restoreMs, std::string& errorMessage)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	restoreMs = 0;
+
+	try
+	{
+		SUsbCameraStateSnapshot snapshot;
+		if (GetSnapshot(camera.GetDeviceInfo().GetSerialNumber().c_str(), snapshot) == false)
+		{
+			errorMessage = "Error: Restore(): No snapshot of camera ";
+			errorMessage.append(camera.GetDeviceInfo().GetSerialNumber().c_str());
+			return false;
+		}
+
+		GenApi::INodeMap& nodeMap = camera.GetNodeMap();
+		if (snapshot.method == UsbRestore_UserSet)
+		{
+			GenApi::CEnumerationPtr selector = nodeMap.GetNode("UserSetSelector");
+			if (GenApi::IsWritable(selector) == false)
+			{
+				errorMessage = "Error: Restore(): UserSetSelector is not available.";
+				return false;
+			}
+			selector->FromString(snapshot.userSet.c_str());
+			if (ExecuteCommand(nodeMap, "UserSetLoad", errorMessage) == false)
+				return false;
+		}
+		else
+		{
+			// the stream came from this camera, validating it again would read back every feature
+			Pylon::CFeaturePersistence::LoadFromString(snapshot.features.c_str(), &nodeMap, false);
+		}
+
+		restoreMs = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		return true;
+	}
+	catch (const GenICam::GenericException &e)
+	{
+		errorMessage = "Error: Restore(): GenICam exception occurred. ";
+		errorMessage.append(e.GetDescription());
+		return false;
+	}
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStateCache::MeasureTimeToFirstFrame(Pylon::CInstantCamera& camera, unsigned int timeoutMs, unsigned int& firstFrameMs, std::string& errorMessage)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	firstFrameMs = 0;
+
+	GenApi::CEnumerationPtr triggerSelector;
+	GenApi::CEnumerationPtr triggerMode;
+	std::string previousTriggerSelector;
+	std::string previousTriggerMode;
+	try
+	{
+		// free run for the one frame, like CPylonStreamProbe does
+		GenApi::INodeMap& nodeMap = camera.GetNodeMap();
+		triggerSelector = nodeMap.GetNode("TriggerSelector");
+		triggerMode = nodeMap.GetNode("TriggerMode");
+		if (GenApi::IsWritable(triggerSelector) && GenApi::IsWritable(triggerMode))
+		{
+			previousTriggerSelector = triggerSelector->ToString().c_str();
+			triggerSelector->FromString("FrameStart");
+			previousTriggerMode = triggerMode->ToString().c_str();
+			triggerMode->FromString("Off");
+		}
+
+		Pylon::CGrabResultPtr result;
+		camera.StartGrabbing(1);
+		bool grabbed = camera.RetrieveResult(timeoutMs, result, Pylon::TimeoutHandling_Return) && result->GrabSucceeded();
+		firstFrameMs = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		camera.StopGrabbing();
+		RestoreTrigger(triggerSelector, triggerMode, previousTriggerSelector, previousTriggerMode);
+
+		if (grabbed == false)
+		{
+			errorMessage = "Error: MeasureTimeToFirstFrame(): No frame after ";
+			errorMessage.append(std::to_string(firstFrameMs));
+			errorMessage.append(" ms.");
+			firstFrameMs = 0;
+			return false;
+		}
+		return true;
+	}
+	catch (const GenICam::GenericException &e)
+	{
+		errorMessage = "Error: MeasureTimeToFirstFrame(): GenICam exception occurred. ";
+		errorMessage.append(e.GetDescription());
+		try
+		{
+			camera.StopGrabbing();   // nothing if it didn't start
+		}
+		catch (const GenICam::GenericException &) {}
+		RestoreTrigger(triggerSelector, triggerMode, previousTriggerSelector, previousTriggerMode);
+		return false;
+	}
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStateCache::RestoreTrigger(GenApi::CEnumerationPtr& triggerSelector, GenApi::CEnumerationPtr& triggerMode,
+	const std::string& previousTriggerSelector, const std::string& previousTriggerMode)
+{
+	try
+	{
+		if (previousTriggerMode != "")
+		{
+			triggerSelector->FromString("FrameStart");
+			triggerMode->FromString(previousTriggerMode.c_str());
+		}
+		if (previousTriggerSelector != "")
+			triggerSelector->FromString(previousTriggerSelector.c_str());
+	}
+	catch (const GenICam::GenericException &) {}
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,658 @@
+// UsbCameraStatusBoard.h
+// Per camera recovery state in shared memory, so separate processes don't reset each other's cameras
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCAMERASTATUSBOARD_H
+#define USBCAMERASTATUSBOARD_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include "UsbMappedFile.h"
+#ifdef LINUX_BUILD
+#include <unistd.h>
+#else
+#include <windows.h>
+#endif
+
+namespace UsbCameraDeviceManager
+{
+	enum EUsbCameraState
+	{
+		UsbCameraState_Unknown = 0,   // nobody has reported on it yet
+		UsbCameraState_Healthy,
+		UsbCameraState_Recovering,
+		UsbCameraState_Failed         // the last recovery didn't bring it back
+	};
+
+	struct SUsbCameraStatus
+	{
+		std::string serialNumber;
+		EUsbCameraState state;
+		uint32_t ownerPid;            // process doing the recovery, 0 if none
+		bool ownerAlive;              // false if the owner hung past the lease (or died, if checked) and the recovery is up for grabs
+		uint32_t generation;          // counts recoveries started, so a reader can tell one from the next
+		uint64_t recoveryStartedMs;   // milliseconds since the epoch
+		uint64_t lastRecoveryMs;      // when the last recovery ended, milliseconds since the epoch
+		uint32_t recoveryCount;       // recoveries ended
+
+		SUsbCameraStatus() : state(UsbCameraState_Unknown), ownerPid(0), ownerAlive(false), generation(0), recoveryStartedMs(0), lastRecoveryMs(0), recoveryCount(0) {}
+	};
+
+	// A fixed table of camera states in a memory mapped file every process on the host opens.
+	// Reading is a hash lookup and a seqlock copy, no locks and no system calls, so it can be polled per frame.
+	// Each slot has a tiny writer lock (a pid in a CAS) that is only held for the stores of one update, and is
+	// taken over if its holder died. Recovery ownership is per owner: a process, plus a token from NewOwnerToken() that
+	// tells apart the owners within it (eg: two device managers). It is lost if the process dies or runs past the lease.
+	class CUsbCameraStatusBoard
+	{
+	public:
+		static const uint32_t Capacity = 256;
+
+	private:
+		static const uint32_t FileVersion = 4;
+		static const uint32_t InitNone = 0;
+		static const uint32_t InitClaimed = 1;
+		static const uint32_t InitDone = 2;
+		static const uint32_t KeyFree = 0;
+		static const uint32_t KeyClaiming = 1;
+		static const uint32_t KeyUsed = 2;
+
+		struct SBoardHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t slotSize;
+			uint32_t capacity;
+			std::atomic<uint32_t> init;       // InitNone, InitClaimed while a process writes the fields above, then InitDone
+			uint32_t reserved[4];
+		};
+
+		// what readers copy out
+		struct SSlotData
+		{
+			uint32_t state;
+			uint32_t ownerPid;
+			uint64_t ownerStartTime;   // tells a dead owner from a new process that got its pid
+			uint32_t ownerToken;       // which owner within that process
+			uint32_t generation;
+			uint32_t recoveryCount;
+			uint64_t recoveryStartedMs;
+			uint64_t lastRecoveryMs;
+			uint32_t lastOwnerPid;     // who ended the last recovery, its own next step isn't held back by the cooldown
+			uint64_t lastOwnerStartTime;
+			uint32_t lastOwnerToken;
+		};
+
+		struct SBoardSlot
+		{
+			std::atomic<uint32_t> key;        // KeyFree, KeyClaiming or KeyUsed. Slots are never freed.
+			std::atomic<uint32_t> writerPid;  // 0 or the pid of the process updating the slot
+			std::atomic<uint32_t> sequence;   // odd while an update is in progress
+			uint32_t reserved;
+			char serialNumber[32];
+			SSlotData data;
+		};
+
+		CUsbMappedFile m_file;
+		uint64_t m_selfStartTime;
+		unsigned int m_recoveryLeaseMs;
+		unsigned int m_recoveryCooldownMs;
+
+		SBoardSlot* Slots() const { return (SBoardSlot*)((char*)m_file.GetData() + sizeof(SBoardHeader)); }
+
+		static uint32_t HashSerial(const std::string& serialNumber);
+		static uint64_t NowMs();
+
+		// index of the camera's slot, or -1. create claims a free slot for it.
+		int FindSlot(const std::string& serialNumber, bool create) const;
+
+		bool ReadSlot(int index, SSlotData& data) const;
+
+		void LockSlot(SBoardSlot& slot);
+		void UnlockSlot(SBoardSlot& slot);
+
+		bool IsOwnerAlive(const SSlotData& data, bool checkProcess) const;
+
+		// true if pid, startTime and token are owner in this process
+		bool IsSelf(uint32_t pid, uint64_t startTime, uint32_t token, uint32_t owner) const;
+
+		CUsbCameraStatusBoard(const CUsbCameraStatusBoard&);
+		CUsbCameraStatusBoard& operator=(const CUsbCameraStatusBoard&);
+
+	public:
+		CUsbCameraStatusBoard();
+
+		// Maps the board, creating it if needed. Every process must use the same absolute path. A board of another
+		// layout (eg: from an older version) is never wiped, it may still be in use: Open() fails and the file has to
+		// be removed once no process has it open.
+		bool Open(const std::string& path, std::string& errorMessage);
+
+		void Close();
+
+		bool IsOpen() const { return m_file.IsOpen(); }
+
+		// A recovery running longer than this is considered hung and may be taken over (default 60 s)
+		void SetRecoveryLeaseMs(unsigned int leaseMs);
+
+		// A camera that finished a recovery this recently isn't recovered again (default 2 s). Another process that saw it
+		// fail while it was down would otherwise reset it right after it came back.
+		void SetRecoveryCooldownMs(unsigned int cooldownMs);
+
+		// Claims the camera for a recovery by owner (a token from NewOwnerToken(), or 0) of this process. False if another
+		// live owner is recovering it, or it just came back. current is the state that was found. Claiming a camera the
+		// owner already has succeeds, and so does claiming one it just ended the recovery of.
+		bool TryBeginRecovery(const std::string& serialNumber, SUsbCameraStatus& current, std::string& errorMessage, uint32_t owner = 0);
+
+		// Ends owner's recovery of the camera
+		bool EndRecovery(const std::string& serialNumber, bool recovered, std::string& errorMessage, uint32_t owner = 0);
+
+		// True if owner of this process has a recovery of the camera
+		bool IsRecoveryOwner(const std::string& serialNumber, uint32_t owner = 0) const;
+
+		// The camera's state. False if the camera isn't on the board. checkOwner also looks up the owner process,
+		// which costs a system call; without it ownerAlive only reflects the lease.
+		bool Read(const std::string& serialNumber, SUsbCameraStatus& status, bool checkOwner = false) const;
+
+		// Every camera on the board
+		void ReadAll(std::vector<SUsbCameraStatus>& statuses) const;
+
+		// A token no other owner in this process gets, never 0. Every caller that passes 0 instead counts as one owner.
+		static uint32_t NewOwnerToken();
+
+		static uint32_t GetCurrentProcessId();
+
+		// The start time of a running process in platform units, 0 if it isn't running
+		static uint64_t GetProcessStartTime(uint32_t pid);
+	};
+
+	// Holds a camera's recovery for one scope (eg: a reset) and ends it when the scope is left, however it is left.
+	// A recovery the owner already had when Claim() was called is left to whoever started it. Without a board
+	// every claim succeeds.
+	class CUsbRecoveryClaim
+	{
+	private:
+		CUsbCameraStatusBoard* m_board;
+		std::string m_serialNumber;
+		uint32_t m_owner;
+		bool m_owned;
+		bool m_recovered;
+
+		CUsbRecoveryClaim(const CUsbRecoveryClaim&);
+		CUsbRecoveryClaim& operator=(const CUsbRecoveryClaim&);
+
+	public:
+		// owner as for CUsbCameraStatusBoard::TryBeginRecovery()
+		CUsbRecoveryClaim(CUsbCameraStatusBoard* board, const std::string& serialNumber, uint32_t owner = 0);
+		~CUsbRecoveryClaim();
+
+		// False if another owner is recovering the camera or it just came back
+		bool Claim(std::string& errorMessage);
+
+		// How the recovery ends, failed unless set
+		void SetRecovered(bool recovered) { m_recovered = recovered; }
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CUsbCameraStatusBoard::CUsbCameraStatusBoard()
+{
+	m_selfStartTime = 0;
+	m_recoveryLeaseMs = 60000;
+	m_recoveryCooldownMs = 2000;
+}
+
+inline uint32_t UsbCameraDeviceManager::CUsbCameraStatusBoard::HashSerial(const std::string& serialNumber)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < serialNumber.size(); i++)
+	{
+		hash ^= (uint8_t)serialNumber[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbCameraStatusBoard::NowMs()
+{
+	// wall clock, the board outlives processes
+	return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t UsbCameraDeviceManager::CUsbCameraStatusBoard::NewOwnerToken()
+{
+	static std::atomic<uint32_t> lastToken(0);
+	uint32_t token = ++lastToken;
+	return (token != 0) ? token : ++lastToken;
+}
+
+inline uint32_t UsbCameraDeviceManager::CUsbCameraStatusBoard::GetCurrentProcessId()
+{
+#ifdef LINUX_BUILD
+	return (uint32_t)getpid();
+#else
+	return (uint32_t)::GetCurrentProcessId();
+#endif
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbCameraStatusBoard::GetProcessStartTime(uint32_t pid)
+{
+	if (pid == 0)
+		return 0;
+
+#ifdef LINUX_BUILD
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%u/stat", pid);
+	FILE* file = fopen(path, "r");
+	if (file == NULL)
+		return 0;
+
+	char buffer[1024];
+	size_t length = fread(buffer, 1, sizeof(buffer) - 1, file);
+	fclose(file);
+	buffer[length] = '\0';
+
+	// "pid (comm) state ppid ... starttime" : comm may hold anything, so count fields from its closing parenthesis.
+	// state is field 3, starttime field 22.
+	char* at = strrchr(buffer, ')');
+	if (at == NULL || at[1] != ' ' || at[2] == 'Z' || at[2] == 'X')
+		return 0;
+	at += 2;
+	for (int field = 3; field < 22 && at != NULL; field++)
+	{
+		at = strchr(at, ' ');
+		if (at != NULL)
+			at++;
+	}
+	return (at != NULL) ? strtoull(at, NULL, 10) : 0;
+#else
+	HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+	if (process == NULL)
+		return 0;
+
+	uint64_t startTime = 0;
+	DWORD exitCode = 0;
+	FILETIME creation, exit, kernel, user;
+	if (GetExitCodeProcess(process, &exitCode) && exitCode == STILL_ACTIVE && GetProcessTimes(process, &creation, &exit, &kernel, &user))
+		startTime = ((uint64_t)creation.dwHighDateTime << 32) | creation.dwLowDateTime;
+	CloseHandle(process);
+	return startTime;
+#endif
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStatusBoard::Open(const std::string& path, std::string& errorMessage)
+{
+	size_t size = sizeof(SBoardHeader) + sizeof(SBoardSlot) * Capacity;
+	if (m_file.Open(path, size, errorMessage) == false)
+		return false;
+
+	// the first process creates the file zero filled, which is a valid empty board apart from the header. Whoever
+	// claims the init word writes the header; the others wait for it. The values are the same for every process on
+	// this version, so if the claimer died half way another one simply writes them again.
+	SBoardHeader* header = (SBoardHeader*)m_file.GetData();
+	static const char noMagic[8] = { 0 };
+	if (header->init.load(std::memory_order_acquire) != InitDone && memcmp(header->magic, noMagic, 8) == 0)
+	{
+		uint32_t expected = InitNone;
+		bool claimed = header->init.compare_exchange_strong(expected, InitClaimed, std::memory_order_acq_rel);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		while (claimed == false && header->init.load(std::memory_order_acquire) != InitDone && std::chrono::steady_clock::now() - start < std::chrono::seconds(1))
+			std::this_thread::yield();
+
+		if (header->init.load(std::memory_order_acquire) != InitDone && memcmp(header->magic, noMagic, 8) == 0)
+		{
+			header->version = FileVersion;
+			header->slotSize = sizeof(SBoardSlot);
+			header->capacity = Capacity;
+			std::atomic_thread_fence(std::memory_order_release);
+			memcpy(header->magic, "UCAMSTAT", 8);
+			header->init.store(InitDone, std::memory_order_release);
+		}
+	}
+
+	bool valid = memcmp(header->magic, "UCAMSTAT", 8) == 0 && header->version == FileVersion
+		&& header->slotSize == sizeof(SBoardSlot) && header->capacity == Capacity;
+	if (valid == false)
+	{
+		m_file.Close();
+		errorMessage = "Error: Open(): ";
+		errorMessage.append(path);
+		errorMessage.append(" is not a status board of this version. Remove it once no process uses it.");
+		return false;
+	}
+
+	m_selfStartTime = GetProcessStartTime(GetCurrentProcessId());
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStatusBoard::Close()
+{
+	m_file.Close();
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStatusBoard::SetRecoveryLeaseMs(unsigned int leaseMs)
+{
+	m_recoveryLeaseMs = leaseMs;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStatusBoard::SetRecoveryCooldownMs(unsigned int cooldownMs)
+{
+	m_recoveryCooldownMs = cooldownMs;
+}
+
+inline int UsbCameraDeviceManager::CUsbCameraStatusBoard::FindSlot(const std::string& serialNumber, bool create) const
+{
+	if (IsOpen() == false || serialNumber == "" || serialNumber.size() >= sizeof(((SBoardSlot*)0)->serialNumber))
+		return -1;
+
+	uint32_t start = HashSerial(serialNumber) % Capacity;
+	for (uint32_t probe = 0; probe < Capacity; probe++)
+	{
+		int index = (int)((start + probe) % Capacity);
+		SBoardSlot& slot = Slots()[index];
+
+		uint32_t key = slot.key.load(std::memory_order_acquire);
+		if (key == KeyFree)
+		{
+			if (create == false)
+				return -1;
+
+			uint32_t expected = KeyFree;
+			if (slot.key.compare_exchange_strong(expected, KeyClaiming, std::memory_order_acq_rel))
+			{
+				memset(slot.serialNumber, 0, sizeof(slot.serialNumber));
+				memcpy(slot.serialNumber, serialNumber.data(), serialNumber.size());
+				slot.key.store(KeyUsed, std::memory_order_release);
+				return index;
+			}
+			key = expected;
+		}
+
+		// another process is writing the serial into this slot, it takes nanoseconds. A claimer that died
+		// here leaves the slot unusable, the probe just moves past it.
+		for (int spin = 0; spin < 1000 && key == KeyClaiming; spin++)
+		{
+			std::this_thread::yield();
+			key = slot.key.load(std::memory_order_acquire);
+		}
+
+		if (key == KeyUsed && strncmp(slot.serialNumber, serialNumber.c_str(), sizeof(slot.serialNumber)) == 0)
+			return index;
+	}
+	return -1;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStatusBoard::ReadSlot(int index, SSlotData& data) const
+{
+	const SBoardSlot& slot = Slots()[index];
+	for (int attempt = 0; attempt < 1000; attempt++)
+	{
+		uint32_t before = slot.sequence.load(std::memory_order_acquire);
+		memcpy(&data, (const void*)&slot.data, sizeof(data));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if ((before & 1) == 0 && before == slot.sequence.load(std::memory_order_relaxed))
+			return true;
+		std::this_thread::yield();
+	}
+	return false;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStatusBoard::LockSlot(SBoardSlot& slot)
+{
+	uint32_t self = GetCurrentProcessId();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int attempt = 0; ; attempt++)
+	{
+		uint32_t holder = 0;
+		if (slot.writerPid.compare_exchange_strong(holder, self, std::memory_order_acquire))
+			break;
+
+		// the lock covers a handful of stores. Held this long, its holder died (or its pid was reused) in the middle of an update.
+		if ((attempt % 1000) == 999 && (GetProcessStartTime(holder) == 0 || std::chrono::steady_clock::now() - start > std::chrono::seconds(1)))
+		{
+			if (slot.writerPid.compare_exchange_strong(holder, self, std::memory_order_acquire))
+			{
+				// finish the dead writer's sequence so readers stop retrying
+				uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+				if (sequence & 1)
+					slot.sequence.store(sequence + 1, std::memory_order_release);
+				break;
+			}
+		}
+		std::this_thread::yield();
+	}
+
+	slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStatusBoard::UnlockSlot(SBoardSlot& slot)
+{
+	slot.sequence.store(slot.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	slot.writerPid.store(0, std::memory_order_release);
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStatusBoard::IsOwnerAlive(const SSlotData& data, bool checkProcess) const
+{
+	if (data.ownerPid == 0)
+		return false;
+	if (checkProcess && GetProcessStartTime(data.ownerPid) != data.ownerStartTime)
+		return false;
+	uint64_t now = NowMs();
+	return now < data.recoveryStartedMs || now - data.recoveryStartedMs <= m_recoveryLeaseMs;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStatusBoard::IsSelf(uint32_t pid, uint64_t startTime, uint32_t token, uint32_t owner) const
+{
+	// a process that got a dead owner's pid doesn't inherit its recovery
+	return pid == GetCurrentProcessId() && startTime == m_selfStartTime && token == owner;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStatusBoard::TryBeginRecovery(const std::string& serialNumber, SUsbCameraStatus& current, std::string& errorMessage, uint32_t owner)
+{
+	int index = FindSlot(serialNumber, true);
+	if (index < 0)
+	{
+		errorMessage = "Error: TryBeginRecovery(): No slot on the status board for camera ";
+		errorMessage.append(serialNumber);
+		return false;
+	}
+
+	SBoardSlot& slot = Slots()[index];
+	uint32_t self = GetCurrentProcessId();
+	uint64_t now = NowMs();
+
+	LockSlot(slot);
+	SSlotData data = slot.data;
+
+	current.serialNumber = serialNumber;
+	current.state = (EUsbCameraState)data.state;
+	current.ownerPid = data.ownerPid;
+	current.ownerAlive = data.state == UsbCameraState_Recovering && IsOwnerAlive(data, true);
+	current.generation = data.generation;
+	current.recoveryStartedMs = data.recoveryStartedMs;
+	current.lastRecoveryMs = data.lastRecoveryMs;
+	current.recoveryCount = data.recoveryCount;
+
+	if (data.state == UsbCameraState_Recovering && IsSelf(data.ownerPid, data.ownerStartTime, data.ownerToken, owner))
+	{
+		UnlockSlot(slot);
+		return true;
+	}
+
+	if (current.ownerAlive)
+	{
+		UnlockSlot(slot);
+		errorMessage = "Error: TryBeginRecovery(): Camera ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(" is being recovered by process ");
+		errorMessage.append(std::to_string(data.ownerPid));
+		if (data.ownerPid == self)
+			errorMessage.append(" (another owner within this one)");
+		return false;
+	}
+
+	// the cooldown keeps other owners off a camera that just came back. The owner that brought it back may go on
+	// (eg: disable it again when it didn't pass its acceptance test).
+	bool lastOwner = IsSelf(data.lastOwnerPid, data.lastOwnerStartTime, data.lastOwnerToken, owner);
+	if (data.state == UsbCameraState_Healthy && lastOwner == false && now >= data.lastRecoveryMs && now - data.lastRecoveryMs < m_recoveryCooldownMs)
+	{
+		UnlockSlot(slot);
+		errorMessage = "Error: TryBeginRecovery(): Camera ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(" was recovered ");
+		errorMessage.append(std::to_string(now - data.lastRecoveryMs));
+		errorMessage.append(" ms ago.");
+		return false;
+	}
+
+	slot.data.state = UsbCameraState_Recovering;
+	slot.data.ownerPid = self;
+	slot.data.ownerStartTime = m_selfStartTime;
+	slot.data.ownerToken = owner;
+	slot.data.generation = data.generation + 1;
+	slot.data.recoveryStartedMs = now;
+	UnlockSlot(slot);
+	return true;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStatusBoard::EndRecovery(const std::string& serialNumber, bool recovered, std::string& errorMessage, uint32_t owner)
+{
+	int index = FindSlot(serialNumber, false);
+	if (index < 0)
+	{
+		errorMessage = "Error: EndRecovery(): Camera ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(" is not on the status board.");
+		return false;
+	}
+
+	SBoardSlot& slot = Slots()[index];
+	uint32_t self = GetCurrentProcessId();
+
+	LockSlot(slot);
+	if (slot.data.state != UsbCameraState_Recovering || IsSelf(slot.data.ownerPid, slot.data.ownerStartTime, slot.data.ownerToken, owner) == false)
+	{
+		uint32_t owner = slot.data.ownerPid;
+		UnlockSlot(slot);
+		errorMessage = "Error: EndRecovery(): Camera ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(" is not being recovered by this owner (owner process ");
+		errorMessage.append(std::to_string(owner));
+		errorMessage.append(").");
+		return false;
+	}
+
+	slot.data.state = recovered ? UsbCameraState_Healthy : UsbCameraState_Failed;
+	slot.data.ownerPid = 0;
+	slot.data.ownerStartTime = 0;
+	slot.data.ownerToken = 0;
+	slot.data.lastOwnerPid = self;
+	slot.data.lastOwnerStartTime = m_selfStartTime;
+	slot.data.lastOwnerToken = owner;
+	slot.data.lastRecoveryMs = NowMs();
+	slot.data.recoveryCount++;
+	UnlockSlot(slot);
+	return true;
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStatusBoard::IsRecoveryOwner(const std::string& serialNumber, uint32_t owner) const
+{
+	int index = FindSlot(serialNumber, false);
+	SSlotData data;
+	if (index < 0 || ReadSlot(index, data) == false)
+		return false;
+	return data.state == UsbCameraState_Recovering && IsSelf(data.ownerPid, data.ownerStartTime, data.ownerToken, owner);
+}
+
+inline bool UsbCameraDeviceManager::CUsbCameraStatusBoard::Read(const std::string& serialNumber, SUsbCameraStatus& status, bool checkOwner) const
+{
+	int index = FindSlot(serialNumber, false);
+	SSlotData data;
+	if (index < 0 || ReadSlot(index, data) == false)
+		return false;
+
+	status.serialNumber = serialNumber;
+	status.state = (EUsbCameraState)data.state;
+	status.ownerPid = data.ownerPid;
+	status.ownerAlive = data.state == UsbCameraState_Recovering && IsOwnerAlive(data, checkOwner);
+	status.generation = data.generation;
+	status.recoveryStartedMs = data.recoveryStartedMs;
+	status.lastRecoveryMs = data.lastRecoveryMs;
+	status.recoveryCount = data.recoveryCount;
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbCameraStatusBoard::ReadAll(std::vector<SUsbCameraStatus>& statuses) const
+{
+	statuses.clear();
+	if (IsOpen() == false)
+		return;
+
+	for (uint32_t i = 0; i < Capacity; i++)
+	{
+		const SBoardSlot& slot = Slots()[i];
+		if (slot.key.load(std::memory_order_acquire) != KeyUsed)
+			continue;
+
+		SUsbCameraStatus status;
+		std::string serialNumber(slot.serialNumber, strnlen(slot.serialNumber, sizeof(slot.serialNumber)));
+		if (Read(serialNumber, status))
+			statuses.push_back(status);
+	}
+}
+
+inline UsbCameraDeviceManager::CUsbRecoveryClaim::CUsbRecoveryClaim(CUsbCameraStatusBoard* board, const std::string& serialNumber, uint32_t owner)
+	: m_board(board), m_serialNumber(serialNumber), m_owner(owner)
+{
+	m_owned = false;
+	m_recovered = false;
+}
+
+inline UsbCameraDeviceManager::CUsbRecoveryClaim::~CUsbRecoveryClaim()
+{
+	if (m_owned == false)
+		return;
+
+	std::string ignored;
+	m_board->EndRecovery(m_serialNumber, m_recovered, ignored, m_owner);
+}
+
+inline bool UsbCameraDeviceManager::CUsbRecoveryClaim::Claim(std::string& errorMessage)
+{
+	if (m_board == NULL || m_board->IsOpen() == false || m_owned)
+		return true;
+
+	bool alreadyOwned = m_board->IsRecoveryOwner(m_serialNumber, m_owner);
+	SUsbCameraStatus current;
+	if (m_board->TryBeginRecovery(m_serialNumber, current, errorMessage, m_owner) == false)
+		return false;
+	m_owned = (alreadyOwned == false);
+	return true;
+}
+// *********************************************************************************************************
+
+#endif
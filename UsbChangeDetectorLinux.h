@@ -0,0 +1,470 @@
+// UsbChangeDetectorLinux.h
+// Notices usb device arrival / removal without the uevent netlink socket, by watching /dev/bus/usb with inotify
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCHANGEDETECTORLINUX_H
+#define USBCHANGEDETECTORLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <stdint.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "UsbDeviceBackendLinux.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// What happened to a device
+	enum EUsbChangeType
+	{
+		UsbChange_Add = 0,
+		UsbChange_Remove,
+		UsbChange_Change
+	};
+
+	// One topology change. generation is the topology generation after this change was applied.
+	struct SUsbChangeEvent
+	{
+		EUsbChangeType type;
+		std::string deviceName;   // sysfs name (eg: "2-1.3"), empty if it could not be resolved
+		std::string serialNumber; // empty if the device has none
+		int busnum;
+		int devnum;
+		uint64_t generation;
+	};
+
+	// Anything that reports topology changes. Consumers (eg: CUsbResetHandleCache::Refresh()) compare
+	// GetTopologyGeneration() against the last value they saw instead of re-reading sysfs on a timer.
+	class IUsbChangeDetector
+	{
+	public:
+		virtual ~IUsbChangeDetector() {}
+
+		// Starts watching. Existing devices are taken as the baseline and don't produce events.
+		virtual bool Start(std::string& errorMessage) = 0;
+
+		// Stops watching and releases the file descriptors
+		virtual void Stop() = 0;
+
+		// Waits up to timeoutMs (0 = don't wait) and appends whatever changed. Returns false on error.
+		virtual bool WaitForEvents(int timeoutMs, std::vector<SUsbChangeEvent>& events) = 0;
+
+		// A descriptor that becomes readable when WaitForEvents() has something, for callers that poll() several sources
+		virtual int GetFileDescriptor() const = 0;
+
+		// Incremented once per change, starting at 0
+		virtual uint64_t GetTopologyGeneration() const = 0;
+	};
+
+	// Works inside containers that have /dev/bus/usb bind mounted but no netlink access. Each node
+	// created or deleted there is mapped back to its sysfs entry through IUsbDeviceBackend::FindDeviceByNumber(),
+	// so the cost of a change does not grow with the number of devices on the host.
+	class CUsbInotifyChangeDetector : public IUsbChangeDetector
+	{
+	private:
+		struct SKnownDevice
+		{
+			std::string deviceName;
+			std::string serialNumber;
+		};
+
+		IUsbDeviceBackend& m_backend;
+		std::string m_usbfsRoot;
+		int m_inotifyFd;
+		int m_rootWatch;
+		std::map<int, int> m_busWatches;               // watch descriptor -> busnum
+		std::map<int, SKnownDevice> m_knownDevices;    // (busnum << 16 | devnum) -> device
+		std::set<std::string> m_knownNames;
+		std::map<int, std::chrono::steady_clock::time_point> m_pendingAdds;   // nodes seen before their sysfs entry was readable, since when
+		std::set<int> m_scannedNodes;                  // nodes of a new bus announced by its first scan, their own IN_CREATE may still come
+		unsigned int m_pendingAddTimeoutMs;
+		std::atomic<uint64_t> m_generation;
+
+		static int Key(int busnum, int devnum) { return (busnum << 16) | devnum; }
+
+		// adds an inotify watch for one /dev/bus/usb/BBB directory
+		bool WatchBus(const std::string& busName);
+
+		// announces the nodes a new bus already had when its watch was added
+		void ScanNewBus(const std::string& busName, std::vector<SUsbChangeEvent>& events);
+
+		// a node that was created: announced, or left pending until sysfs has it
+		void HandleAdd(int busnum, int devnum, std::vector<SUsbChangeEvent>& events);
+
+		// reads sysfs entries we haven't seen yet and files them by bus/dev number (the baseline, and after lost events)
+		void ScanNewSysfsEntries();
+
+		// turns a node name into a device, looking up only that device in sysfs. Returns false if sysfs doesn't have it yet.
+		bool ResolveAdd(int busnum, int devnum, std::vector<SUsbChangeEvent>& events);
+
+		void Emit(EUsbChangeType type, const SKnownDevice& device, int busnum, int devnum, std::vector<SUsbChangeEvent>& events);
+
+	public:
+		CUsbInotifyChangeDetector(IUsbDeviceBackend& backend, const std::string& usbfsRoot = "/dev/bus/usb");
+
+		virtual ~CUsbInotifyChangeDetector();
+
+		// How long a node may wait for its sysfs entry before it is announced without one (default 2000 ms)
+		void SetPendingAddTimeoutMs(unsigned int timeoutMs);
+
+		virtual bool Start(std::string& errorMessage);
+		virtual void Stop();
+		virtual bool WaitForEvents(int timeoutMs, std::vector<SUsbChangeEvent>& events);
+		virtual int GetFileDescriptor() const;
+		virtual uint64_t GetTopologyGeneration() const;
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::CUsbInotifyChangeDetector(IUsbDeviceBackend& backend, const std::string& usbfsRoot)
+	: m_backend(backend), m_usbfsRoot(usbfsRoot), m_inotifyFd(-1), m_rootWatch(-1), m_pendingAddTimeoutMs(2000), m_generation(0)
+{
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::SetPendingAddTimeoutMs(unsigned int timeoutMs)
+{
+	m_pendingAddTimeoutMs = timeoutMs;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::~CUsbInotifyChangeDetector()
+{
+	Stop();
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::WatchBus(const std::string& busName)
+{
+	int busnum = atoi(busName.c_str());
+	if (busnum <= 0)
+		return false;
+
+	std::string path = m_usbfsRoot + "/" + busName;
+	int wd = inotify_add_watch(m_inotifyFd, path.c_str(), IN_CREATE | IN_DELETE | IN_ATTRIB | IN_ONLYDIR);
+	if (wd < 0)
+		return false;
+
+	m_busWatches[wd] = busnum;
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::HandleAdd(int busnum, int devnum, std::vector<SUsbChangeEvent>& events)
+{
+	int key = Key(busnum, devnum);
+	if (ResolveAdd(busnum, devnum, events))
+		m_pendingAdds.erase(key);
+	else if (m_pendingAdds.find(key) == m_pendingAdds.end())
+		m_pendingAdds[key] = std::chrono::steady_clock::now();
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::ScanNewBus(const std::string& busName, std::vector<SUsbChangeEvent>& events)
+{
+	// devices enumerate right after their bus appears, some of them before the watch was in place
+	int busnum = atoi(busName.c_str());
+	DIR* dir = opendir((m_usbfsRoot + "/" + busName).c_str());
+	if (dir == NULL)
+		return;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (entry->d_name[0] == '.')
+			continue;
+		int devnum = atoi(entry->d_name);
+		m_scannedNodes.insert(Key(busnum, devnum));
+		HandleAdd(busnum, devnum, events);
+	}
+	closedir(dir);
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::ScanNewSysfsEntries()
+{
+	std::vector<std::string> deviceNames;
+	if (m_backend.ListDevices(deviceNames) == false)
+		return;
+
+	for (size_t i = 0; i < deviceNames.size(); i++)
+	{
+		if (m_knownNames.count(deviceNames[i]) != 0)
+			continue;
+
+		std::string busnum;
+		std::string devnum;
+		if (m_backend.ReadAttribute(deviceNames[i], "busnum", busnum) == false || m_backend.ReadAttribute(deviceNames[i], "devnum", devnum) == false)
+			continue;
+
+		SKnownDevice device;
+		device.deviceName = deviceNames[i];
+		m_backend.ReadAttribute(deviceNames[i], "serial", device.serialNumber);
+
+		int key = Key(atoi(busnum.c_str()), atoi(devnum.c_str()));
+		std::map<int, SKnownDevice>::iterator stale = m_knownDevices.find(key);
+		if (stale != m_knownDevices.end())
+			m_knownNames.erase(stale->second.deviceName);
+
+		m_knownDevices[key] = device;
+		m_knownNames.insert(deviceNames[i]);
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::Emit(EUsbChangeType type, const SKnownDevice& device, int busnum, int devnum, std::vector<SUsbChangeEvent>& events)
+{
+	SUsbChangeEvent event;
+	event.type = type;
+	event.deviceName = device.deviceName;
+	event.serialNumber = device.serialNumber;
+	event.busnum = busnum;
+	event.devnum = devnum;
+	event.generation = ++m_generation;
+	events.push_back(event);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::ResolveAdd(int busnum, int devnum, std::vector<SUsbChangeEvent>& events)
+{
+	int key = Key(busnum, devnum);
+	std::map<int, SKnownDevice>::iterator it = m_knownDevices.find(key);
+	if (it == m_knownDevices.end())
+	{
+		SKnownDevice device;
+		if (m_backend.FindDeviceByNumber(busnum, devnum, device.deviceName) == false)
+			return false;
+		m_backend.ReadAttribute(device.deviceName, "serial", device.serialNumber);
+
+		// a re-enumerated device may still be filed under its old devnum
+		if (m_knownNames.count(device.deviceName) != 0)
+		{
+			for (std::map<int, SKnownDevice>::iterator stale = m_knownDevices.begin(); stale != m_knownDevices.end(); ++stale)
+			{
+				if (stale->second.deviceName == device.deviceName)
+				{
+					m_knownDevices.erase(stale);
+					break;
+				}
+			}
+		}
+
+		it = m_knownDevices.insert(std::make_pair(key, device)).first;
+		m_knownNames.insert(device.deviceName);
+	}
+
+	Emit(UsbChange_Add, it->second, busnum, devnum, events);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::Start(std::string& errorMessage)
+{
+	Stop();
+
+	m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_inotifyFd < 0)
+	{
+		errorMessage = "Error: Start(): inotify_init1() failed: ";
+		errorMessage.append(strerror(errno));
+		return false;
+	}
+
+	// the root watch tells us about new buses (eg: a controller that was rebound)
+	m_rootWatch = inotify_add_watch(m_inotifyFd, m_usbfsRoot.c_str(), IN_CREATE | IN_DELETE | IN_ONLYDIR);
+	if (m_rootWatch < 0)
+	{
+		errorMessage = "Error: Start(): Unable to watch ";
+		errorMessage.append(m_usbfsRoot);
+		errorMessage.append(": ");
+		errorMessage.append(strerror(errno));
+		Stop();
+		return false;
+	}
+
+	DIR* dir = opendir(m_usbfsRoot.c_str());
+	if (dir != NULL)
+	{
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL)
+		{
+			if (entry->d_name[0] != '.')
+				WatchBus(entry->d_name);
+		}
+		closedir(dir);
+	}
+
+	// the baseline, so removals can be named without sysfs (which is gone by then)
+	ScanNewSysfsEntries();
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::Stop()
+{
+	if (m_inotifyFd >= 0)
+		close(m_inotifyFd);
+	m_inotifyFd = -1;
+	m_rootWatch = -1;
+	m_busWatches.clear();
+	m_knownDevices.clear();
+	m_knownNames.clear();
+	m_pendingAdds.clear();
+	m_scannedNodes.clear();
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::WaitForEvents(int timeoutMs, std::vector<SUsbChangeEvent>& events)
+{
+	if (m_inotifyFd < 0)
+		return false;
+
+	// nodes whose sysfs entry wasn't there yet get another look at a short interval
+	if (m_pendingAdds.empty() == false && (timeoutMs < 0 || timeoutMs > 20))
+		timeoutMs = 20;
+
+	struct pollfd pfd;
+	pfd.fd = m_inotifyFd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	int ready = poll(&pfd, 1, timeoutMs);
+	if (ready < 0 && errno != EINTR)
+		return false;
+
+	// drain everything that is queued in one go
+	alignas(struct inotify_event) char buffer[8192];
+	while (ready > 0)
+	{
+		ssize_t length = read(m_inotifyFd, buffer, sizeof(buffer));
+		if (length <= 0)
+			break;
+
+		for (char* p = buffer; p < buffer + length; )
+		{
+			struct inotify_event* event = (struct inotify_event*)p;
+			p += sizeof(struct inotify_event) + event->len;
+
+			if (event->mask & IN_Q_OVERFLOW)
+			{
+				// lost events: rebuild the baseline and tell consumers to look at everything
+				m_knownDevices.clear();
+				m_knownNames.clear();
+				ScanNewSysfsEntries();
+				SKnownDevice unknown;
+				Emit(UsbChange_Change, unknown, 0, 0, events);
+				continue;
+			}
+
+			// the watch is gone (eg: its bus was removed with its controller). It carries no name, so look before the len check.
+			if (event->mask & IN_IGNORED)
+			{
+				if (event->wd == m_rootWatch)
+					m_rootWatch = -1;
+				m_busWatches.erase(event->wd);
+				continue;
+			}
+
+			if (event->len == 0)
+				continue;
+
+			if (event->wd == m_rootWatch)
+			{
+				if ((event->mask & IN_CREATE) && WatchBus(event->name))
+					ScanNewBus(event->name, events);
+				continue;
+			}
+
+			std::map<int, int>::iterator bus = m_busWatches.find(event->wd);
+			if (bus == m_busWatches.end())
+				continue;
+
+			int busnum = bus->second;
+			int devnum = atoi(event->name);
+			int key = Key(busnum, devnum);
+
+			if (event->mask & IN_CREATE)
+			{
+				// the scan of its new bus announced it already
+				if (m_scannedNodes.erase(key) == 0)
+					HandleAdd(busnum, devnum, events);
+			}
+			else if (event->mask & IN_DELETE)
+			{
+				m_pendingAdds.erase(key);
+				m_scannedNodes.erase(key);
+				std::map<int, SKnownDevice>::iterator it = m_knownDevices.find(key);
+				SKnownDevice device;
+				if (it != m_knownDevices.end())
+				{
+					device = it->second;
+					m_knownNames.erase(it->second.deviceName);
+					m_knownDevices.erase(it);
+				}
+				Emit(UsbChange_Remove, device, busnum, devnum, events);
+			}
+			else if (event->mask & IN_ATTRIB)
+			{
+				// udev adjusting permissions or ownership of the node
+				std::map<int, SKnownDevice>::iterator it = m_knownDevices.find(key);
+				if (it != m_knownDevices.end())
+					Emit(UsbChange_Change, it->second, busnum, devnum, events);
+			}
+		}
+
+		// anything else already queued?
+		pfd.revents = 0;
+		ready = poll(&pfd, 1, 0);
+	}
+
+	// retry adds that raced their sysfs entry. One that never shows up (eg: the device went away again, or sysfs
+	// isn't visible here) is announced without a name instead of being looked for forever.
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for (std::map<int, std::chrono::steady_clock::time_point>::iterator it = m_pendingAdds.begin(); it != m_pendingAdds.end(); )
+	{
+		int busnum = it->first >> 16;
+		int devnum = it->first & 0xFFFF;
+		if (ResolveAdd(busnum, devnum, events))
+			m_pendingAdds.erase(it++);
+		else if (now - it->second >= std::chrono::milliseconds(m_pendingAddTimeoutMs))
+		{
+			SKnownDevice unresolved;
+			Emit(UsbChange_Add, unresolved, busnum, devnum, events);
+			m_pendingAdds.erase(it++);
+		}
+		else
+			++it;
+	}
+
+	return true;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::GetFileDescriptor() const
+{
+	return m_inotifyFd;
+}
+
+inline uint64_t UsbCameraDeviceManagerLinux::CUsbInotifyChangeDetector::GetTopologyGeneration() const
+{
+	return m_generation.load();
+}
+// *********************************************************************************************************
+
+#endif
+#endif
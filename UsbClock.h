@@ -0,0 +1,195 @@
+// UsbClock.h
+// The time base recovery code waits on: the real steady clock, or virtual time for running scenarios without waiting
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCLOCK_H
+#define USBCLOCK_H
+
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <condition_variable>
+#include <stdint.h>
+
+namespace UsbCameraDeviceManager
+{
+	// Every wait, timeout and timestamp of the recovery logic goes through one of these
+	class IUsbClock
+	{
+	public:
+		virtual ~IUsbClock() {}
+
+		// Milliseconds since some fixed point. Only differences mean anything.
+		virtual uint64_t NowMs() = 0;
+
+		virtual void SleepMs(unsigned int ms) = 0;
+	};
+
+	// The steady clock and real sleeps
+	class CSystemUsbClock : public IUsbClock
+	{
+	public:
+		// The one everything uses unless told otherwise
+		static CSystemUsbClock& Instance();
+
+		virtual uint64_t NowMs();
+		virtual void SleepMs(unsigned int ms);
+	};
+
+	// Virtual time. Sleeping doesn't take any real time: once every actor (a thread whose sleeps go through the clock)
+	// is asleep, time jumps to the earliest wake-up and that sleeper runs. Actors run one at a time, in the order of
+	// their wake-up times (ties in the order they went to sleep), so a run is the same every time for the same inputs.
+	// An actor must not wait on anything else that only another actor can end, it would never be woken.
+	class CVirtualUsbClock : public IUsbClock
+	{
+	private:
+		// each sleeper waits on its own condition, so waking one of a hundred doesn't wake them all
+		struct SSleeper
+		{
+			std::condition_variable wake;
+			bool released;
+
+			SSleeper() : released(false) {}
+		};
+
+		std::mutex m_lock;
+		std::condition_variable m_actorsChanged;
+		uint64_t m_nowMs;
+		unsigned int m_running;                                                       // actors not asleep
+		uint64_t m_nextTicket;
+		std::map<std::pair<uint64_t, uint64_t>, SSleeper*> m_sleepers;                // by wake-up time, then ticket
+
+		// wakes the next sleeper if no actor is running (m_lock held)
+		void Schedule();
+
+		CVirtualUsbClock(const CVirtualUsbClock&);
+		CVirtualUsbClock& operator=(const CVirtualUsbClock&);
+
+	public:
+		// actors: how many threads sleep on the clock. The default of one is the thread using it.
+		CVirtualUsbClock(unsigned int actors = 1, uint64_t startMs = 0);
+
+		virtual uint64_t NowMs();
+		virtual void SleepMs(unsigned int ms);
+
+		// Moves time forward without sleeping, eg: to expire a timeout from outside the actors
+		void Advance(unsigned int ms);
+
+		// Adds actors before their threads start. Time stands still until each of them has slept or left.
+		void AddActors(unsigned int count);
+
+		// Called by an actor thread that is done
+		void RemoveActor();
+
+		// Blocks a thread that isn't an actor until no more than running actors are awake. Starting actors one at a
+		// time, each after the one before it is asleep (WaitUntilRunning(remaining)), keeps their order deterministic.
+		void WaitUntilRunning(unsigned int running);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CSystemUsbClock& UsbCameraDeviceManager::CSystemUsbClock::Instance()
+{
+	static CSystemUsbClock clock;
+	return clock;
+}
+
+inline uint64_t UsbCameraDeviceManager::CSystemUsbClock::NowMs()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void UsbCameraDeviceManager::CSystemUsbClock::SleepMs(unsigned int ms)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline UsbCameraDeviceManager::CVirtualUsbClock::CVirtualUsbClock(unsigned int actors, uint64_t startMs)
+{
+	m_nowMs = startMs;
+	m_running = actors;
+	m_nextTicket = 0;
+}
+
+inline void UsbCameraDeviceManager::CVirtualUsbClock::Schedule()
+{
+	if (m_running > 0 || m_sleepers.empty())
+		return;
+
+	std::map<std::pair<uint64_t, uint64_t>, SSleeper*>::iterator next = m_sleepers.begin();
+	if (next->first.first > m_nowMs)
+		m_nowMs = next->first.first;
+	next->second->released = true;
+	next->second->wake.notify_one();
+	m_sleepers.erase(next);
+	m_running++;
+}
+
+inline uint64_t UsbCameraDeviceManager::CVirtualUsbClock::NowMs()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_nowMs;
+}
+
+inline void UsbCameraDeviceManager::CVirtualUsbClock::SleepMs(unsigned int ms)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	SSleeper sleeper;
+	m_sleepers[std::make_pair(m_nowMs + ms, m_nextTicket++)] = &sleeper;
+	if (m_running > 0)
+		m_running--;
+	m_actorsChanged.notify_all();
+	Schedule();
+
+	while (sleeper.released == false)
+		sleeper.wake.wait(lock);
+}
+
+inline void UsbCameraDeviceManager::CVirtualUsbClock::Advance(unsigned int ms)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_nowMs += ms;
+}
+
+inline void UsbCameraDeviceManager::CVirtualUsbClock::AddActors(unsigned int count)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_running += count;
+}
+
+inline void UsbCameraDeviceManager::CVirtualUsbClock::RemoveActor()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_running > 0)
+		m_running--;
+	m_actorsChanged.notify_all();
+	Schedule();
+}
+
+inline void UsbCameraDeviceManager::CVirtualUsbClock::WaitUntilRunning(unsigned int running)
+{
+	std::unique_lock<std::mutex> lock(m_lock);
+	while (m_running > running)
+		m_actorsChanged.wait(lock);
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,557 @@
+// UsbControllerRecoveryLinux.h
+// Last resort recovery: unbind and rebind the xHCI host controller a camera hangs off, instead of rebooting
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBCONTROLLERRECOVERYLINUX_H
+#define USBCONTROLLERRECOVERYLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbClock.h"
+#include "UsbCameraResult.h"
+#include "UsbCameraIdentityDatabase.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// One device that goes down with the controller
+	struct SUsbAffectedDevice
+	{
+		std::string deviceName;
+		std::string serialNumber;   // may be empty
+		std::string vendorId;
+		std::string productId;
+		std::string speed;          // it has to come back at least this fast, in Mbps: its expected speed if the identity database knows it, else its speed before the rebind
+		bool isCamera;
+		bool isHub;
+	};
+
+	// Everything on one controller
+	struct SUsbControllerImpact
+	{
+		std::string pciAddress;                     // eg: 0000:00:14.0
+		std::vector<std::string> rootHubs;          // eg: usb1, usb2 (a USB3 controller has one of each)
+		std::vector<SUsbAffectedDevice> devices;    // hubs and devices below the root hubs
+		std::vector<std::string> notRecovered;      // after a rebind: serial numbers not back at their speed (the port for a camera without one)
+	};
+
+	enum EUsbControllerRebindPolicy
+	{
+		UsbRebind_Never = 0,      // only report the blast radius
+		UsbRebind_CamerasOnly,    // rebind only if nothing but cameras and hubs are on the controller
+		UsbRebind_Always          // rebind even if other devices (keyboards, disks...) go down too
+	};
+
+	struct SUsbControllerRecoveryPolicy
+	{
+		EUsbControllerRebindPolicy rebind;
+		unsigned int maxAffectedCameras;   // refuse if more cameras than this would go down (0 for no limit)
+		unsigned int unboundMs;            // how long the controller stays unbound
+		unsigned int verifyTimeoutMs;      // how long the cameras get to come back
+		unsigned int bindAttempts;         // a failed bind is retried, the controller must not be left unbound
+		unsigned int bindRetryMs;          // before the first retry, doubled for each one after it
+
+		SUsbControllerRecoveryPolicy() : rebind(UsbRebind_Never), maxAffectedCameras(0), unboundMs(1000), verifyTimeoutMs(20000), bindAttempts(5), bindRetryMs(250) {}
+	};
+
+	// Binds and unbinds PCI devices from their driver
+	class IUsbControllerDriver
+	{
+	public:
+		virtual ~IUsbControllerDriver() {}
+
+		virtual bool Unbind(const std::string& pciAddress, std::string& errorMessage) = 0;
+
+		virtual bool Bind(const std::string& pciAddress, std::string& errorMessage) = 0;
+	};
+
+	// The real thing, through /sys/bus/pci. Requires root.
+	class CSysfsUsbControllerDriver : public IUsbControllerDriver
+	{
+	private:
+		std::string m_pciRoot;
+		std::map<std::string, std::string> m_unboundDrivers;   // pci address -> driver directory it was bound to
+
+		static bool WriteFile(const std::string& path, const std::string& value, std::string& errorMessage);
+
+	public:
+		CSysfsUsbControllerDriver(const std::string& pciRoot = "/sys/bus/pci");
+
+		// Writes the address to the unbind file of whatever driver the controller is bound to (usually xhci_hcd)
+		virtual bool Unbind(const std::string& pciAddress, std::string& errorMessage);
+
+		// Writes the address to the bind file of the driver it was unbound from, and to xhci_hcd's if that fails (or the
+		// driver is unknown). A controller that couldn't be bound is remembered until it is.
+		virtual bool Bind(const std::string& pciAddress, std::string& errorMessage);
+
+		// Controllers this object unbound and hasn't bound again yet
+		void GetUnboundControllers(std::vector<std::string>& pciAddresses) const;
+	};
+
+	// Resolves the controller a camera is on, lists what else is on it, and (if the policy allows) rebinds it
+	// and waits for every camera that was on it to come back at the speed it should have. A camera that wedged its
+	// controller has usually dropped off the bus: with an identity database it is found by the controller it was last
+	// on, or the controller can be given directly.
+	class CUsbControllerRecovery
+	{
+	private:
+		IUsbDeviceBackend& m_backend;
+		IUsbControllerDriver& m_driver;
+		UsbCameraDeviceManager::IUsbClock& m_clock;
+		UsbCameraDeviceManager::IUsbApiCallObserver* m_apiCallObserver;
+		UsbCameraDeviceManager::CUsbCameraIdentityDatabase* m_identityDatabase;
+
+		// binds, and retries with a growing pause if that fails
+		bool BindWithRetry(const std::string& pciAddress, const SUsbControllerRecoveryPolicy& policy, std::string& errorMessage);
+
+		// RecoverCamera() and RecoverController() without reporting it to the observer. serialNumber is the camera the
+		// rebind is for, empty if none: it is waited for even if it isn't on the controller right now.
+		bool RebindController(const std::string& pciAddress, const std::string& serialNumber, const SUsbControllerRecoveryPolicy& policy, SUsbControllerImpact& impact, std::string& errorMessage);
+
+	public:
+		// clock times the unbound pause and the verification, NULL for the steady clock
+		CUsbControllerRecovery(IUsbDeviceBackend& backend, IUsbControllerDriver& driver, UsbCameraDeviceManager::IUsbClock* clock = NULL);
+
+		// The pci address in a device path: the component just above the usbN root hub
+		static bool ParseControllerAddress(const std::string& devicePath, std::string& pciAddress, std::string& rootHub);
+
+		// Where cameras were last seen and how fast they should link (may be NULL). Must outlive this object.
+		void SetIdentityDatabase(UsbCameraDeviceManager::CUsbCameraIdentityDatabase* identityDatabase);
+
+		// The PCI address of the controller the camera is on, or was last on according to the identity database
+		bool FindCameraController(const std::string& serialNumber, std::string& pciAddress, std::string& errorMessage);
+
+		// Everything that goes down if the controller is rebound
+		bool GetControllerImpact(const std::string& pciAddress, SUsbControllerImpact& impact, std::string& errorMessage);
+
+		// Binds a controller a rebind left unbound (its cameras are gone, so RecoverCamera() can't find it anymore)
+		bool BindController(const std::string& pciAddress, const SUsbControllerRecoveryPolicy& policy, std::string& errorMessage);
+
+		// Told about every RecoverCamera() and RecoverController() (may be NULL). Must outlive this object.
+		void SetApiCallObserver(UsbCameraDeviceManager::IUsbApiCallObserver* apiCallObserver);
+
+		// Rebinds the camera's controller if the policy allows it. impact reports what was (or would have been) affected.
+		bool RecoverCamera(const std::string& serialNumber, const SUsbControllerRecoveryPolicy& policy, SUsbControllerImpact& impact, std::string& errorMessage);
+
+		// Rebinds a controller given by its PCI address (eg: from the placement map) if the policy allows it
+		bool RecoverController(const std::string& pciAddress, const SUsbControllerRecoveryPolicy& policy, SUsbControllerImpact& impact, std::string& errorMessage);
+
+		// For reference, the impact as text, one device per line
+		static std::string FormatImpact(const SUsbControllerImpact& impact);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CSysfsUsbControllerDriver::CSysfsUsbControllerDriver(const std::string& pciRoot)
+{
+	m_pciRoot = pciRoot;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSysfsUsbControllerDriver::WriteFile(const std::string& path, const std::string& value, std::string& errorMessage)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+	if (fd < 0 || write(fd, value.c_str(), value.size()) != (ssize_t)value.size())
+	{
+		errorMessage = "Error: CSysfsUsbControllerDriver: Unable to write ";
+		errorMessage.append(value);
+		errorMessage.append(" to ");
+		errorMessage.append(path);
+		errorMessage.append(": ");
+		errorMessage.append(strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSysfsUsbControllerDriver::Unbind(const std::string& pciAddress, std::string& errorMessage)
+{
+	// newer kernels call the pci glue xhci-pci, older ones xhci_hcd. Ask the device rather than guess.
+	char resolved[PATH_MAX];
+	std::string driverLink = m_pciRoot + "/devices/" + pciAddress + "/driver";
+	if (realpath(driverLink.c_str(), resolved) == NULL)
+	{
+		errorMessage = "Error: CSysfsUsbControllerDriver::Unbind(): ";
+		errorMessage.append(pciAddress);
+		errorMessage.append(" is not bound to a driver.");
+		return false;
+	}
+
+	std::string driverDirectory = resolved;
+	if (WriteFile(driverDirectory + "/unbind", pciAddress, errorMessage) == false)
+		return false;
+
+	m_unboundDrivers[pciAddress] = driverDirectory;
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSysfsUsbControllerDriver::Bind(const std::string& pciAddress, std::string& errorMessage)
+{
+	std::string fallback = m_pciRoot + "/drivers/xhci_hcd";
+	std::string driverDirectory = fallback;
+	std::map<std::string, std::string>::iterator it = m_unboundDrivers.find(pciAddress);
+	if (it != m_unboundDrivers.end())
+		driverDirectory = it->second;
+	else
+		m_unboundDrivers[pciAddress] = driverDirectory;
+
+	if (WriteFile(driverDirectory + "/bind", pciAddress, errorMessage) == false
+		&& (driverDirectory == fallback || WriteFile(fallback + "/bind", pciAddress, errorMessage) == false))
+		return false;
+
+	m_unboundDrivers.erase(pciAddress);
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSysfsUsbControllerDriver::GetUnboundControllers(std::vector<std::string>& pciAddresses) const
+{
+	pciAddresses.clear();
+	for (std::map<std::string, std::string>::const_iterator it = m_unboundDrivers.begin(); it != m_unboundDrivers.end(); ++it)
+		pciAddresses.push_back(it->first);
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbControllerRecovery::CUsbControllerRecovery(IUsbDeviceBackend& backend, IUsbControllerDriver& driver, UsbCameraDeviceManager::IUsbClock* clock)
+	: m_backend(backend), m_driver(driver), m_clock((clock != NULL) ? *clock : UsbCameraDeviceManager::CSystemUsbClock::Instance()), m_apiCallObserver(NULL), m_identityDatabase(NULL)
+{
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbControllerRecovery::SetIdentityDatabase(UsbCameraDeviceManager::CUsbCameraIdentityDatabase* identityDatabase)
+{
+	m_identityDatabase = identityDatabase;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbControllerRecovery::SetApiCallObserver(UsbCameraDeviceManager::IUsbApiCallObserver* apiCallObserver)
+{
+	m_apiCallObserver = apiCallObserver;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbControllerRecovery::ParseControllerAddress(const std::string& devicePath, std::string& pciAddress, std::string& rootHub)
+{
+	// .../0000:00:14.0/usb2/2-1/2-1.3 : find the usbN component, the one before it is the controller
+	std::size_t start = 0;
+	std::string previous;
+	while (start < devicePath.size())
+	{
+		std::size_t end = devicePath.find('/', start);
+		if (end == std::string::npos)
+			end = devicePath.size();
+
+		std::string component = devicePath.substr(start, end - start);
+		if (component.size() > 3 && component.compare(0, 3, "usb") == 0 && component.find_first_not_of("0123456789", 3) == std::string::npos)
+		{
+			if (previous == "")
+				return false;
+			pciAddress = previous;
+			rootHub = component;
+			return true;
+		}
+
+		if (component != "")
+			previous = component;
+		start = end + 1;
+	}
+	return false;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbControllerRecovery::FindCameraController(const std::string& serialNumber, std::string& pciAddress, std::string& errorMessage)
+{
+	std::string deviceName;
+	std::string devicePath;
+	std::string rootHub;
+	if (FindUsbDeviceBySerial(m_backend, serialNumber, deviceName) == false)
+	{
+		// gone, maybe along with the controller. The database remembers where it was.
+		UsbCameraDeviceManager::SUsbCameraIdentity identity;
+		if (m_identityDatabase != NULL && m_identityDatabase->Lookup(serialNumber, identity) && ParseControllerAddress(identity.sysfsPath, pciAddress, rootHub))
+			return true;
+
+		errorMessage = "Error: FindCameraController(): No usb device with serial number ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(", and the identity database doesn't know where it was.");
+		return false;
+	}
+
+	if (m_backend.ResolveDevicePath(deviceName, devicePath) == false || ParseControllerAddress(devicePath, pciAddress, rootHub) == false)
+	{
+		errorMessage = "Error: FindCameraController(): Unable to find the host controller of ";
+		errorMessage.append(deviceName);
+		return false;
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbControllerRecovery::GetControllerImpact(const std::string& pciAddress, SUsbControllerImpact& impact, std::string& errorMessage)
+{
+	impact.pciAddress = pciAddress;
+	impact.rootHubs.clear();
+	impact.devices.clear();
+	impact.notRecovered.clear();
+
+	std::vector<std::string> deviceNames;
+	if (m_backend.ListDevices(deviceNames) == false)
+	{
+		errorMessage = "Error: GetControllerImpact(): Unable to list usb devices.";
+		return false;
+	}
+
+	for (size_t i = 0; i < deviceNames.size(); i++)
+	{
+		std::string devicePath;
+		std::string controller;
+		std::string rootHub;
+		if (m_backend.ResolveDevicePath(deviceNames[i], devicePath) == false || ParseControllerAddress(devicePath, controller, rootHub) == false || controller != pciAddress)
+			continue;
+
+		if (deviceNames[i] == rootHub)
+		{
+			impact.rootHubs.push_back(rootHub);
+			continue;
+		}
+
+		SUsbAffectedDevice device;
+		device.deviceName = deviceNames[i];
+		m_backend.ReadAttribute(deviceNames[i], "serial", device.serialNumber);
+		m_backend.ReadAttribute(deviceNames[i], "idVendor", device.vendorId);
+		m_backend.ReadAttribute(deviceNames[i], "idProduct", device.productId);
+		m_backend.ReadAttribute(deviceNames[i], "speed", device.speed);
+		std::string deviceClass;
+		m_backend.ReadAttribute(deviceNames[i], "bDeviceClass", deviceClass);
+		device.isHub = (deviceClass == "09");
+		device.isCamera = (device.vendorId == "2676");
+		impact.devices.push_back(device);
+	}
+
+	if (impact.rootHubs.empty() && impact.devices.empty())
+	{
+		errorMessage = "Error: GetControllerImpact(): Nothing found on controller ";
+		errorMessage.append(pciAddress);
+		return false;
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbControllerRecovery::BindWithRetry(const std::string& pciAddress, const SUsbControllerRecoveryPolicy& policy, std::string& errorMessage)
+{
+	// the driver may refuse while the controller is still tearing down, so give it time
+	unsigned int retryMs = policy.bindRetryMs;
+	for (unsigned int attempt = 1; ; attempt++)
+	{
+		if (m_driver.Bind(pciAddress, errorMessage))
+			return true;
+		if (attempt >= policy.bindAttempts)
+			break;
+		m_clock.SleepMs(retryMs);
+		retryMs *= 2;
+	}
+
+	errorMessage.append(" Controller ");
+	errorMessage.append(pciAddress);
+	errorMessage.append(" is left unbound after ");
+	errorMessage.append(std::to_string(policy.bindAttempts));
+	errorMessage.append(" attempts to bind it.");
+	return false;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbControllerRecovery::BindController(const std::string& pciAddress, const SUsbControllerRecoveryPolicy& policy, std::string& errorMessage)
+{
+	return BindWithRetry(pciAddress, policy, errorMessage);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbControllerRecovery::RecoverCamera(const std::string& serialNumber, const SUsbControllerRecoveryPolicy& policy, SUsbControllerImpact& impact, std::string& errorMessage)
+{
+	uint64_t startMs = m_clock.NowMs();
+	std::string pciAddress;
+	bool succeeded = FindCameraController(serialNumber, pciAddress, errorMessage) && RebindController(pciAddress, serialNumber, policy, impact, errorMessage);
+	if (m_apiCallObserver != NULL)
+		m_apiCallObserver->OnApiCall("RecoverCamera", serialNumber, succeeded, (unsigned int)(m_clock.NowMs() - startMs), succeeded ? std::string() : errorMessage);
+	return succeeded;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbControllerRecovery::RecoverController(const std::string& pciAddress, const SUsbControllerRecoveryPolicy& policy, SUsbControllerImpact& impact, std::string& errorMessage)
+{
+	uint64_t startMs = m_clock.NowMs();
+	bool succeeded = RebindController(pciAddress, "", policy, impact, errorMessage);
+	if (m_apiCallObserver != NULL)
+		m_apiCallObserver->OnApiCall("RecoverController", pciAddress, succeeded, (unsigned int)(m_clock.NowMs() - startMs), succeeded ? std::string() : errorMessage);
+	return succeeded;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbControllerRecovery::RebindController(const std::string& pciAddress, const std::string& serialNumber, const SUsbControllerRecoveryPolicy& policy, SUsbControllerImpact& impact, std::string& errorMessage)
+{
+	// a wedged controller may have lost everything on it, there is still something to rebind then
+	std::string impactError;
+	if (GetControllerImpact(pciAddress, impact, impactError) == false)
+	{
+		impact.pciAddress = pciAddress;
+		if (serialNumber == "")
+		{
+			errorMessage = impactError;
+			return false;
+		}
+	}
+
+	// the camera the rebind is for is waited for too, even if it has dropped off
+	bool listed = false;
+	for (size_t i = 0; i < impact.devices.size(); i++)
+		listed = listed || (serialNumber != "" && impact.devices[i].serialNumber == serialNumber);
+	if (serialNumber != "" && listed == false)
+	{
+		SUsbAffectedDevice missing;
+		missing.serialNumber = serialNumber;
+		missing.isCamera = true;
+		missing.isHub = false;
+		UsbCameraDeviceManager::SUsbCameraIdentity identity;
+		if (m_identityDatabase != NULL && m_identityDatabase->Lookup(serialNumber, identity))
+			missing.deviceName = identity.portPath;
+		impact.devices.push_back(missing);
+	}
+
+	// a camera already degraded before the rebind has to come back at the speed it should have, not that one
+	for (size_t i = 0; i < impact.devices.size(); i++)
+	{
+		UsbCameraDeviceManager::SUsbCameraIdentity identity;
+		if (impact.devices[i].isCamera && impact.devices[i].serialNumber != "" && m_identityDatabase != NULL
+			&& m_identityDatabase->Lookup(impact.devices[i].serialNumber, identity) && atoi(identity.expectedSpeed.c_str()) > atoi(impact.devices[i].speed.c_str()))
+			impact.devices[i].speed = identity.expectedSpeed;
+	}
+
+	// check the blast radius against the policy before touching anything
+	unsigned int cameras = 0;
+	std::string bystanders;
+	for (size_t i = 0; i < impact.devices.size(); i++)
+	{
+		if (impact.devices[i].isCamera)
+			cameras++;
+		else if (impact.devices[i].isHub == false)
+		{
+			bystanders.append(" ");
+			bystanders.append(impact.devices[i].deviceName);
+		}
+	}
+
+	if (policy.rebind == UsbRebind_Never)
+	{
+		errorMessage = "Error: RecoverCamera(): Policy does not allow rebinding controller ";
+		errorMessage.append(pciAddress);
+		return false;
+	}
+	if (policy.rebind == UsbRebind_CamerasOnly && bystanders != "")
+	{
+		errorMessage = "Error: RecoverCamera(): Controller ";
+		errorMessage.append(pciAddress);
+		errorMessage.append(" also carries non-camera devices:");
+		errorMessage.append(bystanders);
+		return false;
+	}
+	if (policy.maxAffectedCameras != 0 && cameras > policy.maxAffectedCameras)
+	{
+		errorMessage = "Error: RecoverCamera(): Rebinding controller ";
+		errorMessage.append(pciAddress);
+		errorMessage.append(" would take down ");
+		errorMessage.append(std::to_string(cameras));
+		errorMessage.append(" cameras.");
+		return false;
+	}
+
+	if (m_driver.Unbind(pciAddress, errorMessage) == false)
+		return false;
+
+	m_clock.SleepMs(policy.unboundMs);
+
+	if (BindWithRetry(pciAddress, policy, errorMessage) == false)
+		return false;
+
+	// every camera that was on the controller has to come back, at least as fast as before
+	uint64_t start = m_clock.NowMs();
+	while (true)
+	{
+		impact.notRecovered.clear();
+		for (size_t i = 0; i < impact.devices.size(); i++)
+		{
+			const SUsbAffectedDevice& device = impact.devices[i];
+			if (device.isCamera == false)
+				continue;
+
+			// a camera without a serial number can only be looked for where it was, as the same product
+			std::string deviceName = device.deviceName;
+			std::string vendorId;
+			std::string productId;
+			std::string speed;
+			bool found = (device.serialNumber != "") ? FindUsbDeviceBySerial(m_backend, device.serialNumber, deviceName)
+				: m_backend.ReadAttribute(deviceName, "idVendor", vendorId) && m_backend.ReadAttribute(deviceName, "idProduct", productId)
+				&& vendorId == device.vendorId && productId == device.productId;
+			if (found == false
+				|| m_backend.ReadAttribute(deviceName, "speed", speed) == false
+				|| atoi(speed.c_str()) < atoi(device.speed.c_str()))
+				impact.notRecovered.push_back((device.serialNumber != "") ? device.serialNumber : device.deviceName);
+		}
+
+		if (impact.notRecovered.empty())
+			return true;
+
+		if (m_clock.NowMs() - start >= policy.verifyTimeoutMs)
+			break;
+		m_clock.SleepMs(100);
+	}
+
+	errorMessage = "Error: RecoverCamera(): Controller ";
+	errorMessage.append(pciAddress);
+	errorMessage.append(" rebound, but not back at their speed:");
+	for (size_t i = 0; i < impact.notRecovered.size(); i++)
+	{
+		errorMessage.append(" ");
+		errorMessage.append(impact.notRecovered[i]);
+	}
+	return false;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbControllerRecovery::FormatImpact(const SUsbControllerImpact& impact)
+{
+	std::string text = "Controller " + impact.pciAddress + ":";
+	for (size_t i = 0; i < impact.rootHubs.size(); i++)
+		text += " " + impact.rootHubs[i];
+	text += "\n";
+
+	for (size_t i = 0; i < impact.devices.size(); i++)
+	{
+		const SUsbAffectedDevice& device = impact.devices[i];
+		text += "  " + device.deviceName + " " + device.vendorId + ":" + device.productId + " " + device.speed + "M";
+		if (device.isCamera)
+			text += " camera " + device.serialNumber;
+		else if (device.isHub)
+			text += " hub";
+		text += "\n";
+	}
+	return text;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
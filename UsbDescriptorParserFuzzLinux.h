@@ -0,0 +1,269 @@
+// UsbDescriptorParserFuzzLinux.h
+// Fuzz target for CUsbDescriptorParser, for libFuzzer or as a self-contained mutation run
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBDESCRIPTORPARSERFUZZLINUX_H
+#define USBDESCRIPTORPARSERFUZZLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include "UsbDescriptorParserLinux.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// Feeds arbitrary bytes to the descriptor parser and checks what it hands back: every record and every view lies
+	// inside the input and is at least as long as its type needs, the walk moves forward and ends. Reading past the
+	// input is left to the sanitizer, so build with -fsanitize=address. fuzz/UsbDescriptorParserFuzz.cpp is the
+	// libFuzzer target, and without libFuzzer a program that has Run() mutate the seed blobs itself.
+	class CUsbDescriptorParserFuzzer
+	{
+	private:
+		// whether [p, p + length) lies inside [data, data + size)
+		static bool Inside(const uint8_t* data, size_t size, const uint8_t* p, size_t length);
+
+	public:
+		// Walks one input. Returns false with problem set if the parser broke one of its promises.
+		static bool CheckWalk(const uint8_t* data, size_t size, std::string& problem);
+
+		// libFuzzer entry point body: aborts on a broken promise so the fuzzer keeps the input
+		static int FuzzOne(const uint8_t* data, size_t size);
+
+		// Writes the descriptors of a typical USB3 Vision camera (control, event and streaming interfaces with their bulk
+		// endpoints, and SuperSpeed companions if superSpeed) into buffer. Returns the length, 0 if buffer is too small.
+		// The seed corpus, and what CUsbEnumerationBenchmark parses.
+		static size_t BuildCameraBlob(bool superSpeed, uint8_t* buffer, size_t bufferSize);
+
+		// Walks iterations mutations of the seed blobs (flipped bits, changed lengths, cut and spliced blobs), each copied
+		// into a buffer of exactly its size. Stops at the first broken promise; reproducible for the same seed.
+		static bool Run(unsigned int iterations, uint32_t seed, std::string& errorMessage);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline bool UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::Inside(const uint8_t* data, size_t size, const uint8_t* p, size_t length)
+{
+	return p >= data && (size_t)(p - data) <= size && length <= size - (size_t)(p - data);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::CheckWalk(const uint8_t* data, size_t size, std::string& problem)
+{
+	CUsbDescriptorParser parser(data, size);
+	if (parser.GetDeviceDescriptor().IsValid() && Inside(data, size, data, 18) == false)
+	{
+		problem = "device descriptor view is outside the input";
+		return false;
+	}
+
+	SUsbDescriptorRecord record;
+	size_t steps = 0;
+	size_t lastOffset = parser.GetOffset();
+	while (parser.Next(record) == UsbParseStatus_Ok)
+	{
+		// every descriptor is at least 2 bytes, so there can't be more steps than that allows
+		if (++steps > size / 2)
+		{
+			problem = "the walk doesn't end";
+			return false;
+		}
+		if (parser.GetOffset() <= lastOffset || parser.GetOffset() > size)
+		{
+			problem = "the offset didn't move forward inside the input";
+			return false;
+		}
+		lastOffset = parser.GetOffset();
+
+		if (record.length < 2 || Inside(data, size, record.raw, record.length) == false)
+		{
+			problem = "record is outside the input";
+			return false;
+		}
+		if ((record.type == UsbDescriptorType_Configuration && record.length < 9)
+			|| (record.type == UsbDescriptorType_Interface && record.length < 9)
+			|| (record.type == UsbDescriptorType_Endpoint && record.length < 7)
+			|| (record.type == UsbDescriptorType_SuperSpeedEndpointCompanion && record.length < 6))
+		{
+			problem = "record is shorter than its type";
+			return false;
+		}
+
+		// the views are read through, so the sanitizer sees it if one points past the input
+		volatile unsigned int sink = 0;
+		if (record.configuration.IsValid())
+			sink += record.configuration.TotalLength() + record.configuration.MaxPower();
+		if (record.usbInterface.IsValid())
+			sink += record.usbInterface.InterfaceProtocol();
+		if (record.endpoint.IsValid())
+			sink += record.endpoint.MaxPacketSize() + record.endpoint.Interval();
+		if (record.companion.IsValid())
+			sink += record.companion.BytesPerInterval();
+		(void)sink;
+	}
+
+	EUsbParseStatus status = parser.GetStatus();
+	if (status == UsbParseStatus_Ok)
+	{
+		problem = "the walk stopped without a status";
+		return false;
+	}
+	if (status == UsbParseStatus_End && parser.GetOffset() != size && parser.GetDeviceDescriptor().IsValid())
+	{
+		problem = "the walk ended before the end of the input";
+		return false;
+	}
+	return true;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::FuzzOne(const uint8_t* data, size_t size)
+{
+	std::string problem;
+	if (CheckWalk(data, size, problem) == false)
+		abort();
+	return 0;
+}
+
+inline size_t UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::BuildCameraBlob(bool superSpeed, uint8_t* buffer, size_t bufferSize)
+{
+	uint8_t blob[256];
+	size_t length = 0;
+	uint16_t bcdUsb = superSpeed ? 0x0320 : 0x0210;
+	uint16_t mps = superSpeed ? 1024 : 512;
+
+	// device descriptor: miscellaneous class with an interface association, as USB3 Vision devices report
+	const uint8_t device[18] = { 18, UsbDescriptorType_Device, (uint8_t)(bcdUsb & 0xFF), (uint8_t)(bcdUsb >> 8), 0xEF, 0x02, 0x01, (uint8_t)(superSpeed ? 9 : 64),
+		0x76, 0x26, 0x02, 0xBA, 0x00, 0x01, 1, 2, 3, 1 };
+	memcpy(blob + length, device, sizeof(device));
+	length += sizeof(device);
+
+	size_t configuration = length;
+	const uint8_t configurationHeader[9] = { 9, UsbDescriptorType_Configuration, 0, 0, 3, 1, 0, 0x80, (uint8_t)(superSpeed ? 112 : 250) };
+	memcpy(blob + length, configurationHeader, sizeof(configurationHeader));
+	length += sizeof(configurationHeader);
+
+	const uint8_t association[8] = { 8, UsbDescriptorType_InterfaceAssociation, 0, 3, 0xEF, 0x05, 0x00, 0 };
+	memcpy(blob + length, association, sizeof(association));
+	length += sizeof(association);
+
+	// control (bulk in and out), event (bulk in) and streaming (bulk in) interfaces
+	const uint8_t endpointsPerInterface[3] = { 2, 1, 1 };
+	const uint8_t protocols[3] = { 0x00, 0x01, 0x02 };
+	uint8_t endpointNumber = 1;
+	for (uint8_t i = 0; i < 3; i++)
+	{
+		const uint8_t usbInterface[9] = { 9, UsbDescriptorType_Interface, i, 0, endpointsPerInterface[i], 0xEF, 0x05, protocols[i], 0 };
+		memcpy(blob + length, usbInterface, sizeof(usbInterface));
+		length += sizeof(usbInterface);
+
+		for (uint8_t e = 0; e < endpointsPerInterface[i]; e++)
+		{
+			uint8_t address = (e == 0) ? (uint8_t)(0x80 | endpointNumber) : endpointNumber;
+			endpointNumber++;
+			const uint8_t endpoint[7] = { 7, UsbDescriptorType_Endpoint, address, UsbTransferType_Bulk, (uint8_t)(mps & 0xFF), (uint8_t)(mps >> 8), 0 };
+			memcpy(blob + length, endpoint, sizeof(endpoint));
+			length += sizeof(endpoint);
+
+			if (superSpeed)
+			{
+				// the streaming endpoint bursts, the others don't need to
+				const uint8_t companion[6] = { 6, UsbDescriptorType_SuperSpeedEndpointCompanion, (uint8_t)((i == 2) ? 15 : 0), 0, 0, 0 };
+				memcpy(blob + length, companion, sizeof(companion));
+				length += sizeof(companion);
+			}
+		}
+	}
+
+	blob[configuration + 2] = (uint8_t)((length - configuration) & 0xFF);
+	blob[configuration + 3] = (uint8_t)((length - configuration) >> 8);
+
+	if (buffer == NULL || bufferSize < length)
+		return 0;
+	memcpy(buffer, blob, length);
+	return length;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::Run(unsigned int iterations, uint32_t seed, std::string& errorMessage)
+{
+	std::vector<std::vector<uint8_t> > seeds(2, std::vector<uint8_t>(256));
+	seeds[0].resize(BuildCameraBlob(true, &seeds[0][0], seeds[0].size()));
+	seeds[1].resize(BuildCameraBlob(false, &seeds[1][0], seeds[1].size()));
+
+	std::mt19937 random(seed);
+	for (unsigned int i = 0; i < iterations; i++)
+	{
+		std::vector<uint8_t> input = seeds[random() % seeds.size()];
+
+		// a few mutations on top of each other
+		int mutations = 1 + (int)(random() % 4);
+		for (int m = 0; m < mutations && input.empty() == false; m++)
+		{
+			size_t at = random() % input.size();
+			switch (random() % 6)
+			{
+			case 0:
+				input[at] ^= (uint8_t)(1u << (random() % 8));
+				break;
+			case 1:
+				input[at] = (uint8_t)random();
+				break;
+			case 2:
+				// lengths are what the parser trusts least, hit them on purpose
+				input[at] = (uint8_t)((random() % 2) ? 0 : (random() % 2) ? 1 : 0xFF);
+				break;
+			case 3:
+				input.resize(at);
+				break;
+			case 4:
+			{
+				const std::vector<uint8_t>& other = seeds[random() % seeds.size()];
+				size_t from = random() % other.size();
+				input.resize(at);
+				input.insert(input.end(), other.begin() + from, other.end());
+				break;
+			}
+			default:
+				input.insert(input.begin() + at, (uint8_t)random());
+				break;
+			}
+		}
+
+		// exactly sized on the heap, so the sanitizer catches a read past the end
+		uint8_t* data = (uint8_t*)malloc(input.size() > 0 ? input.size() : 1);
+		if (input.empty() == false)
+			memcpy(data, &input[0], input.size());
+		std::string problem;
+		bool ok = CheckWalk(data, input.size(), problem);
+		free(data);
+
+		if (ok == false)
+		{
+			errorMessage = "Error: CUsbDescriptorParserFuzzer::Run(): Iteration " + std::to_string(i) + " (seed " + std::to_string(seed) + "): " + problem;
+			return false;
+		}
+	}
+	return true;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
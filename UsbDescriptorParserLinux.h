@@ -0,0 +1,355 @@
+// UsbDescriptorParserLinux.h
+// Zero-copy parser for the raw USB descriptor blob exposed by sysfs (/sys/bus/usb/devices/<dev>/descriptors)
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBDESCRIPTORPARSERLINUX_H
+#define USBDESCRIPTORPARSERLINUX_H
+
+#ifdef LINUX_BUILD
+#include <cstddef>
+#include <stdint.h>
+
+// The sysfs blob is the 18 byte device descriptor followed by every configuration descriptor
+// (each with its interface, endpoint and class specific descriptors) exactly as the device sent them.
+// The views below only hold a pointer into the caller's buffer, so parsing never allocates.
+// Multi byte fields are little endian (bus order).
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// Descriptor types we care about (USB 3.2 spec, table 9-6)
+	enum EUsbDescriptorType
+	{
+		UsbDescriptorType_Device = 0x01,
+		UsbDescriptorType_Configuration = 0x02,
+		UsbDescriptorType_String = 0x03,
+		UsbDescriptorType_Interface = 0x04,
+		UsbDescriptorType_Endpoint = 0x05,
+		UsbDescriptorType_InterfaceAssociation = 0x0B,
+		UsbDescriptorType_Bos = 0x0F,
+		UsbDescriptorType_SuperSpeedEndpointCompanion = 0x30
+	};
+
+	// Endpoint transfer types (bmAttributes bits 0..1)
+	enum EUsbTransferType
+	{
+		UsbTransferType_Control = 0,
+		UsbTransferType_Isochronous = 1,
+		UsbTransferType_Bulk = 2,
+		UsbTransferType_Interrupt = 3
+	};
+
+	// Result of a parse step
+	enum EUsbParseStatus
+	{
+		UsbParseStatus_Ok = 0,
+		UsbParseStatus_End,
+		UsbParseStatus_Truncated,      // a descriptor claims more bytes than are left
+		UsbParseStatus_BadLength,      // bLength too small for the descriptor type
+		UsbParseStatus_BadDevice,      // blob does not start with a device descriptor
+		UsbParseStatus_BadTotalLength  // configuration wTotalLength is inconsistent
+	};
+
+	// little endian helper
+	inline uint16_t UsbReadLe16(const uint8_t* p)
+	{
+		return (uint16_t)(p[0] | (p[1] << 8));
+	}
+
+	// View of the 18 byte device descriptor
+	class CUsbDeviceDescriptorView
+	{
+	private:
+		const uint8_t* m_p;
+
+	public:
+		CUsbDeviceDescriptorView(const uint8_t* p = NULL) : m_p(p) {}
+		bool IsValid() const { return m_p != NULL; }
+		uint16_t BcdUsb() const { return UsbReadLe16(m_p + 2); }
+		uint8_t DeviceClass() const { return m_p[4]; }
+		uint8_t MaxPacketSize0() const { return m_p[7]; }
+		uint16_t VendorId() const { return UsbReadLe16(m_p + 8); }
+		uint16_t ProductId() const { return UsbReadLe16(m_p + 10); }
+		uint16_t BcdDevice() const { return UsbReadLe16(m_p + 12); }
+		uint8_t NumConfigurations() const { return m_p[17]; }
+	};
+
+	// View of a configuration descriptor
+	class CUsbConfigurationView
+	{
+	private:
+		const uint8_t* m_p;
+
+	public:
+		CUsbConfigurationView(const uint8_t* p = NULL) : m_p(p) {}
+		bool IsValid() const { return m_p != NULL; }
+		uint16_t TotalLength() const { return UsbReadLe16(m_p + 2); }
+		uint8_t NumInterfaces() const { return m_p[4]; }
+		uint8_t ConfigurationValue() const { return m_p[5]; }
+		uint8_t Attributes() const { return m_p[7]; }
+		bool IsSelfPowered() const { return (m_p[7] & 0x40) != 0; }
+		uint8_t MaxPower() const { return m_p[8]; }
+		// bMaxPower is in 2 mA units for USB2 and 8 mA units for SuperSpeed devices
+		unsigned int MaxPowerMilliAmps(bool superSpeed) const { return m_p[8] * (superSpeed ? 8u : 2u); }
+	};
+
+	// View of an interface descriptor
+	class CUsbInterfaceView
+	{
+	private:
+		const uint8_t* m_p;
+
+	public:
+		CUsbInterfaceView(const uint8_t* p = NULL) : m_p(p) {}
+		bool IsValid() const { return m_p != NULL; }
+		uint8_t InterfaceNumber() const { return m_p[2]; }
+		uint8_t AlternateSetting() const { return m_p[3]; }
+		uint8_t NumEndpoints() const { return m_p[4]; }
+		uint8_t InterfaceClass() const { return m_p[5]; }
+		uint8_t InterfaceSubClass() const { return m_p[6]; }
+		uint8_t InterfaceProtocol() const { return m_p[7]; }
+	};
+
+	// View of an endpoint descriptor
+	class CUsbEndpointView
+	{
+	private:
+		const uint8_t* m_p;
+
+	public:
+		CUsbEndpointView(const uint8_t* p = NULL) : m_p(p) {}
+		bool IsValid() const { return m_p != NULL; }
+		uint8_t Address() const { return m_p[2]; }
+		uint8_t Number() const { return m_p[2] & 0x0F; }
+		bool IsIn() const { return (m_p[2] & 0x80) != 0; }
+		EUsbTransferType TransferType() const { return (EUsbTransferType)(m_p[3] & 0x03); }
+		// bits 0..10 of wMaxPacketSize
+		uint16_t MaxPacketSize() const { return UsbReadLe16(m_p + 4) & 0x07FF; }
+		// bits 11..12 of wMaxPacketSize (high speed high bandwidth endpoints only)
+		uint8_t AdditionalTransactions() const { return (uint8_t)((UsbReadLe16(m_p + 4) >> 11) & 0x03); }
+		uint8_t Interval() const { return m_p[6]; }
+	};
+
+	// View of a SuperSpeed endpoint companion descriptor
+	class CUsbSsCompanionView
+	{
+	private:
+		const uint8_t* m_p;
+
+	public:
+		CUsbSsCompanionView(const uint8_t* p = NULL) : m_p(p) {}
+		bool IsValid() const { return m_p != NULL; }
+		// packets per burst minus one (0..15)
+		uint8_t MaxBurst() const { return m_p[2]; }
+		uint8_t Attributes() const { return m_p[3]; }
+		// bulk endpoints: number of streams as power of two (0 = no streams)
+		uint8_t MaxStreamsExponent() const { return m_p[3] & 0x1F; }
+		// isochronous endpoints: burst multiplier minus one
+		uint8_t Mult() const { return m_p[3] & 0x03; }
+		uint16_t BytesPerInterval() const { return UsbReadLe16(m_p + 4); }
+	};
+
+	// One step of the walk. The enclosing configuration / interface / endpoint views stay valid
+	// across steps, so an endpoint record already knows which interface it belongs to.
+	struct SUsbDescriptorRecord
+	{
+		uint8_t type;
+		uint8_t length;
+		const uint8_t* raw;
+		CUsbConfigurationView configuration;
+		CUsbInterfaceView usbInterface;
+		CUsbEndpointView endpoint;
+		CUsbSsCompanionView companion;
+	};
+
+	// Walks a descriptor blob front to back. Any inconsistency stops the walk with an error status;
+	// nothing is ever read past the end of the buffer.
+	class CUsbDescriptorParser
+	{
+	private:
+		const uint8_t* m_data;
+		size_t m_size;
+		size_t m_offset;
+		size_t m_configurationEnd;
+		EUsbParseStatus m_status;
+		CUsbDeviceDescriptorView m_device;
+		SUsbDescriptorRecord m_current;
+
+		EUsbParseStatus Fail(EUsbParseStatus status);
+
+	public:
+		CUsbDescriptorParser(const uint8_t* data, size_t size);
+
+		// The device descriptor at the front of the blob (invalid if the blob is malformed)
+		CUsbDeviceDescriptorView GetDeviceDescriptor() const;
+
+		// Advances to the next descriptor. Returns UsbParseStatus_Ok while there is a record to look at.
+		EUsbParseStatus Next(SUsbDescriptorRecord& record);
+
+		// Status of the last step (UsbParseStatus_End after a clean walk)
+		EUsbParseStatus GetStatus() const;
+
+		// Offset of the first byte that was not consumed (where parsing stopped on error)
+		size_t GetOffset() const;
+
+		// For reference, a printable name for a status
+		static const char* StatusToString(EUsbParseStatus status);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbDescriptorParser::CUsbDescriptorParser(const uint8_t* data, size_t size)
+{
+	m_data = data;
+	m_size = (data != NULL) ? size : 0;
+	m_offset = 0;
+	m_configurationEnd = 0;
+	m_status = UsbParseStatus_Ok;
+	m_current = SUsbDescriptorRecord();
+
+	// the blob must start with a complete device descriptor
+	if (m_size < 18 || m_data[0] < 18 || m_data[0] > m_size || m_data[1] != UsbDescriptorType_Device)
+	{
+		m_status = UsbParseStatus_BadDevice;
+		return;
+	}
+
+	m_device = CUsbDeviceDescriptorView(m_data);
+	m_offset = m_data[0];
+}
+
+inline UsbCameraDeviceManagerLinux::EUsbParseStatus UsbCameraDeviceManagerLinux::CUsbDescriptorParser::Fail(EUsbParseStatus status)
+{
+	m_status = status;
+	return status;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbDeviceDescriptorView UsbCameraDeviceManagerLinux::CUsbDescriptorParser::GetDeviceDescriptor() const
+{
+	return m_device;
+}
+
+inline UsbCameraDeviceManagerLinux::EUsbParseStatus UsbCameraDeviceManagerLinux::CUsbDescriptorParser::Next(SUsbDescriptorRecord& record)
+{
+	if (m_status != UsbParseStatus_Ok)
+		return m_status;
+
+	if (m_offset == m_size)
+		return Fail(UsbParseStatus_End);
+
+	// every descriptor starts with bLength and bDescriptorType
+	if (m_size - m_offset < 2)
+		return Fail(UsbParseStatus_Truncated);
+
+	const uint8_t* p = m_data + m_offset;
+	uint8_t length = p[0];
+	uint8_t type = p[1];
+
+	if (length < 2)
+		return Fail(UsbParseStatus_BadLength);
+	if (length > m_size - m_offset)
+		return Fail(UsbParseStatus_Truncated);
+
+	// a configuration's children may not spill over its wTotalLength
+	if (type != UsbDescriptorType_Configuration && m_configurationEnd != 0 && m_offset + length > m_configurationEnd)
+		return Fail(UsbParseStatus_BadTotalLength);
+
+	// after the device descriptor everything has to live inside a configuration
+	if (m_current.configuration.IsValid() == false && type != UsbDescriptorType_Configuration)
+		return Fail(UsbParseStatus_BadTotalLength);
+
+	switch (type)
+	{
+	case UsbDescriptorType_Configuration:
+		if (length < 9)
+			return Fail(UsbParseStatus_BadLength);
+		if (m_configurationEnd != 0 && m_offset != m_configurationEnd)
+			return Fail(UsbParseStatus_BadTotalLength);
+		if (UsbReadLe16(p + 2) < length || UsbReadLe16(p + 2) > m_size - m_offset)
+			return Fail(UsbParseStatus_BadTotalLength);
+		m_configurationEnd = m_offset + UsbReadLe16(p + 2);
+		m_current.configuration = CUsbConfigurationView(p);
+		m_current.usbInterface = CUsbInterfaceView();
+		m_current.endpoint = CUsbEndpointView();
+		m_current.companion = CUsbSsCompanionView();
+		break;
+	case UsbDescriptorType_Interface:
+		if (length < 9)
+			return Fail(UsbParseStatus_BadLength);
+		m_current.usbInterface = CUsbInterfaceView(p);
+		m_current.endpoint = CUsbEndpointView();
+		m_current.companion = CUsbSsCompanionView();
+		break;
+	case UsbDescriptorType_Endpoint:
+		if (length < 7)
+			return Fail(UsbParseStatus_BadLength);
+		m_current.endpoint = CUsbEndpointView(p);
+		m_current.companion = CUsbSsCompanionView();
+		break;
+	case UsbDescriptorType_SuperSpeedEndpointCompanion:
+		if (length < 6)
+			return Fail(UsbParseStatus_BadLength);
+		m_current.companion = CUsbSsCompanionView(p);
+		break;
+	default:
+		// class specific and unknown descriptors are passed through untouched
+		break;
+	}
+
+	m_current.type = type;
+	m_current.length = length;
+	m_current.raw = p;
+	m_offset += length;
+
+	record = m_current;
+	return UsbParseStatus_Ok;
+}
+
+inline UsbCameraDeviceManagerLinux::EUsbParseStatus UsbCameraDeviceManagerLinux::CUsbDescriptorParser::GetStatus() const
+{
+	return m_status;
+}
+
+inline size_t UsbCameraDeviceManagerLinux::CUsbDescriptorParser::GetOffset() const
+{
+	return m_offset;
+}
+
+inline const char* UsbCameraDeviceManagerLinux::CUsbDescriptorParser::StatusToString(EUsbParseStatus status)
+{
+	switch (status)
+	{
+	case UsbParseStatus_Ok:
+		return "Ok";
+	case UsbParseStatus_End:
+		return "End";
+	case UsbParseStatus_Truncated:
+		return "Truncated descriptor";
+	case UsbParseStatus_BadLength:
+		return "Descriptor length too small";
+	case UsbParseStatus_BadDevice:
+		return "Missing device descriptor";
+	case UsbParseStatus_BadTotalLength:
+		return "Inconsistent configuration total length";
+	}
+	return "Unknown";
+}
+// *********************************************************************************************************
+
+#endif
+#endif
@@ -0,0 +1,541 @@
+// UsbDeviceBackendLinux.h
+// The system calls the Linux helpers make (sysfs, usbfs), behind an interface so they can be simulated
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBDEVICEBACKENDLINUX_H
+#define USBDEVICEBACKENDLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <climits>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// Everything the Linux helpers need from the system. Devices are named like their sysfs
+	// directory (eg: "2-1.3"). Calls that touch a usbfs handle return 0 / a handle on success
+	// and -errno on failure so callers can tell EBUSY from ENODEV.
+	class IUsbDeviceBackend
+	{
+	public:
+		virtual ~IUsbDeviceBackend() {}
+
+		// Lists the usb devices (not interfaces) currently present
+		virtual bool ListDevices(std::vector<std::string>& deviceNames) = 0;
+
+		// Reads one sysfs attribute of a device (eg: "serial", "busnum"), trailing newline removed
+		virtual bool ReadAttribute(const std::string& deviceName, const char* attribute, std::string& value) = 0;
+
+		// The device's real sysfs path, which shows the PCI controller it hangs off
+		// (eg: /sys/devices/pci0000:00/0000:00:14.0/usb2/2-1/2-1.3)
+		virtual bool ResolveDevicePath(const std::string& deviceName, std::string& devicePath) = 0;
+
+		// Opens the usbfs node /dev/bus/usb/BBB/DDD. Returns a handle >= 0 or -errno.
+		virtual int OpenUsbfs(int busnum, int devnum) = 0;
+
+		// Reads the device descriptor through an open usbfs handle. Returns bytes read or -errno.
+		virtual int ReadUsbfsDescriptor(int handle, uint8_t* buffer, size_t bufferSize) = 0;
+
+		// Issues USBDEVFS_RESET on an open usbfs handle. Returns 0 or -errno.
+		virtual int ResetUsbfs(int handle) = 0;
+
+		// Closes a usbfs handle
+		virtual void CloseUsbfs(int handle) = 0;
+
+		// Finds the device behind the usbfs node /dev/bus/usb/BBB/DDD. This reads the numbers of every device, backends
+		// that can look one up directly override it.
+		virtual bool FindDeviceByNumber(int busnum, int devnum, std::string& deviceName);
+	};
+
+	// Finds the device with the given serial number on a backend. Returns false if none matches.
+	bool FindUsbDeviceBySerial(IUsbDeviceBackend& backend, const std::string& serialNumber, std::string& deviceName);
+
+	// The parent of a device in the topology (eg: "2-1.3" -> "2-1", "2-1" -> "usb2"). Empty for root hubs.
+	std::string GetParentUsbDeviceName(const std::string& deviceName);
+
+	// The real system
+	class CSysfsUsbDeviceBackend : public IUsbDeviceBackend
+	{
+	private:
+		std::string m_sysfsRoot;
+		std::string m_usbfsRoot;
+
+	public:
+		CSysfsUsbDeviceBackend(const std::string& sysfsRoot = "/sys/bus/usb/devices", const std::string& usbfsRoot = "/dev/bus/usb");
+
+		// For reference, the directory devices are listed from
+		std::string GetSysfsRoot() const;
+
+		virtual bool ListDevices(std::vector<std::string>& deviceNames);
+		virtual bool ReadAttribute(const std::string& deviceName, const char* attribute, std::string& value);
+		virtual bool ResolveDevicePath(const std::string& deviceName, std::string& devicePath);
+		virtual int OpenUsbfs(int busnum, int devnum);
+		virtual int ReadUsbfsDescriptor(int handle, uint8_t* buffer, size_t bufferSize);
+		virtual int ResetUsbfs(int handle);
+		virtual void CloseUsbfs(int handle);
+
+		// Follows the device's char device link (/sys/dev/char/189:N) instead of reading every device
+		virtual bool FindDeviceByNumber(int busnum, int devnum, std::string& deviceName);
+	};
+
+	// An in-memory bus. Devices can be plugged, unplugged and re-enumerated at will, and every
+	// reset is counted, so reset and recovery logic can be exercised without cameras or root.
+	class CSimulatedUsbDeviceBackend : public IUsbDeviceBackend
+	{
+	private:
+		struct SSimulatedDevice
+		{
+			std::map<std::string, std::string> attributes;
+			int resetCount;
+		};
+
+		// a handle remembers which enumeration (devnum) of the device it was opened on
+		struct SSimulatedHandle
+		{
+			std::string deviceName;
+			std::string devnum;
+		};
+
+		std::mutex m_lock;
+		std::map<std::string, SSimulatedDevice> m_devices;
+		std::map<int, SSimulatedHandle> m_handles;
+		std::map<int, std::string> m_busControllers;
+		int m_nextHandle;
+		int m_nextDevnum;
+
+		// the device behind a handle, or NULL with error set if the handle is bad or stale (m_lock held)
+		SSimulatedDevice* FindOpenDevice(int handle, int& error);
+
+	public:
+		CSimulatedUsbDeviceBackend();
+
+		// Plugs in a device. speed is the sysfs "speed" value in Mbps (eg: "5000")
+		void AddDevice(const std::string& deviceName, int busnum, uint16_t vendorId, uint16_t productId, const std::string& serialNumber, const std::string& speed = "5000");
+
+		// Unplugs a device. Open handles to it start failing with ENODEV.
+		void RemoveDevice(const std::string& deviceName);
+
+		// Simulates a re-enumeration: the device gets a new devnum and old handles go stale
+		void ReenumerateDevice(const std::string& deviceName);
+
+		// Sets or overrides any sysfs attribute of a device
+		void SetAttribute(const std::string& deviceName, const std::string& attribute, const std::string& value);
+
+		// Number of resets issued to a device
+		int GetResetCount(const std::string& deviceName);
+
+		// Puts a bus on a PCI controller (eg: "0000:00:14.0", the default for every bus)
+		void SetBusController(int busnum, const std::string& pciAddress);
+
+		virtual bool ListDevices(std::vector<std::string>& deviceNames);
+		virtual bool ReadAttribute(const std::string& deviceName, const char* attribute, std::string& value);
+		virtual bool ResolveDevicePath(const std::string& deviceName, std::string& devicePath);
+		virtual int OpenUsbfs(int busnum, int devnum);
+		virtual int ReadUsbfsDescriptor(int handle, uint8_t* buffer, size_t bufferSize);
+		virtual int ResetUsbfs(int handle);
+		virtual void CloseUsbfs(int handle);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline bool UsbCameraDeviceManagerLinux::IUsbDeviceBackend::FindDeviceByNumber(int busnum, int devnum, std::string& deviceName)
+{
+	std::vector<std::string> deviceNames;
+	if (ListDevices(deviceNames) == false)
+		return false;
+
+	for (size_t i = 0; i < deviceNames.size(); i++)
+	{
+		std::string bus;
+		std::string device;
+		if (ReadAttribute(deviceNames[i], "busnum", bus) && atoi(bus.c_str()) == busnum
+			&& ReadAttribute(deviceNames[i], "devnum", device) && atoi(device.c_str()) == devnum)
+		{
+			deviceName = deviceNames[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+inline bool UsbCameraDeviceManagerLinux::FindUsbDeviceBySerial(IUsbDeviceBackend& backend, const std::string& serialNumber, std::string& deviceName)
+{
+	std::vector<std::string> deviceNames;
+	if (serialNumber == "" || backend.ListDevices(deviceNames) == false)
+		return false;
+
+	for (size_t i = 0; i < deviceNames.size(); i++)
+	{
+		std::string serial;
+		if (backend.ReadAttribute(deviceNames[i], "serial", serial) && serial == serialNumber)
+		{
+			deviceName = deviceNames[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::GetParentUsbDeviceName(const std::string& deviceName)
+{
+	// root hubs are named usbN
+	if (deviceName.compare(0, 3, "usb") == 0)
+		return "";
+
+	std::size_t dot = deviceName.rfind('.');
+	if (dot != std::string::npos)
+		return deviceName.substr(0, dot);
+
+	std::size_t dash = deviceName.find('-');
+	if (dash == std::string::npos)
+		return "";
+	return "usb" + deviceName.substr(0, dash);
+}
+
+inline UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::CSysfsUsbDeviceBackend(const std::string& sysfsRoot, const std::string& usbfsRoot)
+{
+	m_sysfsRoot = sysfsRoot;
+	m_usbfsRoot = usbfsRoot;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::GetSysfsRoot() const
+{
+	return m_sysfsRoot;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::ListDevices(std::vector<std::string>& deviceNames)
+{
+	DIR* dir = opendir(m_sysfsRoot.c_str());
+	if (dir == NULL)
+		return false;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		// skip interfaces (eg: 2-1.3:1.0) and hidden entries
+		if (entry->d_name[0] == '.' || strchr(entry->d_name, ':') != NULL)
+			continue;
+		deviceNames.push_back(entry->d_name);
+	}
+
+	closedir(dir);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::ReadAttribute(const std::string& deviceName, const char* attribute, std::string& value)
+{
+	std::string path = m_sysfsRoot;
+	path.append("/");
+	path.append(deviceName);
+	path.append("/");
+	path.append(attribute);
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	char buf[256];
+	ssize_t num_bytes = read(fd, buf, sizeof(buf));
+	close(fd);
+
+	if (num_bytes < 0)
+		return false;
+
+	while (num_bytes > 0 && (buf[num_bytes - 1] == '\n' || buf[num_bytes - 1] == ' '))
+		num_bytes--;
+
+	value.assign(buf, num_bytes);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::ResolveDevicePath(const std::string& deviceName, std::string& devicePath)
+{
+	// the entries in /sys/bus/usb/devices are symlinks into the device tree
+	std::string path = m_sysfsRoot;
+	path.append("/");
+	path.append(deviceName);
+
+	char resolved[PATH_MAX];
+	if (realpath(path.c_str(), resolved) == NULL)
+		return false;
+
+	devicePath = resolved;
+	return true;
+}
+
+inline int UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::OpenUsbfs(int busnum, int devnum)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%03d/%03d", m_usbfsRoot.c_str(), busnum, devnum);
+
+	int fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	return fd;
+}
+
+inline int UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::ReadUsbfsDescriptor(int handle, uint8_t* buffer, size_t bufferSize)
+{
+	// reading a usbfs node returns the cached descriptors starting with the device descriptor
+	ssize_t num_bytes = pread(handle, buffer, bufferSize, 0);
+	if (num_bytes < 0)
+		return -errno;
+	return (int)num_bytes;
+}
+
+inline int UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::ResetUsbfs(int handle)
+{
+	if (ioctl(handle, USBDEVFS_RESET, 0) < 0)
+		return -errno;
+	return 0;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::CloseUsbfs(int handle)
+{
+	if (handle >= 0)
+		close(handle);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend::FindDeviceByNumber(int busnum, int devnum, std::string& deviceName)
+{
+	// a root that isn't sysfs' own layout (eg: a copy of the flat directory only) has no link to follow
+	const std::string devices = "/bus/usb/devices";
+	if (m_sysfsRoot.size() <= devices.size() || m_sysfsRoot.compare(m_sysfsRoot.size() - devices.size(), devices.size(), devices) != 0)
+		return IUsbDeviceBackend::FindDeviceByNumber(busnum, devnum, deviceName);
+
+	// usb devices are char major 189, numbered 128 per bus. No link yet means sysfs doesn't have the device yet.
+	if (busnum <= 0 || devnum <= 0 || devnum > 128)
+		return false;
+	char link[512];
+	snprintf(link, sizeof(link), "%s/dev/char/189:%d", m_sysfsRoot.substr(0, m_sysfsRoot.size() - devices.size()).c_str(), (busnum - 1) * 128 + devnum - 1);
+	char resolved[PATH_MAX];
+	if (realpath(link, resolved) == NULL)
+		return false;
+
+	// the directory is named like the device, and has to still carry these numbers
+	std::string name = resolved;
+	name = name.substr(name.rfind('/') + 1);
+	std::string bus;
+	std::string device;
+	if (ReadAttribute(name, "busnum", bus) == false || atoi(bus.c_str()) != busnum
+		|| ReadAttribute(name, "devnum", device) == false || atoi(device.c_str()) != devnum)
+		return false;
+
+	deviceName = name;
+	return true;
+}
+
+inline UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::CSimulatedUsbDeviceBackend()
+{
+	m_nextHandle = 1000;
+	m_nextDevnum = 2;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::AddDevice(const std::string& deviceName, int busnum, uint16_t vendorId, uint16_t productId, const std::string& serialNumber, const std::string& speed)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+
+	char vid[8];
+	char pid[8];
+	snprintf(vid, sizeof(vid), "%04x", vendorId);
+	snprintf(pid, sizeof(pid), "%04x", productId);
+
+	SSimulatedDevice& device = m_devices[deviceName];
+	device.attributes.clear();
+	device.attributes["busnum"] = std::to_string(busnum);
+	device.attributes["devnum"] = std::to_string(m_nextDevnum++);
+	device.attributes["idVendor"] = vid;
+	device.attributes["idProduct"] = pid;
+	device.attributes["serial"] = serialNumber;
+	device.attributes["speed"] = speed;
+	device.attributes["bConfigurationValue"] = "1";
+	device.resetCount = 0;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::RemoveDevice(const std::string& deviceName)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_devices.erase(deviceName);
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::ReenumerateDevice(const std::string& deviceName)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SSimulatedDevice>::iterator it = m_devices.find(deviceName);
+	if (it != m_devices.end())
+		it->second.attributes["devnum"] = std::to_string(m_nextDevnum++);
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::SetAttribute(const std::string& deviceName, const std::string& attribute, const std::string& value)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SSimulatedDevice>::iterator it = m_devices.find(deviceName);
+	if (it != m_devices.end())
+		it->second.attributes[attribute] = value;
+}
+
+inline int UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::GetResetCount(const std::string& deviceName)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SSimulatedDevice>::iterator it = m_devices.find(deviceName);
+	if (it == m_devices.end())
+		return 0;
+	return it->second.resetCount;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::SetBusController(int busnum, const std::string& pciAddress)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_busControllers[busnum] = pciAddress;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::ListDevices(std::vector<std::string>& deviceNames)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (std::map<std::string, SSimulatedDevice>::iterator it = m_devices.begin(); it != m_devices.end(); ++it)
+		deviceNames.push_back(it->first);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::ReadAttribute(const std::string& deviceName, const char* attribute, std::string& value)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SSimulatedDevice>::iterator it = m_devices.find(deviceName);
+	if (it == m_devices.end())
+		return false;
+
+	std::map<std::string, std::string>::iterator attr = it->second.attributes.find(attribute);
+	if (attr == it->second.attributes.end())
+		return false;
+
+	value = attr->second;
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::ResolveDevicePath(const std::string& deviceName, std::string& devicePath)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SSimulatedDevice>::iterator it = m_devices.find(deviceName);
+	if (it == m_devices.end())
+		return false;
+
+	int busnum = atoi(it->second.attributes["busnum"].c_str());
+	std::map<int, std::string>::iterator controller = m_busControllers.find(busnum);
+	std::string pciAddress = (controller != m_busControllers.end()) ? controller->second : "0000:00:14.0";
+
+	// build the path the way the kernel nests it: controller, root hub, then every hub on the way
+	std::string chain;
+	for (std::string name = deviceName; name != ""; name = GetParentUsbDeviceName(name))
+		chain = "/" + name + chain;
+
+	devicePath = "/sys/devices/pci0000:00/" + pciAddress + chain;
+	return true;
+}
+
+inline int UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::OpenUsbfs(int busnum, int devnum)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::string bus = std::to_string(busnum);
+	std::string dev = std::to_string(devnum);
+	for (std::map<std::string, SSimulatedDevice>::iterator it = m_devices.begin(); it != m_devices.end(); ++it)
+	{
+		if (it->second.attributes["busnum"] == bus && it->second.attributes["devnum"] == dev)
+		{
+			int handle = m_nextHandle++;
+			m_handles[handle].deviceName = it->first;
+			m_handles[handle].devnum = dev;
+			return handle;
+		}
+	}
+	return -ENOENT;
+}
+
+inline int UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::ReadUsbfsDescriptor(int handle, uint8_t* buffer, size_t bufferSize)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	int error = 0;
+	SSimulatedDevice* device = FindOpenDevice(handle, error);
+	if (device == NULL)
+		return error;
+
+	if (bufferSize < 18)
+		return -EINVAL;
+
+	uint16_t vid = (uint16_t)strtoul(device->attributes["idVendor"].c_str(), NULL, 16);
+	uint16_t pid = (uint16_t)strtoul(device->attributes["idProduct"].c_str(), NULL, 16);
+	uint16_t bcdUsb = (atoi(device->attributes["speed"].c_str()) >= 5000) ? 0x0320 : 0x0200;
+	uint8_t descriptor[18] = { 18, 0x01, (uint8_t)(bcdUsb & 0xFF), (uint8_t)(bcdUsb >> 8), 0xEF, 0x02, 0x01, 9,
+		(uint8_t)(vid & 0xFF), (uint8_t)(vid >> 8), (uint8_t)(pid & 0xFF), (uint8_t)(pid >> 8), 0x00, 0x01, 1, 2, 3, 1 };
+	memcpy(buffer, descriptor, sizeof(descriptor));
+	return (int)sizeof(descriptor);
+}
+
+inline int UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::ResetUsbfs(int handle)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	int error = 0;
+	SSimulatedDevice* device = FindOpenDevice(handle, error);
+	if (device == NULL)
+		return error;
+
+	device->resetCount++;
+	return 0;
+}
+
+inline UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::SSimulatedDevice* UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::FindOpenDevice(int handle, int& error)
+{
+	std::map<int, SSimulatedHandle>::iterator h = m_handles.find(handle);
+	if (h == m_handles.end())
+	{
+		error = -EBADF;
+		return NULL;
+	}
+
+	std::map<std::string, SSimulatedDevice>::iterator it = m_devices.find(h->second.deviceName);
+	if (it == m_devices.end() || it->second.attributes["devnum"] != h->second.devnum)
+	{
+		error = -ENODEV;
+		return NULL;
+	}
+
+	return &it->second;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbDeviceBackend::CloseUsbfs(int handle)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_handles.erase(handle);
+}
+// *********************************************************************************************************
+
+#endif
+#endif
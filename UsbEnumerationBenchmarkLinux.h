@@ -0,0 +1,319 @@
+// UsbEnumerationBenchmarkLinux.h
+// Times enumeration, lookup and topology queries against generated sysfs trees of growing size
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBENUMERATIONBENCHMARKLINUX_H
+#define USBENUMERATIONBENCHMARKLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <stdint.h>
+#include "UsbSysfsFixtureLinux.h"
+#include "UsbDeviceBackendLinux.h"
+#include "UsbDescriptorParserLinux.h"
+#include "UsbDescriptorParserFuzzLinux.h"
+#include "UsbResetHandleCacheLinux.h"
+#include "UsbControllerRecoveryLinux.h"
+#include "UsbNumaAdvisorLinux.h"
+#include "UsbCameraPlacementMap.h"
+#include "UsbCameraDeviceManagerLinux.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// One row of the report
+	struct SUsbBenchmarkResult
+	{
+		std::string operation;
+		int deviceCount;
+		int iterations;
+		double nanosecondsPerOperation;
+		double allocationsPerOperation;  // 0 unless AllocationCounter() is wired up, see below
+	};
+
+	// Runs every enumeration, lookup and topology query the Linux helpers offer against generated trees
+	// (see UsbSysfsFixtureLinux.h) so that a change from O(n) to O(n^2) shows up as a number, not a complaint.
+	//
+	// Allocations are counted through AllocationCounter(). A header can't replace the global operator new,
+	// so the benchmark program does it (see benchmark/UsbEnumerationBenchmark.cpp), eg:
+	//   void* operator new(size_t n) { CUsbEnumerationBenchmark::AllocationCounter()++; return malloc(n); }
+	class CUsbEnumerationBenchmark
+	{
+	private:
+		// repeats op until it has run for long enough to time, then appends a result
+		template <typename TOperation>
+		static void Measure(const char* operation, int deviceCount, TOperation op, std::vector<SUsbBenchmarkResult>& results);
+
+	public:
+		// Incremented by the program's operator new, if it has one
+		static std::atomic<uint64_t>& AllocationCounter();
+
+		// Generates a tree of each size below scratchDirectory, benchmarks it and removes it again.
+		// The default sizes are 10, 100, 1000 and 10000 devices.
+		static bool Run(const std::string& scratchDirectory, const std::vector<int>& deviceCounts, std::vector<SUsbBenchmarkResult>& results, std::string& errorMessage);
+
+		// For reference, the results as an aligned text table
+		static std::string FormatResults(const std::vector<SUsbBenchmarkResult>& results);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline std::atomic<uint64_t>& UsbCameraDeviceManagerLinux::CUsbEnumerationBenchmark::AllocationCounter()
+{
+	static std::atomic<uint64_t> counter(0);
+	return counter;
+}
+
+template <typename TOperation>
+inline void UsbCameraDeviceManagerLinux::CUsbEnumerationBenchmark::Measure(const char* operation, int deviceCount, TOperation op, std::vector<SUsbBenchmarkResult>& results)
+{
+	// warm the dentry cache so the first iteration isn't an outlier
+	op();
+
+	const std::chrono::milliseconds budget(200);
+	uint64_t allocationsBefore = AllocationCounter().load();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int iterations = 0;
+	while (iterations < 3 || (iterations < 1000 && std::chrono::steady_clock::now() - start < budget))
+	{
+		op();
+		iterations++;
+	}
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+	uint64_t allocations = AllocationCounter().load() - allocationsBefore;
+
+	SUsbBenchmarkResult result;
+	result.operation = operation;
+	result.deviceCount = deviceCount;
+	result.iterations = iterations;
+	result.nanosecondsPerOperation = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / iterations;
+	result.allocationsPerOperation = (double)allocations / iterations;
+	results.push_back(result);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbEnumerationBenchmark::Run(const std::string& scratchDirectory, const std::vector<int>& deviceCounts, std::vector<SUsbBenchmarkResult>& results, std::string& errorMessage)
+{
+	std::vector<int> sizes = deviceCounts;
+	if (sizes.empty())
+	{
+		sizes.push_back(10);
+		sizes.push_back(100);
+		sizes.push_back(1000);
+		sizes.push_back(10000);
+	}
+
+	// the parser alone, on a camera's blob already in memory. ParseDescriptors below adds reading it from sysfs.
+	uint8_t cameraBlob[256];
+	size_t cameraBlobLength = CUsbDescriptorParserFuzzer::BuildCameraBlob(true, cameraBlob, sizeof(cameraBlob));
+	Measure("ParseDescriptors(in memory)", 1, [&]()
+	{
+		CUsbDescriptorParser parser(cameraBlob, cameraBlobLength);
+		SUsbDescriptorRecord record;
+		while (parser.Next(record) == UsbParseStatus_Ok)
+		{
+		}
+	}, results);
+
+	for (size_t s = 0; s < sizes.size(); s++)
+	{
+		// roughly a test rig: a quarter cameras, a hub per twenty devices, the rest other peripherals
+		SUsbSysfsFixtureOptions options;
+		options.cameras = (sizes[s] / 4 > 0) ? sizes[s] / 4 : 1;
+		options.hubs = sizes[s] / 20;
+		options.otherDevices = sizes[s] - options.cameras - options.hubs;
+		if (options.otherDevices < 0)
+			options.otherDevices = 0;
+		options.attributeNoise = 0.2;
+
+		std::string root = scratchDirectory + "/usbfixture" + std::to_string(sizes[s]);
+		CUsbSysfsFixtureGenerator::Remove(root);
+
+		std::vector<SUsbSysfsFixtureDevice> devices;
+		if (CUsbSysfsFixtureGenerator::Generate(root, options, devices, errorMessage) == false)
+		{
+			CUsbSysfsFixtureGenerator::Remove(root);
+			return false;
+		}
+
+		CSysfsUsbDeviceBackend backend(CUsbSysfsFixtureGenerator::GetSysfsRoot(root), CUsbSysfsFixtureGenerator::GetUsbfsRoot(root));
+		int deviceCount = (int)devices.size();
+
+		// the camera that sorts last is the worst case for a linear scan
+		std::string lastCamera;
+		std::string lastCameraDevice;
+		std::vector<std::string> cameras;
+		for (size_t i = 0; i < devices.size(); i++)
+		{
+			if (devices[i].isCamera == false)
+				continue;
+			cameras.push_back(devices[i].serialNumber);
+			lastCamera = devices[i].serialNumber;
+			lastCameraDevice = devices[i].deviceName;
+		}
+
+		Measure("ListDevices", deviceCount, [&]()
+		{
+			std::vector<std::string> names;
+			backend.ListDevices(names);
+		}, results);
+
+		Measure("FindUsbDeviceBySerial", deviceCount, [&]()
+		{
+			std::string name;
+			FindUsbDeviceBySerial(backend, lastCamera, name);
+		}, results);
+
+		Measure("FindUsbDeviceBySerial(missing)", deviceCount, [&]()
+		{
+			std::string name;
+			FindUsbDeviceBySerial(backend, "NOTPRESENT", name);
+		}, results);
+
+		Measure("ParseDescriptors", deviceCount, [&]()
+		{
+			uint8_t blob[4096];
+			int fd = open((CUsbSysfsFixtureGenerator::GetSysfsRoot(root) + "/" + lastCameraDevice + "/descriptors").c_str(), O_RDONLY | O_CLOEXEC);
+			ssize_t length = (fd >= 0) ? read(fd, blob, sizeof(blob)) : 0;
+			if (fd >= 0)
+				close(fd);
+			CUsbDescriptorParser parser(blob, (length > 0) ? (size_t)length : 0);
+			SUsbDescriptorRecord record;
+			while (parser.Next(record) == UsbParseStatus_Ok)
+			{
+			}
+		}, results);
+
+		Measure("ParentChainSpeeds", deviceCount, [&]()
+		{
+			std::string speed;
+			for (std::string name = lastCameraDevice; name != ""; name = GetParentUsbDeviceName(name))
+				backend.ReadAttribute(name, "speed", speed);
+		}, results);
+
+		Measure("GetCameraEndpointLayout", deviceCount, [&]()
+		{
+			std::vector<SUsbEndpointInfo> endpoints;
+			unsigned int maxPowerMilliAmps = 0;
+			std::string ignored;
+			CUsbCameraDeviceManagerLinux::GetCameraEndpointLayout(backend, lastCamera, endpoints, maxPowerMilliAmps, ignored);
+		}, results);
+
+		Measure("ReadCameraPlacement", deviceCount, [&]()
+		{
+			UsbCameraDeviceManager::SUsbObservedPlacement observed;
+			std::string ignored;
+			CUsbCameraDeviceManagerLinux::ReadCameraPlacement(backend, lastCamera, observed, ignored);
+		}, results);
+
+		// every camera planned where it is, with the topology read once up front as the batch runner does
+		UsbCameraDeviceManager::CUsbCameraPlacementMap placementMap;
+		std::vector<UsbCameraDeviceManager::SUsbObservedPlacement> observedPlacements;
+		for (size_t i = 0; i < devices.size(); i++)
+		{
+			if (devices[i].isCamera == false)
+				continue;
+			UsbCameraDeviceManager::SUsbObservedPlacement observed;
+			observed.serialNumber = devices[i].serialNumber;
+			observed.portPath = devices[i].deviceName;
+			std::string devicePath;
+			std::string rootHub;
+			if (backend.ResolveDevicePath(devices[i].deviceName, devicePath))
+				CUsbControllerRecovery::ParseControllerAddress(devicePath, observed.controller, rootHub);
+			observedPlacements.push_back(observed);
+
+			UsbCameraDeviceManager::SUsbExpectedPlacement expected;
+			expected.serialNumber = observed.serialNumber;
+			expected.portPath = observed.portPath;
+			expected.controller = observed.controller;
+			placementMap.SetExpected(expected);
+		}
+
+		Measure("PlacementMap::CheckAll", deviceCount, [&]()
+		{
+			std::vector<UsbCameraDeviceManager::SUsbPlacementFinding> findings;
+			placementMap.CheckAll(observedPlacements, findings);
+		}, results);
+
+		CUsbNumaAdvisor numaAdvisor(backend);
+		Measure("NumaAdvisor::GetPlacement", deviceCount, [&]()
+		{
+			SUsbNumaPlacement placement;
+			std::string ignored;
+			numaAdvisor.GetPlacement(lastCamera, placement, ignored);
+		}, results);
+
+		// only reads, the driver is never called
+		CSysfsUsbControllerDriver controllerDriver(root + "/bus/pci");
+		CUsbControllerRecovery controllerRecovery(backend, controllerDriver);
+		Measure("ControllerRecovery::GetControllerImpact", deviceCount, [&]()
+		{
+			std::string pciAddress;
+			SUsbControllerImpact impact;
+			std::string ignored;
+			if (controllerRecovery.FindCameraController(lastCamera, pciAddress, ignored))
+				controllerRecovery.GetControllerImpact(pciAddress, impact, ignored);
+		}, results);
+
+		// the hot-standby cache with up to 24 registered cameras, as on a real station
+		CUsbResetHandleCache cache(backend);
+		for (size_t i = 0; i < cameras.size() && i < 24; i++)
+		{
+			std::string ignored;
+			cache.RegisterCamera(cameras[i], ignored);
+		}
+
+		Measure("ResetHandleCache::Refresh", deviceCount, [&]()
+		{
+			cache.Refresh();
+		}, results);
+
+		Measure("ResetHandleCache::RegisterCamera", deviceCount, [&]()
+		{
+			std::string ignored;
+			cache.RegisterCamera(lastCamera, ignored);
+		}, results);
+
+		CUsbSysfsFixtureGenerator::Remove(root);
+	}
+
+	return true;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbEnumerationBenchmark::FormatResults(const std::vector<SUsbBenchmarkResult>& results)
+{
+	std::string table;
+	char line[256];
+	snprintf(line, sizeof(line), "%-40s %8s %10s %14s %12s\n", "operation", "devices", "iterations", "ns/op", "allocs/op");
+	table.append(line);
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		snprintf(line, sizeof(line), "%-40s %8d %10d %14.0f %12.1f\n", results[i].operation.c_str(), results[i].deviceCount,
+			results[i].iterations, results[i].nanosecondsPerOperation, results[i].allocationsPerOperation);
+		table.append(line);
+	}
+	return table;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
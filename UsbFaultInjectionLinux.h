@@ -0,0 +1,875 @@
+// UsbFaultInjectionLinux.h
+// Injects the device misbehaviour seen in the field into a device backend, and measures how long recovery takes
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBFAULTINJECTIONLINUX_H
+#define USBFAULTINJECTIONLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbResetHandleCacheLinux.h"
+#include "UsbModeSwitchResetLinux.h"
+#include "UsbControllerRecoveryLinux.h"
+#include "UsbRecoveryEscalationLinux.h"
+#include "UsbLatencyHistogram.h"
+#include "UsbClock.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	enum EUsbFaultType
+	{
+		UsbFault_NeverReturns = 0,      // the device disappears after a reset and stays gone until it is replugged
+		UsbFault_ReturnsAsUsb2,         // the device comes back at high speed (480) instead of SuperSpeed
+		UsbFault_SlowReenumeration,     // the device takes delayMs to come back instead of the usual time
+		UsbFault_ResetBusy,             // the reset ioctl fails with EBUSY, count times in a row
+		UsbFault_Count
+	};
+
+	// One line of a scenario: what goes wrong, how often, and to whom
+	struct SUsbFaultRule
+	{
+		EUsbFaultType type;
+		double probability;        // chance per reset, 0.0 - 1.0
+		unsigned int delayMs;      // UsbFault_SlowReenumeration: how long the device stays away
+		unsigned int count;        // UsbFault_ResetBusy: how many resets in a row fail
+		std::string serialNumber;  // empty for any camera
+
+		SUsbFaultRule() : type(UsbFault_ResetBusy), probability(0.0), delayMs(8000), count(1) {}
+	};
+
+	// A named set of rules plus the rig to run them on
+	struct SUsbFaultScenario
+	{
+		std::string name;
+		int cameras;
+		int iterations;                    // recoveries to time, spread round-robin over the cameras
+		unsigned int reenumerationMs;      // how long a healthy camera is away after a reset
+		unsigned int timeoutMs;            // a recovery taking longer than this counts as failed
+		int resetsBeforeEscalation;        // usbfs resets that fail or bring the camera back at USB2 before usb_modeswitch, then the controller rebind
+		unsigned int seed;
+		bool concurrent;                   // recover all cameras at once, one thread each (like after a hub drops out), instead of one after the other
+		std::vector<SUsbFaultRule> rules;
+
+		SUsbFaultScenario() : cameras(1), iterations(100), reenumerationMs(1500), timeoutMs(15000), resetsBeforeEscalation(3), seed(1), concurrent(false) {}
+	};
+
+	// The time-to-recovery distribution of one scenario
+	struct SUsbFaultScenarioResult
+	{
+		std::string name;
+		int attempts;
+		int recovered;
+		int failed;                        // not back at the expected speed within timeoutMs
+		int degraded;                      // came back at USB2 at least once before recovering
+		int resetsIssued;                  // through the handle cache
+		int modeSwitchResets;
+		int controllerRebinds;
+		uint64_t faultsInjected[UsbFault_Count];
+		uint64_t meanMs;
+		uint64_t p50Ms;
+		uint64_t p90Ms;
+		uint64_t p99Ms;
+		uint64_t maxMs;                    // worst case downtime seen
+
+		SUsbFaultScenarioResult() : attempts(0), recovered(0), failed(0), degraded(0), resetsIssued(0), modeSwitchResets(0), controllerRebinds(0), meanMs(0), p50Ms(0), p90Ms(0), p99Ms(0), maxMs(0)
+		{
+			for (int t = 0; t < UsbFault_Count; t++)
+				faultsInjected[t] = 0;
+		}
+	};
+
+	// Scenario files are plain text, one scenario per section:
+	//
+	//   # a camera that is sometimes slow and sometimes busy
+	//   [scenario slow-and-busy]
+	//   cameras = 4
+	//   iterations = 500
+	//   reenumeration_ms = 1500
+	//   timeout_ms = 15000
+	//   resets_before_escalation = 3
+	//   seed = 7
+	//   concurrent = false
+	//   fault = slow_reenumeration probability=0.05 delay_ms=8000
+	//   fault = reset_busy probability=0.1 count=3
+	//   fault = usb2 probability=0.02
+	//   fault = never_returns probability=0.001 serial=40000001
+	class CUsbFaultScenarioFile
+	{
+	public:
+		static bool Parse(const std::string& text, std::vector<SUsbFaultScenario>& scenarios, std::string& errorMessage);
+
+		static bool Load(const std::string& path, std::vector<SUsbFaultScenario>& scenarios, std::string& errorMessage);
+
+		// "never_returns", "usb2", "slow_reenumeration", "reset_busy"
+		static const char* FaultTypeToString(EUsbFaultType type);
+	};
+
+	// Wraps any backend (the simulator, or the real system) and makes devices misbehave according to the rules.
+	// Faults are rolled on every reset that reaches the device. A device "away" after a reset is hidden
+	// from ListDevices(), ReadAttribute() and OpenUsbfs() until its time is up.
+	class CFaultInjectingUsbDeviceBackend : public IUsbDeviceBackend
+	{
+	private:
+		struct SDeviceFaultState
+		{
+			uint64_t awayUntilMs;        // hidden until then, UINT64_MAX for never
+			bool usb2;                   // reports speed 480 until the next successful reset
+			unsigned int busyRemaining;  // resets left to fail with EBUSY
+
+			SDeviceFaultState() : awayUntilMs(0), usb2(false), busyRemaining(0) {}
+		};
+
+		IUsbDeviceBackend& m_inner;
+		UsbCameraDeviceManager::IUsbClock& m_clock;
+		std::mutex m_lock;
+		std::mt19937 m_random;
+		std::vector<SUsbFaultRule> m_rules;
+		unsigned int m_reenumerationMs;
+		std::map<std::string, SDeviceFaultState> m_states;
+		std::map<int, std::string> m_handleDevices;
+		uint64_t m_faultsInjected[UsbFault_Count];
+
+		// true if the device is currently away (m_lock held)
+		bool IsAway(const std::string& deviceName);
+
+		bool Roll(const SUsbFaultRule& rule, const std::string& serialNumber);
+
+	public:
+		// clock is the time base faults are scheduled on, NULL for the steady clock
+		CFaultInjectingUsbDeviceBackend(IUsbDeviceBackend& inner, UsbCameraDeviceManager::IUsbClock* clock = NULL);
+
+		// Replaces the rules and reseeds the dice
+		void SetRules(const std::vector<SUsbFaultRule>& rules, unsigned int seed);
+
+		// How long every device is away after a successful reset. 0 (default) when the inner backend is real hardware, which does this by itself.
+		void SetReenumerationDelayMs(unsigned int reenumerationMs);
+
+		// Undoes all faults on a device, as if it was replugged
+		void ClearFaults(const std::string& deviceName);
+
+		// Hides a device until Reconnect(), as if its port lost power
+		void Disconnect(const std::string& deviceName);
+
+		// Undoes all faults on a device and brings it back after the re-enumeration delay, as if its port was powered up again
+		void Reconnect(const std::string& deviceName);
+
+		// Number of faults of one type injected so far
+		uint64_t GetInjectedFaultCount(EUsbFaultType type);
+
+		virtual bool ListDevices(std::vector<std::string>& deviceNames);
+		virtual bool ReadAttribute(const std::string& deviceName, const char* attribute, std::string& value);
+		virtual bool ResolveDevicePath(const std::string& deviceName, std::string& devicePath);
+		virtual int OpenUsbfs(int busnum, int devnum);
+		virtual int ReadUsbfsDescriptor(int handle, uint8_t* buffer, size_t bufferSize);
+		virtual int ResetUsbfs(int handle);
+		virtual void CloseUsbfs(int handle);
+	};
+
+	// Runs CUsbRecoveryEscalation against a simulated rig with the scenario's faults injected: usbfs resets until the
+	// camera is back at SuperSpeed, usb_modeswitch after resetsBeforeEscalation of them failed, and a controller rebind
+	// after that. Everything goes through the fault injecting backend. The simulator stands in for usb_modeswitch and the
+	// PCI driver: the first resets the port through usbfs, the second powers the controller's ports down and up again.
+	// In virtual time (CVirtualUsbClock) no real time passes, so thousands of recoveries with 8 s outliers, or fleets of
+	// a hundred cameras recovering at once, take milliseconds.
+	class CUsbFaultScenarioRunner
+	{
+	private:
+		// The simulator doesn't drop off the bus by itself: before each sleep of a recovery, a device that was reset
+		// since the last one is given a new devnum, the way the kernel re-enumerates it while the recovery waits.
+		class CReenumeratingClock : public UsbCameraDeviceManager::IUsbClock
+		{
+		private:
+			UsbCameraDeviceManager::IUsbClock& m_inner;
+			CSimulatedUsbDeviceBackend& m_simulated;
+			std::string m_deviceName;
+			int m_resetsSeen;
+
+		public:
+			CReenumeratingClock(UsbCameraDeviceManager::IUsbClock& inner, CSimulatedUsbDeviceBackend& simulated, const std::string& deviceName);
+
+			virtual uint64_t NowMs();
+			virtual void SleepMs(unsigned int ms);
+		};
+
+		// Does what usb_modeswitch -R does: USBDEVFS_RESET on the device's usbfs node
+		class CUsbfsModeSwitchTool : public IUsbModeSwitchTool
+		{
+		private:
+			IUsbDeviceBackend& m_backend;
+
+		public:
+			CUsbfsModeSwitchTool(IUsbDeviceBackend& backend);
+
+			virtual bool ResetDevice(const std::string& vendorId, const std::string& productId, int busnum, int devnum, std::string& errorMessage);
+		};
+
+		// Unbinding a controller disconnects every device on it, binding it reconnects them (with their faults undone)
+		class CSimulatedControllerDriver : public IUsbControllerDriver
+		{
+		private:
+			CSimulatedUsbDeviceBackend& m_simulated;
+			CFaultInjectingUsbDeviceBackend& m_faulty;
+
+			// the devices below the controller
+			void ListControllerDevices(const std::string& pciAddress, std::vector<std::string>& deviceNames);
+
+		public:
+			CSimulatedControllerDriver(CSimulatedUsbDeviceBackend& simulated, CFaultInjectingUsbDeviceBackend& faulty);
+
+			virtual bool Unbind(const std::string& pciAddress, std::string& errorMessage);
+			virtual bool Bind(const std::string& pciAddress, std::string& errorMessage);
+		};
+
+	public:
+		static bool Run(const SUsbFaultScenario& scenario, bool virtualTime, SUsbFaultScenarioResult& result, std::string& errorMessage);
+
+		static bool RunAll(const std::vector<SUsbFaultScenario>& scenarios, bool virtualTime, std::vector<SUsbFaultScenarioResult>& results, std::string& errorMessage);
+
+		// For reference, the results as an aligned text table
+		static std::string FormatResults(const std::vector<SUsbFaultScenarioResult>& results);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline const char* UsbCameraDeviceManagerLinux::CUsbFaultScenarioFile::FaultTypeToString(EUsbFaultType type)
+{
+	switch (type)
+	{
+	case UsbFault_NeverReturns: return "never_returns";
+	case UsbFault_ReturnsAsUsb2: return "usb2";
+	case UsbFault_SlowReenumeration: return "slow_reenumeration";
+	case UsbFault_ResetBusy: return "reset_busy";
+	default: return "unknown";
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbFaultScenarioFile::Parse(const std::string& text, std::vector<SUsbFaultScenario>& scenarios, std::string& errorMessage)
+{
+	std::istringstream input(text);
+	std::string line;
+	int lineNumber = 0;
+	SUsbFaultScenario* current = NULL;
+
+	while (std::getline(input, line))
+	{
+		lineNumber++;
+
+		// strip comments and whitespace
+		std::size_t hash = line.find('#');
+		if (hash != std::string::npos)
+			line.erase(hash);
+		std::size_t first = line.find_first_not_of(" \t\r");
+		if (first == std::string::npos)
+			continue;
+		line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+
+		std::string where = "Error: CUsbFaultScenarioFile::Parse(): line " + std::to_string(lineNumber) + ": ";
+
+		if (line[0] == '[')
+		{
+			if (line.compare(0, 10, "[scenario ") != 0 || line[line.size() - 1] != ']')
+			{
+				errorMessage = where + "expected [scenario <name>]";
+				return false;
+			}
+			scenarios.push_back(SUsbFaultScenario());
+			current = &scenarios.back();
+			current->name = line.substr(10, line.size() - 11);
+			continue;
+		}
+
+		std::size_t equals = line.find('=');
+		if (current == NULL || equals == std::string::npos)
+		{
+			errorMessage = where + "expected key = value inside a [scenario]";
+			return false;
+		}
+
+		std::string key = line.substr(0, line.find_last_not_of(" \t", equals - 1) + 1);
+		std::string value = line.substr(line.find_first_not_of(" \t", equals + 1) == std::string::npos ? line.size() : line.find_first_not_of(" \t", equals + 1));
+
+		if (key == "cameras")
+			current->cameras = atoi(value.c_str());
+		else if (key == "iterations")
+			current->iterations = atoi(value.c_str());
+		else if (key == "reenumeration_ms")
+			current->reenumerationMs = (unsigned int)strtoul(value.c_str(), NULL, 10);
+		else if (key == "timeout_ms")
+			current->timeoutMs = (unsigned int)strtoul(value.c_str(), NULL, 10);
+		else if (key == "resets_before_escalation")
+			current->resetsBeforeEscalation = atoi(value.c_str());
+		else if (key == "seed")
+			current->seed = (unsigned int)strtoul(value.c_str(), NULL, 10);
+		else if (key == "concurrent")
+			current->concurrent = (value == "true" || value == "1");
+		else if (key == "fault")
+		{
+			std::istringstream words(value);
+			std::string type;
+			words >> type;
+
+			SUsbFaultRule rule;
+			bool known = false;
+			for (int t = 0; t < UsbFault_Count; t++)
+			{
+				if (type == FaultTypeToString((EUsbFaultType)t))
+				{
+					rule.type = (EUsbFaultType)t;
+					known = true;
+				}
+			}
+			if (known == false)
+			{
+				errorMessage = where + "unknown fault type '" + type + "'";
+				return false;
+			}
+
+			std::string parameter;
+			while (words >> parameter)
+			{
+				std::size_t split = parameter.find('=');
+				std::string name = parameter.substr(0, split);
+				std::string setting = (split == std::string::npos) ? "" : parameter.substr(split + 1);
+				if (name == "probability")
+					rule.probability = atof(setting.c_str());
+				else if (name == "delay_ms")
+					rule.delayMs = (unsigned int)strtoul(setting.c_str(), NULL, 10);
+				else if (name == "count")
+					rule.count = (unsigned int)strtoul(setting.c_str(), NULL, 10);
+				else if (name == "serial")
+					rule.serialNumber = setting;
+				else
+				{
+					errorMessage = where + "unknown fault parameter '" + name + "'";
+					return false;
+				}
+			}
+
+			if (rule.probability < 0.0 || rule.probability > 1.0)
+			{
+				errorMessage = where + "probability must be between 0 and 1";
+				return false;
+			}
+			current->rules.push_back(rule);
+		}
+		else
+		{
+			errorMessage = where + "unknown key '" + key + "'";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbFaultScenarioFile::Load(const std::string& path, std::vector<SUsbFaultScenario>& scenarios, std::string& errorMessage)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+		errorMessage = "Error: CUsbFaultScenarioFile::Load(): Unable to open ";
+		errorMessage.append(path);
+		return false;
+	}
+
+	std::stringstream text;
+	text << file.rdbuf();
+	return Parse(text.str(), scenarios, errorMessage);
+}
+
+inline UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::CFaultInjectingUsbDeviceBackend(IUsbDeviceBackend& inner, UsbCameraDeviceManager::IUsbClock* clock)
+	: m_inner(inner), m_clock((clock != NULL) ? *clock : UsbCameraDeviceManager::CSystemUsbClock::Instance()), m_random(1), m_reenumerationMs(0)
+{
+	for (int t = 0; t < UsbFault_Count; t++)
+		m_faultsInjected[t] = 0;
+}
+
+inline void UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::SetRules(const std::vector<SUsbFaultRule>& rules, unsigned int seed)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_rules = rules;
+	m_random.seed(seed);
+}
+
+inline void UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::SetReenumerationDelayMs(unsigned int reenumerationMs)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_reenumerationMs = reenumerationMs;
+}
+
+inline void UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::ClearFaults(const std::string& deviceName)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_states.erase(deviceName);
+}
+
+inline void UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::Disconnect(const std::string& deviceName)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_states[deviceName].awayUntilMs = UINT64_MAX;
+}
+
+inline void UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::Reconnect(const std::string& deviceName)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	SDeviceFaultState& state = m_states[deviceName];
+	state = SDeviceFaultState();
+	state.awayUntilMs = m_clock.NowMs() + m_reenumerationMs;
+}
+
+inline uint64_t UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::GetInjectedFaultCount(EUsbFaultType type)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return (type >= 0 && type < UsbFault_Count) ? m_faultsInjected[type] : 0;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::IsAway(const std::string& deviceName)
+{
+	std::map<std::string, SDeviceFaultState>::iterator it = m_states.find(deviceName);
+	return it != m_states.end() && m_clock.NowMs() < it->second.awayUntilMs;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::Roll(const SUsbFaultRule& rule, const std::string& serialNumber)
+{
+	if (rule.serialNumber != "" && rule.serialNumber != serialNumber)
+		return false;
+	std::uniform_real_distribution<double> dice(0.0, 1.0);
+	if (dice(m_random) >= rule.probability)
+		return false;
+	m_faultsInjected[rule.type]++;
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::ListDevices(std::vector<std::string>& deviceNames)
+{
+	std::vector<std::string> all;
+	if (m_inner.ListDevices(all) == false)
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < all.size(); i++)
+	{
+		if (IsAway(all[i]) == false)
+			deviceNames.push_back(all[i]);
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::ReadAttribute(const std::string& deviceName, const char* attribute, std::string& value)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (IsAway(deviceName))
+			return false;
+
+		std::map<std::string, SDeviceFaultState>::iterator it = m_states.find(deviceName);
+		if (it != m_states.end() && it->second.usb2 && strcmp(attribute, "speed") == 0)
+		{
+			value = "480";
+			return true;
+		}
+	}
+	return m_inner.ReadAttribute(deviceName, attribute, value);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::ResolveDevicePath(const std::string& deviceName, std::string& devicePath)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (IsAway(deviceName))
+			return false;
+	}
+	return m_inner.ResolveDevicePath(deviceName, devicePath);
+}
+
+inline int UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::OpenUsbfs(int busnum, int devnum)
+{
+	// find out which device this is, so resets through the handle can be attributed to it
+	std::vector<std::string> all;
+	m_inner.ListDevices(all);
+	std::string deviceName;
+	std::string bus = std::to_string(busnum);
+	std::string dev = std::to_string(devnum);
+	for (size_t i = 0; i < all.size(); i++)
+	{
+		std::string value;
+		if (m_inner.ReadAttribute(all[i], "busnum", value) && value == bus && m_inner.ReadAttribute(all[i], "devnum", value) && value == dev)
+		{
+			deviceName = all[i];
+			break;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (deviceName != "" && IsAway(deviceName))
+			return -ENOENT;
+	}
+
+	int handle = m_inner.OpenUsbfs(busnum, devnum);
+	if (handle >= 0)
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_handleDevices[handle] = deviceName;
+	}
+	return handle;
+}
+
+inline int UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::ReadUsbfsDescriptor(int handle, uint8_t* buffer, size_t bufferSize)
+{
+	return m_inner.ReadUsbfsDescriptor(handle, buffer, bufferSize);
+}
+
+inline int UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::ResetUsbfs(int handle)
+{
+	std::string deviceName;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		std::map<int, std::string>::iterator h = m_handleDevices.find(handle);
+		if (h != m_handleDevices.end())
+			deviceName = h->second;
+
+		if (deviceName != "")
+		{
+			SDeviceFaultState& state = m_states[deviceName];
+			if (m_clock.NowMs() < state.awayUntilMs)
+				return -ENODEV;
+			if (state.busyRemaining > 0)
+			{
+				state.busyRemaining--;
+				return -EBUSY;
+			}
+		}
+	}
+
+	std::string serialNumber;
+	if (deviceName != "")
+		m_inner.ReadAttribute(deviceName, "serial", serialNumber);
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (size_t i = 0; i < m_rules.size(); i++)
+		{
+			if (m_rules[i].type == UsbFault_ResetBusy && deviceName != "" && Roll(m_rules[i], serialNumber))
+			{
+				m_states[deviceName].busyRemaining = (m_rules[i].count > 0) ? m_rules[i].count - 1 : 0;
+				return -EBUSY;
+			}
+		}
+	}
+
+	int result = m_inner.ResetUsbfs(handle);
+	if (result != 0 || deviceName == "")
+		return result;
+
+	// the reset went through: decide how the device comes back
+	std::lock_guard<std::mutex> lock(m_lock);
+	SDeviceFaultState& state = m_states[deviceName];
+	uint64_t now = m_clock.NowMs();
+	state.awayUntilMs = now + m_reenumerationMs;
+	state.usb2 = false;
+	for (size_t i = 0; i < m_rules.size(); i++)
+	{
+		const SUsbFaultRule& rule = m_rules[i];
+		if (rule.type == UsbFault_ResetBusy || Roll(rule, serialNumber) == false)
+			continue;
+		if (rule.type == UsbFault_NeverReturns)
+			state.awayUntilMs = UINT64_MAX;
+		else if (rule.type == UsbFault_SlowReenumeration && state.awayUntilMs != UINT64_MAX)
+			state.awayUntilMs = now + rule.delayMs;
+		else if (rule.type == UsbFault_ReturnsAsUsb2)
+			state.usb2 = true;
+	}
+	return 0;
+}
+
+inline void UsbCameraDeviceManagerLinux::CFaultInjectingUsbDeviceBackend::CloseUsbfs(int handle)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_handleDevices.erase(handle);
+	}
+	m_inner.CloseUsbfs(handle);
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CReenumeratingClock::CReenumeratingClock(UsbCameraDeviceManager::IUsbClock& inner, CSimulatedUsbDeviceBackend& simulated, const std::string& deviceName)
+	: m_inner(inner), m_simulated(simulated), m_deviceName(deviceName)
+{
+	m_resetsSeen = m_simulated.GetResetCount(m_deviceName);
+}
+
+inline uint64_t UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CReenumeratingClock::NowMs()
+{
+	return m_inner.NowMs();
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CReenumeratingClock::SleepMs(unsigned int ms)
+{
+	int resets = m_simulated.GetResetCount(m_deviceName);
+	if (resets != m_resetsSeen)
+	{
+		m_resetsSeen = resets;
+		m_simulated.ReenumerateDevice(m_deviceName);
+	}
+	m_inner.SleepMs(ms);
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CUsbfsModeSwitchTool::CUsbfsModeSwitchTool(IUsbDeviceBackend& backend)
+	: m_backend(backend)
+{
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CUsbfsModeSwitchTool::ResetDevice(const std::string& vendorId, const std::string& productId, int busnum, int devnum, std::string& errorMessage)
+{
+	int handle = m_backend.OpenUsbfs(busnum, devnum);
+	if (handle < 0)
+	{
+		errorMessage = "Error: UsbModeSwitchReset(): Unable to open usbfs node of " + vendorId + ":" + productId + ": " + strerror(-handle);
+		return false;
+	}
+
+	int status = m_backend.ResetUsbfs(handle);
+	m_backend.CloseUsbfs(handle);
+	if (status < 0)
+	{
+		errorMessage = "Error: UsbModeSwitchReset(): Reset of " + vendorId + ":" + productId + " failed: " + strerror(-status);
+		return false;
+	}
+	return true;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CSimulatedControllerDriver::CSimulatedControllerDriver(CSimulatedUsbDeviceBackend& simulated, CFaultInjectingUsbDeviceBackend& faulty)
+	: m_simulated(simulated), m_faulty(faulty)
+{
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CSimulatedControllerDriver::ListControllerDevices(const std::string& pciAddress, std::vector<std::string>& deviceNames)
+{
+	std::vector<std::string> all;
+	m_simulated.ListDevices(all);
+	for (size_t i = 0; i < all.size(); i++)
+	{
+		std::string devicePath;
+		std::string controller;
+		std::string rootHub;
+		if (m_simulated.ResolveDevicePath(all[i], devicePath) && CUsbControllerRecovery::ParseControllerAddress(devicePath, controller, rootHub) && controller == pciAddress)
+			deviceNames.push_back(all[i]);
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CSimulatedControllerDriver::Unbind(const std::string& pciAddress, std::string& errorMessage)
+{
+	std::vector<std::string> deviceNames;
+	ListControllerDevices(pciAddress, deviceNames);
+	for (size_t i = 0; i < deviceNames.size(); i++)
+		m_faulty.Disconnect(deviceNames[i]);
+
+	// the simulated driver can't fail to unbind
+	(void)errorMessage;
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::CSimulatedControllerDriver::Bind(const std::string& pciAddress, std::string& errorMessage)
+{
+	// every device comes back under a new devnum
+	std::vector<std::string> deviceNames;
+	ListControllerDevices(pciAddress, deviceNames);
+	for (size_t i = 0; i < deviceNames.size(); i++)
+	{
+		m_simulated.ReenumerateDevice(deviceNames[i]);
+		m_faulty.Reconnect(deviceNames[i]);
+	}
+
+	// nor to bind
+	(void)errorMessage;
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::Run(const SUsbFaultScenario& scenario, bool virtualTime, SUsbFaultScenarioResult& result, std::string& errorMessage)
+{
+	if (scenario.cameras <= 0 || scenario.iterations <= 0)
+	{
+		errorMessage = "Error: CUsbFaultScenarioRunner::Run(): Scenario ";
+		errorMessage.append(scenario.name);
+		errorMessage.append(" needs at least one camera and one iteration.");
+		return false;
+	}
+
+	// the time base. In virtual time each recovery is an actor of the clock: the only one when recovering one camera
+	// after the other, one per thread when they recover concurrently.
+	UsbCameraDeviceManager::CVirtualUsbClock virtualClock(scenario.concurrent ? 0 : 1);
+	UsbCameraDeviceManager::IUsbClock& clock = virtualTime ? (UsbCameraDeviceManager::IUsbClock&)virtualClock : UsbCameraDeviceManager::CSystemUsbClock::Instance();
+
+	// one hub's worth of cameras on bus 2
+	CSimulatedUsbDeviceBackend simulated;
+	std::vector<std::string> serialNumbers;
+	std::vector<std::string> deviceNames;
+	for (int i = 0; i < scenario.cameras; i++)
+	{
+		serialNumbers.push_back(std::to_string(40000000 + i));
+		deviceNames.push_back("2-1." + std::to_string(i + 1));
+		simulated.AddDevice(deviceNames.back(), 2, 0x2676, 0xba02, serialNumbers.back(), "5000");
+	}
+
+	CFaultInjectingUsbDeviceBackend faulty(simulated, &clock);
+	faulty.SetRules(scenario.rules, scenario.seed);
+	faulty.SetReenumerationDelayMs(scenario.reenumerationMs);
+
+	CUsbResetHandleCache cache(faulty);
+	CUsbfsModeSwitchTool modeSwitchTool(faulty);
+	CUsbModeSwitchReset modeSwitch(faulty, modeSwitchTool);
+	CSimulatedControllerDriver controllerDriver(simulated, faulty);
+	for (int i = 0; i < scenario.cameras; i++)
+	{
+		if (cache.RegisterCamera(serialNumbers[i], errorMessage) == false)
+			return false;
+	}
+
+	SUsbEscalationPolicy policy;
+	policy.resetsBeforeEscalation = scenario.resetsBeforeEscalation;
+	policy.timeoutMs = scenario.timeoutMs;
+	policy.controller.verifyTimeoutMs = scenario.timeoutMs;
+
+	UsbCameraDeviceManager::CUsbLatencyHistogram timeToRecovery;
+	result = SUsbFaultScenarioResult();
+	result.name = scenario.name;
+	std::mutex resultLock;
+
+	std::function<void(int)> recoverCamera = [&](int camera)
+	{
+		CReenumeratingClock cameraClock(clock, simulated, deviceNames[camera]);
+		CUsbControllerRecovery controllerRecovery(faulty, controllerDriver, &cameraClock);
+		CUsbRecoveryEscalation escalation(cache, modeSwitch, controllerRecovery, faulty, &cameraClock);
+		uint64_t start = clock.NowMs();
+		SUsbEscalationResult steps;
+		std::string recoveryError;
+		bool recovered = escalation.RecoverCamera(serialNumbers[camera], policy, steps, recoveryError);
+
+		uint64_t elapsedMs = clock.NowMs() - start;
+		timeToRecovery.Record(elapsedMs * 1000);
+		if (recovered == false)
+		{
+			// someone walks over and replugs it
+			faulty.ClearFaults(deviceNames[camera]);
+			cache.Refresh();
+		}
+
+		std::lock_guard<std::mutex> lock(resultLock);
+		result.attempts++;
+		result.resetsIssued += steps.resetsIssued;
+		result.modeSwitchResets += steps.modeSwitchResets;
+		result.controllerRebinds += steps.controllerRebinds;
+		if (recovered)
+			result.recovered++;
+		else
+			result.failed++;
+		if (steps.degraded)
+			result.degraded++;
+	};
+
+	if (scenario.concurrent == false)
+	{
+		for (int iteration = 0; iteration < scenario.iterations; iteration++)
+			recoverCamera(iteration % scenario.cameras);
+	}
+	else
+	{
+		for (int first = 0; first < scenario.iterations; first += scenario.cameras)
+		{
+			int count = std::min(scenario.cameras, scenario.iterations - first);
+			if (virtualTime)
+				virtualClock.AddActors(count);
+
+			std::vector<std::thread> threads;
+			for (int camera = 0; camera < count; camera++)
+			{
+				threads.push_back(std::thread([&, camera]()
+				{
+					recoverCamera(camera);
+					if (virtualTime)
+						virtualClock.RemoveActor();
+				}));
+
+				// start them one at a time, so they go to sleep (and wake up) in the same order every run
+				if (virtualTime && camera + 1 < count)
+					virtualClock.WaitUntilRunning(count - camera - 1);
+			}
+			for (size_t i = 0; i < threads.size(); i++)
+				threads[i].join();
+		}
+	}
+
+	for (int t = 0; t < UsbFault_Count; t++)
+		result.faultsInjected[t] = faulty.GetInjectedFaultCount((EUsbFaultType)t);
+	// percentiles are bucket upper bounds, which can overshoot the largest sample
+	result.maxMs = timeToRecovery.GetMaxMicroseconds() / 1000;
+	result.meanMs = timeToRecovery.GetMeanMicroseconds() / 1000;
+	result.p50Ms = std::min<uint64_t>(timeToRecovery.GetPercentileMicroseconds(0.50) / 1000, result.maxMs);
+	result.p90Ms = std::min<uint64_t>(timeToRecovery.GetPercentileMicroseconds(0.90) / 1000, result.maxMs);
+	result.p99Ms = std::min<uint64_t>(timeToRecovery.GetPercentileMicroseconds(0.99) / 1000, result.maxMs);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::RunAll(const std::vector<SUsbFaultScenario>& scenarios, bool virtualTime, std::vector<SUsbFaultScenarioResult>& results, std::string& errorMessage)
+{
+	for (size_t i = 0; i < scenarios.size(); i++)
+	{
+		SUsbFaultScenarioResult result;
+		if (Run(scenarios[i], virtualTime, result, errorMessage) == false)
+			return false;
+		results.push_back(result);
+	}
+	return true;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbFaultScenarioRunner::FormatResults(const std::vector<SUsbFaultScenarioResult>& results)
+{
+	std::string table;
+	char line[512];
+	snprintf(line, sizeof(line), "%-24s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "scenario", "attempts", "failed", "degraded", "resets", "modesw", "rebinds", "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+	table.append(line);
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const SUsbFaultScenarioResult& r = results[i];
+		snprintf(line, sizeof(line), "%-24s %8d %8d %8d %8d %8d %8d %8llu %8llu %8llu %8llu %8llu\n", r.name.c_str(), r.attempts, r.failed, r.degraded, r.resetsIssued, r.modeSwitchResets, r.controllerRebinds,
+			(unsigned long long)r.meanMs, (unsigned long long)r.p50Ms, (unsigned long long)r.p90Ms, (unsigned long long)r.p99Ms, (unsigned long long)r.maxMs);
+		table.append(line);
+	}
+	return table;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
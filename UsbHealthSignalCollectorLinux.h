@@ -0,0 +1,138 @@
+// UsbHealthSignalCollectorLinux.h
+// Turns sysfs attribute changes and kernel log events into persisted camera health events
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBHEALTHSIGNALCOLLECTORLINUX_H
+#define USBHEALTHSIGNALCOLLECTORLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include "UsbCameraIdentityDatabase.h"
+#include "UsbKernelLogWatcherLinux.h"
+#include "UsbSysfsAttributePollerLinux.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// Feeds CUsbCameraHealthModel. Attribute changes must be labelled with the camera's serial number (as
+	// CUsbSysfsAttributePoller::WatchCamera() does): a speed that drops is a downgrade, an increase of
+	// port/over_current_count one over-current event carrying the increase. Kernel log events add cable, enumeration, bandwidth, transfer and host
+	// errors. Over-currents are taken from sysfs only, the kernel logs the same condition.
+	class CUsbHealthSignalCollector
+	{
+	private:
+		UsbCameraDeviceManager::CUsbCameraIdentityDatabase& m_database;
+
+		CUsbHealthSignalCollector(const CUsbHealthSignalCollector&);
+		CUsbHealthSignalCollector& operator=(const CUsbHealthSignalCollector&);
+
+	public:
+		// The database must outlive this object. Only cameras already in it are recorded.
+		CUsbHealthSignalCollector(UsbCameraDeviceManager::CUsbCameraIdentityDatabase& database);
+
+		// From CUsbSysfsAttributePoller::Poll(). Returns the number of health events recorded.
+		size_t RecordAttributeChanges(const std::vector<SUsbAttributeChange>& changes);
+
+		// From CUsbKernelLogWatcher::ReadEvents(). Returns the number of health events recorded.
+		size_t RecordKernelLogEvents(const std::vector<SUsbKernelLogEvent>& events);
+
+		// Whether a kernel event says something is wrong with the camera or its link
+		static bool IsErrorSignature(EUsbKernelLogEventType type);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbHealthSignalCollector::CUsbHealthSignalCollector(UsbCameraDeviceManager::CUsbCameraIdentityDatabase& database)
+	: m_database(database)
+{
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbHealthSignalCollector::IsErrorSignature(EUsbKernelLogEventType type)
+{
+	switch (type)
+	{
+	case UsbKernel_CableFault:
+	case UsbKernel_EnumerationError:
+	case UsbKernel_BandwidthError:
+	case UsbKernel_TransferError:
+	case UsbKernel_HostNotResponding:
+	case UsbKernel_HostDied:
+		return true;
+	default:
+		return false;
+	}
+}
+
+inline size_t UsbCameraDeviceManagerLinux::CUsbHealthSignalCollector::RecordAttributeChanges(const std::vector<SUsbAttributeChange>& changes)
+{
+	size_t recorded = 0;
+	for (size_t i = 0; i < changes.size(); i++)
+	{
+		const SUsbAttributeChange& change = changes[i];
+
+		// the first poll reports every value with nothing before it, and a device going away isn't a downgrade
+		if (change.present == false || change.oldValue == "")
+			continue;
+
+		unsigned long before = strtoul(change.oldValue.c_str(), NULL, 10);
+		unsigned long after = strtoul(change.newValue.c_str(), NULL, 10);
+
+		if (change.attribute == "speed" && after > 0 && after < before)
+		{
+			if (m_database.RecordHealthEvent(change.label, UsbCameraDeviceManager::UsbHealthEvent_SpeedDowngrade, (unsigned int)after))
+				recorded++;
+		}
+		else if (change.attribute == "port/over_current_count")
+		{
+			// one event for however many conditions the port saw since the last poll, so a burst doesn't flush the others
+			// out of the history. A counter that jumped by a lot (eg: the hub was replaced) counts as at most 100.
+			if (after > before)
+			{
+				unsigned long delta = (after - before < 100) ? after - before : 100;
+				if (m_database.RecordHealthEvent(change.label, UsbCameraDeviceManager::UsbHealthEvent_OverCurrent, (unsigned int)delta))
+					recorded++;
+			}
+		}
+	}
+	return recorded;
+}
+
+inline size_t UsbCameraDeviceManagerLinux::CUsbHealthSignalCollector::RecordKernelLogEvents(const std::vector<SUsbKernelLogEvent>& events)
+{
+	size_t recorded = 0;
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		if (IsErrorSignature(events[i].type) == false)
+			continue;
+
+		// a host controller error concerns every camera on it
+		for (size_t s = 0; s < events[i].serialNumbers.size(); s++)
+		{
+			if (m_database.RecordHealthEvent(events[i].serialNumbers[s], UsbCameraDeviceManager::UsbHealthEvent_KernelError, (unsigned int)events[i].type))
+				recorded++;
+		}
+	}
+	return recorded;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
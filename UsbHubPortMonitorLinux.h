@@ -0,0 +1,698 @@
+// UsbHubPortMonitorLinux.h
+// Samples SuperSpeed link error counts and link state of each camera's upstream hub port to find bad cables early
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBHUBPORTMONITORLINUX_H
+#define USBHUBPORTMONITORLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/usbdevice_fs.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbClock.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// Hub class requests to a port (USB 3.2 spec chapter 10.16.2)
+	enum EUsbHubPortRequest
+	{
+		UsbHubRequestType_PortIn = 0xA3,       // device to host, class, recipient other (a port)
+		UsbHubRequest_GetStatus = 0x00,        // 4 bytes: wPortStatus, wPortChange
+		UsbHubRequest_GetPortErrorCount = 0x0A // 2 bytes: link errors on the port, SuperSpeed hubs only
+	};
+
+	// PORT_LINK_STATE in a SuperSpeed hub's wPortStatus (bits 5..8)
+	enum EUsbLinkState
+	{
+		UsbLink_U0 = 0,
+		UsbLink_U1,
+		UsbLink_U2,
+		UsbLink_U3,
+		UsbLink_Disabled,
+		UsbLink_RxDetect,
+		UsbLink_Inactive,      // the link failed, the port waits for a warm reset
+		UsbLink_Polling,
+		UsbLink_Recovery,      // retraining
+		UsbLink_HotReset,
+		UsbLink_Compliance,    // the link failed training
+		UsbLink_Loopback
+	};
+
+	// A hub port's status, decoded
+	struct SUsbPortStatus
+	{
+		uint16_t status;         // wPortStatus as the hub sent it
+		uint16_t change;         // wPortChange
+		bool connected;
+		bool enabled;
+		bool overCurrent;
+		int linkState;           // EUsbLinkState, SuperSpeed hubs only, -1 otherwise
+
+		SUsbPortStatus() : status(0), change(0), connected(false), enabled(false), overCurrent(false), linkState(-1) {}
+	};
+
+	// Control transfers to hubs, named like their sysfs directory (eg: "2-1", or "usb2" for a root hub)
+	class IUsbHubTransport
+	{
+	public:
+		virtual ~IUsbHubTransport() {}
+
+		// A control transfer on the hub's default pipe. Returns the bytes transferred or -errno (eg: -EPIPE if the
+		// hub doesn't support the request, -ENODEV if it is gone).
+		virtual int ControlTransfer(const std::string& hubDeviceName, uint8_t requestType, uint8_t request, uint16_t value, uint16_t index,
+			uint8_t* data, uint16_t length, unsigned int timeoutMs) = 0;
+	};
+
+	// The real thing, USBDEVFS_CONTROL on the hub's usbfs node. Requests to a port are allowed while the hub driver
+	// is bound, but the node must be writable (usually root). Keeps one descriptor per hub and reopens it when the hub
+	// re-enumerated. Meant for one thread at a time.
+	class CUsbfsHubTransport : public IUsbHubTransport
+	{
+	private:
+		struct SOpenHub
+		{
+			int fd;
+			std::string devnum;   // the enumeration it was opened on
+		};
+
+		IUsbDeviceBackend& m_backend;
+		std::string m_usbfsRoot;
+		std::map<std::string, SOpenHub> m_hubs;
+
+		CUsbfsHubTransport(const CUsbfsHubTransport&);
+		CUsbfsHubTransport& operator=(const CUsbfsHubTransport&);
+
+	public:
+		// The backend resolves hub names to bus and device numbers and must outlive this object
+		CUsbfsHubTransport(IUsbDeviceBackend& backend, const std::string& usbfsRoot = "/dev/bus/usb");
+
+		~CUsbfsHubTransport();
+
+		virtual int ControlTransfer(const std::string& hubDeviceName, uint8_t requestType, uint8_t request, uint16_t value, uint16_t index,
+			uint8_t* data, uint16_t length, unsigned int timeoutMs);
+	};
+
+	// In-memory hubs that answer port requests like real ones, so link monitoring can be exercised without hubs or root.
+	// A USB 2 hub stalls GET_PORT_ERR_COUNT. Thread safe.
+	class CSimulatedUsbHubTransport : public IUsbHubTransport
+	{
+	private:
+		struct SSimulatedPort
+		{
+			bool connected;
+			bool overCurrent;
+			int linkState;
+			uint16_t errorCount;
+
+			SSimulatedPort() : connected(false), overCurrent(false), linkState(UsbLink_RxDetect), errorCount(0) {}
+		};
+
+		struct SSimulatedHub
+		{
+			bool superSpeed;
+			std::map<int, SSimulatedPort> ports;
+		};
+
+		std::mutex m_lock;
+		std::map<std::string, SSimulatedHub> m_hubs;
+		uint64_t m_transfers;
+
+	public:
+		CSimulatedUsbHubTransport();
+
+		void AddHub(const std::string& hubDeviceName, bool superSpeed = true);
+
+		// Requests to it fail with ENODEV from now on
+		void RemoveHub(const std::string& hubDeviceName);
+
+		// A connected port trains to U0, a disconnected one waits in Rx.Detect
+		void ConnectPort(const std::string& hubDeviceName, int port, bool connected = true);
+
+		void SetLinkState(const std::string& hubDeviceName, int port, EUsbLinkState linkState);
+
+		void SetOverCurrent(const std::string& hubDeviceName, int port, bool overCurrent);
+
+		// Counts like the hub's 16 bit counter
+		void AddLinkErrors(const std::string& hubDeviceName, int port, unsigned int count);
+
+		// Clears the port's error count, as a port reset does
+		void ResetPort(const std::string& hubDeviceName, int port);
+
+		// Transfers issued so far, answered or not
+		uint64_t GetTransferCount();
+
+		virtual int ControlTransfer(const std::string& hubDeviceName, uint8_t requestType, uint8_t request, uint16_t value, uint16_t index,
+			uint8_t* data, uint16_t length, unsigned int timeoutMs);
+	};
+
+	// What the monitor knows about one camera's link
+	struct SUsbLinkMetrics
+	{
+		std::string serialNumber;
+		std::string deviceName;          // eg: 2-1.3
+		std::string hubDeviceName;       // the hub it's plugged into, eg: 2-1
+		int port;
+		bool superSpeed;                 // linked at 5000 Mbps or more, only then are error counts and link states sampled
+		SUsbPortStatus portStatus;       // from the last sample
+		uint16_t hubErrorCount;          // as the hub last reported it
+		uint64_t linkErrors;             // since watching, across counter resets (a port reset clears the hub's)
+		uint64_t windowErrors;           // within the last window
+		uint64_t samples;
+		uint64_t failedSamples;          // camera not found or the hub didn't answer
+		uint64_t lastSampleMs;
+		std::string lastError;           // of the last failed sample
+
+		SUsbLinkMetrics() : port(0), superSpeed(false), hubErrorCount(0), linkErrors(0), windowErrors(0), samples(0), failedSamples(0), lastSampleMs(0) {}
+	};
+
+	enum EUsbLinkAlertType
+	{
+		UsbLinkAlert_ErrorRate = 0,   // more link errors within the window than allowed
+		UsbLinkAlert_LinkState        // connected, but the link is Inactive, in Compliance or Disabled
+	};
+
+	struct SUsbLinkAlert
+	{
+		EUsbLinkAlertType type;
+		std::string serialNumber;
+		std::string hubDeviceName;
+		int port;
+		uint64_t value;                  // errors within the window, or the link state
+		std::string detail;
+	};
+
+	struct SUsbLinkThresholds
+	{
+		unsigned int windowMs;
+		unsigned int maxLinkErrors;      // more than this within the window is an alert
+
+		SUsbLinkThresholds() : windowMs(60000), maxLinkErrors(5) {}
+	};
+
+	// A marginal cable behind a USB3 hub doesn't lose the camera at first: the link takes errors and retrains, every
+	// retrain costs throughput, and only much later does it drop. Sample() asks each watched camera's upstream hub
+	// port for its link error count (GET_PORT_ERR_COUNT) and status, accumulates the deltas per camera and alerts
+	// once when the errors within the window exceed the threshold, or when the link has failed; again only after it
+	// was back to normal. Cameras are looked up again if they re-enumerated or moved. Call it periodically (eg: every
+	// few seconds) from one thread.
+	class CUsbHubPortMonitor
+	{
+	private:
+		static const unsigned int TransferTimeoutMs = 1000;
+
+		struct SWatchedCamera
+		{
+			SUsbLinkMetrics metrics;
+			bool counted;                                         // hubErrorCount is a baseline
+			std::deque<std::pair<uint64_t, uint64_t> > history;   // (ms, linkErrors) of the samples in the window
+			bool rateAlerted;
+			bool stateAlerted;
+
+			SWatchedCamera() : counted(false), rateAlerted(false), stateAlerted(false) {}
+		};
+
+		IUsbDeviceBackend& m_backend;
+		IUsbHubTransport& m_transport;
+		UsbCameraDeviceManager::IUsbClock& m_clock;
+		SUsbLinkThresholds m_thresholds;
+		std::map<std::string, SWatchedCamera> m_cameras;
+
+		CUsbHubPortMonitor(const CUsbHubPortMonitor&);
+		CUsbHubPortMonitor& operator=(const CUsbHubPortMonitor&);
+
+		// Finds the camera again if it isn't where it was, and starts its counting over if it moved
+		bool LocateCamera(SWatchedCamera& camera, std::string& errorMessage);
+
+		// Samples one camera and appends its alerts
+		void SampleCamera(SWatchedCamera& camera, uint64_t nowMs, std::vector<SUsbLinkAlert>& alerts);
+
+	public:
+		// Both must outlive this object. clock times the window, NULL for the steady clock.
+		CUsbHubPortMonitor(IUsbDeviceBackend& backend, IUsbHubTransport& transport, UsbCameraDeviceManager::IUsbClock* clock = NULL);
+
+		void SetThresholds(const SUsbLinkThresholds& thresholds);
+
+		// Fails if the camera isn't connected now
+		bool WatchCamera(const std::string& serialNumber, std::string& errorMessage);
+
+		void UnwatchCamera(const std::string& serialNumber);
+
+		// Samples every watched camera and appends the alerts raised. Returns their number.
+		size_t Sample(std::vector<SUsbLinkAlert>& alerts);
+
+		bool GetMetrics(const std::string& serialNumber, SUsbLinkMetrics& metrics) const;
+
+		std::vector<SUsbLinkMetrics> GetAllMetrics() const;
+
+		// The port a device is plugged into, the last number of its name (eg: "2-1.3" -> 3, "2-1" -> 1). 0 for root hubs.
+		static int GetPortNumber(const std::string& deviceName);
+
+		// GET_STATUS of a hub port. Returns 0 or -errno.
+		static int ReadPortStatus(IUsbHubTransport& transport, const std::string& hubDeviceName, int port, bool superSpeed, SUsbPortStatus& status);
+
+		// GET_PORT_ERR_COUNT of a hub port. Returns 0 or -errno (-EPIPE from a hub that isn't SuperSpeed).
+		static int ReadPortErrorCount(IUsbHubTransport& transport, const std::string& hubDeviceName, int port, uint16_t& errorCount);
+
+		// Decodes wPortStatus and wPortChange. The link state is only there on SuperSpeed hubs.
+		static SUsbPortStatus ParsePortStatus(const uint8_t data[4], bool superSpeed);
+
+		// eg: "U0", "Recovery", "SS.Inactive"
+		static const char* LinkStateToString(int linkState);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbfsHubTransport::CUsbfsHubTransport(IUsbDeviceBackend& backend, const std::string& usbfsRoot)
+	: m_backend(backend)
+{
+	m_usbfsRoot = usbfsRoot;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbfsHubTransport::~CUsbfsHubTransport()
+{
+	for (std::map<std::string, SOpenHub>::iterator it = m_hubs.begin(); it != m_hubs.end(); ++it)
+		close(it->second.fd);
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbfsHubTransport::ControlTransfer(const std::string& hubDeviceName, uint8_t requestType, uint8_t request,
+	uint16_t value, uint16_t index, uint8_t* data, uint16_t length, unsigned int timeoutMs)
+{
+	std::string busnum;
+	std::string devnum;
+	if (m_backend.ReadAttribute(hubDeviceName, "busnum", busnum) == false || m_backend.ReadAttribute(hubDeviceName, "devnum", devnum) == false)
+		return -ENODEV;
+
+	// a descriptor of an earlier enumeration only ever answers ENODEV
+	std::map<std::string, SOpenHub>::iterator it = m_hubs.find(hubDeviceName);
+	if (it != m_hubs.end() && it->second.devnum != devnum)
+	{
+		close(it->second.fd);
+		m_hubs.erase(it);
+		it = m_hubs.end();
+	}
+
+	if (it == m_hubs.end())
+	{
+		char path[512];
+		snprintf(path, sizeof(path), "%s/%03d/%03d", m_usbfsRoot.c_str(), atoi(busnum.c_str()), atoi(devnum.c_str()));
+		int fd = open(path, O_RDWR | O_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+
+		SOpenHub hub;
+		hub.fd = fd;
+		hub.devnum = devnum;
+		it = m_hubs.insert(std::make_pair(hubDeviceName, hub)).first;
+	}
+
+	struct usbdevfs_ctrltransfer transfer;
+	memset(&transfer, 0, sizeof(transfer));
+	transfer.bRequestType = requestType;
+	transfer.bRequest = request;
+	transfer.wValue = value;
+	transfer.wIndex = index;
+	transfer.wLength = length;
+	transfer.timeout = timeoutMs;
+	transfer.data = data;
+
+	int transferred = ioctl(it->second.fd, USBDEVFS_CONTROL, &transfer);
+	if (transferred < 0)
+	{
+		int error = errno;
+		if (error == ENODEV)
+		{
+			close(it->second.fd);
+			m_hubs.erase(it);
+		}
+		return -error;
+	}
+	return transferred;
+}
+
+inline UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::CSimulatedUsbHubTransport()
+{
+	m_transfers = 0;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::AddHub(const std::string& hubDeviceName, bool superSpeed)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_hubs[hubDeviceName].superSpeed = superSpeed;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::RemoveHub(const std::string& hubDeviceName)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_hubs.erase(hubDeviceName);
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::ConnectPort(const std::string& hubDeviceName, int port, bool connected)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	SSimulatedPort& simulated = m_hubs[hubDeviceName].ports[port];
+	simulated.connected = connected;
+	simulated.linkState = connected ? UsbLink_U0 : UsbLink_RxDetect;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::SetLinkState(const std::string& hubDeviceName, int port, EUsbLinkState linkState)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_hubs[hubDeviceName].ports[port].linkState = linkState;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::SetOverCurrent(const std::string& hubDeviceName, int port, bool overCurrent)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_hubs[hubDeviceName].ports[port].overCurrent = overCurrent;
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::AddLinkErrors(const std::string& hubDeviceName, int port, unsigned int count)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	SSimulatedPort& simulated = m_hubs[hubDeviceName].ports[port];
+	simulated.errorCount = (uint16_t)(simulated.errorCount + count);
+}
+
+inline void UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::ResetPort(const std::string& hubDeviceName, int port)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_hubs[hubDeviceName].ports[port].errorCount = 0;
+}
+
+inline uint64_t UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::GetTransferCount()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_transfers;
+}
+
+inline int UsbCameraDeviceManagerLinux::CSimulatedUsbHubTransport::ControlTransfer(const std::string& hubDeviceName, uint8_t requestType, uint8_t request,
+	uint16_t value, uint16_t index, uint8_t* data, uint16_t length, unsigned int timeoutMs)
+{
+	(void)value;
+	(void)timeoutMs;
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_transfers++;
+
+	std::map<std::string, SSimulatedHub>::iterator hub = m_hubs.find(hubDeviceName);
+	if (hub == m_hubs.end())
+		return -ENODEV;
+	if (requestType != UsbHubRequestType_PortIn || index == 0)
+		return -EPIPE;
+
+	SSimulatedPort& port = hub->second.ports[index];
+	if (request == UsbHubRequest_GetStatus && length >= 4)
+	{
+		// PORT_CONNECTION, PORT_ENABLE, PORT_OVER_CURRENT, then PORT_LINK_STATE and PORT_POWER (bit 9) on
+		// SuperSpeed hubs, PORT_POWER (bit 8) on USB 2 ones
+		uint16_t status = 0;
+		if (port.connected)
+			status |= 0x0003;
+		if (port.overCurrent)
+			status |= 0x0008;
+		if (hub->second.superSpeed)
+			status |= (uint16_t)(((port.linkState & 0x0F) << 5) | 0x0200);
+		else
+			status |= 0x0100;
+
+		data[0] = (uint8_t)(status & 0xFF);
+		data[1] = (uint8_t)(status >> 8);
+		data[2] = 0;
+		data[3] = 0;
+		return 4;
+	}
+
+	if (request == UsbHubRequest_GetPortErrorCount && length >= 2)
+	{
+		if (hub->second.superSpeed == false)
+			return -EPIPE;
+		data[0] = (uint8_t)(port.errorCount & 0xFF);
+		data[1] = (uint8_t)(port.errorCount >> 8);
+		return 2;
+	}
+
+	return -EPIPE;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::CUsbHubPortMonitor(IUsbDeviceBackend& backend, IUsbHubTransport& transport, UsbCameraDeviceManager::IUsbClock* clock)
+	: m_backend(backend), m_transport(transport), m_clock((clock != NULL) ? *clock : UsbCameraDeviceManager::CSystemUsbClock::Instance())
+{
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::SetThresholds(const SUsbLinkThresholds& thresholds)
+{
+	m_thresholds = thresholds;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::GetPortNumber(const std::string& deviceName)
+{
+	std::size_t separator = deviceName.find_last_of(".-");
+	if (deviceName.compare(0, 3, "usb") == 0 || separator == std::string::npos)
+		return 0;
+	return atoi(deviceName.c_str() + separator + 1);
+}
+
+inline UsbCameraDeviceManagerLinux::SUsbPortStatus UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::ParsePortStatus(const uint8_t data[4], bool superSpeed)
+{
+	SUsbPortStatus status;
+	status.status = (uint16_t)(data[0] | (data[1] << 8));
+	status.change = (uint16_t)(data[2] | (data[3] << 8));
+	status.connected = (status.status & 0x0001) != 0;
+	status.enabled = (status.status & 0x0002) != 0;
+	status.overCurrent = (status.status & 0x0008) != 0;
+	status.linkState = superSpeed ? (int)((status.status >> 5) & 0x0F) : -1;
+	return status;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::ReadPortStatus(IUsbHubTransport& transport, const std::string& hubDeviceName, int port, bool superSpeed, SUsbPortStatus& status)
+{
+	uint8_t data[4] = { 0 };
+	int transferred = transport.ControlTransfer(hubDeviceName, UsbHubRequestType_PortIn, UsbHubRequest_GetStatus, 0, (uint16_t)port, data, sizeof(data), TransferTimeoutMs);
+	if (transferred < 0)
+		return transferred;
+	if (transferred < (int)sizeof(data))
+		return -EPROTO;
+
+	status = ParsePortStatus(data, superSpeed);
+	return 0;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::ReadPortErrorCount(IUsbHubTransport& transport, const std::string& hubDeviceName, int port, uint16_t& errorCount)
+{
+	uint8_t data[2] = { 0 };
+	int transferred = transport.ControlTransfer(hubDeviceName, UsbHubRequestType_PortIn, UsbHubRequest_GetPortErrorCount, 0, (uint16_t)port, data, sizeof(data), TransferTimeoutMs);
+	if (transferred < 0)
+		return transferred;
+	if (transferred < (int)sizeof(data))
+		return -EPROTO;
+
+	errorCount = (uint16_t)(data[0] | (data[1] << 8));
+	return 0;
+}
+
+inline const char* UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::LinkStateToString(int linkState)
+{
+	switch (linkState)
+	{
+	case UsbLink_U0: return "U0";
+	case UsbLink_U1: return "U1";
+	case UsbLink_U2: return "U2";
+	case UsbLink_U3: return "U3";
+	case UsbLink_Disabled: return "SS.Disabled";
+	case UsbLink_RxDetect: return "Rx.Detect";
+	case UsbLink_Inactive: return "SS.Inactive";
+	case UsbLink_Polling: return "Polling";
+	case UsbLink_Recovery: return "Recovery";
+	case UsbLink_HotReset: return "Hot Reset";
+	case UsbLink_Compliance: return "Compliance";
+	case UsbLink_Loopback: return "Loopback";
+	default: return "unknown";
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::WatchCamera(const std::string& serialNumber, std::string& errorMessage)
+{
+	SWatchedCamera camera;
+	camera.metrics.serialNumber = serialNumber;
+	if (LocateCamera(camera, errorMessage) == false)
+		return false;
+
+	m_cameras[serialNumber] = camera;
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::UnwatchCamera(const std::string& serialNumber)
+{
+	m_cameras.erase(serialNumber);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::LocateCamera(SWatchedCamera& camera, std::string& errorMessage)
+{
+	SUsbLinkMetrics& metrics = camera.metrics;
+
+	// still there? One attribute read, no listing.
+	std::string serial;
+	std::string deviceName = metrics.deviceName;
+	if (deviceName == "" || m_backend.ReadAttribute(deviceName, "serial", serial) == false || serial != metrics.serialNumber)
+	{
+		if (FindUsbDeviceBySerial(m_backend, metrics.serialNumber, deviceName) == false)
+		{
+			errorMessage = "Error: LocateCamera(): Camera " + metrics.serialNumber + " not found.";
+			return false;
+		}
+	}
+
+	std::string hubDeviceName = GetParentUsbDeviceName(deviceName);
+	if (hubDeviceName == "")
+	{
+		errorMessage = "Error: LocateCamera(): " + deviceName + " has no upstream hub.";
+		return false;
+	}
+
+	// a camera that fell back to USB 2 sits on the hub's USB 2 half, which keeps no link error count
+	std::string speed;
+	m_backend.ReadAttribute(deviceName, "speed", speed);
+	bool superSpeed = atoi(speed.c_str()) >= 5000;
+
+	// another port is another counter
+	if (hubDeviceName != metrics.hubDeviceName || GetPortNumber(deviceName) != metrics.port || superSpeed != metrics.superSpeed)
+	{
+		camera.counted = false;
+		camera.history.clear();
+	}
+
+	metrics.deviceName = deviceName;
+	metrics.hubDeviceName = hubDeviceName;
+	metrics.port = GetPortNumber(deviceName);
+	metrics.superSpeed = superSpeed;
+	return true;
+}
+
+inline size_t UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::Sample(std::vector<SUsbLinkAlert>& alerts)
+{
+	size_t before = alerts.size();
+	uint64_t nowMs = m_clock.NowMs();
+	for (std::map<std::string, SWatchedCamera>::iterator it = m_cameras.begin(); it != m_cameras.end(); ++it)
+		SampleCamera(it->second, nowMs, alerts);
+	return alerts.size() - before;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::SampleCamera(SWatchedCamera& camera, uint64_t nowMs, std::vector<SUsbLinkAlert>& alerts)
+{
+	SUsbLinkMetrics& metrics = camera.metrics;
+	metrics.lastSampleMs = nowMs;
+
+	std::string errorMessage;
+	if (LocateCamera(camera, errorMessage) == false)
+	{
+		metrics.failedSamples++;
+		metrics.lastError = errorMessage;
+		return;
+	}
+
+	int result = ReadPortStatus(m_transport, metrics.hubDeviceName, metrics.port, metrics.superSpeed, metrics.portStatus);
+	if (result == 0 && metrics.superSpeed)
+	{
+		uint16_t errorCount = 0;
+		result = ReadPortErrorCount(m_transport, metrics.hubDeviceName, metrics.port, errorCount);
+		if (result == 0)
+		{
+			// the hub's counter starts over after a port reset (eg: a recovery)
+			if (camera.counted)
+				metrics.linkErrors += (errorCount >= metrics.hubErrorCount) ? (uint64_t)(errorCount - metrics.hubErrorCount) : errorCount;
+			metrics.hubErrorCount = errorCount;
+			camera.counted = true;
+		}
+	}
+
+	if (result != 0)
+	{
+		metrics.failedSamples++;
+		metrics.lastError = "Error: SampleCamera(): Hub " + metrics.hubDeviceName + " port " + std::to_string(metrics.port) + ": " + strerror(-result);
+		return;
+	}
+	metrics.samples++;
+
+	// the errors within the window: since the last sample at or before its start
+	camera.history.push_back(std::make_pair(nowMs, metrics.linkErrors));
+	while (camera.history.size() > 1 && camera.history[1].first + m_thresholds.windowMs <= nowMs)
+		camera.history.pop_front();
+	metrics.windowErrors = metrics.linkErrors - camera.history.front().second;
+
+	SUsbLinkAlert alert;
+	alert.serialNumber = metrics.serialNumber;
+	alert.hubDeviceName = metrics.hubDeviceName;
+	alert.port = metrics.port;
+
+	bool tooManyErrors = metrics.windowErrors > m_thresholds.maxLinkErrors;
+	if (tooManyErrors && camera.rateAlerted == false)
+	{
+		alert.type = UsbLinkAlert_ErrorRate;
+		alert.value = metrics.windowErrors;
+		alert.detail = std::to_string(metrics.windowErrors) + " link errors within " + std::to_string(m_thresholds.windowMs / 1000)
+			+ " s on hub " + metrics.hubDeviceName + " port " + std::to_string(metrics.port) + ", check the cable.";
+		alerts.push_back(alert);
+	}
+	camera.rateAlerted = tooManyErrors;
+
+	int linkState = metrics.portStatus.linkState;
+	bool linkFailed = metrics.portStatus.connected && (linkState == UsbLink_Inactive || linkState == UsbLink_Compliance || linkState == UsbLink_Disabled);
+	if (linkFailed && camera.stateAlerted == false)
+	{
+		alert.type = UsbLinkAlert_LinkState;
+		alert.value = (uint64_t)linkState;
+		alert.detail = std::string("Link in ") + LinkStateToString(linkState) + " on hub " + metrics.hubDeviceName + " port " + std::to_string(metrics.port) + ".";
+		alerts.push_back(alert);
+	}
+	camera.stateAlerted = linkFailed;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::GetMetrics(const std::string& serialNumber, SUsbLinkMetrics& metrics) const
+{
+	std::map<std::string, SWatchedCamera>::const_iterator it = m_cameras.find(serialNumber);
+	if (it == m_cameras.end())
+		return false;
+	metrics = it->second.metrics;
+	return true;
+}
+
+inline std::vector<UsbCameraDeviceManagerLinux::SUsbLinkMetrics> UsbCameraDeviceManagerLinux::CUsbHubPortMonitor::GetAllMetrics() const
+{
+	std::vector<SUsbLinkMetrics> all;
+	for (std::map<std::string, SWatchedCamera>::const_iterator it = m_cameras.begin(); it != m_cameras.end(); ++it)
+		all.push_back(it->second.metrics);
+	return all;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
@@ -0,0 +1,956 @@
+// UsbIncidentRecorderLinux.h
+// Records the timeline of a usb incident into a compact file and replays it into the simulated backend
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBINCIDENTRECORDERLINUX_H
+#define USBINCIDENTRECORDERLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <stdint.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbChangeDetectorLinux.h"
+#include "UsbKernelLogWatcherLinux.h"
+#include "UsbSysfsAttributePollerLinux.h"
+#include "UsbClock.h"
+#include "UsbCameraResult.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	enum EUsbIncidentRecordType
+	{
+		UsbRecord_Device = 1,      // a device and its attributes, when recording starts and whenever one is added
+		UsbRecord_Attribute,       // a sysfs attribute changed
+		UsbRecord_Change,          // a topology change (uevent)
+		UsbRecord_KernelLog,       // a classified kernel message
+		UsbRecord_ApiCall          // a library call and its result
+	};
+
+	// One entry of the timeline. Which fields are used depends on the type.
+	struct SUsbIncidentRecord
+	{
+		EUsbIncidentRecordType type;
+		uint64_t timeUs;                                 // since recording (or replaying) started
+		std::string deviceName;                          // eg: 2-1.3
+		std::string serialNumber;                        // KernelLog: all serials it concerns, comma separated
+		std::string name;                                // Attribute: the attribute. ApiCall: the call (eg: "DisableCamera")
+		std::string value;                               // Attribute: the new value. KernelLog: the message. ApiCall: the error message.
+		int code;                                        // Attribute: 1 if present. Change: EUsbChangeType. KernelLog: EUsbKernelLogEventType. ApiCall: 1 if it succeeded.
+		int busnum;                                      // Change only
+		int devnum;                                      // Change only
+		unsigned int durationMs;                         // ApiCall only
+		std::map<std::string, std::string> attributes;  // Device only
+
+		SUsbIncidentRecord() : type(UsbRecord_Device), timeUs(0), code(0), busnum(0), devnum(0), durationMs(0) {}
+	};
+
+	// How long a camera was gone in one incident: from its removal to its return at no less than its speed before
+	struct SUsbIncidentRecovery
+	{
+		std::string serialNumber;
+		uint64_t lostAtUs;
+		uint64_t recoveredAtUs;      // 0 if it didn't come back
+		bool recovered;
+		uint64_t latencyMs;
+	};
+
+	// Appends the timeline to a file as it happens. Each record is a type byte, the time since the previous record and
+	// its fields; device names, serial numbers, attribute names and values are written once and then referred to by
+	// index, so a busy hour of polling stays small. Every record is flushed, a crash loses at most the one being written.
+	// Thread safe.
+	class CUsbIncidentRecorder : public UsbCameraDeviceManager::IUsbApiCallObserver
+	{
+	private:
+		IUsbDeviceBackend& m_backend;
+		UsbCameraDeviceManager::IUsbClock& m_clock;
+		std::mutex m_lock;
+		FILE* m_file;
+		uint64_t m_startMs;
+		uint64_t m_lastTimeUs;
+		std::map<std::string, uint32_t> m_names;
+		std::map<std::string, std::string> m_serialNumbers;   // device name -> serial, from the devices recorded
+		uint64_t m_bytesWritten;
+		size_t m_records;
+
+		void WriteByte(uint8_t value);
+		void WriteVarint(uint64_t value);
+		void WriteText(const std::string& text);
+		void WriteName(const std::string& name);
+
+		// type and time of a record (m_lock held)
+		void BeginRecord(EUsbIncidentRecordType type);
+		void EndRecord();
+
+		// reads a device's attributes and records them (m_lock held)
+		void RecordDevice(const std::string& deviceName);
+
+		CUsbIncidentRecorder(const CUsbIncidentRecorder&);
+		CUsbIncidentRecorder& operator=(const CUsbIncidentRecorder&);
+
+	public:
+		// clock timestamps the records, NULL for the steady clock
+		CUsbIncidentRecorder(IUsbDeviceBackend& backend, UsbCameraDeviceManager::IUsbClock* clock = NULL);
+
+		~CUsbIncidentRecorder();
+
+		// busnum, devnum, idVendor, idProduct, serial, speed, version, manufacturer, product, bMaxPower
+		static std::vector<std::string> GetRecordedAttributes();
+
+		// Creates the file and records every device present as the starting point
+		bool Open(const std::string& path, std::string& errorMessage);
+
+		void Close();
+
+		// From CUsbSysfsAttributePoller::Poll()
+		void RecordAttributeChanges(const std::vector<SUsbAttributeChange>& changes);
+
+		// From IUsbChangeDetector::WaitForEvents(). Added devices are recorded with their attributes.
+		void RecordChangeEvents(const std::vector<SUsbChangeEvent>& events);
+
+		// From CUsbKernelLogWatcher::ReadEvents()
+		void RecordKernelLogEvents(const std::vector<SUsbKernelLogEvent>& events);
+
+		// A library call that acted on a camera (eg: DisableCamera(), ResetCamera()) and how it went
+		void RecordApiCall(const std::string& call, const std::string& serialNumber, bool succeeded, unsigned int durationMs, const std::string& errorMessage);
+
+		// The same, as the observer of the objects that make the calls (eg: CUsbResetHandleCache::SetApiCallObserver())
+		virtual void OnApiCall(const std::string& call, const std::string& serialNumber, bool succeeded, unsigned int durationMs, const std::string& errorMessage);
+
+		// For reference, the file's size and number of records so far
+		uint64_t GetBytesWritten();
+		size_t GetRecordCount();
+	};
+
+	class CUsbIncidentFile
+	{
+	public:
+		// Reads a recording. A file cut short (the recording process died) loads up to its last whole record and sets truncated.
+		static bool Load(const std::string& path, std::vector<SUsbIncidentRecord>& records, bool& truncated, std::string& errorMessage);
+
+		// "device", "attribute", "change", "kernel_log", "api_call"
+		static const char* RecordTypeToString(EUsbIncidentRecordType type);
+
+		// Every camera that was removed in the timeline, and when (if) it came back
+		static void FindRecoveries(const std::vector<SUsbIncidentRecord>& records, std::vector<SUsbIncidentRecovery>& recoveries);
+
+		// For reference, the recoveries of two runs of the same incident side by side, as an aligned text table
+		static std::string CompareRecoveries(const std::vector<SUsbIncidentRecovery>& recorded, const std::vector<SUsbIncidentRecovery>& replayed);
+	};
+
+	// What a replay did
+	struct SUsbIncidentReplayResult
+	{
+		size_t applied;                              // records replayed
+		size_t notReplayed;                          // camera responses to calls the library under test never made
+		std::vector<SUsbIncidentRecord> timeline;    // what happened during the replay, in replay time, including OnApiCall()s
+	};
+
+	// Plays a recording into a simulated backend on a clock (in real or virtual time), so the library under test sees the
+	// incident again. Everything the world did is replayed at its recorded time, except a camera's response to the
+	// library: records about a camera that follow a call naming it (eg: it re-enumerated 2.3 s after EnableCamera()) are
+	// replayed the same delay after the library under test makes the same call, reported through OnApiCall(). A version
+	// that acts sooner gets its cameras back sooner, one that doesn't make the call doesn't get them back at all.
+	class CUsbIncidentReplayer : public UsbCameraDeviceManager::IUsbApiCallObserver
+	{
+	public:
+		// Called on the replaying thread after each record is applied, with the record in replay time. Feed KernelLog
+		// records to the code under test here. It may call OnApiCall(), but must not wait for the incident to progress.
+		typedef std::function<void(const SUsbIncidentRecord& record)> RecordHandler;
+
+	private:
+		struct SAnchoredRecord
+		{
+			size_t index;
+			uint64_t delayUs;
+		};
+
+		CSimulatedUsbDeviceBackend& m_simulated;
+		UsbCameraDeviceManager::IUsbClock& m_clock;
+		RecordHandler m_onRecord;
+		unsigned int m_resolutionMs;
+		unsigned int m_tailMs;
+
+		std::mutex m_lock;
+		const std::vector<SUsbIncidentRecord>* m_records;
+		uint64_t m_startMs;
+		std::multimap<uint64_t, size_t> m_scheduled;                                              // replay time -> record
+		std::map<std::string, std::vector<std::vector<SAnchoredRecord> > > m_anchors;              // serial + call -> responses per occurrence
+		std::map<std::string, size_t> m_calls;                                                      // serial + call -> calls made so far
+		size_t m_unscheduled;
+		SUsbIncidentReplayResult* m_result;
+
+		static std::string AnchorKey(const std::string& serialNumber, const std::string& call);
+
+		// sorts the records into the ones replayed on time and the ones anchored to a call
+		void Classify(const std::vector<SUsbIncidentRecord>& records);
+
+		void Apply(const SUsbIncidentRecord& record);
+
+		CUsbIncidentReplayer(const CUsbIncidentReplayer&);
+		CUsbIncidentReplayer& operator=(const CUsbIncidentReplayer&);
+
+	public:
+		// clock is the one the library under test waits on, NULL for the steady clock. The replaying thread sleeps on it
+		// too, so with a CVirtualUsbClock it counts as one of the actors.
+		CUsbIncidentReplayer(CSimulatedUsbDeviceBackend& simulated, UsbCameraDeviceManager::IUsbClock* clock = NULL);
+
+		void SetRecordHandler(RecordHandler onRecord);
+
+		// How often the replay checks for responses that became due (default 10 ms)
+		void SetResolutionMs(unsigned int resolutionMs);
+
+		// How long after the last recorded event the replay keeps waiting for calls that bring cameras back (default 30000 ms)
+		void SetTailMs(unsigned int tailMs);
+
+		// Replays the records, returning when all are applied or no more can be
+		bool Replay(const std::vector<SUsbIncidentRecord>& records, SUsbIncidentReplayResult& result, std::string& errorMessage);
+
+		// The library under test made a call on a camera. Thread safe, may be called during Replay() from any thread.
+		// Set the replayer as the observer of the objects under test (eg: CUsbResetHandleCache::SetApiCallObserver()).
+		virtual void OnApiCall(const std::string& call, const std::string& serialNumber, bool succeeded, unsigned int durationMs, const std::string& errorMessage);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::CUsbIncidentRecorder(IUsbDeviceBackend& backend, UsbCameraDeviceManager::IUsbClock* clock)
+	: m_backend(backend), m_clock((clock != NULL) ? *clock : UsbCameraDeviceManager::CSystemUsbClock::Instance())
+{
+	m_file = NULL;
+	m_startMs = 0;
+	m_lastTimeUs = 0;
+	m_bytesWritten = 0;
+	m_records = 0;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::~CUsbIncidentRecorder()
+{
+	Close();
+}
+
+inline std::vector<std::string> UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::GetRecordedAttributes()
+{
+	std::vector<std::string> attributes;
+	attributes.push_back("busnum");
+	attributes.push_back("devnum");
+	attributes.push_back("idVendor");
+	attributes.push_back("idProduct");
+	attributes.push_back("serial");
+	attributes.push_back("speed");
+	attributes.push_back("version");
+	attributes.push_back("manufacturer");
+	attributes.push_back("product");
+	attributes.push_back("bMaxPower");
+	return attributes;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::WriteByte(uint8_t value)
+{
+	fputc(value, m_file);
+	m_bytesWritten++;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::WriteVarint(uint64_t value)
+{
+	// 7 bits per byte, high bit set on all but the last
+	while (value >= 0x80)
+	{
+		WriteByte((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	WriteByte((uint8_t)value);
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::WriteText(const std::string& text)
+{
+	WriteVarint(text.size());
+	fwrite(text.data(), 1, text.size(), m_file);
+	m_bytesWritten += text.size();
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::WriteName(const std::string& name)
+{
+	// 0 and the text the first time, index + 1 after that
+	std::map<std::string, uint32_t>::iterator known = m_names.find(name);
+	if (known != m_names.end())
+	{
+		WriteVarint(known->second + 1);
+		return;
+	}
+
+	WriteVarint(0);
+	WriteText(name);
+	uint32_t index = (uint32_t)m_names.size();
+	m_names[name] = index;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::BeginRecord(EUsbIncidentRecordType type)
+{
+	uint64_t timeUs = (m_clock.NowMs() - m_startMs) * 1000;
+	if (timeUs < m_lastTimeUs)
+		timeUs = m_lastTimeUs;
+
+	WriteByte((uint8_t)type);
+	WriteVarint(timeUs - m_lastTimeUs);
+	m_lastTimeUs = timeUs;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::EndRecord()
+{
+	fflush(m_file);
+	m_records++;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::RecordDevice(const std::string& deviceName)
+{
+	std::vector<std::string> attributes = GetRecordedAttributes();
+	std::vector<std::pair<std::string, std::string> > values;
+	for (size_t i = 0; i < attributes.size(); i++)
+	{
+		std::string value;
+		if (m_backend.ReadAttribute(deviceName, attributes[i].c_str(), value))
+			values.push_back(std::make_pair(attributes[i], value));
+	}
+
+	std::string serialNumber;
+	m_backend.ReadAttribute(deviceName, "serial", serialNumber);
+	m_serialNumbers[deviceName] = serialNumber;
+
+	BeginRecord(UsbRecord_Device);
+	WriteName(deviceName);
+	WriteName(serialNumber);
+	WriteVarint(values.size());
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		WriteName(values[i].first);
+		WriteName(values[i].second);
+	}
+	EndRecord();
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::Open(const std::string& path, std::string& errorMessage)
+{
+	Close();
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_file = fopen(path.c_str(), "wb");
+	if (m_file == NULL)
+	{
+		errorMessage = "Error: CUsbIncidentRecorder::Open(): Unable to create ";
+		errorMessage.append(path);
+		errorMessage.append(": ");
+		errorMessage.append(strerror(errno));
+		return false;
+	}
+
+	m_startMs = m_clock.NowMs();
+	m_lastTimeUs = 0;
+	m_names.clear();
+	m_serialNumbers.clear();
+	m_bytesWritten = 0;
+	m_records = 0;
+
+	fwrite("UCAMINC1", 1, 8, m_file);
+	m_bytesWritten += 8;
+
+	std::vector<std::string> deviceNames;
+	m_backend.ListDevices(deviceNames);
+	for (size_t i = 0; i < deviceNames.size(); i++)
+		RecordDevice(deviceNames[i]);
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::Close()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_file != NULL)
+		fclose(m_file);
+	m_file = NULL;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::RecordAttributeChanges(const std::vector<SUsbAttributeChange>& changes)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_file == NULL)
+		return;
+
+	for (size_t i = 0; i < changes.size(); i++)
+	{
+		const SUsbAttributeChange& change = changes[i];
+		BeginRecord(UsbRecord_Attribute);
+		WriteName(change.deviceName);
+		WriteName(m_serialNumbers[change.deviceName]);
+		WriteName(change.attribute);
+		WriteName(change.newValue);
+		WriteByte(change.present ? 1 : 0);
+		EndRecord();
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::RecordChangeEvents(const std::vector<SUsbChangeEvent>& events)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_file == NULL)
+		return;
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const SUsbChangeEvent& event = events[i];
+
+		// the replay needs the attributes to plug the device back in
+		if (event.type == UsbChange_Add && event.deviceName != "")
+			RecordDevice(event.deviceName);
+
+		BeginRecord(UsbRecord_Change);
+		WriteName(event.deviceName);
+		WriteName(event.serialNumber);
+		WriteByte((uint8_t)event.type);
+		WriteVarint(event.busnum > 0 ? event.busnum : 0);
+		WriteVarint(event.devnum > 0 ? event.devnum : 0);
+		EndRecord();
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::RecordKernelLogEvents(const std::vector<SUsbKernelLogEvent>& events)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_file == NULL)
+		return;
+
+	for (size_t i = 0; i < events.size(); i++)
+	{
+		const SUsbKernelLogEvent& event = events[i];
+		std::string serialNumbers;
+		for (size_t s = 0; s < event.serialNumbers.size(); s++)
+		{
+			if (s > 0)
+				serialNumbers.append(",");
+			serialNumbers.append(event.serialNumbers[s]);
+		}
+
+		BeginRecord(UsbRecord_KernelLog);
+		WriteName(event.deviceName);
+		WriteName(serialNumbers);
+		WriteByte((uint8_t)event.type);
+		WriteText(event.message);
+		EndRecord();
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::RecordApiCall(const std::string& call, const std::string& serialNumber, bool succeeded, unsigned int durationMs, const std::string& errorMessage)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_file == NULL)
+		return;
+
+	BeginRecord(UsbRecord_ApiCall);
+	WriteName(call);
+	WriteName(serialNumber);
+	WriteByte(succeeded ? 1 : 0);
+	WriteVarint(durationMs);
+	WriteText(errorMessage);
+	EndRecord();
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::OnApiCall(const std::string& call, const std::string& serialNumber, bool succeeded, unsigned int durationMs, const std::string& errorMessage)
+{
+	RecordApiCall(call, serialNumber, succeeded, durationMs, errorMessage);
+}
+
+inline uint64_t UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::GetBytesWritten()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_bytesWritten;
+}
+
+inline size_t UsbCameraDeviceManagerLinux::CUsbIncidentRecorder::GetRecordCount()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_records;
+}
+
+inline const char* UsbCameraDeviceManagerLinux::CUsbIncidentFile::RecordTypeToString(EUsbIncidentRecordType type)
+{
+	switch (type)
+	{
+	case UsbRecord_Device: return "device";
+	case UsbRecord_Attribute: return "attribute";
+	case UsbRecord_Change: return "change";
+	case UsbRecord_KernelLog: return "kernel_log";
+	case UsbRecord_ApiCall: return "api_call";
+	default: return "unknown";
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbIncidentFile::Load(const std::string& path, std::vector<SUsbIncidentRecord>& records, bool& truncated, std::string& errorMessage)
+{
+	truncated = false;
+
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		errorMessage = "Error: CUsbIncidentFile::Load(): Unable to open ";
+		errorMessage.append(path);
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	uint8_t buffer[65536];
+	size_t length = 0;
+	while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		data.insert(data.end(), buffer, buffer + length);
+	fclose(file);
+
+	if (data.size() < 8 || memcmp(&data[0], "UCAMINC1", 8) != 0)
+	{
+		errorMessage = "Error: CUsbIncidentFile::Load(): ";
+		errorMessage.append(path);
+		errorMessage.append(" is not an incident recording.");
+		return false;
+	}
+
+	size_t at = 8;
+	bool ok = true;
+	std::vector<std::string> names;
+
+	// the readers clear ok instead of reading past the end, which is how a cut short file ends
+	std::function<uint64_t()> readVarint = [&]() -> uint64_t
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (at >= data.size())
+				break;
+			uint8_t byte = data[at++];
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				return value;
+		}
+		ok = false;
+		return 0;
+	};
+	std::function<uint8_t()> readByte = [&]() -> uint8_t
+	{
+		if (at >= data.size())
+		{
+			ok = false;
+			return 0;
+		}
+		return data[at++];
+	};
+	std::function<std::string()> readText = [&]() -> std::string
+	{
+		uint64_t size = readVarint();
+		if (ok == false || size > data.size() - at)
+		{
+			ok = false;
+			return "";
+		}
+		std::string text((const char*)&data[at], (size_t)size);
+		at += (size_t)size;
+		return text;
+	};
+	std::function<std::string()> readName = [&]() -> std::string
+	{
+		uint64_t index = readVarint();
+		if (ok == false)
+			return "";
+		if (index == 0)
+		{
+			std::string name = readText();
+			if (ok)
+				names.push_back(name);
+			return name;
+		}
+		if (index > names.size())
+		{
+			ok = false;
+			return "";
+		}
+		return names[(size_t)index - 1];
+	};
+
+	uint64_t timeUs = 0;
+	while (at < data.size())
+	{
+		size_t namesBefore = names.size();
+		SUsbIncidentRecord record;
+		record.type = (EUsbIncidentRecordType)readByte();
+		timeUs += readVarint();
+		record.timeUs = timeUs;
+
+		switch (record.type)
+		{
+		case UsbRecord_Device:
+		{
+			record.deviceName = readName();
+			record.serialNumber = readName();
+			uint64_t count = readVarint();
+			for (uint64_t i = 0; i < count && ok; i++)
+			{
+				std::string attribute = readName();
+				std::string value = readName();
+				record.attributes[attribute] = value;
+			}
+			break;
+		}
+		case UsbRecord_Attribute:
+			record.deviceName = readName();
+			record.serialNumber = readName();
+			record.name = readName();
+			record.value = readName();
+			record.code = readByte();
+			break;
+		case UsbRecord_Change:
+			record.deviceName = readName();
+			record.serialNumber = readName();
+			record.code = readByte();
+			record.busnum = (int)readVarint();
+			record.devnum = (int)readVarint();
+			break;
+		case UsbRecord_KernelLog:
+			record.deviceName = readName();
+			record.serialNumber = readName();
+			record.code = readByte();
+			record.value = readText();
+			break;
+		case UsbRecord_ApiCall:
+			record.name = readName();
+			record.serialNumber = readName();
+			record.code = readByte();
+			record.durationMs = (unsigned int)readVarint();
+			record.value = readText();
+			break;
+		default:
+			if (ok)
+			{
+				errorMessage = "Error: CUsbIncidentFile::Load(): Unknown record type ";
+				errorMessage.append(std::to_string((int)record.type));
+				errorMessage.append(" at offset ");
+				errorMessage.append(std::to_string(at - 1));
+				return false;
+			}
+		}
+
+		if (ok == false)
+		{
+			// names the partial record introduced never made it into a whole one
+			names.resize(namesBefore);
+			truncated = true;
+			break;
+		}
+		records.push_back(record);
+	}
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentFile::FindRecoveries(const std::vector<SUsbIncidentRecord>& records, std::vector<SUsbIncidentRecovery>& recoveries)
+{
+	std::map<std::string, int> speeds;         // serial -> speed when last seen
+	std::map<std::string, size_t> lost;        // serial -> its open entry in recoveries
+
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const SUsbIncidentRecord& record = records[i];
+		if (record.serialNumber == "")
+			continue;
+
+		if (record.type == UsbRecord_Change && record.code == UsbChange_Remove && lost.find(record.serialNumber) == lost.end())
+		{
+			SUsbIncidentRecovery recovery;
+			recovery.serialNumber = record.serialNumber;
+			recovery.lostAtUs = record.timeUs;
+			recovery.recoveredAtUs = 0;
+			recovery.recovered = false;
+			recovery.latencyMs = 0;
+			lost[record.serialNumber] = recoveries.size();
+			recoveries.push_back(recovery);
+		}
+		else if (record.type == UsbRecord_Device)
+		{
+			std::map<std::string, std::string>::const_iterator speed = record.attributes.find("speed");
+			int current = (speed != record.attributes.end()) ? atoi(speed->second.c_str()) : 0;
+
+			std::map<std::string, size_t>::iterator open = lost.find(record.serialNumber);
+			if (open != lost.end() && current >= speeds[record.serialNumber])
+			{
+				SUsbIncidentRecovery& recovery = recoveries[open->second];
+				recovery.recoveredAtUs = record.timeUs;
+				recovery.recovered = true;
+				recovery.latencyMs = (record.timeUs - recovery.lostAtUs) / 1000;
+				lost.erase(open);
+			}
+			if (open == lost.end() || current >= speeds[record.serialNumber])
+				speeds[record.serialNumber] = current;
+		}
+	}
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbIncidentFile::CompareRecoveries(const std::vector<SUsbIncidentRecovery>& recorded, const std::vector<SUsbIncidentRecovery>& replayed)
+{
+	std::string table;
+	char line[256];
+	snprintf(line, sizeof(line), "%-16s %12s %12s %12s\n", "serial", "recorded ms", "replayed ms", "change ms");
+	table.append(line);
+
+	// the n-th loss of a camera in one run against its n-th loss in the other
+	std::map<std::string, size_t> seen;
+	for (size_t i = 0; i < recorded.size(); i++)
+	{
+		const SUsbIncidentRecovery& before = recorded[i];
+		size_t occurrence = seen[before.serialNumber]++;
+		const SUsbIncidentRecovery* after = NULL;
+		for (size_t j = 0, count = 0; j < replayed.size(); j++)
+		{
+			if (replayed[j].serialNumber == before.serialNumber && count++ == occurrence)
+			{
+				after = &replayed[j];
+				break;
+			}
+		}
+
+		std::string recordedMs = before.recovered ? std::to_string(before.latencyMs) : "never";
+		std::string replayedMs = (after == NULL) ? "not lost" : (after->recovered ? std::to_string(after->latencyMs) : "never");
+		std::string change = "";
+		if (before.recovered && after != NULL && after->recovered)
+			change = std::to_string((long long)after->latencyMs - (long long)before.latencyMs);
+		snprintf(line, sizeof(line), "%-16s %12s %12s %12s\n", before.serialNumber.c_str(), recordedMs.c_str(), replayedMs.c_str(), change.c_str());
+		table.append(line);
+	}
+	return table;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::CUsbIncidentReplayer(CSimulatedUsbDeviceBackend& simulated, UsbCameraDeviceManager::IUsbClock* clock)
+	: m_simulated(simulated), m_clock((clock != NULL) ? *clock : UsbCameraDeviceManager::CSystemUsbClock::Instance())
+{
+	m_resolutionMs = 10;
+	m_tailMs = 30000;
+	m_records = NULL;
+	m_startMs = 0;
+	m_unscheduled = 0;
+	m_result = NULL;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::SetRecordHandler(RecordHandler onRecord)
+{
+	m_onRecord = onRecord;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::SetResolutionMs(unsigned int resolutionMs)
+{
+	m_resolutionMs = (resolutionMs == 0) ? 1 : resolutionMs;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::SetTailMs(unsigned int tailMs)
+{
+	m_tailMs = tailMs;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::AnchorKey(const std::string& serialNumber, const std::string& call)
+{
+	return serialNumber + "\n" + call;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::Classify(const std::vector<SUsbIncidentRecord>& records)
+{
+	m_scheduled.clear();
+	m_anchors.clear();
+	m_calls.clear();
+	m_unscheduled = 0;
+
+	// the last call naming each camera so far, and which occurrence of that call it was
+	std::map<std::string, std::pair<size_t, size_t> > lastCall;   // serial -> (record, occurrence)
+	std::map<std::string, size_t> occurrences;
+	std::map<std::string, std::string> serialNumbers;             // device name -> serial
+
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const SUsbIncidentRecord& record = records[i];
+		if (record.type == UsbRecord_ApiCall)
+		{
+			if (record.serialNumber != "" && record.code != 0)
+			{
+				size_t occurrence = occurrences[AnchorKey(record.serialNumber, record.name)]++;
+				lastCall[record.serialNumber] = std::make_pair(i, occurrence);
+			}
+			continue;
+		}
+
+		std::string serialNumber = record.serialNumber;
+		if (record.type == UsbRecord_Device && record.deviceName != "")
+			serialNumbers[record.deviceName] = serialNumber;
+		if (serialNumber == "" && record.deviceName != "")
+			serialNumber = serialNumbers[record.deviceName];
+
+		std::map<std::string, std::pair<size_t, size_t> >::iterator call = lastCall.end();
+		if (record.type != UsbRecord_KernelLog && serialNumber != "")
+			call = lastCall.find(serialNumber);
+
+		if (call == lastCall.end())
+		{
+			m_scheduled.insert(std::make_pair(record.timeUs, i));
+			continue;
+		}
+
+		const SUsbIncidentRecord& anchor = records[call->second.first];
+		std::vector<std::vector<SAnchoredRecord> >& responses = m_anchors[AnchorKey(serialNumber, anchor.name)];
+		if (responses.size() <= call->second.second)
+			responses.resize(call->second.second + 1);
+
+		SAnchoredRecord anchored;
+		anchored.index = i;
+		anchored.delayUs = record.timeUs - anchor.timeUs;
+		responses[call->second.second].push_back(anchored);
+		m_unscheduled++;
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::Apply(const SUsbIncidentRecord& record)
+{
+	if (record.type == UsbRecord_Device)
+	{
+		std::map<std::string, std::string> attributes = record.attributes;
+		int busnum = atoi(attributes["busnum"].c_str());
+		uint16_t vendorId = (uint16_t)strtoul(attributes["idVendor"].c_str(), NULL, 16);
+		uint16_t productId = (uint16_t)strtoul(attributes["idProduct"].c_str(), NULL, 16);
+		m_simulated.AddDevice(record.deviceName, busnum, vendorId, productId, record.serialNumber, attributes["speed"]);
+
+		// the simulator hands out its own device numbers
+		for (std::map<std::string, std::string>::iterator it = attributes.begin(); it != attributes.end(); ++it)
+		{
+			if (it->first != "busnum" && it->first != "devnum")
+				m_simulated.SetAttribute(record.deviceName, it->first, it->second);
+		}
+	}
+	else if (record.type == UsbRecord_Attribute && record.code != 0)
+		m_simulated.SetAttribute(record.deviceName, record.name, record.value);
+	else if (record.type == UsbRecord_Change && record.code == UsbChange_Remove)
+		m_simulated.RemoveDevice(record.deviceName);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::Replay(const std::vector<SUsbIncidentRecord>& records, SUsbIncidentReplayResult& result, std::string& errorMessage)
+{
+	result = SUsbIncidentReplayResult();
+	result.applied = 0;
+	result.notReplayed = 0;
+	if (records.empty())
+	{
+		errorMessage = "Error: CUsbIncidentReplayer::Replay(): The recording is empty.";
+		return false;
+	}
+
+	uint64_t endUs = records.back().timeUs;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		Classify(records);
+		m_records = &records;
+		m_result = &result;
+		m_startMs = m_clock.NowMs();
+	}
+
+	while (true)
+	{
+		std::vector<size_t> due;
+		bool finished = false;
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			uint64_t nowUs = (m_clock.NowMs() - m_startMs) * 1000;
+			while (m_scheduled.empty() == false && m_scheduled.begin()->first <= nowUs)
+			{
+				due.push_back(m_scheduled.begin()->second);
+				m_scheduled.erase(m_scheduled.begin());
+			}
+
+			// done once nothing is scheduled, and nothing can be anymore (or the library had its chance)
+			finished = due.empty() && m_scheduled.empty() && (m_unscheduled == 0 || nowUs >= endUs + (uint64_t)m_tailMs * 1000);
+			if (finished)
+			{
+				result.notReplayed = m_unscheduled;
+				m_records = NULL;
+				m_result = NULL;
+			}
+		}
+		if (finished)
+			break;
+
+		for (size_t i = 0; i < due.size(); i++)
+		{
+			SUsbIncidentRecord record = records[due[i]];
+			Apply(record);
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				record.timeUs = (m_clock.NowMs() - m_startMs) * 1000;
+				result.timeline.push_back(record);
+				result.applied++;
+			}
+			if (m_onRecord)
+				m_onRecord(record);
+		}
+
+		if (due.empty())
+			m_clock.SleepMs(m_resolutionMs);
+	}
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbIncidentReplayer::OnApiCall(const std::string& call, const std::string& serialNumber, bool succeeded, unsigned int durationMs, const std::string& errorMessage)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (m_records == NULL)
+		return;
+
+	uint64_t nowUs = (m_clock.NowMs() - m_startMs) * 1000;
+	SUsbIncidentRecord record;
+	record.type = UsbRecord_ApiCall;
+	record.timeUs = nowUs;
+	record.name = call;
+	record.serialNumber = serialNumber;
+	record.code = succeeded ? 1 : 0;
+	record.durationMs = durationMs;
+	record.value = errorMessage;
+	m_result->timeline.push_back(record);
+
+	if (succeeded == false)
+		return;
+
+	// the camera responds to this call the way it responded to the recorded one
+	std::string key = AnchorKey(serialNumber, call);
+	size_t occurrence = m_calls[key]++;
+	std::map<std::string, std::vector<std::vector<SAnchoredRecord> > >::iterator anchors = m_anchors.find(key);
+	if (anchors == m_anchors.end() || occurrence >= anchors->second.size())
+		return;
+
+	std::vector<SAnchoredRecord>& responses = anchors->second[occurrence];
+	for (size_t i = 0; i < responses.size(); i++)
+		m_scheduled.insert(std::make_pair(nowUs + responses[i].delayUs, responses[i].index));
+	m_unscheduled -= responses.size();
+	responses.clear();
+}
+// *********************************************************************************************************
+
+#endif
+#endif
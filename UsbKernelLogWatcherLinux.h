@@ -0,0 +1,631 @@
+// UsbKernelLogWatcherLinux.h
+// Follows /dev/kmsg and turns the kernel's USB and xHCI complaints into typed events per camera
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBKERNELLOGWATCHERLINUX_H
+#define USBKERNELLOGWATCHERLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbControllerRecoveryLinux.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	enum EUsbKernelLogEventType
+	{
+		UsbKernel_CableFault = 0,       // "Cannot enable. Maybe the USB cable is bad?", "disabled by hub (EMI?)"
+		UsbKernel_DeviceReset,          // "reset SuperSpeed Gen 1 USB device number 5 using xhci_hcd"
+		UsbKernel_EnumerationError,     // "device descriptor read/64, error -71", "device not accepting address"
+		UsbKernel_BandwidthError,       // "Not enough bandwidth for new device state."
+		UsbKernel_OverCurrent,          // "over-current condition"
+		UsbKernel_Disconnect,           // "USB disconnect, device number 5"
+		UsbKernel_Connect,              // "new SuperSpeed USB device number 6 using xhci_hcd"
+		UsbKernel_TransferError,        // "WARN Event TRB for slot 3 ep 2 with no TDs queued?"
+		UsbKernel_HostNotResponding,    // "xHCI host not responding to stop endpoint command"
+		UsbKernel_HostDied,             // "xHCI host controller not responding, assume dead", "HC died; cleaning up"
+		UsbKernel_Count
+	};
+
+	struct SUsbKernelLogEvent
+	{
+		EUsbKernelLogEventType type;
+		uint64_t sequence;                        // kmsg sequence number
+		uint64_t timestampUs;                     // kernel monotonic time
+		std::string deviceName;                   // port path (eg: "2-1.3"), empty for controller events
+		std::string pciAddress;                   // controller events only (eg: "0000:00:14.0")
+		std::string speed;                        // Connect only, as the kernel says it (eg: "SuperSpeed", "high-speed")
+		std::vector<std::string> serialNumbers;   // the device's serial, or every device's on the controller
+		std::string message;
+	};
+
+	// Classifies kernel messages. The table is split by driver once, so a line that isn't from usb, hub
+	// or xhci_hcd is rejected after looking at its first word, and the rest need a few memcmp()s.
+	class CUsbKernelLogSignatureMatcher
+	{
+	public:
+		struct SMatch
+		{
+			EUsbKernelLogEventType type;
+			std::string driver;       // usb, hub, xhci_hcd
+			std::string deviceToken;  // as printed (eg: "2-1.3", "usb2-port3", "2-1:1.0", "0000:00:14.0")
+			std::string deviceName;   // resolved port path, or the pci address for xhci_hcd
+			std::string speed;
+		};
+
+	private:
+		struct SSignature
+		{
+			const char* driver;
+			const char* needle;
+			bool prefix;              // needle must start the text, otherwise anywhere in it
+			EUsbKernelLogEventType type;
+		};
+
+		std::map<std::string, std::vector<SSignature> > m_byDriver;
+
+		// "port 3" in a hub message
+		static int ParsePortNumber(const char* text, size_t length);
+
+	public:
+		CUsbKernelLogSignatureMatcher();
+
+		// text is the message part of the record, without the kmsg prefix
+		bool Match(const char* text, size_t length, SMatch& match) const;
+
+		// usb2-port3 -> 2-3, 2-1-port3 -> 2-1.3, 2-1:1.0 -> 2-1, for a hub message with port 3: 2-1:1.0 -> 2-1.3
+		static std::string ResolvePortPath(const std::string& driver, const std::string& deviceToken, int port);
+
+		static const char* EventTypeToString(EUsbKernelLogEventType type);
+
+		// True for the events worth starting a recovery for before anything times out. Not for resets: the kernel logs
+		// one for every reset this library issues, and recovering on those would reset the camera again and again.
+		static bool IsRecoveryTrigger(EUsbKernelLogEventType type);
+	};
+
+	// Non-blocking follower of /dev/kmsg. Each read() returns exactly one record; the watcher drains
+	// what is there in bounded batches so a burst can't hold the caller, and counts records the kernel
+	// overwrote before they were read (the gap in sequence numbers after an EPIPE) instead of stalling on them.
+	class CUsbKernelLogWatcher
+	{
+	public:
+		// Told about an event worth starting a recovery for
+		typedef std::function<void(const SUsbKernelLogEvent& event)> RecoveryTriggerHandler;
+
+	private:
+		IUsbDeviceBackend& m_backend;
+		std::string m_kmsgPath;
+		int m_fd;
+		CUsbKernelLogSignatureMatcher m_matcher;
+		std::map<std::string, std::string> m_serialNumbers;   // port path -> serial, kept past the disconnect
+		std::map<std::string, std::vector<std::string> > m_controllerSerialNumbers;   // pci address -> serials below it, kept past the disconnect
+		bool m_controllerSerialNumbersStale;                  // a device connected since they were read
+		RecoveryTriggerHandler m_onRecoveryTrigger;
+		uint64_t m_lastSequence;
+		uint64_t m_recordsRead;
+		uint64_t m_recordsLost;
+
+		// the serial of the device on a port, from the cache or the backend
+		std::string LookupSerialNumber(const std::string& deviceName);
+
+		// every serial below a controller, read once per hotplug
+		void LookupControllerSerialNumbers(const std::string& pciAddress, std::vector<std::string>& serialNumbers);
+
+	public:
+		CUsbKernelLogWatcher(IUsbDeviceBackend& backend, const std::string& kmsgPath = "/dev/kmsg");
+
+		~CUsbKernelLogWatcher();
+
+		// Opens the log. fromEnd skips what is already in the buffer.
+		bool Start(bool fromEnd, std::string& errorMessage);
+
+		void Stop();
+
+		// Becomes readable when records are waiting
+		int GetFileDescriptor() const;
+
+		// Waits up to timeoutMs, then handles up to maxRecords waiting records and appends the matching events
+		bool ReadEvents(int timeoutMs, std::vector<SUsbKernelLogEvent>& events, std::string& errorMessage, int maxRecords = 4096);
+
+		// Handles one record in /dev/kmsg format ("6,1234,5678901,-;usb 2-1.3: ..."). Public so tests can feed lines.
+		void ProcessRecord(const char* record, size_t length, std::vector<SUsbKernelLogEvent>& events);
+
+		// Handles one message with its own sequence number and timestamp (eg: from a dmesg dump)
+		void ProcessMessage(uint64_t sequence, uint64_t timestampUs, const char* message, size_t length, std::vector<SUsbKernelLogEvent>& events);
+
+		// Replays a recorded dump: raw /dev/kmsg records (cat /dev/kmsg) or dmesg output ("[   12.345678] usb 2-1: ...")
+		bool ReplayDump(const std::string& path, std::vector<SUsbKernelLogEvent>& events, std::string& errorMessage);
+
+		// Learns every current device's serial, so a later disconnect can still be attributed. Controller events read
+		// the devices below the controller again after this, or after a connect in the log.
+		void RefreshSerialNumbers();
+
+		// Called with every event that concerns a known camera and is worth starting a recovery for (see
+		// CUsbKernelLogSignatureMatcher::IsRecoveryTrigger()), on the thread handling the record and before the event
+		// is appended. Typically hands the cameras to a recovery thread. May be empty.
+		void SetRecoveryTriggerHandler(RecoveryTriggerHandler onRecoveryTrigger);
+
+		uint64_t GetRecordsRead() const { return m_recordsRead; }
+		uint64_t GetRecordsLost() const { return m_recordsLost; }
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbKernelLogSignatureMatcher::CUsbKernelLogSignatureMatcher()
+{
+	static const SSignature signatures[] =
+	{
+		{ "usb", "Cannot enable. Maybe the USB cable is bad?", false, UsbKernel_CableFault },
+		{ "usb", "disabled by hub (EMI?)", false, UsbKernel_CableFault },
+		{ "usb", "reset ", true, UsbKernel_DeviceReset },
+		{ "usb", "device descriptor read", true, UsbKernel_EnumerationError },
+		{ "usb", "device not accepting address", true, UsbKernel_EnumerationError },
+		{ "usb", "Device not responding to setup address", true, UsbKernel_EnumerationError },
+		{ "usb", "unable to enumerate USB device", true, UsbKernel_EnumerationError },
+		{ "usb", "can't set config", true, UsbKernel_EnumerationError },
+		{ "usb", "Not enough bandwidth", true, UsbKernel_BandwidthError },
+		{ "usb", "over-current condition", false, UsbKernel_OverCurrent },
+		{ "usb", "USB disconnect", true, UsbKernel_Disconnect },
+		{ "usb", "new ", true, UsbKernel_Connect },
+		{ "hub", "Maybe the USB cable is bad", false, UsbKernel_CableFault },
+		{ "hub", "disabled by hub (EMI?)", false, UsbKernel_CableFault },
+		{ "hub", "over-current", false, UsbKernel_OverCurrent },
+		{ "hub", "unable to enumerate USB device", false, UsbKernel_EnumerationError },
+		{ "xhci_hcd", "xHCI host not responding", true, UsbKernel_HostNotResponding },
+		{ "xhci_hcd", "Host halt failed", true, UsbKernel_HostNotResponding },
+		{ "xhci_hcd", "xHCI host controller not responding, assume dead", true, UsbKernel_HostDied },
+		{ "xhci_hcd", "HC died", true, UsbKernel_HostDied },
+		{ "xhci_hcd", "WARN Event TRB for slot", true, UsbKernel_TransferError },
+		{ "xhci_hcd", "ERROR Transfer event TRB DMA ptr not part of current TD", true, UsbKernel_TransferError },
+		{ "xhci_hcd", "ERROR unknown event type", true, UsbKernel_TransferError },
+	};
+
+	for (size_t i = 0; i < sizeof(signatures) / sizeof(signatures[0]); i++)
+		m_byDriver[signatures[i].driver].push_back(signatures[i]);
+
+	// the pci glue logs under its own name on newer kernels
+	m_byDriver["xhci-pci"] = m_byDriver["xhci_hcd"];
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbKernelLogSignatureMatcher::ParsePortNumber(const char* text, size_t length)
+{
+	for (size_t i = 0; i + 5 < length; i++)
+	{
+		if (memcmp(text + i, "port ", 5) == 0 && text[i + 5] >= '0' && text[i + 5] <= '9')
+			return atoi(text + i + 5);
+	}
+	return 0;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbKernelLogSignatureMatcher::ResolvePortPath(const std::string& driver, const std::string& deviceToken, int port)
+{
+	std::string token = deviceToken;
+
+	// usbN-portM (root hub port) and B-P-portM (external hub port) name the port, not the device on it
+	std::size_t portSuffix = token.find("-port");
+	if (portSuffix != std::string::npos)
+	{
+		std::string hub = token.substr(0, portSuffix);
+		std::string portNumber = token.substr(portSuffix + 5);
+		if (hub.compare(0, 3, "usb") == 0)
+			return hub.substr(3) + "-" + portNumber;
+		return hub + "." + portNumber;
+	}
+
+	// interfaces (2-1:1.0) belong to their device
+	std::size_t colon = token.find(':');
+	if (colon != std::string::npos)
+		token = token.substr(0, colon);
+
+	if (driver == "hub" && port > 0)
+	{
+		// the hub driver binds the hub interface and names the port in the text. Root hub interfaces are B-0:1.0.
+		if (token.size() > 2 && token.compare(token.size() - 2, 2, "-0") == 0)
+			return token.substr(0, token.size() - 2) + "-" + std::to_string(port);
+		return token + "." + std::to_string(port);
+	}
+
+	return token;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbKernelLogSignatureMatcher::Match(const char* text, size_t length, SMatch& match) const
+{
+	// dev_printk format: "<driver> <device>: <message>"
+	const char* space = (const char*)memchr(text, ' ', length);
+	if (space == NULL)
+		return false;
+
+	std::map<std::string, std::vector<SSignature> >::const_iterator driver = m_byDriver.find(std::string(text, space - text));
+	if (driver == m_byDriver.end())
+		return false;
+
+	const char* device = space + 1;
+	const char* end = text + length;
+	const char* separator = device;
+	while (separator + 1 < end && (separator[0] != ':' || separator[1] != ' '))
+		separator++;
+	if (separator + 1 >= end)
+		return false;
+
+	const char* body = separator + 2;
+	size_t bodyLength = end - body;
+
+	const std::vector<SSignature>& signatures = driver->second;
+	for (size_t i = 0; i < signatures.size(); i++)
+	{
+		const SSignature& signature = signatures[i];
+		size_t needleLength = strlen(signature.needle);
+		bool found = false;
+		if (signature.prefix)
+			found = bodyLength >= needleLength && memcmp(body, signature.needle, needleLength) == 0;
+		else
+		{
+			for (size_t at = 0; at + needleLength <= bodyLength && found == false; at++)
+				found = (body[at] == signature.needle[0] && memcmp(body + at, signature.needle, needleLength) == 0);
+		}
+		if (found == false)
+			continue;
+
+		// "new " only counts as a connect if it's "new <speed> USB device number"
+		if (signature.type == UsbKernel_Connect)
+		{
+			const char* usbDevice = NULL;
+			for (const char* at = body + 4; at + 11 <= end; at++)
+			{
+				if (memcmp(at, " USB device", 11) == 0)
+				{
+					usbDevice = at;
+					break;
+				}
+			}
+			if (usbDevice == NULL)
+				continue;
+			match.speed.assign(body + 4, usbDevice - (body + 4));
+		}
+		else
+			match.speed = "";
+
+		match.type = signature.type;
+		match.driver = driver->first;
+		match.deviceToken.assign(device, separator - device);
+		if (match.driver == "usb" || match.driver == "hub")
+			match.deviceName = ResolvePortPath(match.driver, match.deviceToken, (match.driver == "hub") ? ParsePortNumber(body, bodyLength) : 0);
+		else
+			match.deviceName = match.deviceToken;
+		return true;
+	}
+	return false;
+}
+
+inline const char* UsbCameraDeviceManagerLinux::CUsbKernelLogSignatureMatcher::EventTypeToString(EUsbKernelLogEventType type)
+{
+	switch (type)
+	{
+	case UsbKernel_CableFault: return "CableFault";
+	case UsbKernel_DeviceReset: return "DeviceReset";
+	case UsbKernel_EnumerationError: return "EnumerationError";
+	case UsbKernel_BandwidthError: return "BandwidthError";
+	case UsbKernel_OverCurrent: return "OverCurrent";
+	case UsbKernel_Disconnect: return "Disconnect";
+	case UsbKernel_Connect: return "Connect";
+	case UsbKernel_TransferError: return "TransferError";
+	case UsbKernel_HostNotResponding: return "HostNotResponding";
+	case UsbKernel_HostDied: return "HostDied";
+	default: return "Unknown";
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbKernelLogSignatureMatcher::IsRecoveryTrigger(EUsbKernelLogEventType type)
+{
+	// connects, disconnects and resets are the normal course of a recovery, the rest means something is going wrong
+	return type != UsbKernel_Connect && type != UsbKernel_Disconnect && type != UsbKernel_DeviceReset;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::CUsbKernelLogWatcher(IUsbDeviceBackend& backend, const std::string& kmsgPath)
+	: m_backend(backend)
+{
+	m_kmsgPath = kmsgPath;
+	m_fd = -1;
+	m_controllerSerialNumbersStale = true;
+	m_lastSequence = 0;
+	m_recordsRead = 0;
+	m_recordsLost = 0;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::~CUsbKernelLogWatcher()
+{
+	Stop();
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::Start(bool fromEnd, std::string& errorMessage)
+{
+	Stop();
+
+	m_fd = open(m_kmsgPath.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (m_fd < 0)
+	{
+		errorMessage = "Error: CUsbKernelLogWatcher::Start(): Unable to open ";
+		errorMessage.append(m_kmsgPath);
+		errorMessage.append(": ");
+		errorMessage.append(strerror(errno));
+		return false;
+	}
+
+	if (fromEnd)
+		lseek(m_fd, 0, SEEK_END);
+
+	m_lastSequence = 0;
+	RefreshSerialNumbers();
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::Stop()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::GetFileDescriptor() const
+{
+	return m_fd;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::SetRecoveryTriggerHandler(RecoveryTriggerHandler onRecoveryTrigger)
+{
+	m_onRecoveryTrigger = onRecoveryTrigger;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::RefreshSerialNumbers()
+{
+	m_controllerSerialNumbersStale = true;
+
+	std::vector<std::string> deviceNames;
+	m_backend.ListDevices(deviceNames);
+	for (size_t i = 0; i < deviceNames.size(); i++)
+	{
+		std::string serialNumber;
+		if (m_backend.ReadAttribute(deviceNames[i], "serial", serialNumber))
+			m_serialNumbers[deviceNames[i]] = serialNumber;
+	}
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::LookupSerialNumber(const std::string& deviceName)
+{
+	std::map<std::string, std::string>::iterator it = m_serialNumbers.find(deviceName);
+	if (it != m_serialNumbers.end())
+		return it->second;
+
+	std::string serialNumber;
+	if (m_backend.ReadAttribute(deviceName, "serial", serialNumber))
+		m_serialNumbers[deviceName] = serialNumber;
+	return serialNumber;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::LookupControllerSerialNumbers(const std::string& pciAddress, std::vector<std::string>& serialNumbers)
+{
+	// a dying controller logs line after line, they all concern the same devices
+	if (m_controllerSerialNumbersStale)
+	{
+		std::vector<std::string> deviceNames;
+		m_backend.ListDevices(deviceNames);
+		std::map<std::string, std::vector<std::string> > controllerSerialNumbers;
+		for (size_t i = 0; i < deviceNames.size(); i++)
+		{
+			std::string devicePath;
+			std::string controller;
+			std::string rootHub;
+			if (m_backend.ResolveDevicePath(deviceNames[i], devicePath) == false
+				|| CUsbControllerRecovery::ParseControllerAddress(devicePath, controller, rootHub) == false)
+				continue;
+			std::string serialNumber = LookupSerialNumber(deviceNames[i]);
+			if (serialNumber != "")
+				controllerSerialNumbers[controller].push_back(serialNumber);
+		}
+
+		// a controller that lost its devices keeps the last ones seen on it
+		for (std::map<std::string, std::vector<std::string> >::iterator it = controllerSerialNumbers.begin(); it != controllerSerialNumbers.end(); ++it)
+			m_controllerSerialNumbers[it->first].swap(it->second);
+		m_controllerSerialNumbersStale = false;
+	}
+
+	std::map<std::string, std::vector<std::string> >::iterator it = m_controllerSerialNumbers.find(pciAddress);
+	if (it != m_controllerSerialNumbers.end())
+		serialNumbers.insert(serialNumbers.end(), it->second.begin(), it->second.end());
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::ProcessMessage(uint64_t sequence, uint64_t timestampUs, const char* message, size_t length, std::vector<SUsbKernelLogEvent>& events)
+{
+	m_recordsRead++;
+	if (m_lastSequence != 0 && sequence > m_lastSequence + 1)
+		m_recordsLost += sequence - m_lastSequence - 1;
+	m_lastSequence = sequence;
+
+	CUsbKernelLogSignatureMatcher::SMatch match;
+	if (m_matcher.Match(message, length, match) == false)
+		return;
+
+	SUsbKernelLogEvent event;
+	event.type = match.type;
+	event.sequence = sequence;
+	event.timestampUs = timestampUs;
+	event.speed = match.speed;
+	event.message.assign(message, length);
+
+	if (match.driver == "usb" || match.driver == "hub")
+	{
+		event.deviceName = match.deviceName;
+
+		// a port can get a different device after a disconnect, so forget it then and look again on connect
+		if (event.type == UsbKernel_Connect)
+		{
+			m_serialNumbers.erase(event.deviceName);
+			m_controllerSerialNumbersStale = true;
+		}
+
+		std::string serialNumber = LookupSerialNumber(event.deviceName);
+		if (serialNumber != "")
+			event.serialNumbers.push_back(serialNumber);
+
+		if (event.type == UsbKernel_Disconnect)
+			m_serialNumbers.erase(event.deviceName);
+	}
+	else
+	{
+		event.pciAddress = match.deviceName;
+		LookupControllerSerialNumbers(event.pciAddress, event.serialNumbers);
+	}
+
+	if (m_onRecoveryTrigger && event.serialNumbers.empty() == false && CUsbKernelLogSignatureMatcher::IsRecoveryTrigger(event.type))
+		m_onRecoveryTrigger(event);
+
+	events.push_back(event);
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::ProcessRecord(const char* record, size_t length, std::vector<SUsbKernelLogEvent>& events)
+{
+	// "<prio>,<seq>,<timestamp us>,<flags>[,...];<message>\n[ KEY=value\n...]"
+	const char* semicolon = (const char*)memchr(record, ';', length);
+	if (semicolon == NULL)
+		return;
+
+	char* next = NULL;
+	strtoul(record, &next, 10);
+	if (next == NULL || *next != ',')
+		return;
+	uint64_t sequence = strtoull(next + 1, &next, 10);
+	if (next == NULL || *next != ',')
+		return;
+	uint64_t timestampUs = strtoull(next + 1, &next, 10);
+
+	const char* message = semicolon + 1;
+	const char* end = record + length;
+	const char* newline = (const char*)memchr(message, '\n', end - message);
+	if (newline != NULL)
+		end = newline;
+
+	ProcessMessage(sequence, timestampUs, message, end - message, events);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::ReadEvents(int timeoutMs, std::vector<SUsbKernelLogEvent>& events, std::string& errorMessage, int maxRecords)
+{
+	if (m_fd < 0)
+	{
+		errorMessage = "Error: CUsbKernelLogWatcher::ReadEvents(): Not started.";
+		return false;
+	}
+
+	if (timeoutMs != 0)
+	{
+		struct pollfd descriptor;
+		descriptor.fd = m_fd;
+		descriptor.events = POLLIN;
+		descriptor.revents = 0;
+		if (poll(&descriptor, 1, timeoutMs) < 0 && errno != EINTR)
+		{
+			errorMessage = "Error: CUsbKernelLogWatcher::ReadEvents(): poll() failed: ";
+			errorMessage.append(strerror(errno));
+			return false;
+		}
+	}
+
+	// a record is at most about 8k (CONSOLE_EXT_LOG_MAX)
+	char buffer[8192];
+	for (int i = 0; i < maxRecords; i++)
+	{
+		ssize_t num_bytes = read(m_fd, buffer, sizeof(buffer));
+		if (num_bytes < 0)
+		{
+			if (errno == EAGAIN || errno == EINTR)
+				return true;
+			if (errno == EPIPE)
+			{
+				// we fell behind and the kernel overwrote records. The next read continues with the oldest one left,
+				// and the gap in sequence numbers to it counts what was lost.
+				continue;
+			}
+			errorMessage = "Error: CUsbKernelLogWatcher::ReadEvents(): read() failed: ";
+			errorMessage.append(strerror(errno));
+			return false;
+		}
+		if (num_bytes == 0)
+			return true;
+
+		ProcessRecord(buffer, (size_t)num_bytes, events);
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbKernelLogWatcher::ReplayDump(const std::string& path, std::vector<SUsbKernelLogEvent>& events, std::string& errorMessage)
+{
+	FILE* file = fopen(path.c_str(), "r");
+	if (file == NULL)
+	{
+		errorMessage = "Error: CUsbKernelLogWatcher::ReplayDump(): Unable to open ";
+		errorMessage.append(path);
+		return false;
+	}
+
+	uint64_t syntheticSequence = 0;
+	char line[8192];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		size_t length = strlen(line);
+		while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+			length--;
+		line[length] = '\0';
+
+		if (line[0] == '[')
+		{
+			// dmesg: "[   12.345678] message"
+			char* close = strchr(line, ']');
+			if (close == NULL)
+				continue;
+			double seconds = atof(line + 1);
+			const char* message = close + 1;
+			while (*message == ' ')
+				message++;
+			ProcessMessage(++syntheticSequence, (uint64_t)(seconds * 1000000.0), message, strlen(message), events);
+		}
+		else if (line[0] >= '0' && line[0] <= '9')
+		{
+			// /dev/kmsg. Continuation lines (" SUBSYSTEM=usb") start with a space and are skipped.
+			ProcessRecord(line, length, events);
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
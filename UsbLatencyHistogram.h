@@ -0,0 +1,173 @@
+// UsbLatencyHistogram.h
+// Lock-free log2 latency histogram for timing resets and recoveries
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBLATENCYHISTOGRAM_H
+#define USBLATENCYHISTOGRAM_H
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+namespace UsbCameraDeviceManager
+{
+	// Bucket i counts samples in [2^(i-1), 2^i) microseconds; bucket 0 counts samples below 1 us.
+	// Recording is a handful of relaxed atomic adds, so it can sit on the reset path.
+	class CUsbLatencyHistogram
+	{
+	public:
+		static const int NumBuckets = 40;
+
+	private:
+		std::atomic<uint64_t> m_buckets[NumBuckets];
+		std::atomic<uint64_t> m_count;
+		std::atomic<uint64_t> m_sumMicroseconds;
+		std::atomic<uint64_t> m_maxMicroseconds;
+
+		CUsbLatencyHistogram(const CUsbLatencyHistogram&);
+		CUsbLatencyHistogram& operator=(const CUsbLatencyHistogram&);
+
+	public:
+		CUsbLatencyHistogram();
+
+		// Adds one sample
+		void Record(uint64_t microseconds);
+
+		// Clears all samples
+		void Reset();
+
+		// Number of samples recorded
+		uint64_t GetCount() const;
+
+		// Mean of all samples in microseconds (0 if empty)
+		uint64_t GetMeanMicroseconds() const;
+
+		// Largest sample in microseconds
+		uint64_t GetMaxMicroseconds() const;
+
+		// Upper bound of the bucket holding the given percentile (0.0 - 1.0)
+		uint64_t GetPercentileMicroseconds(double percentile) const;
+
+		// Samples in one bucket
+		uint64_t GetBucketCount(int bucket) const;
+
+		// For reference, a one line summary (count, mean, p50, p99, max)
+		std::string ToString() const;
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CUsbLatencyHistogram::CUsbLatencyHistogram()
+{
+	Reset();
+}
+
+inline void UsbCameraDeviceManager::CUsbLatencyHistogram::Record(uint64_t microseconds)
+{
+	int bucket = 0;
+	uint64_t value = microseconds;
+	while (value != 0 && bucket < NumBuckets - 1)
+	{
+		value >>= 1;
+		bucket++;
+	}
+
+	m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+	m_sumMicroseconds.fetch_add(microseconds, std::memory_order_relaxed);
+
+	uint64_t max = m_maxMicroseconds.load(std::memory_order_relaxed);
+	while (microseconds > max && m_maxMicroseconds.compare_exchange_weak(max, microseconds, std::memory_order_relaxed) == false)
+	{
+		// max was reloaded, try again
+	}
+}
+
+inline void UsbCameraDeviceManager::CUsbLatencyHistogram::Reset()
+{
+	for (int i = 0; i < NumBuckets; i++)
+		m_buckets[i].store(0, std::memory_order_relaxed);
+	m_count.store(0, std::memory_order_relaxed);
+	m_sumMicroseconds.store(0, std::memory_order_relaxed);
+	m_maxMicroseconds.store(0, std::memory_order_relaxed);
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbLatencyHistogram::GetCount() const
+{
+	return m_count.load(std::memory_order_relaxed);
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbLatencyHistogram::GetMeanMicroseconds() const
+{
+	uint64_t count = GetCount();
+	if (count == 0)
+		return 0;
+	return m_sumMicroseconds.load(std::memory_order_relaxed) / count;
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbLatencyHistogram::GetMaxMicroseconds() const
+{
+	return m_maxMicroseconds.load(std::memory_order_relaxed);
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbLatencyHistogram::GetPercentileMicroseconds(double percentile) const
+{
+	uint64_t count = GetCount();
+	if (count == 0)
+		return 0;
+
+	uint64_t target = (uint64_t)(percentile * count);
+	if (target >= count)
+		target = count - 1;
+
+	uint64_t seen = 0;
+	for (int i = 0; i < NumBuckets; i++)
+	{
+		seen += m_buckets[i].load(std::memory_order_relaxed);
+		if (seen > target)
+			return (i == 0) ? 1 : ((uint64_t)1 << i);
+	}
+	return GetMaxMicroseconds();
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbLatencyHistogram::GetBucketCount(int bucket) const
+{
+	if (bucket < 0 || bucket >= NumBuckets)
+		return 0;
+	return m_buckets[bucket].load(std::memory_order_relaxed);
+}
+
+inline std::string UsbCameraDeviceManager::CUsbLatencyHistogram::ToString() const
+{
+	std::string summary = "count=";
+	summary.append(std::to_string(GetCount()));
+	summary.append(" mean=");
+	summary.append(std::to_string(GetMeanMicroseconds()));
+	summary.append("us p50<=");
+	summary.append(std::to_string(GetPercentileMicroseconds(0.50)));
+	summary.append("us p99<=");
+	summary.append(std::to_string(GetPercentileMicroseconds(0.99)));
+	summary.append("us max=");
+	summary.append(std::to_string(GetMaxMicroseconds()));
+	summary.append("us");
+	return summary;
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,252 @@
+// UsbMappedFile.h
+// A fixed size file mapped into memory, on Windows (file mapping) and Linux (mmap)
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBMAPPEDFILE_H
+#define USBMAPPEDFILE_H
+
+#include <string>
+#include <cstring>
+#ifdef LINUX_BUILD
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#else
+#include <windows.h>
+#endif
+
+namespace UsbCameraDeviceManager
+{
+	// Maps a file of a given size read/write, creating it (zero filled) if it doesn't exist.
+	// Several processes mapping the same file see each other's writes.
+	class CUsbMappedFile
+	{
+	private:
+		void* m_data;
+		size_t m_size;
+		bool m_created;
+#ifdef LINUX_BUILD
+		int m_fd;
+#else
+		HANDLE m_file;
+		HANDLE m_mapping;
+#endif
+
+		CUsbMappedFile(const CUsbMappedFile&);
+		CUsbMappedFile& operator=(const CUsbMappedFile&);
+
+	public:
+		CUsbMappedFile();
+
+		~CUsbMappedFile();
+
+		// Maps the file. created tells whether the file was new (and therefore all zeros).
+		bool Open(const std::string& path, size_t size, std::string& errorMessage);
+
+		// Unmaps the file
+		void Close();
+
+		// Pushes dirty pages to disk (the OS does this eventually anyway)
+		bool Flush();
+
+		// Waits for an exclusive lock on the file, for writers in several processes (or several objects mapping the same
+		// file). Advisory: only keeps out whoever takes it too. It goes away with the process that held it.
+		bool LockExclusive();
+
+		void Unlock();
+
+		bool IsOpen() const { return m_data != NULL; }
+		bool WasCreated() const { return m_created; }
+		void* GetData() const { return m_data; }
+		size_t GetSize() const { return m_size; }
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CUsbMappedFile::CUsbMappedFile()
+{
+	m_data = NULL;
+	m_size = 0;
+	m_created = false;
+#ifdef LINUX_BUILD
+	m_fd = -1;
+#else
+	m_file = INVALID_HANDLE_VALUE;
+	m_mapping = NULL;
+#endif
+}
+
+inline UsbCameraDeviceManager::CUsbMappedFile::~CUsbMappedFile()
+{
+	Close();
+}
+
+inline bool UsbCameraDeviceManager::CUsbMappedFile::Open(const std::string& path, size_t size, std::string& errorMessage)
+{
+	Close();
+
+#ifdef LINUX_BUILD
+	m_fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if (m_fd < 0)
+	{
+		errorMessage = "Error: CUsbMappedFile::Open(): Unable to open ";
+		errorMessage.append(path);
+		errorMessage.append(": ");
+		errorMessage.append(strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(m_fd, &st) != 0)
+	{
+		errorMessage = "Error: CUsbMappedFile::Open(): fstat() failed.";
+		Close();
+		return false;
+	}
+
+	m_created = (st.st_size == 0);
+	if ((size_t)st.st_size < size && ftruncate(m_fd, size) != 0)
+	{
+		errorMessage = "Error: CUsbMappedFile::Open(): Unable to size ";
+		errorMessage.append(path);
+		Close();
+		return false;
+	}
+
+	void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (data == MAP_FAILED)
+	{
+		errorMessage = "Error: CUsbMappedFile::Open(): mmap() failed: ";
+		errorMessage.append(strerror(errno));
+		Close();
+		return false;
+	}
+#else
+	m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		errorMessage = "Error: CUsbMappedFile::Open(): Unable to open ";
+		errorMessage.append(path);
+		errorMessage.append(": ");
+		errorMessage.append(std::to_string(GetLastError()));
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(m_file, &fileSize);
+	m_created = (fileSize.QuadPart == 0);
+
+	// mapping a file larger than it is grows it (zero filled)
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+	if (m_mapping == NULL)
+	{
+		errorMessage = "Error: CUsbMappedFile::Open(): CreateFileMapping(): ";
+		errorMessage.append(std::to_string(GetLastError()));
+		Close();
+		return false;
+	}
+
+	void* data = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (data == NULL)
+	{
+		errorMessage = "Error: CUsbMappedFile::Open(): MapViewOfFile(): ";
+		errorMessage.append(std::to_string(GetLastError()));
+		Close();
+		return false;
+	}
+#endif
+
+	m_data = data;
+	m_size = size;
+	return true;
+}
+
+inline void UsbCameraDeviceManager::CUsbMappedFile::Close()
+{
+#ifdef LINUX_BUILD
+	if (m_data != NULL)
+		munmap(m_data, m_size);
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+#else
+	if (m_data != NULL)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != NULL)
+		CloseHandle(m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle(m_file);
+	m_mapping = NULL;
+	m_file = INVALID_HANDLE_VALUE;
+#endif
+	m_data = NULL;
+	m_size = 0;
+}
+
+inline bool UsbCameraDeviceManager::CUsbMappedFile::Flush()
+{
+	if (m_data == NULL)
+		return false;
+#ifdef LINUX_BUILD
+	return msync(m_data, m_size, MS_ASYNC) == 0;
+#else
+	return FlushViewOfFile(m_data, 0) != 0;
+#endif
+}
+
+inline bool UsbCameraDeviceManager::CUsbMappedFile::LockExclusive()
+{
+#ifdef LINUX_BUILD
+	if (m_fd < 0)
+		return false;
+	while (flock(m_fd, LOCK_EX) != 0)
+	{
+		if (errno != EINTR)
+			return false;
+	}
+	return true;
+#else
+	if (m_file == INVALID_HANDLE_VALUE)
+		return false;
+	// the first byte stands for the whole file. Byte range locks don't apply to mapped views, so it's only a token.
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	return LockFileEx(m_file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped) != 0;
+#endif
+}
+
+inline void UsbCameraDeviceManager::CUsbMappedFile::Unlock()
+{
+#ifdef LINUX_BUILD
+	if (m_fd >= 0)
+		flock(m_fd, LOCK_UN);
+#else
+	if (m_file == INVALID_HANDLE_VALUE)
+		return;
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	UnlockFileEx(m_file, 0, 1, 0, &overlapped);
+#endif
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,177 @@
+// UsbModeSwitchResetLinux.h
+// Resets a camera's usb port with usb_modeswitch, found by serial number through a device backend
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBMODESWITCHRESETLINUX_H
+#define USBMODESWITCHRESETLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbCameraStatusBoard.h"
+#include "UsbCameraResult.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// Runs usb_modeswitch
+	class IUsbModeSwitchTool
+	{
+	public:
+		virtual ~IUsbModeSwitchTool() {}
+
+		// Resets the device at busnum/devnum, which has to be vendorId:productId (hex, as in sysfs: "2676", "ba02")
+		virtual bool ResetDevice(const std::string& vendorId, const std::string& productId, int busnum, int devnum, std::string& errorMessage) = 0;
+	};
+
+	// The real thing. Requires root.
+	class CUsbModeSwitchTool : public IUsbModeSwitchTool
+	{
+	public:
+		// eg: sudo usb_modeswitch -v 0x2676 -p 0xba02 -b 003 -g 039 -R
+		static std::string BuildCommand(const std::string& vendorId, const std::string& productId, int busnum, int devnum);
+
+		virtual bool ResetDevice(const std::string& vendorId, const std::string& productId, int busnum, int devnum, std::string& errorMessage);
+	};
+
+	// Finds the camera by serial number and has usb_modeswitch reset its port. This replaces scraping 'lsusb -v'
+	// for the bus and device numbers.
+	class CUsbModeSwitchReset
+	{
+	private:
+		IUsbDeviceBackend& m_backend;
+		IUsbModeSwitchTool& m_tool;
+		UsbCameraDeviceManager::IUsbApiCallObserver* m_apiCallObserver;
+
+		// ResetCamera() without reporting it to the observer
+		bool ResetThroughModeSwitch(const std::string& serialNumber, std::string& errorMessage, UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard);
+
+	public:
+		CUsbModeSwitchReset(IUsbDeviceBackend& backend, IUsbModeSwitchTool& tool);
+
+		// Told about every ResetCamera() (may be NULL). Must outlive this object.
+		void SetApiCallObserver(UsbCameraDeviceManager::IUsbApiCallObserver* apiCallObserver);
+
+		// Resets the camera's port. The camera is claimed on statusBoard (may be NULL) while the tool runs.
+		bool ResetCamera(const std::string& serialNumber, std::string& errorMessage, UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard = NULL);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbModeSwitchTool::BuildCommand(const std::string& vendorId, const std::string& productId, int busnum, int devnum)
+{
+	// usb_modeswitch expects the same zero padded numbers lsusb prints
+	char bus[8];
+	char device[8];
+	snprintf(bus, sizeof(bus), "%03d", busnum);
+	snprintf(device, sizeof(device), "%03d", devnum);
+
+	std::string strCommand = "";
+	strCommand.append("sudo usb_modeswitch");
+	strCommand.append(" -v 0x");
+	strCommand.append(vendorId);
+	strCommand.append(" -p 0x");
+	strCommand.append(productId);
+	strCommand.append(" -b ");
+	strCommand.append(bus);
+	strCommand.append(" -g ");
+	strCommand.append(device);
+	strCommand.append(" -R");
+	return strCommand;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbModeSwitchTool::ResetDevice(const std::string& vendorId, const std::string& productId, int busnum, int devnum, std::string& errorMessage)
+{
+	// issue the command to reset the usb port
+	std::string strCommand = BuildCommand(vendorId, productId, busnum, devnum);
+	int status = system(strCommand.c_str());
+	if (status != 0)
+	{
+		errorMessage = "Error: UsbModeSwitchReset(): '";
+		errorMessage.append(strCommand);
+		errorMessage.append("' failed with status ");
+		errorMessage.append(std::to_string(status));
+		return false;
+	}
+	return true;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbModeSwitchReset::CUsbModeSwitchReset(IUsbDeviceBackend& backend, IUsbModeSwitchTool& tool)
+	: m_backend(backend), m_tool(tool), m_apiCallObserver(NULL)
+{
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbModeSwitchReset::SetApiCallObserver(UsbCameraDeviceManager::IUsbApiCallObserver* apiCallObserver)
+{
+	m_apiCallObserver = apiCallObserver;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbModeSwitchReset::ResetCamera(const std::string& serialNumber, std::string& errorMessage, UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool succeeded = ResetThroughModeSwitch(serialNumber, errorMessage, statusBoard);
+	if (m_apiCallObserver != NULL)
+	{
+		unsigned int durationMs = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		m_apiCallObserver->OnApiCall("UsbModeSwitchReset", serialNumber, succeeded, durationMs, succeeded ? std::string() : errorMessage);
+	}
+	return succeeded;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbModeSwitchReset::ResetThroughModeSwitch(const std::string& serialNumber, std::string& errorMessage, UsbCameraDeviceManager::CUsbCameraStatusBoard* statusBoard)
+{
+	std::string deviceName;
+	if (FindUsbDeviceBySerial(m_backend, serialNumber, deviceName) == false)
+	{
+		errorMessage.append("Error: UsbModeSwitchReset(): No usb device with serial number ");
+		errorMessage.append(serialNumber);
+		errorMessage.append(" found.");
+		return false;
+	}
+
+	std::string vendor;
+	std::string product;
+	std::string busnum;
+	std::string devnum;
+	if (m_backend.ReadAttribute(deviceName, "idVendor", vendor) == false
+		|| m_backend.ReadAttribute(deviceName, "idProduct", product) == false
+		|| m_backend.ReadAttribute(deviceName, "busnum", busnum) == false
+		|| m_backend.ReadAttribute(deviceName, "devnum", devnum) == false)
+	{
+		errorMessage.append("Error: UsbModeSwitchReset(): Unable to read device attributes of ");
+		errorMessage.append(deviceName);
+		return false;
+	}
+
+	// another process may be recovering this camera
+	UsbCameraDeviceManager::CUsbRecoveryClaim claim(statusBoard, serialNumber);
+	if (claim.Claim(errorMessage) == false)
+		return false;
+
+	bool reset = m_tool.ResetDevice(vendor, product, atoi(busnum.c_str()), atoi(devnum.c_str()), errorMessage);
+	claim.SetRecovered(reset);
+	return reset;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
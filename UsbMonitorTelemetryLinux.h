@@ -0,0 +1,1062 @@
+// UsbMonitorTelemetryLinux.h
+// Per-camera transfer telemetry from usbmon: throughput, URB errors, completion latency and stall detection
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBMONITORTELEMETRYLINUX_H
+#define USBMONITORTELEMETRYLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbChangeDetectorLinux.h"
+#include "UsbLatencyHistogram.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// One usbmon event, decoded from the binary interface or a capture file
+	struct SUsbMonEvent
+	{
+		uint64_t urbId;          // pairs a submission with its completion
+		char type;               // 'S' submission, 'C' completion, 'E' submission error
+		uint8_t transferType;    // 0 iso, 1 interrupt, 2 control, 3 bulk
+		uint8_t endpoint;        // 0x80 set for IN
+		uint8_t devnum;
+		uint16_t busnum;
+		int64_t timestampUs;
+		int32_t status;          // 0 or -errno
+		uint32_t length;         // bytes submitted (S) or transferred (C)
+		int32_t isoErrorCount;   // iso completions only
+	};
+
+	// What a watched device has done so far
+	struct SUsbMonDeviceStats
+	{
+		std::string label;               // usually the camera serial number
+		int busnum;                      // 0 while a camera watched by serial number is away
+		int devnum;
+		uint64_t submitted;
+		uint64_t completed;
+		uint64_t bytes;                  // transferred by successful completions
+		uint64_t errors;                 // all failed completions and submissions, excluding cancellations
+		uint64_t stalls;                 // -EPIPE, an endpoint halted (recoverable with CLEAR_FEATURE(ENDPOINT_HALT))
+		uint64_t babble;                 // -EOVERFLOW, the device sent more than asked for
+		uint64_t protocolErrors;         // -EPROTO, -EILSEQ, -ETIME: bit stuffing, CRC, no response
+		uint64_t cancelled;              // -ENOENT, -ECONNRESET: unlinked by the driver, normal when streaming stops
+		uint64_t shutdowns;              // -ESHUTDOWN: the device is gone (unplugged, disabled or its controller died)
+		uint64_t discarded;              // outstanding urbs forgotten because usbmon dropped events, their completion may be lost
+		uint64_t outstanding;            // submitted and not yet completed
+		double bytesPerSecond;           // over the last few whole seconds
+		double baselineBytesPerSecond;   // moving average of whole seconds while streaming
+		uint64_t latencyP50Us;
+		uint64_t latencyP99Us;
+		uint64_t latencyMaxUs;
+
+		SUsbMonDeviceStats() : busnum(0), devnum(0), submitted(0), completed(0), bytes(0), errors(0), stalls(0), babble(0), protocolErrors(0), cancelled(0),
+			shutdowns(0), discarded(0), outstanding(0), bytesPerSecond(0.0), baselineBytesPerSecond(0.0), latencyP50Us(0), latencyP99Us(0), latencyMaxUs(0) {}
+	};
+
+	enum EUsbTelemetryWarningType
+	{
+		UsbTelemetry_EndpointStall = 0,  // an endpoint returned -EPIPE. Clearing the halt usually recovers it.
+		UsbTelemetry_TransferStall,      // URBs are outstanding but nothing has completed for a while, on a device that should be streaming
+		UsbTelemetry_ErrorRate,          // too many completions fail
+		UsbTelemetry_ThroughputCollapse, // still submitting, but far less data arrives than usual
+		UsbTelemetry_DeviceLost          // URBs ended with -ESHUTDOWN, the device is gone
+	};
+
+	// Whether a device should be delivering data. A triggered or idle camera keeps URBs queued without completing
+	// them, which is only a stall if data is expected.
+	enum EUsbTrafficExpectation
+	{
+		UsbTraffic_Auto = 0,             // expected while it has been streaming steadily (data in each of the last seconds)
+		UsbTraffic_Expected,             // eg: a free-running camera the application is grabbing from
+		UsbTraffic_Idle                  // eg: waiting for a hardware trigger, never a stall
+	};
+
+	struct SUsbTelemetryWarning
+	{
+		EUsbTelemetryWarningType type;
+		std::string label;
+		int busnum;
+		int devnum;
+		uint8_t endpoint;                // EndpointStall only
+		std::string detail;
+	};
+
+	struct SUsbTelemetryThresholds
+	{
+		unsigned int transferStallMs;          // oldest outstanding URB age that counts as a stall
+		double errorRateLimit;                 // failed / completed since the last Evaluate()
+		double collapseRatio;                  // bytes/s below this fraction of the baseline is a collapse
+		double minimumBaselineBytesPerSecond;  // don't call a collapse on a device that was barely streaming
+
+		SUsbTelemetryThresholds() : transferStallMs(500), errorRateLimit(0.01), collapseRatio(0.25), minimumBaselineBytesPerSecond(1000000.0) {}
+	};
+
+	// Aggregates usbmon events of the watched devices. Events of other devices are dropped after one map lookup.
+	// Timestamps are whatever the events carry (wall clock for live capture), so Evaluate() takes "now" on the same base.
+	// usbmon only knows bus and device numbers, and a device gets a new one each time it enumerates: feed the change
+	// detector's events to ApplyChangeEvents() so a camera's numbers follow it and a reused number isn't taken for it.
+	class CUsbMonTelemetry
+	{
+	private:
+		static const int ThroughputSeconds = 16;
+
+		struct SDeviceState
+		{
+			SUsbMonDeviceStats stats;
+			UsbCameraDeviceManager::CUsbLatencyHistogram latency;
+			std::map<uint64_t, int64_t> pending;         // urb id -> submission time
+			std::map<uint8_t, uint64_t> newStalls;       // endpoint -> -EPIPE count since the last Evaluate()
+			uint64_t newShutdowns;                       // -ESHUTDOWN count since the last Evaluate()
+			EUsbTrafficExpectation expectation;
+			int64_t secondStamps[ThroughputSeconds];     // which second each throughput bucket holds
+			uint64_t secondBytes[ThroughputSeconds];
+			uint64_t completedAtLastEvaluate;
+			uint64_t errorsAtLastEvaluate;
+			int64_t lastCompletionUs;
+			int64_t lastSubmissionUs;
+			std::string serialNumber;                    // WatchCamera() only: the camera is found again by it when it re-enumerates
+		};
+
+		std::mutex m_lock;
+		SUsbTelemetryThresholds m_thresholds;
+		std::vector<std::shared_ptr<SDeviceState> > m_watched;          // every watched device, connected or not
+		std::map<uint32_t, std::shared_ptr<SDeviceState> > m_devices;   // the connected ones by (busnum << 8) | devnum
+		int64_t m_latestTimestampUs;
+		uint64_t m_eventsProcessed;
+
+		static uint32_t DeviceKey(int busnum, int devnum) { return ((uint32_t)busnum << 8) | (uint32_t)(devnum & 0xFF); }
+
+		static std::shared_ptr<SDeviceState> NewDeviceState(const std::string& label, int busnum, int devnum);
+
+		// watches a device under its numbers, replacing whatever was watched there (m_lock held)
+		void AddWatch(const std::shared_ptr<SDeviceState>& device);
+
+		// files the camera watched under serialNumber under its new numbers. False if it isn't watched. (m_lock held)
+		bool MoveCamera(const std::string& serialNumber, int busnum, int devnum);
+
+		// the device behind these numbers is gone: a camera is kept until it comes back, anything else is forgotten (m_lock held)
+		void DetachDevice(uint32_t key);
+
+		void RemoveWatch(const std::shared_ptr<SDeviceState>& device);
+
+		// folds a finished second into the baseline and starts a new bucket (m_lock held)
+		void AddBytes(SDeviceState& device, int64_t timestampUs, uint64_t bytes);
+
+		// mean bytes/s over the last whole seconds before nowUs (m_lock held)
+		static double GetBytesPerSecond(const SDeviceState& device, int64_t nowUs, int seconds);
+
+		static void FillStats(SDeviceState& device, int64_t nowUs, SUsbMonDeviceStats& stats);
+
+		// whether data came in each of the whole seconds just before untilUs (m_lock held)
+		static bool WasStreaming(const SDeviceState& device, int64_t untilUs, int seconds);
+
+	public:
+		CUsbMonTelemetry();
+
+		void SetThresholds(const SUsbTelemetryThresholds& thresholds);
+
+		// Starts collecting for a device. label names it in stats and warnings.
+		void WatchDevice(const std::string& label, int busnum, int devnum);
+
+		// Looks the camera up on the backend and watches it under its serial number. It stays watched when it re-enumerates.
+		bool WatchCamera(IUsbDeviceBackend& backend, const std::string& serialNumber, std::string& errorMessage);
+
+		void UnwatchDevice(int busnum, int devnum);
+
+		void UnwatchCamera(const std::string& serialNumber);
+
+		// From IUsbChangeDetector::WaitForEvents(). A removed device's numbers stop counting for it: a camera watched by
+		// serial number is kept (its stats too) and picks up its new numbers when it is added again, any other device is
+		// no longer watched. Lost events (a change without a device) can't be followed, call WatchCamera() again then.
+		void ApplyChangeEvents(const std::vector<SUsbChangeEvent>& events);
+
+		// Whether the device should be delivering data, which decides if outstanding URBs are a stall (default UsbTraffic_Auto)
+		void SetTrafficExpectation(int busnum, int devnum, EUsbTrafficExpectation expectation);
+
+		// usbmon dropped events: completions of outstanding URBs may be among them, so everything outstanding is forgotten
+		// rather than reported as a stall forever. CUsbMonReader::Poll() calls this.
+		void DiscardOutstanding();
+
+		// Feeds one event
+		void ProcessEvent(const SUsbMonEvent& event);
+
+		// Current numbers of every watched device
+		void GetStats(std::vector<SUsbMonDeviceStats>& stats);
+
+		// Checks every watched device for trouble. nowUs is on the event time base (see GetLatestTimestampUs()).
+		void Evaluate(int64_t nowUs, std::vector<SUsbTelemetryWarning>& warnings);
+
+		// Timestamp of the newest event seen, the natural "now" when replaying
+		int64_t GetLatestTimestampUs();
+
+		uint64_t GetEventsProcessed();
+
+		static const char* WarningTypeToString(EUsbTelemetryWarningType type);
+	};
+
+	// Reads /dev/usbmonN through its memory mapped ring: the kernel writes events into the shared ring
+	// and MON_IOCX_MFETCH only hands back offsets, so nothing is copied. Requires root (or read access to the node).
+	class CUsbMonReader
+	{
+	private:
+		// from drivers/usb/mon/mon_bin.c, which has no uapi header
+		struct SMonBinHeader
+		{
+			uint64_t id;
+			unsigned char type;
+			unsigned char xfer_type;
+			unsigned char epnum;
+			unsigned char devnum;
+			uint16_t busnum;
+			char flag_setup;
+			char flag_data;
+			int64_t ts_sec;
+			int32_t ts_usec;
+			int32_t status;
+			uint32_t len_urb;
+			uint32_t len_cap;
+			union
+			{
+				unsigned char setup[8];
+				struct { int32_t error_count; int32_t numdesc; } iso;
+			} s;
+			int32_t interval;
+			int32_t start_frame;
+			uint32_t xfer_flags;
+			uint32_t ndesc;
+		};
+
+		struct SMonBinStats
+		{
+			uint32_t queued;
+			uint32_t dropped;
+		};
+
+		struct SMonBinMfetch
+		{
+			uint32_t* offvec;
+			uint32_t nfetch;
+			uint32_t nflush;
+		};
+
+		static const int FetchBatch = 256;
+
+		int m_fd;
+		uint8_t* m_ring;
+		size_t m_ringSize;
+		uint32_t m_pendingFlush;
+		uint64_t m_dropped;
+		uint32_t m_offsets[FetchBatch];
+
+		// reads (and thereby resets) the kernel's count of events lost since the last read
+		uint32_t ReadDropped();
+
+		CUsbMonReader(const CUsbMonReader&);
+		CUsbMonReader& operator=(const CUsbMonReader&);
+
+	public:
+		CUsbMonReader();
+
+		~CUsbMonReader();
+
+		// Opens usbmon for one bus (0 for all buses). ringSize 0 keeps the kernel's default.
+		bool Open(int busnum, size_t ringSize, std::string& errorMessage);
+
+		void Close();
+
+		// Waits up to timeoutMs for events and feeds everything available to the telemetry. Returns the number of events, or -1 on error.
+		// If the kernel dropped events since the last poll, the telemetry forgets its outstanding urbs (their completions may be lost).
+		int Poll(int timeoutMs, CUsbMonTelemetry& telemetry, std::string& errorMessage);
+
+		// Events the kernel dropped because the ring was full, since Open()
+		uint64_t GetDroppedCount();
+
+		// Decodes a usbmon binary header in host byte order (48 or 64 bytes long)
+		static void DecodeHeader(const uint8_t* header, bool swapBytes, SUsbMonEvent& event);
+	};
+
+	// Replays a saved capture (tcpdump -i usbmonN, or Wireshark saved as pcap) into the telemetry, so it can be
+	// tested and benchmarked without cameras. Link types 220 (usbmon mmapped, 64 byte header) and 189 (48 byte header).
+	class CUsbMonCaptureReplay
+	{
+	public:
+		static bool ReplayBuffer(const uint8_t* data, size_t size, CUsbMonTelemetry& telemetry, uint64_t& events, std::string& errorMessage);
+
+		static bool ReplayFile(const std::string& path, CUsbMonTelemetry& telemetry, uint64_t& events, std::string& errorMessage);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbMonTelemetry::CUsbMonTelemetry()
+{
+	m_latestTimestampUs = 0;
+	m_eventsProcessed = 0;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::SetThresholds(const SUsbTelemetryThresholds& thresholds)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_thresholds = thresholds;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::WatchDevice(const std::string& label, int busnum, int devnum)
+{
+	std::shared_ptr<SDeviceState> device = NewDeviceState(label, busnum, devnum);
+	std::lock_guard<std::mutex> lock(m_lock);
+	AddWatch(device);
+}
+
+inline std::shared_ptr<UsbCameraDeviceManagerLinux::CUsbMonTelemetry::SDeviceState> UsbCameraDeviceManagerLinux::CUsbMonTelemetry::NewDeviceState(const std::string& label, int busnum, int devnum)
+{
+	std::shared_ptr<SDeviceState> device = std::make_shared<SDeviceState>();
+	device->stats.label = label;
+	device->stats.busnum = busnum;
+	device->stats.devnum = devnum;
+	for (int i = 0; i < ThroughputSeconds; i++)
+	{
+		device->secondStamps[i] = -1;
+		device->secondBytes[i] = 0;
+	}
+	device->completedAtLastEvaluate = 0;
+	device->errorsAtLastEvaluate = 0;
+	device->lastCompletionUs = 0;
+	device->lastSubmissionUs = 0;
+	device->newShutdowns = 0;
+	device->expectation = UsbTraffic_Auto;
+	return device;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::AddWatch(const std::shared_ptr<SDeviceState>& device)
+{
+	uint32_t key = DeviceKey(device->stats.busnum, device->stats.devnum);
+	std::map<uint32_t, std::shared_ptr<SDeviceState> >::iterator existing = m_devices.find(key);
+	if (existing != m_devices.end())
+		RemoveWatch(existing->second);
+	m_devices[key] = device;
+	m_watched.push_back(device);
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::RemoveWatch(const std::shared_ptr<SDeviceState>& device)
+{
+	for (size_t i = 0; i < m_watched.size(); i++)
+	{
+		if (m_watched[i] == device)
+		{
+			m_watched.erase(m_watched.begin() + i);
+			break;
+		}
+	}
+	std::map<uint32_t, std::shared_ptr<SDeviceState> >::iterator it = m_devices.find(DeviceKey(device->stats.busnum, device->stats.devnum));
+	if (it != m_devices.end() && it->second == device)
+		m_devices.erase(it);
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::DetachDevice(uint32_t key)
+{
+	std::map<uint32_t, std::shared_ptr<SDeviceState> >::iterator it = m_devices.find(key);
+	if (it == m_devices.end())
+		return;
+
+	std::shared_ptr<SDeviceState> device = it->second;
+	m_devices.erase(it);
+	if (device->serialNumber.empty())
+	{
+		RemoveWatch(device);
+		return;
+	}
+
+	// the host controller ended its urbs with -ESHUTDOWN. Any left have no completion coming.
+	device->stats.discarded += device->pending.size();
+	device->pending.clear();
+	device->stats.busnum = 0;
+	device->stats.devnum = 0;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbMonTelemetry::WatchCamera(IUsbDeviceBackend& backend, const std::string& serialNumber, std::string& errorMessage)
+{
+	std::string deviceName;
+	std::string busnum;
+	std::string devnum;
+	if (FindUsbDeviceBySerial(backend, serialNumber, deviceName) == false
+		|| backend.ReadAttribute(deviceName, "busnum", busnum) == false
+		|| backend.ReadAttribute(deviceName, "devnum", devnum) == false)
+	{
+		errorMessage = "Error: WatchCamera(): No usb device with serial number ";
+		errorMessage.append(serialNumber);
+		return false;
+	}
+
+	std::shared_ptr<SDeviceState> device = NewDeviceState(serialNumber, atoi(busnum.c_str()), atoi(devnum.c_str()));
+	device->serialNumber = serialNumber;
+
+	// a camera already watched keeps its stats, it only moves to its current numbers
+	std::lock_guard<std::mutex> lock(m_lock);
+	if (MoveCamera(serialNumber, device->stats.busnum, device->stats.devnum) == false)
+		AddWatch(device);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbMonTelemetry::MoveCamera(const std::string& serialNumber, int busnum, int devnum)
+{
+	for (size_t i = 0; i < m_watched.size(); i++)
+	{
+		std::shared_ptr<SDeviceState> device = m_watched[i];
+		if (device->serialNumber != serialNumber)
+			continue;
+
+		std::map<uint32_t, std::shared_ptr<SDeviceState> >::iterator old = m_devices.find(DeviceKey(device->stats.busnum, device->stats.devnum));
+		if (old != m_devices.end() && old->second == device)
+			m_devices.erase(old);
+
+		// whatever else was watched under the new numbers missed its removal (eg: events were lost), it isn't there anymore
+		uint32_t key = DeviceKey(busnum, devnum);
+		if (m_devices.count(key) != 0)
+			DetachDevice(key);
+
+		device->pending.clear();
+		device->stats.busnum = busnum;
+		device->stats.devnum = devnum;
+		m_devices[key] = device;
+		return true;
+	}
+	return false;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::UnwatchDevice(int busnum, int devnum)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<uint32_t, std::shared_ptr<SDeviceState> >::iterator it = m_devices.find(DeviceKey(busnum, devnum));
+	if (it != m_devices.end())
+		RemoveWatch(it->second);
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::UnwatchCamera(const std::string& serialNumber)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < m_watched.size(); i++)
+	{
+		if (m_watched[i]->serialNumber == serialNumber)
+		{
+			RemoveWatch(m_watched[i]);
+			return;
+		}
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::ApplyChangeEvents(const std::vector<SUsbChangeEvent>& events)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t e = 0; e < events.size(); e++)
+	{
+		const SUsbChangeEvent& event = events[e];
+		if (event.type == UsbChange_Remove)
+		{
+			DetachDevice(DeviceKey(event.busnum, event.devnum));
+			continue;
+		}
+		if (event.type != UsbChange_Add)
+			continue;
+
+		// a camera back under new numbers. Anything else new under numbers still watched means their device missed its removal.
+		if (event.serialNumber.empty() || MoveCamera(event.serialNumber, event.busnum, event.devnum) == false)
+			DetachDevice(DeviceKey(event.busnum, event.devnum));
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::SetTrafficExpectation(int busnum, int devnum, EUsbTrafficExpectation expectation)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<uint32_t, std::shared_ptr<SDeviceState> >::iterator it = m_devices.find(DeviceKey(busnum, devnum));
+	if (it != m_devices.end())
+		it->second->expectation = expectation;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::DiscardOutstanding()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < m_watched.size(); i++)
+	{
+		m_watched[i]->stats.discarded += m_watched[i]->pending.size();
+		m_watched[i]->pending.clear();
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbMonTelemetry::WasStreaming(const SDeviceState& device, int64_t untilUs, int seconds)
+{
+	int64_t until = untilUs / 1000000;
+	for (int64_t second = until - seconds; second < until; second++)
+	{
+		int slot = (int)(((second % ThroughputSeconds) + ThroughputSeconds) % ThroughputSeconds);
+		if (second < 0 || device.secondStamps[slot] != second || device.secondBytes[slot] == 0)
+			return false;
+	}
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::AddBytes(SDeviceState& device, int64_t timestampUs, uint64_t bytes)
+{
+	int64_t second = timestampUs / 1000000;
+	int slot = (int)(second % ThroughputSeconds);
+	if (device.secondStamps[slot] != second)
+	{
+		// the previous second is complete now. Only seconds with traffic count toward the baseline.
+		int64_t previous = second - 1;
+		int previousSlot = (int)((previous + ThroughputSeconds) % ThroughputSeconds);   // -1 in the first second of the time base
+		if (device.secondStamps[previousSlot] == previous && device.secondBytes[previousSlot] > 0)
+		{
+			double completed = (double)device.secondBytes[previousSlot];
+			if (device.stats.baselineBytesPerSecond == 0.0)
+				device.stats.baselineBytesPerSecond = completed;
+			else
+				device.stats.baselineBytesPerSecond = (device.stats.baselineBytesPerSecond * 7.0 + completed) / 8.0;
+		}
+		device.secondStamps[slot] = second;
+		device.secondBytes[slot] = 0;
+	}
+	device.secondBytes[slot] += bytes;
+}
+
+inline double UsbCameraDeviceManagerLinux::CUsbMonTelemetry::GetBytesPerSecond(const SDeviceState& device, int64_t nowUs, int seconds)
+{
+	int64_t now = nowUs / 1000000;
+	uint64_t total = 0;
+	for (int64_t second = now - seconds; second < now; second++)
+	{
+		if (second < 0)
+			continue;
+		int slot = (int)(second % ThroughputSeconds);
+		if (device.secondStamps[slot] == second)
+			total += device.secondBytes[slot];
+	}
+	return (double)total / seconds;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::ProcessEvent(const SUsbMonEvent& event)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_eventsProcessed++;
+	if (event.timestampUs > m_latestTimestampUs)
+		m_latestTimestampUs = event.timestampUs;
+
+	std::map<uint32_t, std::shared_ptr<SDeviceState> >::iterator it = m_devices.find(DeviceKey(event.busnum, event.devnum));
+	if (it == m_devices.end())
+		return;
+
+	SDeviceState& device = *it->second;
+	SUsbMonDeviceStats& stats = device.stats;
+
+	if (event.type == 'S')
+	{
+		stats.submitted++;
+		device.pending[event.urbId] = event.timestampUs;
+		device.lastSubmissionUs = event.timestampUs;
+		return;
+	}
+
+	// a completion or a submission error
+	std::map<uint64_t, int64_t>::iterator submitted = device.pending.find(event.urbId);
+	if (submitted != device.pending.end())
+	{
+		if (event.timestampUs >= submitted->second)
+			device.latency.Record((uint64_t)(event.timestampUs - submitted->second));
+		device.pending.erase(submitted);
+	}
+
+	if (event.type == 'C')
+	{
+		stats.completed++;
+		device.lastCompletionUs = event.timestampUs;
+	}
+
+	int status = event.status;
+	if (status == 0 && event.transferType == 0 && event.isoErrorCount > 0)
+		status = -EPROTO;  // an iso urb "succeeds" even when some of its packets didn't
+
+	switch (status)
+	{
+	case 0:
+		stats.bytes += event.length;
+		AddBytes(device, event.timestampUs, event.length);
+		break;
+	case -ENOENT:
+	case -ECONNRESET:
+		stats.cancelled++;
+		break;
+	case -ESHUTDOWN:
+		// not a cancel: the host controller ends every urb of a device that disconnected this way. Reported as
+		// DeviceLost rather than as errors, which would only add an ErrorRate warning for the same event.
+		stats.shutdowns++;
+		device.newShutdowns++;
+		break;
+	case -EPIPE:
+		stats.errors++;
+		stats.stalls++;
+		device.newStalls[event.endpoint]++;
+		break;
+	case -EOVERFLOW:
+		stats.errors++;
+		stats.babble++;
+		break;
+	case -EPROTO:
+	case -EILSEQ:
+	case -ETIME:
+		stats.errors++;
+		stats.protocolErrors++;
+		break;
+	default:
+		// -EREMOTEIO is a short read, which is how bulk image transfers normally end
+		if (status == -EREMOTEIO)
+		{
+			stats.bytes += event.length;
+			AddBytes(device, event.timestampUs, event.length);
+		}
+		else
+			stats.errors++;
+		break;
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::FillStats(SDeviceState& device, int64_t nowUs, SUsbMonDeviceStats& stats)
+{
+	stats = device.stats;
+	stats.outstanding = device.pending.size();
+	stats.bytesPerSecond = GetBytesPerSecond(device, nowUs, 4);
+	stats.latencyP50Us = device.latency.GetPercentileMicroseconds(0.50);
+	stats.latencyP99Us = device.latency.GetPercentileMicroseconds(0.99);
+	stats.latencyMaxUs = device.latency.GetMaxMicroseconds();
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::GetStats(std::vector<SUsbMonDeviceStats>& stats)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < m_watched.size(); i++)
+	{
+		SUsbMonDeviceStats deviceStats;
+		FillStats(*m_watched[i], m_latestTimestampUs, deviceStats);
+		stats.push_back(deviceStats);
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonTelemetry::Evaluate(int64_t nowUs, std::vector<SUsbTelemetryWarning>& warnings)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < m_watched.size(); i++)
+	{
+		SDeviceState& device = *m_watched[i];
+		SUsbTelemetryWarning warning;
+		warning.label = device.stats.label;
+		warning.busnum = device.stats.busnum;
+		warning.devnum = device.stats.devnum;
+		warning.endpoint = 0;
+
+		for (std::map<uint8_t, uint64_t>::iterator stall = device.newStalls.begin(); stall != device.newStalls.end(); ++stall)
+		{
+			char text[64];
+			snprintf(text, sizeof(text), "endpoint 0x%02x halted %llu times", stall->first, (unsigned long long)stall->second);
+			warning.type = UsbTelemetry_EndpointStall;
+			warning.endpoint = stall->first;
+			warning.detail = text;
+			warnings.push_back(warning);
+		}
+		device.newStalls.clear();
+		warning.endpoint = 0;
+
+		// the oldest outstanding urb, and nothing completed since it was submitted
+		int64_t oldest = nowUs;
+		for (std::map<uint64_t, int64_t>::iterator pending = device.pending.begin(); pending != device.pending.end(); ++pending)
+		{
+			if (pending->second < oldest)
+				oldest = pending->second;
+		}
+		int64_t stalledSinceUs = (device.lastCompletionUs > oldest) ? device.lastCompletionUs : oldest;
+		int64_t stalledUs = nowUs - stalledSinceUs;
+
+		// queued urbs of a camera waiting for a trigger are no stall. Unless told, only one that was streaming steadily
+		// right up to it is expected to go on.
+		bool expected = device.expectation == UsbTraffic_Expected || (device.expectation == UsbTraffic_Auto && WasStreaming(device, stalledSinceUs, 2));
+		if (expected && device.pending.empty() == false && stalledUs >= (int64_t)m_thresholds.transferStallMs * 1000)
+		{
+			warning.type = UsbTelemetry_TransferStall;
+			warning.detail = std::to_string(device.pending.size()) + " urbs outstanding, nothing completed for " + std::to_string(stalledUs / 1000) + " ms";
+			warnings.push_back(warning);
+		}
+
+		if (device.newShutdowns > 0)
+		{
+			warning.type = UsbTelemetry_DeviceLost;
+			warning.detail = std::to_string(device.newShutdowns) + " urbs ended with -ESHUTDOWN";
+			warnings.push_back(warning);
+			device.newShutdowns = 0;
+		}
+
+		uint64_t completed = device.stats.completed - device.completedAtLastEvaluate;
+		uint64_t errors = device.stats.errors - device.errorsAtLastEvaluate;
+		device.completedAtLastEvaluate = device.stats.completed;
+		device.errorsAtLastEvaluate = device.stats.errors;
+		if (errors > 0 && (completed == 0 || (double)errors / completed > m_thresholds.errorRateLimit))
+		{
+			warning.type = UsbTelemetry_ErrorRate;
+			warning.detail = std::to_string(errors) + " of " + std::to_string(completed) + " urbs failed";
+			warnings.push_back(warning);
+		}
+
+		// still asking for data (submitted in the last second) but getting far less than usual
+		double bytesPerSecond = GetBytesPerSecond(device, nowUs, 2);
+		double baseline = device.stats.baselineBytesPerSecond;
+		if (baseline >= m_thresholds.minimumBaselineBytesPerSecond && nowUs - device.lastSubmissionUs < 1000000
+			&& bytesPerSecond < baseline * m_thresholds.collapseRatio)
+		{
+			char text[96];
+			snprintf(text, sizeof(text), "%.1f MB/s against a usual %.1f MB/s", bytesPerSecond / 1e6, baseline / 1e6);
+			warning.type = UsbTelemetry_ThroughputCollapse;
+			warning.detail = text;
+			warnings.push_back(warning);
+		}
+	}
+}
+
+inline int64_t UsbCameraDeviceManagerLinux::CUsbMonTelemetry::GetLatestTimestampUs()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_latestTimestampUs;
+}
+
+inline uint64_t UsbCameraDeviceManagerLinux::CUsbMonTelemetry::GetEventsProcessed()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_eventsProcessed;
+}
+
+inline const char* UsbCameraDeviceManagerLinux::CUsbMonTelemetry::WarningTypeToString(EUsbTelemetryWarningType type)
+{
+	switch (type)
+	{
+	case UsbTelemetry_EndpointStall: return "EndpointStall";
+	case UsbTelemetry_TransferStall: return "TransferStall";
+	case UsbTelemetry_ErrorRate: return "ErrorRate";
+	case UsbTelemetry_ThroughputCollapse: return "ThroughputCollapse";
+	case UsbTelemetry_DeviceLost: return "DeviceLost";
+	default: return "Unknown";
+	}
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbMonReader::CUsbMonReader()
+{
+	m_fd = -1;
+	m_ring = NULL;
+	m_ringSize = 0;
+	m_pendingFlush = 0;
+	m_dropped = 0;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbMonReader::~CUsbMonReader()
+{
+	Close();
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbMonReader::Open(int busnum, size_t ringSize, std::string& errorMessage)
+{
+	Close();
+
+	char path[64];
+	snprintf(path, sizeof(path), "/dev/usbmon%d", busnum);
+	m_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (m_fd < 0)
+	{
+		errorMessage = "Error: CUsbMonReader::Open(): Unable to open ";
+		errorMessage.append(path);
+		errorMessage.append(": ");
+		errorMessage.append(strerror(errno));
+		errorMessage.append(" (is the usbmon module loaded?)");
+		return false;
+	}
+
+	if (ringSize != 0 && ioctl(m_fd, _IO(0x92, 4), (unsigned long)ringSize) < 0)  // MON_IOCT_RING_SIZE
+	{
+		errorMessage = "Error: CUsbMonReader::Open(): Unable to set the ring size: ";
+		errorMessage.append(strerror(errno));
+		Close();
+		return false;
+	}
+
+	int size = ioctl(m_fd, _IO(0x92, 5));  // MON_IOCQ_RING_SIZE
+	if (size <= 0)
+	{
+		errorMessage = "Error: CUsbMonReader::Open(): Unable to query the ring size.";
+		Close();
+		return false;
+	}
+
+	void* ring = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, m_fd, 0);
+	if (ring == MAP_FAILED)
+	{
+		errorMessage = "Error: CUsbMonReader::Open(): mmap() failed: ";
+		errorMessage.append(strerror(errno));
+		Close();
+		return false;
+	}
+
+	m_ring = (uint8_t*)ring;
+	m_ringSize = (size_t)size;
+	m_pendingFlush = 0;
+	m_dropped = 0;
+	ReadDropped();
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonReader::Close()
+{
+	if (m_ring != NULL)
+		munmap(m_ring, m_ringSize);
+	if (m_fd >= 0)
+		close(m_fd);
+	m_ring = NULL;
+	m_ringSize = 0;
+	m_fd = -1;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbMonReader::DecodeHeader(const uint8_t* header, bool swapBytes, SUsbMonEvent& event)
+{
+	// field by field, so capture files from a machine of the other endianness work too
+	uint64_t id;
+	uint16_t busnum;
+	int64_t seconds;
+	int32_t microseconds;
+	int32_t status;
+	uint32_t lengthUrb;
+	int32_t isoErrors;
+	memcpy(&id, header + 0, 8);
+	memcpy(&busnum, header + 12, 2);
+	memcpy(&seconds, header + 16, 8);
+	memcpy(&microseconds, header + 24, 4);
+	memcpy(&status, header + 28, 4);
+	memcpy(&lengthUrb, header + 32, 4);
+	memcpy(&isoErrors, header + 40, 4);
+
+	if (swapBytes)
+	{
+		id = __builtin_bswap64(id);
+		busnum = __builtin_bswap16(busnum);
+		seconds = (int64_t)__builtin_bswap64((uint64_t)seconds);
+		microseconds = (int32_t)__builtin_bswap32((uint32_t)microseconds);
+		status = (int32_t)__builtin_bswap32((uint32_t)status);
+		lengthUrb = __builtin_bswap32(lengthUrb);
+		isoErrors = (int32_t)__builtin_bswap32((uint32_t)isoErrors);
+	}
+
+	event.urbId = id;
+	event.type = (char)header[8];
+	event.transferType = header[9];
+	event.endpoint = header[10];
+	event.devnum = header[11];
+	event.busnum = busnum;
+	event.timestampUs = seconds * 1000000 + microseconds;
+	event.status = status;
+	event.length = lengthUrb;  // requested on S, transferred on C
+	event.isoErrorCount = (event.transferType == 0 && event.type == 'C') ? isoErrors : 0;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbMonReader::Poll(int timeoutMs, CUsbMonTelemetry& telemetry, std::string& errorMessage)
+{
+	if (m_fd < 0)
+	{
+		errorMessage = "Error: CUsbMonReader::Poll(): Not open.";
+		return -1;
+	}
+
+	struct pollfd descriptor;
+	descriptor.fd = m_fd;
+	descriptor.events = POLLIN;
+	descriptor.revents = 0;
+	if (poll(&descriptor, 1, timeoutMs) < 0 && errno != EINTR)
+	{
+		errorMessage = "Error: CUsbMonReader::Poll(): poll() failed: ";
+		errorMessage.append(strerror(errno));
+		return -1;
+	}
+
+	int total = 0;
+	while (true)
+	{
+		// hand back what we consumed last time and get the offsets of what's new, in one call
+		SMonBinMfetch fetch;
+		fetch.offvec = m_offsets;
+		fetch.nfetch = FetchBatch;
+		fetch.nflush = m_pendingFlush;
+		if (ioctl(m_fd, _IOWR(0x92, 7, SMonBinMfetch), &fetch) < 0)  // MON_IOCX_MFETCH
+		{
+			if (errno == EAGAIN || errno == EINTR)
+			{
+				m_pendingFlush = 0;
+				break;
+			}
+			errorMessage = "Error: CUsbMonReader::Poll(): MON_IOCX_MFETCH failed: ";
+			errorMessage.append(strerror(errno));
+			return -1;
+		}
+
+		m_pendingFlush = fetch.nfetch;
+		for (uint32_t i = 0; i < fetch.nfetch; i++)
+		{
+			if (m_offsets[i] + sizeof(SMonBinHeader) > m_ringSize)
+				continue;
+			const uint8_t* header = m_ring + m_offsets[i];
+			if (header[8] == '@')  // filler the kernel puts in front of the ring wrap
+				continue;
+
+			SUsbMonEvent event;
+			DecodeHeader(header, false, event);
+			telemetry.ProcessEvent(event);
+			total++;
+		}
+
+		if (fetch.nfetch < (uint32_t)FetchBatch)
+			break;
+	}
+
+	uint32_t dropped = ReadDropped();
+	if (dropped > 0)
+	{
+		m_dropped += dropped;
+		telemetry.DiscardOutstanding();
+	}
+	return total;
+}
+
+inline uint32_t UsbCameraDeviceManagerLinux::CUsbMonReader::ReadDropped()
+{
+	SMonBinStats stats;
+	if (m_fd < 0 || ioctl(m_fd, _IOR(0x92, 3, SMonBinStats), &stats) < 0)  // MON_IOCG_STATS
+		return 0;
+	return stats.dropped;
+}
+
+inline uint64_t UsbCameraDeviceManagerLinux::CUsbMonReader::GetDroppedCount()
+{
+	return m_dropped;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbMonCaptureReplay::ReplayBuffer(const uint8_t* data, size_t size, CUsbMonTelemetry& telemetry, uint64_t& events, std::string& errorMessage)
+{
+	events = 0;
+	if (size < 24)
+	{
+		errorMessage = "Error: ReplayBuffer(): Not a pcap file.";
+		return false;
+	}
+
+	uint32_t magic;
+	memcpy(&magic, data, 4);
+	// microsecond or nanosecond pcap, either byte order. The timestamps used are the ones in the usbmon header.
+	bool swapBytes;
+	if (magic == 0xa1b2c3d4 || magic == 0xa1b23c4d)
+		swapBytes = false;
+	else if (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1)
+		swapBytes = true;
+	else
+	{
+		errorMessage = "Error: ReplayBuffer(): Not a pcap file (pcapng isn't supported, save as pcap).";
+		return false;
+	}
+
+	uint32_t linkType;
+	memcpy(&linkType, data + 20, 4);
+	if (swapBytes)
+		linkType = __builtin_bswap32(linkType);
+
+	size_t headerLength;
+	if (linkType == 220)
+		headerLength = 64;
+	else if (linkType == 189)
+		headerLength = 48;
+	else
+	{
+		errorMessage = "Error: ReplayBuffer(): Link type ";
+		errorMessage.append(std::to_string(linkType));
+		errorMessage.append(" is not a usbmon capture.");
+		return false;
+	}
+
+	size_t offset = 24;
+	while (offset + 16 <= size)
+	{
+		uint32_t capturedLength;
+		memcpy(&capturedLength, data + offset + 8, 4);
+		if (swapBytes)
+			capturedLength = __builtin_bswap32(capturedLength);
+		offset += 16;
+
+		if (capturedLength > size - offset)
+		{
+			errorMessage = "Error: ReplayBuffer(): Capture is truncated.";
+			return false;
+		}
+
+		if (capturedLength >= headerLength)
+		{
+			SUsbMonEvent event;
+			CUsbMonReader::DecodeHeader(data + offset, swapBytes, event);
+			telemetry.ProcessEvent(event);
+			events++;
+		}
+		offset += capturedLength;
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbMonCaptureReplay::ReplayFile(const std::string& path, CUsbMonTelemetry& telemetry, uint64_t& events, std::string& errorMessage)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == NULL)
+	{
+		errorMessage = "Error: ReplayFile(): Unable to open ";
+		errorMessage.append(path);
+		return false;
+	}
+
+	std::vector<uint8_t> data;
+	uint8_t chunk[65536];
+	size_t num_bytes;
+	while ((num_bytes = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		data.insert(data.end(), chunk, chunk + num_bytes);
+	fclose(file);
+
+	return ReplayBuffer(data.empty() ? NULL : &data[0], data.size(), telemetry, events, errorMessage);
+}
+// *********************************************************************************************************
+
+#endif
+#endif
@@ -0,0 +1,284 @@
+// UsbNumaAdvisorLinux.h
+// Recommends CPUs and a memory node for a camera's grab thread and buffers, local to its host controller
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBNUMAADVISORLINUX_H
+#define USBNUMAADVISORLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbControllerRecoveryLinux.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// Where a camera's grab thread and buffers should live
+	struct SUsbNumaPlacement
+	{
+		std::string serialNumber;
+		std::string deviceName;        // eg: 2-1.3
+		std::string pciAddress;        // the camera's xHCI controller (eg: 0000:00:14.0)
+		int numaNode;                  // -1 if the firmware doesn't say (single socket hosts usually)
+		std::vector<int> cpus;         // the controller's local cpus this process may run on. All it may run on if unknown.
+		std::string cpuList;           // cpus as a cpulist (eg: "0-7,16-23")
+	};
+
+	// Maps a camera to its controller's numa_node and local_cpulist in sysfs. Cameras on controllers of the other
+	// socket DMA across the interconnect, which shows up as frame latency jitter.
+	class CUsbNumaAdvisor
+	{
+	private:
+		IUsbDeviceBackend& m_backend;
+
+		static bool ReadFile(const std::string& path, std::string& value);
+
+		// the cpus the calling process is allowed on (taskset, cgroups)
+		static void GetAllowedCpus(std::vector<int>& cpus);
+
+	public:
+		CUsbNumaAdvisor(IUsbDeviceBackend& backend);
+
+		// Looks up the camera's controller and recommends a placement for it
+		bool GetPlacement(const std::string& serialNumber, SUsbNumaPlacement& placement, std::string& errorMessage);
+
+		// Pins a thread to the placement's cpus
+		static bool ApplyThreadAffinity(const SUsbNumaPlacement& placement, pthread_t thread, std::string& errorMessage);
+
+		// Makes the calling thread prefer the placement's node for memory it touches first, so buffers it allocates
+		// and fills land there. Does nothing if the node is unknown.
+		static bool ApplyMemoryPreference(const SUsbNumaPlacement& placement, std::string& errorMessage);
+
+		// "0-3,8,10-11" -> 0 1 2 3 8 10 11
+		static bool ParseCpuList(const std::string& text, std::vector<int>& cpus);
+
+		// 0 1 2 3 8 10 11 -> "0-3,8,10-11"
+		static std::string FormatCpuList(const std::vector<int>& cpus);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbNumaAdvisor::CUsbNumaAdvisor(IUsbDeviceBackend& backend)
+	: m_backend(backend)
+{
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbNumaAdvisor::ReadFile(const std::string& path, std::string& value)
+{
+	FILE* file = fopen(path.c_str(), "r");
+	if (file == NULL)
+		return false;
+
+	char buffer[4096];
+	size_t length = fread(buffer, 1, sizeof(buffer) - 1, file);
+	fclose(file);
+
+	value.assign(buffer, length);
+	while (value.size() > 0 && (value[value.size() - 1] == '\n' || value[value.size() - 1] == ' '))
+		value.erase(value.size() - 1);
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbNumaAdvisor::GetAllowedCpus(std::vector<int>& cpus)
+{
+	cpus.clear();
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) != 0)
+		return;
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET(cpu, &set))
+			cpus.push_back(cpu);
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbNumaAdvisor::ParseCpuList(const std::string& text, std::vector<int>& cpus)
+{
+	cpus.clear();
+	const char* at = text.c_str();
+	while (*at != '\0')
+	{
+		char* end = NULL;
+		long first = strtol(at, &end, 10);
+		if (end == at || first < 0)
+			return false;
+
+		long last = first;
+		if (*end == '-')
+		{
+			at = end + 1;
+			last = strtol(at, &end, 10);
+			if (end == at || last < first)
+				return false;
+		}
+
+		for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+			cpus.push_back((int)cpu);
+
+		if (*end == ',')
+			end++;
+		else if (*end != '\0')
+			return false;
+		at = end;
+	}
+	return true;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbNumaAdvisor::FormatCpuList(const std::vector<int>& cpus)
+{
+	std::string text;
+	size_t i = 0;
+	while (i < cpus.size())
+	{
+		size_t j = i;
+		while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+			j++;
+
+		if (text != "")
+			text.append(",");
+		text.append(std::to_string(cpus[i]));
+		if (j > i)
+		{
+			text.append("-");
+			text.append(std::to_string(cpus[j]));
+		}
+		i = j + 1;
+	}
+	return text;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbNumaAdvisor::GetPlacement(const std::string& serialNumber, SUsbNumaPlacement& placement, std::string& errorMessage)
+{
+	placement = SUsbNumaPlacement();
+	placement.serialNumber = serialNumber;
+	placement.numaNode = -1;
+
+	if (FindUsbDeviceBySerial(m_backend, serialNumber, placement.deviceName) == false)
+	{
+		errorMessage = "Error: GetPlacement(): No usb device with serial number ";
+		errorMessage.append(serialNumber);
+		return false;
+	}
+
+	std::string devicePath;
+	std::string rootHub;
+	if (m_backend.ResolveDevicePath(placement.deviceName, devicePath) == false
+		|| CUsbControllerRecovery::ParseControllerAddress(devicePath, placement.pciAddress, rootHub) == false)
+	{
+		errorMessage = "Error: GetPlacement(): Unable to find the host controller of ";
+		errorMessage.append(placement.deviceName);
+		return false;
+	}
+
+	std::vector<int> allowed;
+	GetAllowedCpus(allowed);
+
+	// the controller's directory is the device path up to and including its pci address
+	std::string controllerPath = devicePath.substr(0, devicePath.find("/" + rootHub));
+
+	std::string value;
+	if (ReadFile(controllerPath + "/numa_node", value))
+		placement.numaNode = atoi(value.c_str());
+
+	std::vector<int> local;
+	if (ReadFile(controllerPath + "/local_cpulist", value))
+		ParseCpuList(value, local);
+
+	// local cpus we can't run on are no use. If that leaves nothing, any cpu beats none.
+	for (size_t i = 0; i < local.size(); i++)
+	{
+		for (size_t j = 0; j < allowed.size(); j++)
+		{
+			if (allowed[j] == local[i])
+			{
+				placement.cpus.push_back(local[i]);
+				break;
+			}
+		}
+	}
+	if (placement.cpus.size() == 0)
+		placement.cpus = allowed;
+
+	placement.cpuList = FormatCpuList(placement.cpus);
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbNumaAdvisor::ApplyThreadAffinity(const SUsbNumaPlacement& placement, pthread_t thread, std::string& errorMessage)
+{
+	if (placement.cpus.size() == 0)
+	{
+		errorMessage = "Error: ApplyThreadAffinity(): The placement has no cpus.";
+		return false;
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < placement.cpus.size(); i++)
+		CPU_SET(placement.cpus[i], &set);
+
+	int result = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (result != 0)
+	{
+		errorMessage = "Error: ApplyThreadAffinity(): pthread_setaffinity_np() failed: ";
+		errorMessage.append(strerror(result));
+		return false;
+	}
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbNumaAdvisor::ApplyMemoryPreference(const SUsbNumaPlacement& placement, std::string& errorMessage)
+{
+	if (placement.numaNode < 0)
+		return true;
+
+	// set_mempolicy(MPOL_PREFERRED) directly, so we don't need libnuma
+	const int mpolPreferred = 1;
+	unsigned long nodeMask[16];
+	memset(nodeMask, 0, sizeof(nodeMask));
+	const int bitsPerWord = (int)(sizeof(unsigned long) * 8);
+	if (placement.numaNode >= bitsPerWord * 16)
+	{
+		errorMessage = "Error: ApplyMemoryPreference(): Node out of range.";
+		return false;
+	}
+	nodeMask[placement.numaNode / bitsPerWord] = 1UL << (placement.numaNode % bitsPerWord);
+
+	if (syscall(SYS_set_mempolicy, mpolPreferred, nodeMask, (unsigned long)(bitsPerWord * 16)) != 0)
+	{
+		errorMessage = "Error: ApplyMemoryPreference(): set_mempolicy() failed: ";
+		errorMessage.append(strerror(errno));
+		return false;
+	}
+	return true;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
@@ -0,0 +1,183 @@
+// UsbRecoveryEscalationLinux.h
+// Recovers a camera one step at a time: usbfs reset, then usb_modeswitch, then a rebind of its controller
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBRECOVERYESCALATIONLINUX_H
+#define USBRECOVERYESCALATIONLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <cstdlib>
+#include <stdint.h>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbResetHandleCacheLinux.h"
+#include "UsbModeSwitchResetLinux.h"
+#include "UsbControllerRecoveryLinux.h"
+#include "UsbClock.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	struct SUsbEscalationPolicy
+	{
+		int resetsBeforeEscalation;               // usbfs resets that fail or bring the camera back too slow before usb_modeswitch, then the controller rebind
+		unsigned int timeoutMs;                   // for the whole recovery, every step included
+		unsigned int minimumSpeedMbps;            // the camera is recovered once it is back at least this fast
+		SUsbControllerRecoveryPolicy controller;  // for the last step. Its verifyTimeoutMs is capped to what is left of timeoutMs.
+
+		SUsbEscalationPolicy() : resetsBeforeEscalation(3), timeoutMs(15000), minimumSpeedMbps(5000) { controller.rebind = UsbRebind_CamerasOnly; }
+	};
+
+	// How far one recovery had to go
+	struct SUsbEscalationResult
+	{
+		int resetsIssued;
+		int modeSwitchResets;
+		int controllerRebinds;
+		bool degraded;           // it came back too slow at least once on the way
+		unsigned int elapsedMs;
+
+		SUsbEscalationResult() : resetsIssued(0), modeSwitchResets(0), controllerRebinds(0), degraded(false), elapsedMs(0) {}
+	};
+
+	// Resets the camera through CUsbResetHandleCache until it is back at the policy's speed. After resetsBeforeEscalation
+	// of them failed (or brought it back at USB2) it has CUsbModeSwitchReset reset its port once, and after that
+	// CUsbControllerRecovery rebind its controller. A step that can't be issued (busy, or the camera is still away from
+	// the last one) is retried after a growing pause. Once the camera is back the handle cache is refreshed.
+	// The steps report to their own observers. One object per camera when recovering cameras in parallel: the
+	// controller recovery's clock times the step of this camera only.
+	class CUsbRecoveryEscalation
+	{
+	private:
+		CUsbResetHandleCache& m_cache;
+		CUsbModeSwitchReset& m_modeSwitch;
+		CUsbControllerRecovery& m_controllerRecovery;
+		IUsbDeviceBackend& m_backend;
+		UsbCameraDeviceManager::IUsbClock& m_clock;
+
+		// not copyable
+		CUsbRecoveryEscalation(const CUsbRecoveryEscalation&);
+		CUsbRecoveryEscalation& operator=(const CUsbRecoveryEscalation&);
+
+	public:
+		// clock times the recovery and its pauses, NULL for the steady clock
+		CUsbRecoveryEscalation(CUsbResetHandleCache& cache, CUsbModeSwitchReset& modeSwitch, CUsbControllerRecovery& controllerRecovery,
+			IUsbDeviceBackend& backend, UsbCameraDeviceManager::IUsbClock* clock = NULL);
+
+		// Returns false if the camera isn't back at the policy's speed within its timeout. errorMessage then carries the
+		// last step's error, if it had one.
+		bool RecoverCamera(const std::string& serialNumber, const SUsbEscalationPolicy& policy, SUsbEscalationResult& result, std::string& errorMessage);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbRecoveryEscalation::CUsbRecoveryEscalation(CUsbResetHandleCache& cache, CUsbModeSwitchReset& modeSwitch, CUsbControllerRecovery& controllerRecovery,
+	IUsbDeviceBackend& backend, UsbCameraDeviceManager::IUsbClock* clock)
+	: m_cache(cache), m_modeSwitch(modeSwitch), m_controllerRecovery(controllerRecovery), m_backend(backend),
+	m_clock(clock != NULL ? *clock : UsbCameraDeviceManager::CSystemUsbClock::Instance())
+{
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbRecoveryEscalation::RecoverCamera(const std::string& serialNumber, const SUsbEscalationPolicy& policy, SUsbEscalationResult& result, std::string& errorMessage)
+{
+	uint64_t start = m_clock.NowMs();
+	unsigned int backoffMs = 50;
+	int failedResets = 0;
+	std::string lastError;
+	result = SUsbEscalationResult();
+
+	while (m_clock.NowMs() - start < policy.timeoutMs)
+	{
+		std::string stepError;
+		bool issued = false;
+		if (failedResets < policy.resetsBeforeEscalation)
+		{
+			result.resetsIssued++;
+			issued = m_cache.ResetCamera(serialNumber, stepError);
+		}
+		else if (failedResets == policy.resetsBeforeEscalation)
+		{
+			result.modeSwitchResets++;
+			issued = m_modeSwitch.ResetCamera(serialNumber, stepError);
+		}
+		else
+		{
+			// waits for every camera on the controller itself
+			SUsbControllerRecoveryPolicy controllerPolicy = policy.controller;
+			unsigned int remainingMs = policy.timeoutMs - (unsigned int)(m_clock.NowMs() - start);
+			if (controllerPolicy.verifyTimeoutMs > remainingMs)
+				controllerPolicy.verifyTimeoutMs = remainingMs;
+			SUsbControllerImpact impact;
+			result.controllerRebinds++;
+			issued = m_controllerRecovery.RecoverCamera(serialNumber, controllerPolicy, impact, stepError);
+		}
+
+		if (issued == false)
+		{
+			// busy, or the camera is still away from an earlier step
+			lastError = stepError;
+			failedResets++;
+			m_clock.SleepMs(backoffMs);
+			backoffMs = (backoffMs * 2 < 1000) ? backoffMs * 2 : 1000;
+			continue;
+		}
+		backoffMs = 50;
+
+		// the camera dropped off the bus. Once it is back the handle cache is refreshed.
+		while (m_clock.NowMs() - start < policy.timeoutMs)
+		{
+			m_clock.SleepMs(50);
+			std::string deviceName;
+			std::string speed;
+			if (FindUsbDeviceBySerial(m_backend, serialNumber, deviceName) == false || m_backend.ReadAttribute(deviceName, "speed", speed) == false)
+				continue;
+
+			m_cache.Refresh();
+			if (atoi(speed.c_str()) >= (int)policy.minimumSpeedMbps)
+			{
+				result.elapsedMs = (unsigned int)(m_clock.NowMs() - start);
+				return true;
+			}
+
+			// back, but too slow. Another reset usually brings it up at SuperSpeed.
+			result.degraded = true;
+			failedResets++;
+			break;
+		}
+	}
+
+	result.elapsedMs = (unsigned int)(m_clock.NowMs() - start);
+	errorMessage = "Error: CUsbRecoveryEscalation::RecoverCamera(): Camera ";
+	errorMessage.append(serialNumber);
+	errorMessage.append(" not back at ");
+	errorMessage.append(std::to_string(policy.minimumSpeedMbps));
+	errorMessage.append(" Mbps within ");
+	errorMessage.append(std::to_string(policy.timeoutMs));
+	errorMessage.append(" ms.");
+	if (lastError.empty() == false)
+	{
+		errorMessage.append(" Last step: ");
+		errorMessage.append(lastError);
+	}
+	return false;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
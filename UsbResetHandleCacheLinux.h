@@ -0,0 +1,475 @@
+// UsbResetHandleCacheLinux.h
+// Keeps an open, validated usbfs handle per registered camera so a reset is a single ioctl
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBRESETHANDLECACHELINUX_H
+#define USBRESETHANDLECACHELINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include "UsbDeviceBackendLinux.h"
+#include "UsbChangeDetectorLinux.h"
+#include "UsbDescriptorParserLinux.h"
+#include "UsbLatencyHistogram.h"
+#include "UsbCameraResult.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// Hot-standby mode: instead of resolving the serial number, opening the usbfs node and checking
+	// the device on every reset, this does all of it up front (and again whenever the topology changes)
+	// and keeps the handle open. ResetCamera() is then a lookup plus one USBDEVFS_RESET.
+	class CUsbResetHandleCache
+	{
+	private:
+		// One open handle. Shared so a reset in flight keeps the handle alive while Refresh() swaps it.
+		struct SStandbyHandle
+		{
+			IUsbDeviceBackend* backend;
+			std::string deviceName;
+			int busnum;
+			int devnum;
+			int handle;
+
+			SStandbyHandle() : backend(NULL), busnum(0), devnum(0), handle(-1) {}
+			~SStandbyHandle() { if (backend != NULL && handle >= 0) backend->CloseUsbfs(handle); }
+		};
+
+		struct SRegisteredCamera
+		{
+			std::string serialNumber;
+			std::shared_ptr<SStandbyHandle> standby;
+		};
+
+		IUsbDeviceBackend& m_backend;
+		UsbCameraDeviceManager::IUsbApiCallObserver* m_apiCallObserver;
+		const IUsbChangeDetector* m_changeDetector;
+		uint64_t m_refreshedGeneration;        // the detector's topology generation at the last Refresh()
+		std::mutex m_lock;
+		std::vector<SRegisteredCamera> m_cameras;
+		UsbCameraDeviceManager::CUsbLatencyHistogram m_dispatchLatency;
+		UsbCameraDeviceManager::CUsbLatencyHistogram m_resetLatency;
+
+		// finds the device by serial number, opens it and checks the handle really is that device
+		bool OpenStandbyHandle(const std::string& serialNumber, std::shared_ptr<SStandbyHandle>& standby, std::string& errorMessage);
+
+		// the same for a device whose sysfs name is already known (eg: from a change event)
+		bool OpenStandbyHandleOn(const std::string& deviceName, std::shared_ptr<SStandbyHandle>& standby, std::string& errorMessage);
+
+		// Refresh() after the generation check
+		int RevalidateAll();
+
+		// true if the sysfs entry behind a handle still has the same bus and device number
+		bool IsStandbyHandleCurrent(const SStandbyHandle& standby, const std::string& serialNumber);
+
+		// ResetCamera() without reporting it to the observer
+		bool ResetThroughStandbyHandle(const std::string& serialNumber, std::string& errorMessage);
+
+	public:
+		CUsbResetHandleCache(IUsbDeviceBackend& backend);
+
+		~CUsbResetHandleCache();
+
+		// Adds a camera and opens its standby handle
+		bool RegisterCamera(const std::string& serialNumber, std::string& errorMessage);
+
+		// Removes a camera and closes its handle
+		void UnregisterCamera(const std::string& serialNumber);
+
+		// Re-validates every handle and reopens the ones whose device went away or re-enumerated.
+		// Call this on every topology change (eg: from a change detector). Returns the number of handles reopened.
+		int Refresh();
+
+		// From IUsbChangeDetector::WaitForEvents(): only touches the cameras the events name. A removed camera's handle
+		// is closed, an added one is opened on the device the event resolved, without looking for it. Events that can't
+		// be pinned to a device (an add that couldn't be resolved, lost events) fall back to Refresh(). Returns the
+		// number of handles reopened.
+		int Refresh(const std::vector<SUsbChangeEvent>& events);
+
+		// With a started change detector (may be NULL), Refresh() returns right away unless the topology changed since the
+		// last one, so it can be called as often as the application likes. Must outlive this object.
+		void SetChangeDetector(const IUsbChangeDetector* changeDetector);
+
+		// Told about every ResetCamera() (may be NULL). Must outlive this object.
+		void SetApiCallObserver(UsbCameraDeviceManager::IUsbApiCallObserver* apiCallObserver);
+
+		// Resets the camera through its standby handle. If the handle went stale it is reopened once.
+		bool ResetCamera(const std::string& serialNumber, std::string& errorMessage);
+
+		// For reference, true if the camera currently has a validated handle
+		bool HasStandbyHandle(const std::string& serialNumber);
+
+		// Time from ResetCamera() being called until the reset ioctl is issued
+		const UsbCameraDeviceManager::CUsbLatencyHistogram& GetDispatchLatencyHistogram() const;
+
+		// Time from ResetCamera() being called until the reset ioctl returned
+		const UsbCameraDeviceManager::CUsbLatencyHistogram& GetResetLatencyHistogram() const;
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbResetHandleCache::CUsbResetHandleCache(IUsbDeviceBackend& backend)
+	: m_backend(backend), m_apiCallObserver(NULL), m_changeDetector(NULL), m_refreshedGeneration(0)
+{
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbResetHandleCache::SetApiCallObserver(UsbCameraDeviceManager::IUsbApiCallObserver* apiCallObserver)
+{
+	m_apiCallObserver = apiCallObserver;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbResetHandleCache::~CUsbResetHandleCache()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_cameras.clear();
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbResetHandleCache::OpenStandbyHandle(const std::string& serialNumber, std::shared_ptr<SStandbyHandle>& standby, std::string& errorMessage)
+{
+	std::string deviceName;
+	if (FindUsbDeviceBySerial(m_backend, serialNumber, deviceName) == false)
+	{
+		errorMessage = "Error: OpenStandbyHandle(): No usb device with serial number ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(" found.");
+		return false;
+	}
+	return OpenStandbyHandleOn(deviceName, standby, errorMessage);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbResetHandleCache::OpenStandbyHandleOn(const std::string& deviceName, std::shared_ptr<SStandbyHandle>& standby, std::string& errorMessage)
+{
+	std::string busnum;
+	std::string devnum;
+	std::string idVendor;
+	std::string idProduct;
+	if (m_backend.ReadAttribute(deviceName, "busnum", busnum) == false
+		|| m_backend.ReadAttribute(deviceName, "devnum", devnum) == false
+		|| m_backend.ReadAttribute(deviceName, "idVendor", idVendor) == false
+		|| m_backend.ReadAttribute(deviceName, "idProduct", idProduct) == false)
+	{
+		errorMessage = "Error: OpenStandbyHandle(): Unable to read attributes of ";
+		errorMessage.append(deviceName);
+		return false;
+	}
+
+	std::shared_ptr<SStandbyHandle> candidate(new SStandbyHandle());
+	candidate->backend = &m_backend;
+	candidate->deviceName = deviceName;
+	candidate->busnum = atoi(busnum.c_str());
+	candidate->devnum = atoi(devnum.c_str());
+	candidate->handle = m_backend.OpenUsbfs(candidate->busnum, candidate->devnum);
+	if (candidate->handle < 0)
+	{
+		errorMessage = "Error: OpenStandbyHandle(): Unable to open usbfs node: ";
+		errorMessage.append(strerror(-candidate->handle));
+		return false;
+	}
+
+	// the device may have re-enumerated between reading sysfs and opening, so check what we got
+	uint8_t descriptor[64];
+	int length = m_backend.ReadUsbfsDescriptor(candidate->handle, descriptor, sizeof(descriptor));
+	CUsbDescriptorParser parser(descriptor, (length > 0) ? (size_t)length : 0);
+	CUsbDeviceDescriptorView device = parser.GetDeviceDescriptor();
+	if (device.IsValid() == false
+		|| device.VendorId() != (uint16_t)strtoul(idVendor.c_str(), NULL, 16)
+		|| device.ProductId() != (uint16_t)strtoul(idProduct.c_str(), NULL, 16))
+	{
+		errorMessage = "Error: OpenStandbyHandle(): usbfs node does not match ";
+		errorMessage.append(deviceName);
+		return false;
+	}
+
+	standby = candidate;
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbResetHandleCache::IsStandbyHandleCurrent(const SStandbyHandle& standby, const std::string& serialNumber)
+{
+	std::string serial;
+	std::string busnum;
+	std::string devnum;
+	if (m_backend.ReadAttribute(standby.deviceName, "serial", serial) == false || serial != serialNumber)
+		return false;
+	if (m_backend.ReadAttribute(standby.deviceName, "busnum", busnum) == false || atoi(busnum.c_str()) != standby.busnum)
+		return false;
+	if (m_backend.ReadAttribute(standby.deviceName, "devnum", devnum) == false || atoi(devnum.c_str()) != standby.devnum)
+		return false;
+	return true;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbResetHandleCache::RegisterCamera(const std::string& serialNumber, std::string& errorMessage)
+{
+	if (serialNumber == "")
+	{
+		errorMessage = "Error: RegisterCamera(): Serial Number Invalid.";
+		return false;
+	}
+
+	std::shared_ptr<SStandbyHandle> standby;
+	bool opened = OpenStandbyHandle(serialNumber, standby, errorMessage);
+
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < m_cameras.size(); i++)
+	{
+		if (m_cameras[i].serialNumber == serialNumber)
+		{
+			m_cameras[i].standby = standby;
+			return opened;
+		}
+	}
+
+	// a camera that isn't connected yet stays registered and picks up its handle on the next Refresh()
+	SRegisteredCamera camera;
+	camera.serialNumber = serialNumber;
+	camera.standby = standby;
+	m_cameras.push_back(camera);
+	return opened;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbResetHandleCache::UnregisterCamera(const std::string& serialNumber)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < m_cameras.size(); i++)
+	{
+		if (m_cameras[i].serialNumber == serialNumber)
+		{
+			m_cameras.erase(m_cameras.begin() + i);
+			return;
+		}
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbResetHandleCache::SetChangeDetector(const IUsbChangeDetector* changeDetector)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_changeDetector = changeDetector;
+	m_refreshedGeneration = (changeDetector != NULL) ? changeDetector->GetTopologyGeneration() : 0;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbResetHandleCache::Refresh()
+{
+	if (m_changeDetector != NULL)
+	{
+		// nothing plugged, unplugged or re-enumerated since the last look
+		std::lock_guard<std::mutex> lock(m_lock);
+		uint64_t generation = m_changeDetector->GetTopologyGeneration();
+		if (generation == m_refreshedGeneration)
+			return 0;
+		m_refreshedGeneration = generation;
+	}
+	return RevalidateAll();
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbResetHandleCache::Refresh(const std::vector<SUsbChangeEvent>& events)
+{
+	// the cameras that came back, and where
+	std::vector<std::pair<std::string, std::string> > added;
+	bool everything = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (size_t e = 0; e < events.size(); e++)
+		{
+			const SUsbChangeEvent& event = events[e];
+			if (event.generation > m_refreshedGeneration)
+				m_refreshedGeneration = event.generation;
+
+			if (event.deviceName.empty() && event.type != UsbChange_Remove)
+			{
+				everything = true;
+				continue;
+			}
+
+			for (size_t i = 0; i < m_cameras.size(); i++)
+			{
+				SRegisteredCamera& camera = m_cameras[i];
+				if (event.type == UsbChange_Remove)
+				{
+					// a node that went away without its sysfs entry ever being read is known by its numbers only
+					bool sameNode = camera.standby && camera.standby->busnum == event.busnum && camera.standby->devnum == event.devnum;
+					if (sameNode || (event.serialNumber.empty() == false && camera.serialNumber == event.serialNumber))
+						camera.standby.reset();
+				}
+				else if (event.type == UsbChange_Add && event.serialNumber.empty() == false && camera.serialNumber == event.serialNumber)
+					added.push_back(std::make_pair(camera.serialNumber, event.deviceName));
+			}
+		}
+	}
+
+	if (everything)
+		return RevalidateAll();
+
+	int reopened = 0;
+	for (size_t i = 0; i < added.size(); i++)
+	{
+		std::string errorMessage;
+		std::shared_ptr<SStandbyHandle> standby;
+		if (OpenStandbyHandleOn(added[i].second, standby, errorMessage) == false)
+			continue;
+		reopened++;
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (size_t j = 0; j < m_cameras.size(); j++)
+		{
+			if (m_cameras[j].serialNumber == added[i].first)
+				m_cameras[j].standby = standby;
+		}
+	}
+	return reopened;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbResetHandleCache::RevalidateAll()
+{
+	// work on a copy so resets are not blocked while sysfs is read
+	std::vector<SRegisteredCamera> cameras;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		cameras = m_cameras;
+	}
+
+	int reopened = 0;
+	for (size_t i = 0; i < cameras.size(); i++)
+	{
+		if (cameras[i].standby && IsStandbyHandleCurrent(*cameras[i].standby, cameras[i].serialNumber))
+			continue;
+
+		std::string errorMessage;
+		std::shared_ptr<SStandbyHandle> standby;
+		if (OpenStandbyHandle(cameras[i].serialNumber, standby, errorMessage))
+			reopened++;
+
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (size_t j = 0; j < m_cameras.size(); j++)
+		{
+			if (m_cameras[j].serialNumber == cameras[i].serialNumber)
+				m_cameras[j].standby = standby;
+		}
+	}
+
+	return reopened;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbResetHandleCache::ResetCamera(const std::string& serialNumber, std::string& errorMessage)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool succeeded = ResetThroughStandbyHandle(serialNumber, errorMessage);
+	if (m_apiCallObserver != NULL)
+	{
+		unsigned int durationMs = (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		m_apiCallObserver->OnApiCall("ResetCamera", serialNumber, succeeded, durationMs, succeeded ? std::string() : errorMessage);
+	}
+	return succeeded;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbResetHandleCache::ResetThroughStandbyHandle(const std::string& serialNumber, std::string& errorMessage)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::shared_ptr<SStandbyHandle> standby;
+	bool registered = false;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (size_t i = 0; i < m_cameras.size(); i++)
+		{
+			if (m_cameras[i].serialNumber == serialNumber)
+			{
+				standby = m_cameras[i].standby;
+				registered = true;
+				break;
+			}
+		}
+	}
+
+	if (registered == false)
+	{
+		errorMessage = "Error: ResetCamera(): Camera ";
+		errorMessage.append(serialNumber);
+		errorMessage.append(" is not registered.");
+		return false;
+	}
+
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		if (standby)
+		{
+			m_dispatchLatency.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+
+			int result = m_backend.ResetUsbfs(standby->handle);
+
+			m_resetLatency.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+
+			if (result == 0)
+				return true;
+
+			// anything but a stale handle is a real failure (eg: EBUSY)
+			if (result != -ENODEV && result != -ENOENT && result != -EBADF)
+			{
+				errorMessage = "Error: ResetCamera(): USBDEVFS_RESET failed: ";
+				errorMessage.append(strerror(-result));
+				return false;
+			}
+		}
+
+		// the handle was missing or went stale, reopen it once on the slow path
+		if (attempt == 0)
+		{
+			if (OpenStandbyHandle(serialNumber, standby, errorMessage) == false)
+				return false;
+
+			std::lock_guard<std::mutex> lock(m_lock);
+			for (size_t i = 0; i < m_cameras.size(); i++)
+			{
+				if (m_cameras[i].serialNumber == serialNumber)
+					m_cameras[i].standby = standby;
+			}
+		}
+	}
+
+	errorMessage = "Error: ResetCamera(): Device went away during reset.";
+	return false;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbResetHandleCache::HasStandbyHandle(const std::string& serialNumber)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	for (size_t i = 0; i < m_cameras.size(); i++)
+	{
+		if (m_cameras[i].serialNumber == serialNumber)
+			return (bool)m_cameras[i].standby;
+	}
+	return false;
+}
+
+inline const UsbCameraDeviceManager::CUsbLatencyHistogram& UsbCameraDeviceManagerLinux::CUsbResetHandleCache::GetDispatchLatencyHistogram() const
+{
+	return m_dispatchLatency;
+}
+
+inline const UsbCameraDeviceManager::CUsbLatencyHistogram& UsbCameraDeviceManagerLinux::CUsbResetHandleCache::GetResetLatencyHistogram() const
+{
+	return m_resetLatency;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
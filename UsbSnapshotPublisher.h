@@ -0,0 +1,180 @@
+// UsbSnapshotPublisher.h
+// Publishes a value as immutable snapshots that any number of threads can read without taking a lock
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBSNAPSHOTPUBLISHER_H
+#define USBSNAPSHOTPUBLISHER_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace UsbCameraDeviceManager
+{
+	// Read-copy-update: writers copy the current snapshot, change the copy and swap the pointer; readers pin whatever
+	// snapshot is current and never see it change under them. Reading is two atomic adds and a load, so status can be
+	// polled at any rate while a recovery is publishing. Readers announce themselves in one of two counters chosen by
+	// an epoch; a writer frees the old snapshot only after flipping the epoch twice and seeing each counter drain, so
+	// a reader that stalled anywhere is either waited for or already sees the new snapshot. Writers are serialized.
+	template <typename T>
+	class CUsbSnapshotPublisher
+	{
+	private:
+		std::atomic<const T*> m_current;
+		std::atomic<unsigned int> m_epoch;
+		mutable std::atomic<unsigned int> m_readers[2];
+		std::mutex m_writeLock;
+
+		// flips the epoch and waits until no reader is left in the old one (m_writeLock held)
+		void WaitForReaders();
+
+		CUsbSnapshotPublisher(const CUsbSnapshotPublisher&);
+		CUsbSnapshotPublisher& operator=(const CUsbSnapshotPublisher&);
+
+	public:
+		// Pins the snapshot that is current when it is made, until it goes out of scope. Keep it short lived,
+		// writers wait for it before freeing the snapshot.
+		class CReader
+		{
+		private:
+			const CUsbSnapshotPublisher& m_publisher;
+			unsigned int m_slot;
+			const T* m_snapshot;
+
+			CReader(const CReader&);
+			CReader& operator=(const CReader&);
+
+		public:
+			CReader(const CUsbSnapshotPublisher& publisher);
+
+			~CReader();
+
+			const T& operator*() const;
+
+			const T* operator->() const;
+		};
+
+		CUsbSnapshotPublisher(const T& initial = T());
+
+		~CUsbSnapshotPublisher();
+
+		// A copy of the current snapshot
+		T Read() const;
+
+		// Replaces the snapshot
+		void Publish(const T& value);
+
+		// Copies the current snapshot, applies update (void(T&)) to the copy and publishes it. Concurrent updates don't
+		// lose each other's changes.
+		template <typename TUpdate>
+		void Update(TUpdate update);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+template <typename T>
+inline UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::CReader::CReader(const CUsbSnapshotPublisher& publisher)
+	: m_publisher(publisher)
+{
+	m_slot = m_publisher.m_epoch.load() & 1;
+	m_publisher.m_readers[m_slot].fetch_add(1);
+	m_snapshot = m_publisher.m_current.load();
+}
+
+template <typename T>
+inline UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::CReader::~CReader()
+{
+	m_publisher.m_readers[m_slot].fetch_sub(1);
+}
+
+template <typename T>
+inline const T& UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::CReader::operator*() const
+{
+	return *m_snapshot;
+}
+
+template <typename T>
+inline const T* UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::CReader::operator->() const
+{
+	return m_snapshot;
+}
+
+template <typename T>
+inline UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::CUsbSnapshotPublisher(const T& initial)
+{
+	m_current.store(new T(initial));
+	m_epoch.store(0);
+	m_readers[0].store(0);
+	m_readers[1].store(0);
+}
+
+template <typename T>
+inline UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::~CUsbSnapshotPublisher()
+{
+	delete m_current.load();
+}
+
+template <typename T>
+inline void UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::WaitForReaders()
+{
+	unsigned int old = m_epoch.fetch_add(1) & 1;
+	while (m_readers[old].load() != 0)
+		std::this_thread::yield();
+}
+
+template <typename T>
+inline T UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::Read() const
+{
+	CReader reader(*this);
+	return *reader;
+}
+
+template <typename T>
+inline void UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::Publish(const T& value)
+{
+	std::lock_guard<std::mutex> lock(m_writeLock);
+	const T* old = m_current.exchange(new T(value));
+	WaitForReaders();
+	WaitForReaders();
+	delete old;
+}
+
+template <typename T>
+template <typename TUpdate>
+inline void UsbCameraDeviceManager::CUsbSnapshotPublisher<T>::Update(TUpdate update)
+{
+	std::lock_guard<std::mutex> lock(m_writeLock);
+	T* next = new T(*m_current.load());
+	try
+	{
+		update(*next);
+	}
+	catch (...)
+	{
+		delete next;
+		throw;
+	}
+	const T* old = m_current.exchange(next);
+	WaitForReaders();
+	WaitForReaders();
+	delete old;
+}
+// *********************************************************************************************************
+
+#endif
@@ -0,0 +1,363 @@
+// UsbStreamAdmissionController.h
+// Admits cameras back to streaming in a staggered, prioritized order that fits controller bandwidth and usbfs memory
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBSTREAMADMISSIONCONTROLLER_H
+#define USBSTREAMADMISSIONCONTROLLER_H
+
+#include <pylon/PylonIncludes.h>
+#include <string>
+#include <map>
+#include <set>
+#include <mutex>
+#include <stdint.h>
+#include "UsbClock.h"
+
+namespace UsbCameraDeviceManager
+{
+	// What a camera needs to stream
+	struct SUsbStreamDemand
+	{
+		std::string serialNumber;
+		std::string controllerId;           // the host controller it is on, any name as long as it's used consistently (eg: its PCI address)
+		uint64_t bandwidthBytesPerSecond;
+		uint64_t bufferBytes;               // memory its grab buffers take, counted against the usbfs budget
+		int priority;                       // higher is admitted first
+
+		SUsbStreamDemand() : bandwidthBytesPerSecond(0), bufferBytes(0), priority(0) {}
+	};
+
+	// After a fleet recovery every camera wants to stream again at the same moment; starting them all at once
+	// oversubscribes the controllers and usbfs memory, they fail again and the next recovery wave begins. Each camera
+	// asks here first (Acquire()) and gives its share back when it stops (Release()). Waiting cameras are admitted by
+	// priority, then in the order they asked; one per controller per stagger interval, and only while what is already
+	// streaming plus the newcomer fits the controller's bandwidth and the usbfs budget. A camera that doesn't fit yet
+	// holds back the ones behind it on its controller, and one waiting for usbfs memory holds back everyone behind it,
+	// so large cameras aren't starved by a stream of small ones. Thread safe.
+	class CUsbStreamAdmissionController
+	{
+	private:
+		struct SWaiter
+		{
+			SUsbStreamDemand demand;
+			uint64_t ticket;
+		};
+
+		struct SController
+		{
+			uint64_t grantedBytesPerSecond;
+			uint64_t lastGrantMs;
+			bool granted;            // lastGrantMs is valid
+
+			SController() : grantedBytesPerSecond(0), lastGrantMs(0), granted(false) {}
+		};
+
+		IUsbClock& m_clock;
+		std::mutex m_lock;
+		uint64_t m_defaultCapacity;
+		std::map<std::string, uint64_t> m_capacities;
+		uint64_t m_usbfsBudget;
+		uint64_t m_usbfsInUse;
+		unsigned int m_staggerMs;
+		unsigned int m_pollMs;
+		uint64_t m_nextTicket;
+		std::map<std::pair<int, uint64_t>, SWaiter> m_waiters;       // by -priority, then ticket
+		std::map<std::string, SUsbStreamDemand> m_granted;           // by serial number
+		std::map<std::string, SController> m_controllers;
+
+		uint64_t GetCapacity(const std::string& controllerId) const;
+
+		// whether the waiter may start now: it fits, nobody ahead holds it back and its controller's stagger has passed (m_lock held)
+		bool MayStart(const std::pair<int, uint64_t>& key, uint64_t nowMs);
+
+		CUsbStreamAdmissionController(const CUsbStreamAdmissionController&);
+		CUsbStreamAdmissionController& operator=(const CUsbStreamAdmissionController&);
+
+	public:
+		// clock is what waiting cameras sleep on, NULL for the steady clock
+		CUsbStreamAdmissionController(IUsbClock* clock = NULL);
+
+		// Usable bandwidth of controllers not given their own (default 360000000, a little under what USB 3.0 delivers)
+		void SetDefaultControllerCapacity(uint64_t bytesPerSecond);
+
+		void SetControllerCapacity(const std::string& controllerId, uint64_t bytesPerSecond);
+
+		// Memory all streaming cameras' buffers may take together, 0 for no limit (the default). On Linux that is
+		// usbcore's usbfs_memory_mb in bytes.
+		void SetUsbfsBudget(uint64_t bytes);
+
+		// Time between two cameras starting on the same controller (default 200 ms)
+		void SetStaggerMs(unsigned int staggerMs);
+
+		// How often a waiting camera checks whether it's its turn (default 10 ms)
+		void SetPollMs(unsigned int pollMs);
+
+		// What an open camera will need: its throughput limit (or current throughput if it has none) and PayloadSize
+		// times MaxNumBuffer
+		static bool ReadStreamDemand(Pylon::CInstantCamera& camera, const std::string& controllerId, int priority, SUsbStreamDemand& demand, std::string& errorMessage);
+
+		// Waits until the camera may start streaming. Fails right away if it could never fit, and after timeoutMs if
+		// its turn didn't come. Call Release() once it stops.
+		bool Acquire(const SUsbStreamDemand& demand, unsigned int timeoutMs, std::string& errorMessage);
+
+		// The camera stopped streaming (or failed), its share goes to the next one waiting
+		void Release(const std::string& serialNumber);
+
+		// For reference
+		uint64_t GetGrantedBandwidth(const std::string& controllerId);
+		uint64_t GetUsbfsInUse();
+		size_t GetStreamingCount();
+		size_t GetWaitingCount();
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManager::CUsbStreamAdmissionController::CUsbStreamAdmissionController(IUsbClock* clock)
+	: m_clock((clock != NULL) ? *clock : CSystemUsbClock::Instance())
+{
+	m_defaultCapacity = 360000000;
+	m_usbfsBudget = 0;
+	m_usbfsInUse = 0;
+	m_staggerMs = 200;
+	m_pollMs = 10;
+	m_nextTicket = 0;
+}
+
+inline void UsbCameraDeviceManager::CUsbStreamAdmissionController::SetDefaultControllerCapacity(uint64_t bytesPerSecond)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_defaultCapacity = bytesPerSecond;
+}
+
+inline void UsbCameraDeviceManager::CUsbStreamAdmissionController::SetControllerCapacity(const std::string& controllerId, uint64_t bytesPerSecond)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_capacities[controllerId] = bytesPerSecond;
+}
+
+inline void UsbCameraDeviceManager::CUsbStreamAdmissionController::SetUsbfsBudget(uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_usbfsBudget = bytes;
+}
+
+inline void UsbCameraDeviceManager::CUsbStreamAdmissionController::SetStaggerMs(unsigned int staggerMs)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_staggerMs = staggerMs;
+}
+
+inline void UsbCameraDeviceManager::CUsbStreamAdmissionController::SetPollMs(unsigned int pollMs)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_pollMs = (pollMs == 0) ? 1 : pollMs;
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbStreamAdmissionController::GetCapacity(const std::string& controllerId) const
+{
+	std::map<std::string, uint64_t>::const_iterator capacity = m_capacities.find(controllerId);
+	return (capacity != m_capacities.end()) ? capacity->second : m_defaultCapacity;
+}
+
+inline bool UsbCameraDeviceManager::CUsbStreamAdmissionController::MayStart(const std::pair<int, uint64_t>& key, uint64_t nowMs)
+{
+	// cameras ahead that are about to start keep the usbfs memory they will take
+	uint64_t usbfsPromised = m_usbfsInUse;
+	std::set<std::string> controllersSeen;
+
+	for (std::map<std::pair<int, uint64_t>, SWaiter>::iterator it = m_waiters.begin(); it != m_waiters.end(); ++it)
+	{
+		const SUsbStreamDemand& demand = it->second.demand;
+		bool first = controllersSeen.insert(demand.controllerId).second;
+		if (first == false)
+		{
+			// only the first one waiting on a controller is considered
+			if (it->first == key)
+				return false;
+			continue;
+		}
+
+		const SController& controller = m_controllers[demand.controllerId];
+		bool fitsBandwidth = controller.grantedBytesPerSecond + demand.bandwidthBytesPerSecond <= GetCapacity(demand.controllerId);
+		bool fitsUsbfs = m_usbfsBudget == 0 || usbfsPromised + demand.bufferBytes <= m_usbfsBudget;
+
+		if (it->first == key)
+		{
+			bool staggered = controller.granted == false || nowMs >= controller.lastGrantMs + m_staggerMs;
+			return fitsBandwidth && fitsUsbfs && staggered;
+		}
+
+		if (fitsUsbfs == false)
+			return false;
+		if (fitsBandwidth)
+			usbfsPromised += demand.bufferBytes;
+	}
+	return false;
+}
+
+inline bool UsbCameraDeviceManager::CUsbStreamAdmissionController::ReadStreamDemand(Pylon::CInstantCamera& camera, const std::string& controllerId, int priority, SUsbStreamDemand& demand, std::string& errorMessage)
+{
+	try
+	{
+		if (camera.IsOpen() == false)
+		{
+			errorMessage = "Error: ReadStreamDemand(): Camera is not open.";
+			return false;
+		}
+
+		demand = SUsbStreamDemand();
+		demand.serialNumber = camera.GetDeviceInfo().GetSerialNumber().c_str();
+		demand.controllerId = controllerId;
+		demand.priority = priority;
+
+		GenApi::INodeMap& nodeMap = camera.GetNodeMap();
+		GenApi::CEnumerationPtr limitMode = nodeMap.GetNode("DeviceLinkThroughputLimitMode");
+		GenApi::CIntegerPtr limit = nodeMap.GetNode("DeviceLinkThroughputLimit");
+		GenApi::CIntegerPtr current = nodeMap.GetNode("DeviceLinkCurrentThroughput");
+		if (GenApi::IsReadable(limitMode) && limitMode->ToString() == "On" && GenApi::IsReadable(limit))
+			demand.bandwidthBytesPerSecond = (uint64_t)limit->GetValue();
+		else if (GenApi::IsReadable(current))
+			demand.bandwidthBytesPerSecond = (uint64_t)current->GetValue();
+		else
+		{
+			errorMessage = "Error: ReadStreamDemand(): The camera reports no link throughput.";
+			return false;
+		}
+
+		GenApi::CIntegerPtr payloadSize = nodeMap.GetNode("PayloadSize");
+		if (GenApi::IsReadable(payloadSize) == false)
+		{
+			errorMessage = "Error: ReadStreamDemand(): PayloadSize is not available.";
+			return false;
+		}
+		demand.bufferBytes = (uint64_t)payloadSize->GetValue() * (uint64_t)camera.MaxNumBuffer.GetValue();
+		return true;
+	}
+	catch (const GenICam::GenericException &e)
+	{
+		errorMessage = "Error: ReadStreamDemand(): GenICam exception occurred. ";
+		errorMessage.append(e.GetDescription());
+		return false;
+	}
+}
+
+inline bool UsbCameraDeviceManager::CUsbStreamAdmissionController::Acquire(const SUsbStreamDemand& demand, unsigned int timeoutMs, std::string& errorMessage)
+{
+	std::pair<int, uint64_t> key;
+	uint64_t startMs = m_clock.NowMs();
+	unsigned int pollMs = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if (m_granted.find(demand.serialNumber) != m_granted.end())
+		{
+			errorMessage = "Error: Acquire(): Camera ";
+			errorMessage.append(demand.serialNumber);
+			errorMessage.append(" is already streaming.");
+			return false;
+		}
+		if (demand.bandwidthBytesPerSecond > GetCapacity(demand.controllerId) || (m_usbfsBudget != 0 && demand.bufferBytes > m_usbfsBudget))
+		{
+			errorMessage = "Error: Acquire(): Camera ";
+			errorMessage.append(demand.serialNumber);
+			errorMessage.append(" needs more bandwidth or buffer memory than there is, even with nothing else streaming.");
+			return false;
+		}
+
+		SWaiter waiter;
+		waiter.demand = demand;
+		waiter.ticket = m_nextTicket++;
+		key = std::make_pair(-demand.priority, waiter.ticket);
+		m_waiters[key] = waiter;
+		pollMs = m_pollMs;
+	}
+
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			uint64_t nowMs = m_clock.NowMs();
+			if (MayStart(key, nowMs))
+			{
+				SController& controller = m_controllers[demand.controllerId];
+				controller.grantedBytesPerSecond += demand.bandwidthBytesPerSecond;
+				controller.lastGrantMs = nowMs;
+				controller.granted = true;
+				m_usbfsInUse += demand.bufferBytes;
+				m_granted[demand.serialNumber] = demand;
+				m_waiters.erase(key);
+				return true;
+			}
+
+			if (nowMs - startMs >= timeoutMs)
+			{
+				m_waiters.erase(key);
+				errorMessage = "Error: Acquire(): Camera ";
+				errorMessage.append(demand.serialNumber);
+				errorMessage.append(" was not admitted within ");
+				errorMessage.append(std::to_string(timeoutMs));
+				errorMessage.append(" ms, ");
+				errorMessage.append(std::to_string(m_waiters.size()));
+				errorMessage.append(" other cameras waiting.");
+				return false;
+			}
+		}
+		m_clock.SleepMs(pollMs);
+	}
+}
+
+inline void UsbCameraDeviceManager::CUsbStreamAdmissionController::Release(const std::string& serialNumber)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SUsbStreamDemand>::iterator granted = m_granted.find(serialNumber);
+	if (granted == m_granted.end())
+		return;
+
+	SController& controller = m_controllers[granted->second.controllerId];
+	controller.grantedBytesPerSecond -= granted->second.bandwidthBytesPerSecond;
+	m_usbfsInUse -= granted->second.bufferBytes;
+	m_granted.erase(granted);
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbStreamAdmissionController::GetGrantedBandwidth(const std::string& controllerId)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	std::map<std::string, SController>::const_iterator controller = m_controllers.find(controllerId);
+	return (controller != m_controllers.end()) ? controller->second.grantedBytesPerSecond : 0;
+}
+
+inline uint64_t UsbCameraDeviceManager::CUsbStreamAdmissionController::GetUsbfsInUse()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_usbfsInUse;
+}
+
+inline size_t UsbCameraDeviceManager::CUsbStreamAdmissionController::GetStreamingCount()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_granted.size();
+}
+
+inline size_t UsbCameraDeviceManager::CUsbStreamAdmissionController::GetWaitingCount()
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_waiters.size();
+}
+// *********************************************************************************************************
+
+#endif
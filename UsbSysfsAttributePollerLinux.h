@@ -0,0 +1,269 @@
+// UsbSysfsAttributePollerLinux.h
+// Samples sysfs attributes of watched devices through descriptors kept open, reporting only what changed
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBSYSFSATTRIBUTEPOLLERLINUX_H
+#define USBSYSFSATTRIBUTEPOLLERLINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "UsbDeviceBackendLinux.h"
+
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// One attribute that changed since the last poll
+	struct SUsbAttributeChange
+	{
+		std::string label;        // as given to WatchDevice() (the serial number for WatchCamera())
+		std::string deviceName;   // eg: 2-1.3
+		std::string attribute;    // eg: port/state
+		std::string oldValue;
+		std::string newValue;
+		bool present;             // false once the attribute can't be read anymore (device gone)
+	};
+
+	// Keeps one descriptor per watched attribute and re-reads them all with pread() at offset 0, which makes sysfs
+	// regenerate the value without an open() and close() each time. Values are compared in fixed buffers, so a poll
+	// in which nothing changed allocates nothing. Attributes that went away (device unplugged or re-enumerated) are
+	// reopened every few polls until they are back.
+	class CUsbSysfsAttributePoller
+	{
+	private:
+		static const size_t MaxValueLength = 64;
+
+		struct SWatchedAttribute
+		{
+			std::string label;
+			std::string deviceName;
+			std::string attribute;
+			std::string path;
+			int fd;
+			bool present;
+			size_t length;
+			char value[MaxValueLength];
+		};
+
+		std::string m_sysfsRoot;
+		std::vector<SWatchedAttribute> m_attributes;
+		unsigned int m_reopenInterval;
+		unsigned int m_polls;
+
+		CUsbSysfsAttributePoller(const CUsbSysfsAttributePoller&);
+		CUsbSysfsAttributePoller& operator=(const CUsbSysfsAttributePoller&);
+
+	public:
+		CUsbSysfsAttributePoller(const std::string& sysfsRoot = "/sys/bus/usb/devices");
+
+		~CUsbSysfsAttributePoller();
+
+		// speed, port/state, port/over_current_count, power/runtime_status, authorized and bConfigurationValue
+		static std::vector<std::string> GetDefaultAttributes();
+
+		// Watches attributes of a device, paths relative to its sysfs directory
+		void WatchDevice(const std::string& label, const std::string& deviceName, const std::vector<std::string>& attributes);
+
+		// Watches the default attributes of a camera, labelled with its serial number
+		bool WatchCamera(IUsbDeviceBackend& backend, const std::string& serialNumber, std::string& errorMessage);
+
+		void UnwatchDevice(const std::string& label);
+
+		// Polls between attempts to reopen attributes that went away (default 10)
+		void SetReopenInterval(unsigned int polls);
+
+		// Re-reads every watched attribute and appends the ones that changed. The first poll reports every value.
+		size_t Poll(std::vector<SUsbAttributeChange>& changes);
+
+		// The last value read
+		bool GetValue(const std::string& label, const std::string& attribute, std::string& value) const;
+
+		// For reference, how many descriptors are open
+		size_t GetOpenCount() const;
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::CUsbSysfsAttributePoller(const std::string& sysfsRoot)
+{
+	m_sysfsRoot = sysfsRoot;
+	m_reopenInterval = 10;
+	m_polls = 0;
+}
+
+inline UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::~CUsbSysfsAttributePoller()
+{
+	for (size_t i = 0; i < m_attributes.size(); i++)
+	{
+		if (m_attributes[i].fd >= 0)
+			close(m_attributes[i].fd);
+	}
+}
+
+inline std::vector<std::string> UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::GetDefaultAttributes()
+{
+	std::vector<std::string> attributes;
+	attributes.push_back("speed");
+	attributes.push_back("port/state");
+	attributes.push_back("port/over_current_count");
+	attributes.push_back("power/runtime_status");
+	attributes.push_back("authorized");
+	attributes.push_back("bConfigurationValue");
+	return attributes;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::WatchDevice(const std::string& label, const std::string& deviceName, const std::vector<std::string>& attributes)
+{
+	for (size_t i = 0; i < attributes.size(); i++)
+	{
+		SWatchedAttribute watched;
+		watched.label = label;
+		watched.deviceName = deviceName;
+		watched.attribute = attributes[i];
+		watched.path = m_sysfsRoot + "/" + deviceName + "/" + attributes[i];
+		watched.fd = open(watched.path.c_str(), O_RDONLY | O_CLOEXEC);
+		watched.present = false;
+		watched.length = 0;
+		m_attributes.push_back(watched);
+	}
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::WatchCamera(IUsbDeviceBackend& backend, const std::string& serialNumber, std::string& errorMessage)
+{
+	std::string deviceName;
+	if (FindUsbDeviceBySerial(backend, serialNumber, deviceName) == false)
+	{
+		errorMessage = "Error: WatchCamera(): No usb device with serial number ";
+		errorMessage.append(serialNumber);
+		return false;
+	}
+
+	WatchDevice(serialNumber, deviceName, GetDefaultAttributes());
+	return true;
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::UnwatchDevice(const std::string& label)
+{
+	for (size_t i = 0; i < m_attributes.size();)
+	{
+		if (m_attributes[i].label == label)
+		{
+			if (m_attributes[i].fd >= 0)
+				close(m_attributes[i].fd);
+			m_attributes.erase(m_attributes.begin() + i);
+		}
+		else
+			i++;
+	}
+}
+
+inline void UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::SetReopenInterval(unsigned int polls)
+{
+	m_reopenInterval = (polls == 0) ? 1 : polls;
+}
+
+inline size_t UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::Poll(std::vector<SUsbAttributeChange>& changes)
+{
+	size_t changed = 0;
+	bool reopen = (m_polls % m_reopenInterval) == 0;
+	m_polls++;
+
+	char buffer[MaxValueLength];
+	for (size_t i = 0; i < m_attributes.size(); i++)
+	{
+		SWatchedAttribute& watched = m_attributes[i];
+
+		if (watched.fd < 0 && reopen)
+			watched.fd = open(watched.path.c_str(), O_RDONLY | O_CLOEXEC);
+
+		ssize_t length = -1;
+		if (watched.fd >= 0)
+		{
+			length = pread(watched.fd, buffer, sizeof(buffer), 0);
+			if (length < 0)
+			{
+				// ENODEV once the device is gone. A new device on the same port is a new file, so start over.
+				close(watched.fd);
+				watched.fd = -1;
+			}
+		}
+
+		bool present = length >= 0;
+		if (present)
+		{
+			while (length > 0 && (buffer[length - 1] == '\n' || buffer[length - 1] == ' '))
+				length--;
+		}
+		else
+			length = 0;
+
+		if (present == watched.present && (size_t)length == watched.length && memcmp(buffer, watched.value, length) == 0)
+			continue;
+
+		SUsbAttributeChange change;
+		change.label = watched.label;
+		change.deviceName = watched.deviceName;
+		change.attribute = watched.attribute;
+		change.oldValue.assign(watched.value, watched.length);
+		change.newValue.assign(buffer, length);
+		change.present = present;
+		changes.push_back(change);
+		changed++;
+
+		watched.present = present;
+		watched.length = length;
+		memcpy(watched.value, buffer, length);
+	}
+	return changed;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::GetValue(const std::string& label, const std::string& attribute, std::string& value) const
+{
+	for (size_t i = 0; i < m_attributes.size(); i++)
+	{
+		const SWatchedAttribute& watched = m_attributes[i];
+		if (watched.label == label && watched.attribute == attribute)
+		{
+			if (watched.present == false)
+				return false;
+			value.assign(watched.value, watched.length);
+			return true;
+		}
+	}
+	return false;
+}
+
+inline size_t UsbCameraDeviceManagerLinux::CUsbSysfsAttributePoller::GetOpenCount() const
+{
+	size_t count = 0;
+	for (size_t i = 0; i < m_attributes.size(); i++)
+	{
+		if (m_attributes[i].fd >= 0)
+			count++;
+	}
+	return count;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
@@ -0,0 +1,456 @@
+// UsbSysfsFixtureLinux.h
+// Writes synthetic /sys/bus/usb/devices (and matching /dev/bus/usb) trees for rehearsals and benchmarks
+//
+// Copyright (c) 2022 Matthew Breit - matt.breit@baslerweb.com or matt.breit@gmail.com
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http ://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+#ifndef USBSYSFSFIXTURELINUX_H
+#define USBSYSFSFIXTURELINUX_H
+
+#ifdef LINUX_BUILD
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+
+// The generated layout mirrors a real host:
+//   <root>/devices/pci0000:00/0000:00:NN.0/usbB/B-P/B-P.P...   device directories, nested like the hardware
+//   <root>/bus/usb/devices/B-P.P -> ../../../devices/...        flat symlinks, like sysfs
+//   <root>/dev/char/189:N -> ../../devices/...                  char device links, like sysfs
+//   <root>/dev/bus/usb/BBB/DDD                                  usbfs nodes holding the device descriptors
+// so CSysfsUsbDeviceBackend(<root>/bus/usb/devices, <root>/dev/bus/usb) can run against it.
+
+namespace UsbCameraDeviceManagerLinux
+{
+	// What to put in a generated tree
+	struct SUsbSysfsFixtureOptions
+	{
+		int controllers;       // xHCI controllers (one bus each). More are added if the devices don't fit.
+		int hubs;              // external hubs, nested up to maxDepth
+		int cameras;           // Basler cameras (2676:ba02) with serial numbers 40000000, 40000001, ...
+		int otherDevices;      // keyboards, storage and other noise
+		int maxDepth;          // tiers of hubs below the root hub (usb allows 5)
+		double attributeNoise; // 0..1, chance that a device gets extra attributes, interfaces or a missing serial
+		unsigned int seed;
+
+		SUsbSysfsFixtureOptions() : controllers(1), hubs(2), cameras(4), otherDevices(4), maxDepth(3), attributeNoise(0.1), seed(1) {}
+	};
+
+	// One generated device, for callers that want to look things up afterwards
+	struct SUsbSysfsFixtureDevice
+	{
+		std::string deviceName;
+		std::string serialNumber;
+		int busnum;
+		int devnum;
+		bool isHub;
+		bool isCamera;
+	};
+
+	class CUsbSysfsFixtureGenerator
+	{
+	private:
+		static bool WriteFile(const std::string& path, const void* data, size_t size);
+		static bool WriteAttribute(const std::string& devicePath, const char* attribute, const std::string& value);
+		static bool MakeDirectories(const std::string& path);
+		static int RemoveEntry(const char* path, const struct stat* sb, int typeflag, struct FTW* ftwbuf);
+
+		// writes one device directory, its flat symlink and its usbfs node
+		static bool WriteDevice(const std::string& root, const std::string& path, const std::string& name, int busnum, int devnum,
+			uint16_t vid, uint16_t pid, uint8_t deviceClass, const std::string& serial, const std::string& speed, int maxchild, bool noisy, std::mt19937& random);
+
+	public:
+		// Writes a tree below root (which must not exist yet, or be empty)
+		static bool Generate(const std::string& root, const SUsbSysfsFixtureOptions& options, std::vector<SUsbSysfsFixtureDevice>& devices, std::string& errorMessage);
+
+		// Deletes a generated tree
+		static bool Remove(const std::string& root);
+
+		// For reference, the sysfs and usbfs roots to hand to CSysfsUsbDeviceBackend
+		static std::string GetSysfsRoot(const std::string& root);
+		static std::string GetUsbfsRoot(const std::string& root);
+	};
+}
+
+
+// *********************************************************************************************************
+// DEFINITIONS
+
+inline bool UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::WriteFile(const std::string& path, const void* data, size_t size)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	bool ok = (write(fd, data, size) == (ssize_t)size);
+	close(fd);
+	return ok;
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::WriteAttribute(const std::string& devicePath, const char* attribute, const std::string& value)
+{
+	std::string line = value;
+	line.append("\n");
+	return WriteFile(devicePath + "/" + attribute, line.c_str(), line.size());
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::MakeDirectories(const std::string& path)
+{
+	for (size_t pos = 1; pos <= path.size(); pos++)
+	{
+		if (pos == path.size() || path[pos] == '/')
+		{
+			std::string partial = path.substr(0, pos);
+			if (mkdir(partial.c_str(), 0755) != 0 && errno != EEXIST)
+				return false;
+		}
+	}
+	return true;
+}
+
+inline int UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::RemoveEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::Remove(const std::string& root)
+{
+	return nftw(root.c_str(), RemoveEntry, 64, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::GetSysfsRoot(const std::string& root)
+{
+	return root + "/bus/usb/devices";
+}
+
+inline std::string UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::GetUsbfsRoot(const std::string& root)
+{
+	return root + "/dev/bus/usb";
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::WriteDevice(const std::string& root, const std::string& path, const std::string& name, int busnum, int devnum,
+	uint16_t vid, uint16_t pid, uint8_t deviceClass, const std::string& serial, const std::string& speed, int maxchild, bool noisy, std::mt19937& random)
+{
+	char text[64];
+	if (MakeDirectories(path) == false)
+		return false;
+
+	WriteAttribute(path, "busnum", std::to_string(busnum));
+	WriteAttribute(path, "devnum", std::to_string(devnum));
+	snprintf(text, sizeof(text), "%04x", vid);
+	WriteAttribute(path, "idVendor", text);
+	snprintf(text, sizeof(text), "%04x", pid);
+	WriteAttribute(path, "idProduct", text);
+	snprintf(text, sizeof(text), "%02x", deviceClass);
+	WriteAttribute(path, "bDeviceClass", text);
+	WriteAttribute(path, "speed", speed);
+	WriteAttribute(path, "maxchild", std::to_string(maxchild));
+	WriteAttribute(path, "bConfigurationValue", "1");
+	WriteAttribute(path, "authorized", "1");
+	WriteAttribute(path, "devpath", name.substr(name.find('-') + 1));
+	if (serial != "")
+		WriteAttribute(path, "serial", serial);
+	WriteAttribute(path, "manufacturer", (vid == 0x2676) ? "Basler" : "Generic");
+	WriteAttribute(path, "product", (deviceClass == 0x09) ? "USB3.0 Hub" : ((vid == 0x2676) ? "acA1920-40um" : "USB Device"));
+
+	MakeDirectories(path + "/power");
+	WriteAttribute(path + "/power", "runtime_status", "active");
+	WriteAttribute(path + "/power", "control", "on");
+
+	// the hub port the device is plugged into (a symlink into the hub's interface on real systems). Root hubs have none.
+	if (name.compare(0, 3, "usb") != 0)
+	{
+		MakeDirectories(path + "/port");
+		WriteAttribute(path + "/port", "state", "configured");
+		WriteAttribute(path + "/port", "over_current_count", "0");
+		WriteAttribute(path + "/port", "connect_type", "hotplug");
+	}
+
+	// device descriptor + one configuration with a vendor interface and a bulk IN endpoint
+	uint16_t bcdUsb = (atoi(speed.c_str()) >= 5000) ? 0x0320 : 0x0200;
+	uint16_t mps = (bcdUsb >= 0x0300) ? 1024 : 512;
+	uint8_t blob[18 + 9 + 9 + 7 + 6] = {
+		18, 0x01, (uint8_t)(bcdUsb & 0xFF), (uint8_t)(bcdUsb >> 8), deviceClass, 0, 0, 9,
+		(uint8_t)(vid & 0xFF), (uint8_t)(vid >> 8), (uint8_t)(pid & 0xFF), (uint8_t)(pid >> 8), 0x00, 0x01, 1, 2, 3, 1,
+		9, 0x02, sizeof(blob) - 18, 0, 1, 1, 0, 0x80, 112,
+		9, 0x04, 0, 0, 1, (uint8_t)((deviceClass == 0x09) ? 0x09 : 0xFF), 0, 0, 0,
+		7, 0x05, 0x81, 0x02, (uint8_t)(mps & 0xFF), (uint8_t)(mps >> 8), 0,
+		6, 0x30, 15, 0, 0, 0 };
+	size_t blobSize = (bcdUsb >= 0x0300) ? sizeof(blob) : sizeof(blob) - 6;
+	blob[20] = (uint8_t)(blobSize - 18);
+	WriteFile(path + "/descriptors", blob, blobSize);
+
+	// interface directory, plus some clutter on noisy devices
+	std::string interfacePath = path + "/" + name + ":1.0";
+	MakeDirectories(interfacePath);
+	WriteAttribute(interfacePath, "bInterfaceClass", (deviceClass == 0x09) ? "09" : "ff");
+	if (noisy)
+	{
+		std::uniform_int_distribution<int> extra(1, 3);
+		int count = extra(random);
+		for (int i = 1; i <= count; i++)
+		{
+			std::string noisePath = path + "/" + name + ":1." + std::to_string(i);
+			MakeDirectories(noisePath);
+			WriteAttribute(noisePath, "bInterfaceClass", "03");
+		}
+		WriteAttribute(path, "quirks", "0x0");
+		WriteAttribute(path, "avoid_reset_quirk", "0");
+		WriteAttribute(path, "removable", "unknown");
+	}
+
+	// flat symlink, like /sys/bus/usb/devices
+	std::string relative = "../../.." + path.substr(path.find("/devices/"));
+	std::string link = GetSysfsRoot(root) + "/" + name;
+	if (symlink(relative.c_str(), link.c_str()) != 0 && errno != EEXIST)
+		return false;
+
+	// char device link, like /sys/dev/char
+	MakeDirectories(root + "/dev/char");
+	snprintf(text, sizeof(text), "/dev/char/189:%d", (busnum - 1) * 128 + devnum - 1);
+	relative = "../.." + path.substr(path.find("/devices/"));
+	link = root + text;
+	if (symlink(relative.c_str(), link.c_str()) != 0 && errno != EEXIST)
+		return false;
+
+	// usbfs node
+	snprintf(text, sizeof(text), "/%03d", busnum);
+	std::string busPath = GetUsbfsRoot(root) + text;
+	MakeDirectories(busPath);
+	snprintf(text, sizeof(text), "/%03d", devnum);
+	return WriteFile(busPath + text, blob, blobSize);
+}
+
+inline bool UsbCameraDeviceManagerLinux::CUsbSysfsFixtureGenerator::Generate(const std::string& root, const SUsbSysfsFixtureOptions& options, std::vector<SUsbSysfsFixtureDevice>& devices, std::string& errorMessage)
+{
+	// A hub tier or a device in the plan. Hubs are created first so leaves always have somewhere to go.
+	struct SPort
+	{
+		std::string deviceName;  // hub the port belongs to
+		std::string path;        // directory of that hub
+		int busnum;
+		int depth;               // tiers below the root hub
+		int freePorts;
+		int nextPort;
+	};
+
+	std::mt19937 random(options.seed);
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+	// each bus addresses at most 127 devices, so big trees get more controllers (with headroom for extra hubs)
+	const int devicesPerBus = 126;
+	const int plannedPerBus = 96;
+	int total = options.hubs + options.cameras + options.otherDevices;
+	int controllers = options.controllers > 0 ? options.controllers : 1;
+	if (controllers < (total + plannedPerBus - 1) / plannedPerBus)
+		controllers = (total + plannedPerBus - 1) / plannedPerBus;
+
+	std::string sysfsRoot = GetSysfsRoot(root);
+	std::string usbfsRoot = GetUsbfsRoot(root);
+	if (MakeDirectories(sysfsRoot) == false || MakeDirectories(usbfsRoot) == false)
+	{
+		errorMessage = "Error: Generate(): Unable to create ";
+		errorMessage.append(root);
+		return false;
+	}
+
+	std::vector<SPort> ports;
+	std::vector<int> nextDevnum(controllers + 1, 2);
+	std::vector<int> devicesOnBus(controllers + 1, 0);
+	int cameraSerial = 40000000;
+	int otherSerial = 0;
+
+	// controllers and root hubs
+	for (int c = 1; c <= controllers; c++)
+	{
+		char pci[64];
+		snprintf(pci, sizeof(pci), "/devices/pci0000:00/0000:00:%02x.%d", 0x10 + (c - 1) / 8, (c - 1) % 8);
+		std::string pciPath = root + pci;
+		MakeDirectories(pciPath);
+		WriteAttribute(pciPath, "numa_node", std::to_string((c - 1) % 2));
+		WriteAttribute(pciPath, "local_cpulist", ((c - 1) % 2 == 0) ? "0-7" : "8-15");
+		WriteAttribute(pciPath, "class", "0x0c0330");
+
+		std::string name = "usb" + std::to_string(c);
+		std::string path = pciPath + "/" + name;
+		if (WriteDevice(root, path, name, c, 1, 0x1d6b, 0x0003, 0x09, "0000:00", "5000", 4, false, random) == false)
+		{
+			errorMessage = "Error: Generate(): Unable to write ";
+			errorMessage.append(path);
+			return false;
+		}
+
+		SPort port;
+		port.deviceName = name;
+		port.path = path;
+		port.busnum = c;
+		port.depth = 0;
+		port.freePorts = 4;
+		port.nextPort = 1;
+		ports.push_back(port);
+
+		SUsbSysfsFixtureDevice device;
+		device.deviceName = name;
+		device.serialNumber = "";
+		device.busnum = c;
+		device.devnum = 1;
+		device.isHub = true;
+		device.isCamera = false;
+		devices.push_back(device);
+	}
+
+	// devices are dealt round robin to the buses, then placed on a random free port of their bus
+	std::vector<int> leavesLeft(controllers + 1, 0);
+	for (int i = options.hubs; i < total; i++)
+		leavesLeft[1 + i % controllers]++;
+
+	for (int i = 0; i < total; i++)
+	{
+		bool isHub = i < options.hubs;
+		bool isCamera = !isHub && i < options.hubs + options.cameras;
+		int bus = 1 + i % controllers;
+
+		// not enough ports left on this bus for its remaining leaves: spend one on an extra hub first
+		int freePorts = 0;
+		int freeHubPorts = 0;
+		for (size_t p = 0; p < ports.size(); p++)
+		{
+			if (ports[p].busnum != bus)
+				continue;
+			freePorts += ports[p].freePorts;
+			if (ports[p].depth < options.maxDepth)
+				freeHubPorts += ports[p].freePorts;
+		}
+		bool extraHub = (isHub == false && freePorts < leavesLeft[bus] && freeHubPorts > 0);
+		if (extraHub)
+		{
+			isHub = true;
+			isCamera = false;
+		}
+
+		std::vector<size_t> candidates;
+		for (size_t p = 0; p < ports.size(); p++)
+		{
+			if (ports[p].busnum != bus || ports[p].freePorts <= 0)
+				continue;
+			if (isHub && ports[p].depth >= options.maxDepth)
+				continue;
+			candidates.push_back(p);
+		}
+
+		if (candidates.empty() || devicesOnBus[bus] >= devicesPerBus)
+		{
+			errorMessage = "Error: Generate(): Not enough hub ports for ";
+			errorMessage.append(std::to_string(total));
+			errorMessage.append(" devices. Add hubs, controllers or depth.");
+			return false;
+		}
+
+		std::uniform_int_distribution<size_t> pick(0, candidates.size() - 1);
+		SPort& parent = ports[candidates[pick(random)]];
+
+		std::string name = (parent.depth == 0)
+			? std::to_string(parent.busnum) + "-" + std::to_string(parent.nextPort)
+			: parent.deviceName + "." + std::to_string(parent.nextPort);
+		std::string path = parent.path + "/" + name;
+		int busnum = parent.busnum;
+		int depth = parent.depth + 1;
+		parent.nextPort++;
+		parent.freePorts--;
+
+		int devnum = nextDevnum[busnum]++;
+		devicesOnBus[busnum]++;
+
+		bool noisy = chance(random) < options.attributeNoise;
+		std::string serial;
+		uint16_t vid;
+		uint16_t pid;
+		uint8_t deviceClass;
+		std::string speed;
+		if (isHub)
+		{
+			vid = 0x05e3;
+			pid = 0x0626;
+			deviceClass = 0x09;
+			speed = "5000";
+		}
+		else if (isCamera)
+		{
+			vid = 0x2676;
+			pid = 0xba02;
+			deviceClass = 0xEF;
+			speed = (noisy && chance(random) < 0.5) ? "480" : "5000";
+			serial = std::to_string(cameraSerial++);
+		}
+		else
+		{
+			vid = 0x046d;
+			pid = (uint16_t)(0xc000 + otherSerial);
+			deviceClass = 0x00;
+			speed = (otherSerial % 3 == 0) ? "12" : "480";
+			// noisy devices may not report a serial at all
+			if (noisy == false || chance(random) < 0.5)
+				serial = "OTHER" + std::to_string(otherSerial);
+			otherSerial++;
+		}
+
+		if (WriteDevice(root, path, name, busnum, devnum, vid, pid, deviceClass, serial, speed, isHub ? 7 : 0, noisy, random) == false)
+		{
+			errorMessage = "Error: Generate(): Unable to write ";
+			errorMessage.append(path);
+			return false;
+		}
+
+		if (isHub == false)
+			leavesLeft[bus]--;
+
+		if (isHub)
+		{
+			SPort port;
+			port.deviceName = name;
+			port.path = path;
+			port.busnum = busnum;
+			port.depth = depth;
+			port.freePorts = 7;
+			port.nextPort = 1;
+			ports.push_back(port);
+		}
+
+		SUsbSysfsFixtureDevice device;
+		device.deviceName = name;
+		device.serialNumber = serial;
+		device.busnum = busnum;
+		device.devnum = devnum;
+		device.isHub = isHub;
+		device.isCamera = isCamera;
+		devices.push_back(device);
+
+		// the device this slot was meant for still has to be placed
+		if (extraHub)
+			i--;
+	}
+
+	return true;
+}
+// *********************************************************************************************************
+
+#endif
+#endif
@@ -0,0 +1,120 @@
+/*
+Benchmark for the usb descriptor parser (UsbDescriptorParserLinux.h). Linux only.
+
+Times walking a USB3 Vision camera's descriptor blob in memory (the blob CUsbDescriptorParserFuzzer builds), and
+reading and walking the descriptors of every device under a sysfs root, and counts the allocations of each. The
+parser itself should show 0 allocations per walk. Build and run from this directory with eg:
+
+    g++ -std=c++11 -O2 -DLINUX_BUILD -I.. UsbDescriptorParserBenchmark.cpp -o UsbDescriptorParserBenchmark
+    ./UsbDescriptorParserBenchmark                             in memory, and the devices in /sys/bus/usb/devices
+    ./UsbDescriptorParserBenchmark /tmp/fixture/bus/usb/devices   eg: a tree written by CUsbSysfsFixtureGenerator
+
+*/
+
+#ifdef LINUX_BUILD
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "UsbDescriptorParserFuzzLinux.h"
+#include "UsbDeviceBackendLinux.h"
+
+// every allocation of the program, for the allocations per walk
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	allocationCount++;
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+// Walks a blob to its end, returns the number of records
+static int Walk(const uint8_t* data, size_t size)
+{
+	UsbCameraDeviceManagerLinux::CUsbDescriptorParser parser(data, size);
+	UsbCameraDeviceManagerLinux::SUsbDescriptorRecord record;
+	int records = 0;
+	while (parser.Next(record) == UsbCameraDeviceManagerLinux::UsbParseStatus_Ok)
+		records++;
+	return records;
+}
+
+// Repeats op for about 200 ms and prints the time and allocations per run
+template <typename TOperation>
+static void Measure(const char* operation, TOperation op)
+{
+	// warm up (page cache, dentries)
+	op();
+
+	uint64_t allocationsBefore = allocationCount.load();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int iterations = 0;
+	while (iterations < 3 || std::chrono::steady_clock::now() - start < std::chrono::milliseconds(200))
+	{
+		op();
+		iterations++;
+	}
+	double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / iterations;
+	double allocations = (double)(allocationCount.load() - allocationsBefore) / iterations;
+	printf("%-36s %10d %14.0f %12.1f\n", operation, iterations, ns, allocations);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string sysfsRoot = (argc > 1) ? argv[1] : "/sys/bus/usb/devices";
+
+	printf("%-36s %10s %14s %12s\n", "operation", "iterations", "ns/op", "allocs/op");
+
+	uint8_t superSpeedBlob[256];
+	size_t superSpeedLength = UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::BuildCameraBlob(true, superSpeedBlob, sizeof(superSpeedBlob));
+	uint8_t highSpeedBlob[256];
+	size_t highSpeedLength = UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::BuildCameraBlob(false, highSpeedBlob, sizeof(highSpeedBlob));
+	volatile int sink = 0;
+
+	Measure("Walk(camera, SuperSpeed)", [&]() { sink = sink + Walk(superSpeedBlob, superSpeedLength); });
+	Measure("Walk(camera, high-speed)", [&]() { sink = sink + Walk(highSpeedBlob, highSpeedLength); });
+
+	// the whole pipeline on the host's devices: read the sysfs blob, walk it
+	UsbCameraDeviceManagerLinux::CSysfsUsbDeviceBackend backend(sysfsRoot);
+	std::vector<std::string> deviceNames;
+	if (backend.ListDevices(deviceNames) == false || deviceNames.empty())
+	{
+		printf("No devices in %s, skipped reading from sysfs.\n", sysfsRoot.c_str());
+		return 0;
+	}
+
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < deviceNames.size(); i++)
+		paths.push_back(sysfsRoot + "/" + deviceNames[i] + "/descriptors");
+
+	std::string operation = "ReadAndWalk(" + std::to_string(paths.size()) + " devices)";
+	Measure(operation.c_str(), [&]()
+	{
+		for (size_t i = 0; i < paths.size(); i++)
+		{
+			uint8_t blob[4096];
+			int fd = open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				continue;
+			ssize_t length = read(fd, blob, sizeof(blob));
+			close(fd);
+			sink = sink + Walk(blob, (length > 0) ? (size_t)length : 0);
+		}
+	});
+	return 0;
+}
+#endif
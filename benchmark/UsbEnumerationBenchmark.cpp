@@ -0,0 +1,68 @@
+/*
+Benchmark for the Linux enumeration, lookup and topology queries (UsbEnumerationBenchmarkLinux.h). Linux only.
+
+Generates sysfs trees of growing size with CUsbSysfsFixtureGenerator in a scratch directory, times every query
+against each of them and counts the allocations of each. A query whose time grows faster than the device count
+stands out in the table. Nothing touches the real /sys, so it runs without root. Build and run from this directory
+with eg:
+
+    g++ -std=c++11 -O2 -DLINUX_BUILD -I.. $(/opt/pylon/bin/pylon-config --cflags) UsbEnumerationBenchmark.cpp -o UsbEnumerationBenchmark -pthread
+    ./UsbEnumerationBenchmark                       10, 100, 1000 and 10000 devices below /tmp
+    ./UsbEnumerationBenchmark /dev/shm 50 500       the given sizes below /dev/shm
+
+*/
+
+#ifdef LINUX_BUILD
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <new>
+
+#include "UsbEnumerationBenchmarkLinux.h"
+
+// every allocation of the program, for the allocations per operation
+void* operator new(size_t size)
+{
+	UsbCameraDeviceManagerLinux::CUsbEnumerationBenchmark::AllocationCounter()++;
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+// not inlined, or gcc 12 takes the free() for a mismatch with the builtin operator new (-Wmismatched-new-delete)
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string scratchDirectory = (argc > 1) ? argv[1] : "/tmp";
+
+	// none given: the benchmark's default sizes
+	std::vector<int> deviceCounts;
+	for (int i = 2; i < argc; i++)
+	{
+		int count = atoi(argv[i]);
+		if (count <= 0)
+		{
+			printf("Usage: %s [scratch directory] [device count...]\n", argv[0]);
+			return 2;
+		}
+		deviceCounts.push_back(count);
+	}
+
+	std::vector<UsbCameraDeviceManagerLinux::SUsbBenchmarkResult> results;
+	std::string errorMessage;
+	if (UsbCameraDeviceManagerLinux::CUsbEnumerationBenchmark::Run(scratchDirectory, deviceCounts, results, errorMessage) == false)
+	{
+		printf("%s\n", errorMessage.c_str());
+		return 1;
+	}
+
+	printf("%s", UsbCameraDeviceManagerLinux::CUsbEnumerationBenchmark::FormatResults(results).c_str());
+	return 0;
+}
+#endif
@@ -0,0 +1,124 @@
+/*
+Fuzz target for the usb descriptor parser (UsbDescriptorParserLinux.h), see CUsbDescriptorParserFuzzer in
+UsbDescriptorParserFuzzLinux.h for what is checked. Linux only.
+
+With libFuzzer (clang), from this directory:
+
+    clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -DLINUX_BUILD -I.. UsbDescriptorParserFuzz.cpp -o UsbDescriptorParserFuzz
+    ./UsbDescriptorParserFuzz -max_len=4096 corpus/
+
+The corpus directory can be seeded with the descriptors of real devices (cp /sys/bus/usb/devices/WHATEVER/descriptors corpus/)
+or with the camera blobs the standalone build writes. That build needs no libFuzzer and works with gcc too:
+
+    g++ -std=c++11 -g -O1 -fsanitize=address,undefined -DLINUX_BUILD -DUSB_FUZZ_STANDALONE -I.. UsbDescriptorParserFuzz.cpp -o UsbDescriptorParserFuzz
+    ./UsbDescriptorParserFuzz                               mutates the camera blobs 1000000 times
+    ./UsbDescriptorParserFuzz --iterations 100000 --seed 7
+    ./UsbDescriptorParserFuzz --write-seeds corpus/         writes the camera blobs for libFuzzer
+    ./UsbDescriptorParserFuzz crash-1234 /sys/bus/usb/devices/WHATEVER/descriptors    walks the files given
+
+The exit code is 0 if the parser kept its promises. A broken promise aborts, so libFuzzer keeps the input.
+
+*/
+
+#ifdef LINUX_BUILD
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "UsbDescriptorParserFuzzLinux.h"
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	return UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::FuzzOne(data, size);
+}
+
+#ifdef USB_FUZZ_STANDALONE
+// Walks one file, copied into a buffer of exactly its size like libFuzzer does
+static bool WalkFile(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error: Unable to open %s\n", path);
+		return false;
+	}
+
+	std::vector<uint8_t> input;
+	uint8_t chunk[4096];
+	size_t length;
+	while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		input.insert(input.end(), chunk, chunk + length);
+	fclose(file);
+
+	uint8_t* data = (uint8_t*)malloc(input.size() > 0 ? input.size() : 1);
+	if (input.empty() == false)
+		memcpy(data, &input[0], input.size());
+	std::string problem;
+	bool ok = UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::CheckWalk(data, input.size(), problem);
+	free(data);
+
+	printf("%s: %zu bytes, %s\n", path, input.size(), ok ? "ok" : problem.c_str());
+	return ok;
+}
+
+// Writes the seed corpus
+static bool WriteSeeds(const std::string& directory)
+{
+	for (int superSpeed = 0; superSpeed < 2; superSpeed++)
+	{
+		uint8_t blob[256];
+		size_t length = UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::BuildCameraBlob(superSpeed != 0, blob, sizeof(blob));
+		std::string path = directory + (superSpeed ? "/camera-superspeed" : "/camera-highspeed");
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file == NULL || fwrite(blob, 1, length, file) != length)
+		{
+			fprintf(stderr, "Error: Unable to write %s\n", path.c_str());
+			if (file != NULL)
+				fclose(file);
+			return false;
+		}
+		fclose(file);
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int iterations = 1000000;
+	uint32_t seed = 1;
+	std::vector<const char*> files;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+			iterations = (unsigned int)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--write-seeds") == 0 && i + 1 < argc)
+			return WriteSeeds(argv[++i]) ? 0 : 1;
+		else
+			files.push_back(argv[i]);
+	}
+
+	if (files.empty() == false)
+	{
+		bool ok = true;
+		for (size_t i = 0; i < files.size(); i++)
+			ok = WalkFile(files[i]) && ok;
+		return ok ? 0 : 1;
+	}
+
+	std::string errorMessage;
+	if (UsbCameraDeviceManagerLinux::CUsbDescriptorParserFuzzer::Run(iterations, seed, errorMessage) == false)
+	{
+		fprintf(stderr, "%s\n", errorMessage.c_str());
+		return 1;
+	}
+	printf("%u inputs, no broken promises\n", iterations);
+	return 0;
+}
+#endif
+#endif